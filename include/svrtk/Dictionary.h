@@ -50,8 +50,7 @@ namespace svrtk {
         class SimulateSlices;
         class SimulateMasks;
         class Average;
-        class AdaptiveRegularization1;
-        class AdaptiveRegularization2;
+        class AdaptiveRegularization;
     }
     
     namespace ParallelqMRI {
@@ -0,0 +1,134 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// MIRTK
+#include "mirtk/Common.h"
+#include "mirtk/Array.h"
+#include "mirtk/GenericImage.h"
+
+// C++ Standard
+#include <cstdint>
+#include <map>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Memory-mapped exchange file of the remote reconstruction model.
+     * @details All objects are stored in a single file made of a header, a table of named
+     * entries and the raw payloads, each aligned to a cache line. Images are stored as their
+     * geometry and uncompressed RealPixel voxels, parameter vectors (e.g. rigid transformations)
+     * as doubles. The file is written to a temporary name and renamed, so a process that has
+     * the previous file mapped keeps a consistent view. Readers map the file and use the
+     * payloads in place, without NIfTI compression and decompression.
+     */
+    class ExchangeArena {
+    public:
+        /// Image geometry stored with every image entry
+        struct Geometry {
+            int32_t x, y, z, t;
+            double dx, dy, dz, dt;
+            double xorigin, yorigin, zorigin, torigin;
+            double xaxis[3], yaxis[3], zaxis[3];
+            double smat[16];
+        };
+
+    protected:
+        enum EntryKind : uint32_t { IMAGE = 0, PARAMETERS = 1 };
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t number_of_entries;
+            uint64_t size;
+        };
+
+        struct Entry {
+            char name[64];
+            uint32_t kind;
+            uint32_t reserved;
+            /// Offset of the payload from the start of the file
+            uint64_t offset;
+            /// Number of payload values
+            uint64_t count;
+            Geometry geometry;
+        };
+
+        /// Object added for writing, images are referenced and must stay alive until Write()
+        struct Pending {
+            string name;
+            EntryKind kind;
+            const RealPixel *voxels;
+            Array<double> parameters;
+            uint64_t count;
+            Geometry geometry;
+        };
+
+        Array<Pending> _pending;
+
+        /// Mapped file for reading (private mapping, writes to it never reach the file)
+        char *_data;
+        size_t _size;
+        map<string, const Entry*> _entries;
+
+        const Entry *Find(const string& name, EntryKind kind) const;
+
+    public:
+        ExchangeArena();
+        ~ExchangeArena();
+
+        ExchangeArena(const ExchangeArena&) = delete;
+        ExchangeArena& operator=(const ExchangeArena&) = delete;
+
+        /// Add an image to be written, the image must not change or be destroyed before Write()
+        void AddImage(const string& name, const RealImage& image);
+
+        /// Add a vector of parameters to be written
+        void AddParameters(const string& name, const Array<double>& parameters);
+
+        /// Write all added objects to the file and clear them
+        void Write(const string& file_name);
+
+        /// Map an arena file for reading, returns false if it is missing or invalid
+        bool Open(const string& file_name);
+
+        /// Unmap the file
+        void Close();
+
+        /// Whether a file is mapped
+        inline bool IsOpen() const { return _data != nullptr; }
+
+        /// Whether the mapped file contains an entry of the given name
+        inline bool Contains(const string& name) const { return _entries.find(name) != _entries.end(); }
+
+        /**
+         * @brief Get an image of the mapped file without copying its voxels, throws if it is missing.
+         * @details The image refers to the mapped payload and is only valid until Close(). Changes
+         * of the voxels are private to the process and leave the file unchanged.
+         */
+        void GetImage(const string& name, RealImage& image) const;
+
+        /// Copy a parameter vector of the mapped file, throws if it is missing
+        Array<double> GetParameters(const string& name) const;
+    };
+
+} // namespace svrtk
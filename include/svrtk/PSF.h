@@ -0,0 +1,113 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// MIRTK
+#include "mirtk/Common.h"
+#include "mirtk/Array.h"
+#include "mirtk/Point.h"
+#include "mirtk/Matrix.h"
+#include "mirtk/GenericImage.h"
+
+// C++ Standard
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Discretised Gaussian PSF of a slice voxel.
+     * @details Besides the normalised PSF image, the kernel stores for every PSF point
+     * its weight and its offset from the PSF centre in slice image coordinates
+     * (PSF world coordinates divided by the slice voxel size), in the order
+     * ii-major, kk-minor. For rigid transformations the offsets are mapped to the image
+     * coordinates of the reconstructed volume once per slice (see MapPSFOffsets), so only
+     * the mapped centre of the slice voxel is added per PSF point.
+     */
+    struct PSFKernel {
+        /// Dimensions of the PSF image
+        int xDim, yDim, zDim;
+        /// Dimension and centre of the transformed PSF in the space of the reconstructed volume
+        int dim, centre;
+        /// Normalised PSF image
+        RealImage image;
+        /// Offsets of the PSF points in slice image coordinates
+        Array<Point> offset;
+        /// Normalised PSF values
+        Array<RealPixel> value;
+    };
+
+    /**
+     * @brief Map the PSF offsets of a kernel to the image coordinates of the reconstructed volume.
+     * @param m affine mapping from slice image to volume image coordinates, i.e. the volume world-to-image
+     * matrix times the rigid transformation times the slice image-to-world matrix
+     * @details Only the linear part of the mapping applies to the offsets: the position of a PSF point is the
+     * mapped centre of the slice voxel plus the mapped offset. FFDs are not affine and map every PSF point.
+     */
+    inline Array<Point> MapPSFOffsets(const PSFKernel& kernel, const Matrix& m) {
+        Array<Point> mapped_offset(kernel.offset.size());
+        for (size_t p = 0; p < kernel.offset.size(); p++) {
+            const Point& o = kernel.offset[p];
+            mapped_offset[p]._x = m(0, 0) * o._x + m(0, 1) * o._y + m(0, 2) * o._z;
+            mapped_offset[p]._y = m(1, 0) * o._x + m(1, 1) * o._y + m(1, 2) * o._z;
+            mapped_offset[p]._z = m(2, 0) * o._x + m(2, 1) * o._y + m(2, 2) * o._z;
+        }
+        return mapped_offset;
+    }
+
+    /**
+     * @brief Thread-safe cache of PSF kernels shared by all coefficient initialisers.
+     * @details Kernels are keyed by the slice voxel size, the sigmas of the Gaussian
+     * (which encode the reconstruction type and the no-SR mode), the PSF sampling size
+     * (derived from the quality factor) and the resolution of the reconstructed volume.
+     * Kernels are immutable once created and are never evicted, as there are only
+     * a handful of distinct slice geometries in a reconstruction.
+     */
+    class PSFCache {
+        typedef tuple<double, double, double, double, double, double, double, double> Key;
+
+        map<Key, shared_ptr<const PSFKernel>> _kernels;
+        mutex _mutex;
+
+        /// Compute the discretised PSF
+        static shared_ptr<const PSFKernel> Compute(double dx, double dy, double dz, double sigmax, double sigmay, double sigmaz, double size, double res);
+
+    public:
+        /// Cache shared by all reconstructions
+        static PSFCache& Instance();
+
+        /**
+         * @brief Get the PSF kernel for the given parameters, computing it on first use.
+         * @param dx, dy, dz slice voxel size
+         * @param sigmax, sigmay, sigmaz sigma of the 3D Gaussian
+         * @param size isotropic voxel size of the PSF image
+         * @param res isotropic voxel size of the reconstructed volume
+         */
+        shared_ptr<const PSFKernel> Get(double dx, double dy, double dz, double sigmax, double sigmay, double sigmaz, double size, double res);
+
+        /// Release all cached kernels
+        void Clear();
+    };
+
+} // namespace svrtk
@@ -20,6 +20,8 @@
 
 // SVRTK
 #include "svrtk/ReconstructionCardiacVelocity4D.h"
+#include "svrtk/Profiling.h"
+#include "svrtk/SignalModel.h"
 
 using namespace mirtk;
 using namespace svrtk;
@@ -284,21 +286,24 @@ namespace svrtk::Parallel {
         SimulateMasks(Reconstruction *reconstructor) : reconstructor(reconstructor) {}
 
         void operator()(const blocked_range<size_t>& r) {
+            SliceCoeffs buffer;
+
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
                 //Calculate simulated slice
                 RealImage& sim_mask = reconstructor->_slice_masks[inputIndex];
                 memset(sim_mask.Data(), 0, sizeof(RealPixel) * sim_mask.NumberOfVoxels());
                 bool slice_inside = false;
+                const SliceCoeffs& coeffs = reconstructor->GetSliceCoeffs(inputIndex, buffer);
+                const RealPixel *pevaluation_mask = reconstructor->_evaluation_mask.Data();
 
                 for (int i = 0; i < reconstructor->_slice_attributes[inputIndex]._x; i++) {
                     for (int j = 0; j < reconstructor->_slice_attributes[inputIndex]._y; j++) {
                         if (reconstructor->_slices[inputIndex](i, j, 0) > -0.01) {
                             double weight = 0;
-                            const size_t n = reconstructor->_volcoeffs[inputIndex][i][j].size();
-                            for (size_t k = 0; k < n; k++) {
-                                const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                sim_mask(i, j, 0) += p.value * reconstructor->_evaluation_mask(p.x, p.y, p.z);
-                                weight += p.value;
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                                const double value = coeffs.Value(k);
+                                sim_mask(i, j, 0) += value * pevaluation_mask[coeffs.Index(k)];
+                                weight += value;
                             }
                             if (weight > 0)
                                 sim_mask(i, j, 0) /= weight;
@@ -337,13 +342,30 @@ namespace svrtk::Parallel {
     /// Class for simulation of slices from the current reconstructed 3D volume - v2 (use this one)
     class SimulateSlices {
         Reconstruction *reconstructor;
+        bool mstep;
 
     public:
-        SimulateSlices(SimulateSlices& x, split) : SimulateSlices(x.reconstructor) {}
+        /// Partial sums of the MStep, accumulated while the simulated slices are still in cache
+        double sigma;
+        double mix;
+        double num;
+        double min;
+        double max;
 
-        SimulateSlices(Reconstruction *reconstructor) : reconstructor(reconstructor) {}
+        SimulateSlices(SimulateSlices& x, split) : SimulateSlices(x.reconstructor, x.mstep) {}
+
+        /// Simulate the slices and, if requested, accumulate the MStep sums in the same pass
+        SimulateSlices(Reconstruction *reconstructor, bool mstep = false) : reconstructor(reconstructor), mstep(mstep) {
+            sigma = 0;
+            mix = 0;
+            num = 0;
+            min = voxel_limits<RealPixel>::max();
+            max = voxel_limits<RealPixel>::min();
+        }
 
         void operator()(const blocked_range<size_t>& r) {
+            SliceCoeffs buffer;
+
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
                 //Calculate simulated slice
                 RealImage& sim_slice = reconstructor->_simulated_slices[inputIndex];
@@ -365,44 +387,73 @@ namespace svrtk::Parallel {
                     }
                 }
 
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++) {
-                            double test_val = reconstructor->_slices[inputIndex](i, j, 0);
-                            if (reconstructor->_no_masking_background)
-                                test_val = reconstructor->_not_masked_slices[inputIndex](i, j, 0);
-                            if (test_val > -0.01) {
-                                double weight = 0;
-                                for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                    const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                    sim_slice(i, j, 0) += p.value * reconstructor->_reconstructed(p.x, p.y, p.z);
-                                    weight += p.value;
-
-                                    for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                                        double tmp_val = reconstructor->_mc_simulated_slices[inputIndex][nc]->GetAsDouble(i, j, 0) + p.value * reconstructor->_mc_reconstructed[nc](p.x, p.y, p.z);
-                                        reconstructor->_mc_simulated_slices[inputIndex][nc]->PutAsDouble(i, j, 0, tmp_val);
-                                    }
+                const SliceCoeffs& coeffs = reconstructor->GetSliceCoeffs(inputIndex, buffer);
+                const RealPixel *pmask = reconstructor->_mask.Data();
+                const RealImage& slice = reconstructor->_no_masking_background ? reconstructor->_not_masked_slices[inputIndex] : reconstructor->_slices[inputIndex];
+                const bool no_masking_background = reconstructor->_no_masking_background;
 
-                                    if (reconstructor->_no_masking_background || reconstructor->_mask(p.x, p.y, p.z) > 0.1) {
-                                        sim_inside(i, j, 0) = 1;
-                                        reconstructor->_slice_inside[inputIndex] = true;
-                                    }
-                                }
-                                if (weight > 0) {
-                                    sim_slice(i, j, 0) /= weight;
-                                    sim_weight(i, j, 0) = weight;
+                auto sample = [&](int i, int j) { return slice(i, j, 0) > -0.01; };
+                auto inside = [&](int index) { return no_masking_background || pmask[index] > 0.1; };
+                if (SimulateSlice(coeffs, ScalarSignal(reconstructor->_reconstructed.Data()), sample, inside, sim_slice, sim_weight, sim_inside))
+                    reconstructor->_slice_inside[inputIndex] = true;
 
-                                    for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                                        double tmp_val = reconstructor->_mc_simulated_slices[inputIndex][nc]->GetAsDouble(i, j, 0) / weight;
-                                        reconstructor->_mc_simulated_slices[inputIndex][nc]->PutAsDouble(i, j, 0, tmp_val);
-                                    }
+                //the channels share the weights of the simulated slice
+                for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
+                    RealImage& mc_sim_slice = *reconstructor->_mc_simulated_slices[inputIndex][nc];
+                    ProjectSlice(coeffs, ChannelSignal(reconstructor->_mc_reconstructed[nc].Data()), sample, [](int) { return false; },
+                        [&](int i, int j, double signal, double weight, bool) { mc_sim_slice(i, j, 0) = weight > 0 ? signal / weight : signal; });
+                }
 
-                                }
-                            }
-                        };
+                if (mstep)
+                    AccumulateMStep(inputIndex);
             } //end of loop for a slice inputIndex
         }
 
-        void join(const SimulateSlices& y) {}
+        /// MStep sums of a slice (see MStep)
+        void AccumulateMStep(size_t inputIndex) {
+            const RealImage& slice = reconstructor->_slices[inputIndex];
+            const RealImage& sim_slice = reconstructor->_simulated_slices[inputIndex];
+            const RealImage& sim_weight = reconstructor->_simulated_weights[inputIndex];
+            const RealImage& weight = reconstructor->_weights[inputIndex];
+            const RealImage& bias = reconstructor->_bias[inputIndex];
+            const double scale = reconstructor->_scale[inputIndex];
+
+            for (int i = 0; i < slice.GetX(); i++)
+                for (int j = 0; j < slice.GetY(); j++)
+                    if (slice(i, j, 0) > -0.01) {
+                        //otherwise the error has no meaning - it is equal to slice intensity
+                        if (sim_weight(i, j, 0) > 0.99) {
+                            //bias correct and scale the slice
+                            RealPixel residual = slice(i, j, 0);
+                            residual *= exp(-bias(i, j, 0)) * scale;
+                            residual -= sim_slice(i, j, 0);
+
+                            //sigma and mix
+                            const double e = residual;
+                            sigma += e * e * weight(i, j, 0);
+                            mix += weight(i, j, 0);
+
+                            //_m
+                            if (e < min)
+                                min = e;
+                            if (e > max)
+                                max = e;
+
+                            num++;
+                        }
+                    }
+        }
+
+        void join(const SimulateSlices& y) {
+            if (y.min < min)
+                min = y.min;
+            if (y.max > max)
+                max = y.max;
+
+            sigma += y.sigma;
+            mix += y.mix;
+            num += y.num;
+        }
 
         void operator()() {
             parallel_reduce(blocked_range<size_t>(0, reconstructor->_slices.size()), *this);
@@ -426,26 +477,16 @@ namespace svrtk::Parallel {
                 reconstructor->_simulated_inside[inputIndex].Initialize(slice.Attributes());
                 reconstructor->_slice_inside[inputIndex] = false;
 
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
-                        if (slice(i, j, 0) != -1) {
-                            double weight = 0;
-                            for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                for (int outputIndex = 0; outputIndex < reconstructor->_reconstructed4D.GetT(); outputIndex++) {
-                                    reconstructor->_simulated_slices[inputIndex](i, j, 0) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * reconstructor->_reconstructed4D(p.x, p.y, p.z, outputIndex);
-                                    weight += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value;
-                                }
-                                if (reconstructor->_mask(p.x, p.y, p.z) == 1) {
-                                    reconstructor->_simulated_inside[inputIndex](i, j, 0) = 1;
-                                    reconstructor->_slice_inside[inputIndex] = true;
-                                }
-                            }
-                            if (weight > 0) {
-                                reconstructor->_simulated_slices[inputIndex](i, j, 0) /= weight;
-                                reconstructor->_simulated_weights[inputIndex](i, j, 0) = weight;
-                            }
-                        }
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
+                const RealPixel *pmask = reconstructor->_mask.Data();
+                const TemporalSignal model(reconstructor->_reconstructed4D.Data(), reconstructor->_reconstructed4D.NumberOfSpatialVoxels(),
+                    reconstructor->_slice_temporal_weight, inputIndex);
+
+                auto sample = [&](int i, int j) { return slice(i, j, 0) != -1; };
+                auto inside = [&](int index) { return pmask[index] == 1; };
+                if (SimulateSlice(coeffs, model, sample, inside, reconstructor->_simulated_slices[inputIndex],
+                        reconstructor->_simulated_weights[inputIndex], reconstructor->_simulated_inside[inputIndex]))
+                    reconstructor->_slice_inside[inputIndex] = true;
             }
         }
 
@@ -479,12 +520,17 @@ namespace svrtk::Parallel {
                 const int gradientIndex = reconstructor->_stack_index[inputIndex];
                 const double gval = reconstructor->_g_values[gradientIndex];
 
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
+                const RealPixel *pmask = reconstructor->_mask.Data();
+                const int nvox = reconstructor->_reconstructed4D.NumberOfSpatialVoxels();
+
+                for (int i = 0; i < coeffs.GetX(); i++)
+                    for (int j = 0; j < coeffs.GetY(); j++)
                         if (reconstructor->_slices[inputIndex](i, j, 0) > -10) {
                             double weight = 0;
-                            for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                                const int index = coeffs.Index(k);
+                                const double value = coeffs.Value(k);
                                 for (int outputIndex = 0; outputIndex < reconstructor->_reconstructed4D.GetT(); outputIndex++) {
                                     if (reconstructor->_reconstructed4D.GetT() == 1)
                                         reconstructor->_slice_temporal_weight[outputIndex][inputIndex] = 1;
@@ -493,14 +539,15 @@ namespace svrtk::Parallel {
                                     double sim_signal = 0;
 
                                     for (size_t velocityIndex = 0; velocityIndex < reconstructor->_reconstructed5DVelocity.size(); velocityIndex++) {
-                                        sim_signal += reconstructor->_reconstructed5DVelocity[velocityIndex](p.x, p.y, p.z, outputIndex) * gval * reconstructor->_slice_g_directions[inputIndex][velocityIndex];
-                                        reconstructor->_simulated_velocities[inputIndex][velocityIndex](i, j, 0) += reconstructor->_reconstructed5DVelocity[velocityIndex](p.x, p.y, p.z, outputIndex) * reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value;
+                                        const double velocity = reconstructor->_reconstructed5DVelocity[velocityIndex].Data()[index + outputIndex * nvox];
+                                        sim_signal += velocity * gval * reconstructor->_slice_g_directions[inputIndex][velocityIndex];
+                                        reconstructor->_simulated_velocities[inputIndex][velocityIndex](i, j, 0) += velocity * reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * value;
                                     }
 
-                                    reconstructor->_simulated_slices[inputIndex](i, j, 0) += sim_signal * reconstructor->gamma * reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value;
-                                    weight += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value;
+                                    reconstructor->_simulated_slices[inputIndex](i, j, 0) += sim_signal * reconstructor->gamma * reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * value;
+                                    weight += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * value;
                                 }
-                                if (reconstructor->_mask(p.x, p.y, p.z) == 1) {
+                                if (pmask[index] == 1) {
                                     reconstructor->_simulated_inside[inputIndex](i, j, 0) = 1;
                                     reconstructor->_slice_inside[inputIndex] = true;
                                 }
@@ -525,51 +572,107 @@ namespace svrtk::Parallel {
 
     //-------------------------------------------------------------------
 
+    /**
+     * @brief Registration target volumes shared read-only by all slice registrations of an iteration.
+     * @details The grey-level volume of each target (one per cardiac phase for 4D reconstructions)
+     * and its intensity range are computed once per iteration instead of once per slice, as well as
+     * the pyramids used by the dedicated rigid registration.
+     */
+    class SliceRegistrationTarget {
+        /// Volumes extracted from a 4D reconstruction
+        Array<GreyImage> _phases;
+        Array<const GreyImage*> _volume;
+        Array<GreyPixel> _min, _max;
+        Array<RegistrationPyramid> _pyramids;
+
+        void ComputeRange() {
+            _min.resize(_volume.size());
+            _max.resize(_volume.size());
+            for (size_t t = 0; t < _volume.size(); t++)
+                _volume[t]->GetMinMax(&_min[t], &_max[t]);
+        }
+
+    public:
+        /// Single target volume, referenced and not copied
+        SliceRegistrationTarget(const GreyImage& volume) : _volume(1, &volume) {
+            ComputeRange();
+        }
+
+        /// One target per phase of a 4D volume
+        SliceRegistrationTarget(const RealImage& volume4D) : _phases(volume4D.GetT()), _volume(volume4D.GetT()) {
+            const ImageAttributes& attr = volume4D.Attributes();
+            #pragma omp parallel for
+            for (int t = 0; t < attr._t; t++)
+                _phases[t] = volume4D.GetRegion(0, 0, 0, t, attr._x, attr._y, attr._z, t + 1);
+            for (int t = 0; t < attr._t; t++)
+                _volume[t] = &_phases[t];
+            ComputeRange();
+        }
+
+        /// Build the pyramids of all volumes for the dedicated rigid registration
+        void InitializePyramids(double background, int levels) {
+            _pyramids.resize(_volume.size());
+            #pragma omp parallel for
+            for (size_t t = 0; t < _volume.size(); t++)
+                _pyramids[t].Initialize(*_volume[t], background, levels);
+        }
+
+        inline const GreyImage& Volume(int t = 0) const { return *_volume[t]; }
+        inline const RegistrationPyramid& Pyramid(int t = 0) const { return _pyramids[t]; }
+        inline GreyPixel Min(int t = 0) const { return _min[t]; }
+        inline GreyPixel Max(int t = 0) const { return _max[t]; }
+    };
+
+    //-------------------------------------------------------------------
+
     /// Class for parallel SVR
     class SliceToVolumeRegistration {
         Reconstruction *reconstructor;
+        shared_ptr<SliceRegistrationTarget> source;
+        /// Similarity parameters common to all slices
+        ParameterList params_similarity;
 
     public:
-        SliceToVolumeRegistration(Reconstruction *reconstructor) : reconstructor(reconstructor) {}
+        SliceToVolumeRegistration(Reconstruction *reconstructor) : reconstructor(reconstructor),
+            source(make_shared<SliceRegistrationTarget>(reconstructor->_grey_reconstructed)) {
+            // the generic registration uses the finest level to measure the similarity improvement of the slices
+            if (reconstructor->_fast_rigid_svr || reconstructor->_svr_skip_converged) {
+                // same background as in the generic registration
+                double background = -numeric_limits<double>::infinity();
+                if (!reconstructor->_no_offset_registration && source->Min() < 1)
+                    background = source->Min() < 0 ? -1 : 0;
+                source->InitializePyramids(background, reconstructor->_fast_rigid_svr ? reconstructor->_fast_rigid_svr_levels : 1);
+            }
+
+            if (!reconstructor->_ncc_reg) {
+                Insert(params_similarity, "Image (dis-)similarity measure", "NMI");
+                if (reconstructor->_nmi_bins > 0)
+                    Insert(params_similarity, "No. of bins", reconstructor->_nmi_bins);
+            } else {
+                Insert(params_similarity, "Image (dis-)similarity measure", "NCC");
+                const string type = "sigma";
+                const string units = "mm";
+                constexpr double width = 0;
+                Insert(params_similarity, string("Local window size [") + type + string("]"), ToString(width) + units);
+            }
+        }
 
         void operator()(const blocked_range<size_t>& r) const {
-            GreyPixel smin, smax, tmin, tmax;
+            GreyPixel smin, smax;
+            const GreyPixel tmin = source->Min();
             GreyImage target;
 
             for (size_t inputIndex = r.begin(); inputIndex != r.end(); inputIndex++) {
-                target = reconstructor->_grey_slices[inputIndex];
-                target.GetMinMax(&smin, &smax);
-
-                if (smax > 1 && (smax - smin) > 1) {
-                    ParameterList params;
-                    Insert(params, "Transformation model", "Rigid");
-                    reconstructor->_grey_reconstructed.GetMinMax(&tmin, &tmax);
+                // converged slices
+                if (reconstructor->_svr_skip[inputIndex])
+                    continue;
 
-                    if (!reconstructor->_no_offset_registration) {
-                        
-                        if (smin < 1)
-                            Insert(params, "Background value for image 1", -1);
-                        if (tmin < 0)
-                            Insert(params, "Background value for image 2", -1);
-                        else if (tmin < 1)
-                            Insert(params, "Background value for image 2", 0);
-                        
-                    }
+                ProfileTask task("slice", inputIndex);
 
-                    if (!reconstructor->_ncc_reg) {
-                        Insert(params, "Image (dis-)similarity measure", "NMI");
-                        if (reconstructor->_nmi_bins > 0)
-                            Insert(params, "No. of bins", reconstructor->_nmi_bins);
-                    } else {
-                        Insert(params, "Image (dis-)similarity measure", "NCC");
-                        const string type = "sigma";
-                        const string units = "mm";
-                        constexpr double width = 0;
-                        Insert(params, string("Local window size [") + type + string("]"), ToString(width) + units);
-                    }
+                reconstructor->_grey_slices[inputIndex].GetMinMax(&smin, &smax);
 
-                    GenericRegistrationFilter registration;
-                    registration.Parameter(params);
+                if (smax > 1 && (smax - smin) > 1) {
+                    target = reconstructor->_grey_slices[inputIndex];
 
                     //put origin to zero
                     RigidTransformation offset;
@@ -581,17 +684,55 @@ namespace svrtk::Parallel {
                         transformation.PutMatrix(transformation.GetMatrix() * mo);
                     }
 
-                    // run registration
-                    registration.Input(&target, &reconstructor->_grey_reconstructed);
-                    Transformation *dofout;
-                    registration.Output(&dofout);
-                    registration.InitialGuess(&transformation);
-                    registration.GuessParameter();
-                    registration.Run();
+                    const double background = !reconstructor->_no_offset_registration && smin < 1 ? -1 : -numeric_limits<double>::infinity();
+                    const RigidSliceRegistration::Similarity similarity_measure = reconstructor->_ncc_reg ? RigidSliceRegistration::NCC : RigidSliceRegistration::NMI;
+
+                    if (reconstructor->_fast_rigid_svr) {
+                        // run the dedicated rigid registration
+                        RigidSliceRegistration registration(source->Pyramid(), similarity_measure, reconstructor->_nmi_bins);
+                        double initial_similarity;
+                        const double similarity = registration.Run(target, background, transformation, &initial_similarity);
+                        reconstructor->_svr_improvement[inputIndex] = similarity - initial_similarity;
+                    } else {
+                        // similarity before the registration, for the convergence of the slice
+                        double initial_similarity = 0;
+                        if (reconstructor->_svr_skip_converged)
+                            initial_similarity = RigidSliceRegistration(source->Pyramid(), similarity_measure, reconstructor->_nmi_bins).Evaluate(target, background, transformation);
+
+                        ParameterList params;
+                        Insert(params, "Transformation model", "Rigid");
+
+                        if (!reconstructor->_no_offset_registration) {
+                            
+                            if (smin < 1)
+                                Insert(params, "Background value for image 1", -1);
+                            if (tmin < 0)
+                                Insert(params, "Background value for image 2", -1);
+                            else if (tmin < 1)
+                                Insert(params, "Background value for image 2", 0);
+                            
+                        }
+
+                        params.insert(params.end(), params_similarity.begin(), params_similarity.end());
+
+                        GenericRegistrationFilter registration;
+                        registration.Parameter(params);
+
+                        // run registration
+                        registration.Input(&target, &source->Volume());
+                        Transformation *dofout;
+                        registration.Output(&dofout);
+                        registration.InitialGuess(&transformation);
+                        registration.GuessParameter();
+                        registration.Run();
+
+                        // output transformation
+                        unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
+                        transformation = *rigidTransf;
 
-                    // output transformation
-                    unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
-                    transformation = *rigidTransf;
+                        if (reconstructor->_svr_skip_converged)
+                            reconstructor->_svr_improvement[inputIndex] = RigidSliceRegistration(source->Pyramid(), similarity_measure, reconstructor->_nmi_bins).Evaluate(target, background, transformation) - initial_similarity;
+                    }
 
                     if (!reconstructor->_no_offset_registration) {
                         //undo the offset
@@ -624,13 +765,17 @@ namespace svrtk::Parallel {
 
     class SliceToVolumeRegistrationCardiac4D {
         ReconstructionCardiac4D *reconstructor;
+        shared_ptr<SliceRegistrationTarget> sources;
 
     public:
-        SliceToVolumeRegistrationCardiac4D(ReconstructionCardiac4D *reconstructor) : reconstructor(reconstructor) {}
+        SliceToVolumeRegistrationCardiac4D(ReconstructionCardiac4D *reconstructor) : reconstructor(reconstructor),
+            sources(make_shared<SliceRegistrationTarget>(reconstructor->_reconstructed4D)) {
+            if (reconstructor->_fast_rigid_svr)
+                sources->InitializePyramids(-1, reconstructor->_fast_rigid_svr_levels);
+        }
 
         void operator()(const blocked_range<size_t>& r) const {
-            const ImageAttributes& attr = reconstructor->_reconstructed4D.Attributes();
-            GreyImage source, target;
+            GreyImage target;
 
             ParameterList params;
             Insert(params, "Transformation model", "Rigid");
@@ -657,6 +802,8 @@ namespace svrtk::Parallel {
                 if (reconstructor->_slice_excluded[inputIndex])
                     continue;
 
+                ProfileTask task("slice", inputIndex);
+
                 // ResamplingWithPadding<RealPixel> resampling(attr._dx, attr._dx, attr._dx, -1);
                 // GenericLinearInterpolateImageFunction<RealImage> interpolator;
                 // // TARGET
@@ -684,13 +831,18 @@ namespace svrtk::Parallel {
                     transformation.PutMatrix(transformation.GetMatrix() * mo);
 
                     // TODO: extract the nearest cardiac phase from reconstructed 4D to use as source
-                    source = reconstructor->_reconstructed4D.GetRegion(0, 0, 0, reconstructor->_slice_svr_card_index[inputIndex], attr._x, attr._y, attr._z, reconstructor->_slice_svr_card_index[inputIndex] + 1);
-                    registration.Input(&target, &source);
-                    registration.InitialGuess(&transformation);
-                    registration.GuessParameter();
-                    registration.Run();
-                    unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
-                    transformation = *rigidTransf;
+                    const int phase = reconstructor->_slice_svr_card_index[inputIndex];
+                    if (reconstructor->_fast_rigid_svr) {
+                        RigidSliceRegistration fast_registration(sources->Pyramid(phase), RigidSliceRegistration::NMI, reconstructor->_nmi_bins);
+                        fast_registration.Run(target, 0, transformation);
+                    } else {
+                        registration.Input(&target, &sources->Volume(phase));
+                        registration.InitialGuess(&transformation);
+                        registration.GuessParameter();
+                        registration.Run();
+                        unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
+                        transformation = *rigidTransf;
+                    }
 
                     //undo the offset
                     transformation.PutMatrix(transformation.GetMatrix() * mo.Inverse());
@@ -743,6 +895,7 @@ namespace svrtk::Parallel {
             reconstructor->_reconstructed.GetMinMax(&smin, &smax);
 
             for (size_t inputIndex = r.begin(); inputIndex != r.end(); inputIndex++) {
+                ProfileTask task("slice", inputIndex);
 
                 GenericRegistrationFilter registration;
 
@@ -847,6 +1000,9 @@ namespace svrtk::Parallel {
 
         void operator()(const blocked_range<size_t>& r) const {
             for (size_t inputIndex = r.begin(); inputIndex != r.end(); inputIndex++) {
+                // converged slices keep their input transformation
+                if (rigid && reconstructor->_svr_skip.size() == reconstructor->_slices.size() && reconstructor->_svr_skip[inputIndex])
+                    continue;
                 if (reconstructor->_zero_slices[inputIndex] > 0) {
                     auto register_cmd_formatter = boost::format(register_cmd) % inputIndex;
                     if (is4d)
@@ -867,288 +1023,276 @@ namespace svrtk::Parallel {
     /// Class for calculation of transformation matrices
     class CoeffInit {
         Reconstruction *reconstructor;
+        const Array<size_t> *slice_indices;
 
     public:
-        CoeffInit(Reconstruction *reconstructor) : reconstructor(reconstructor) {}
-
-        void operator()(const blocked_range<size_t>& r) const {
-            const RealImage global_reconstructed(reconstructor->_grey_reconstructed.Attributes());
-            RealImage global_slice, PSF, tPSF;
+        /// Compute the matrices of all slices or, if given, only of the listed slices
+        CoeffInit(Reconstruction *reconstructor, const Array<size_t> *slice_indices = nullptr) :
+            reconstructor(reconstructor),
+            slice_indices(slice_indices) {}
+
+        /**
+         * @brief Compute the matrix of a single slice.
+         * @param global_reconstructed image with the geometry of the reconstructed volume
+         * @param tPSF buffer for the transformed PSF
+         */
+        static void Compute(const Reconstruction *reconstructor, size_t inputIndex, const RealImage& global_reconstructed, RealImage& tPSF, SliceCoeffs& slicecoeffs, bool& slice_inside) {
+            const RealImage& global_slice = reconstructor->_slices[inputIndex];
             //get resolution of the volume
             double vx, vy, vz;
             global_reconstructed.GetPixelSize(&vx, &vy, &vz);
             //volume is always isotropic
             const double& res = vx;
 
-            for (size_t inputIndex = r.begin(); inputIndex != r.end(); inputIndex++) {
-                global_slice.Initialize(reconstructor->_slices[inputIndex].Attributes());
-
-                //prepare storage variable
-                VOXELCOEFFS empty;
-                SLICECOEFFS slicecoeffs(global_slice.GetX(), Array<VOXELCOEFFS>(global_slice.GetY(), empty));
+            //prepare storage variable
+            slicecoeffs.Initialize(global_slice.GetX(), global_slice.GetY());
 
-                // To check whether the slice has an overlap with mask ROI
-                bool slice_inside = false;
+            // To check whether the slice has an overlap with mask ROI
+            slice_inside = false;
 
-                //PSF will be calculated in slice space in higher resolution
+            //PSF will be calculated in slice space in higher resolution
 
-                //get slice voxel size to define PSF
-                double dx, dy, dz;
-                global_slice.GetPixelSize(&dx, &dy, &dz);
+            //get slice voxel size to define PSF
+            double dx, dy, dz;
+            global_slice.GetPixelSize(&dx, &dy, &dz);
 
-                //sigma of 3D Gaussian (sinc with FWHM=dx or dy in-plane, Gaussian with FWHM = dz through-plane)
-                double sigmax, sigmay, sigmaz;
-                switch (reconstructor->_recon_type) {
-                case _3D:
-                    sigmax = 1.2 * dx / 2.3548;
-                    sigmay = 1.2 * dy / 2.3548;
-                    sigmaz = dz / 2.3548;
-                    break;
-
-                case _1D:
-                    sigmax = 0.5 * dx / 2.3548;
-                    sigmay = 0.5 * dy / 2.3548;
-                    sigmaz = dz / 2.3548;
-                    break;
-
-                case _interpolate:
-                    sigmax = sigmay = sigmaz = 0.5 * dx / 2.3548;
-                    break;
-                }
+            //sigma of 3D Gaussian (sinc with FWHM=dx or dy in-plane, Gaussian with FWHM = dz through-plane)
+            double sigmax, sigmay, sigmaz;
+            switch (reconstructor->_recon_type) {
+            case _3D:
+                sigmax = 1.2 * dx / 2.3548;
+                sigmay = 1.2 * dy / 2.3548;
+                sigmaz = dz / 2.3548;
+                break;
 
-                if (reconstructor->_no_sr) {
-                    sigmax = 0.6 * dx / 2.3548;
-                    sigmay = 0.6 * dy / 2.3548;
-                    sigmaz = 0.6 * dz / 2.3548;
-                }
+            case _1D:
+                sigmax = 0.5 * dx / 2.3548;
+                sigmay = 0.5 * dy / 2.3548;
+                sigmaz = dz / 2.3548;
+                break;
 
-                //calculate discretized PSF
+            case _interpolate:
+                sigmax = sigmay = sigmaz = 0.5 * dx / 2.3548;
+                break;
+            }
 
-                //isotropic voxel size of PSF - derived from resolution of reconstructed volume
-                const double size = res / reconstructor->_quality_factor;
+            if (reconstructor->_no_sr) {
+                sigmax = 0.6 * dx / 2.3548;
+                sigmay = 0.6 * dy / 2.3548;
+                sigmaz = 0.6 * dz / 2.3548;
+            }
 
-                //number of voxels in each direction
-                //the ROI is 2*voxel dimension
-                int xDim = round(2 * dx / size);
-                int yDim = round(2 * dy / size);
-                int zDim = round(2 * dz / size);
+            //discretised PSF, shared between slices with the same geometry
+            const shared_ptr<const PSFKernel> kernel = PSFCache::Instance().Get(dx, dy, dz, sigmax, sigmay, sigmaz, res / reconstructor->_quality_factor, res);
 
-                ///test to make dimension always odd
-                xDim = xDim / 2 * 2 + 1;
-                yDim = yDim / 2 * 2 + 1;
-                zDim = zDim / 2 * 2 + 1;
+            if (reconstructor->_debug && inputIndex == 0)
+                kernel->image.Write("PSF.nii.gz");
 
-                //image corresponding to PSF
+            //prepare storage for PSF transformed and resampled to the space of reconstructed volume
+            const int dim = kernel->dim;
+            if (tPSF.GetX() != dim) {
+                //voxel dimension will be taken from the reconstructed volume
                 ImageAttributes attr;
-                attr._x = xDim;
-                attr._y = yDim;
-                attr._z = zDim;
-                attr._dx = size;
-                attr._dy = size;
-                attr._dz = size;
-                PSF.Initialize(attr);
-
-                //centre of PSF
-                double cx = 0.5 * (xDim - 1);
-                double cy = 0.5 * (yDim - 1);
-                double cz = 0.5 * (zDim - 1);
-                PSF.ImageToWorld(cx, cy, cz);
-
-                double sum = 0;
-                for (int i = 0; i < xDim; i++)
-                    for (int j = 0; j < yDim; j++)
-                        for (int k = 0; k < zDim; k++) {
-                            double x = i;
-                            double y = j;
-                            double z = k;
-                            PSF.ImageToWorld(x, y, z);
-                            x -= cx;
-                            y -= cy;
-                            z -= cz;
-                            //continuous PSF does not need to be normalized as discrete will be
-                            PSF(i, j, k) = exp(-x * x / (2 * sigmax * sigmax) - y * y / (2 * sigmay * sigmay) - z * z / (2 * sigmaz * sigmaz));
-                            sum += PSF(i, j, k);
-                        }
-                PSF /= sum;
-
-                if (reconstructor->_debug && inputIndex == 0)
-                    PSF.Write("PSF.nii.gz");
-
-                //prepare storage for PSF transformed and resampled to the space of reconstructed volume
-                //maximum dim of rotated kernel - the next higher odd integer plus two to accound for rounding error of tx,ty,tz.
-                //Note conversion from PSF image coordinates to tPSF image coordinates *size/res
-                int dim = floor(ceil(sqrt(double(xDim * xDim + yDim * yDim + zDim * zDim)) * size / res) / 2) * 2 + 1 + 2;
-                //prepare image attributes. Voxel dimension will be taken from the reconstructed volume
                 attr._x = dim;
                 attr._y = dim;
                 attr._z = dim;
                 attr._dx = res;
                 attr._dy = res;
                 attr._dz = res;
-                //create matrix from transformed PSF
                 tPSF.Initialize(attr);
-                //calculate centre of tPSF in image coordinates
-                const int centre = (dim - 1) / 2;
-
-                //for each voxel in current slice calculate matrix coefficients
-                bool excluded_slice = false;
-                for (size_t ff = 0; ff < reconstructor->_force_excluded.size(); ff++) {
-                    if (inputIndex == reconstructor->_force_excluded[ff]) {
-                        excluded_slice = true;
-                        break;
-                    }
+            }
+            //calculate centre of tPSF in image coordinates
+            const int centre = kernel->centre;
+
+            //for each voxel in current slice calculate matrix coefficients
+            bool excluded_slice = false;
+            for (size_t ff = 0; ff < reconstructor->_force_excluded.size(); ff++) {
+                if (inputIndex == reconstructor->_force_excluded[ff]) {
+                    excluded_slice = true;
+                    break;
                 }
+            }
 
-                for (int i = 0; i < global_slice.GetX(); i++)
-                    for (int j = 0; j < global_slice.GetY(); j++) {
-                        double test_val = reconstructor->_slices[inputIndex](i, j, 0);
-                        if (reconstructor->_no_masking_background)
-                            test_val = reconstructor->_not_masked_slices[inputIndex](i, j, 0);
+            //for a rigid transformation the mapping from slice image to reconstructed image coordinates is affine,
+            //so the PSF offsets are mapped once per slice and only added to the mapped centre of each slice voxel
+            Array<Point> mapped_offset;
+            if (!reconstructor->_ffd)
+                mapped_offset = MapPSFOffsets(*kernel, global_reconstructed.GetWorldToImageMatrix() * reconstructor->_transformations[inputIndex].GetMatrix() * global_slice.GetImageToWorldMatrix());
+
+            for (int i = 0; i < global_slice.GetX(); i++)
+                for (int j = 0; j < global_slice.GetY(); j++) {
+                    double test_val = reconstructor->_slices[inputIndex](i, j, 0);
+                    if (reconstructor->_no_masking_background)
+                        test_val = reconstructor->_not_masked_slices[inputIndex](i, j, 0);
+
+                    if (test_val > -0.01 && reconstructor->_structural_slice_weight[inputIndex] > 0 && !excluded_slice) {
+                        //calculate centrepoint of slice voxel in volume space (tx,ty,tz)
+                        double x = i;
+                        double y = j;
+                        double z = 0;
+                        global_slice.ImageToWorld(x, y, z);
+
+                        if (!reconstructor->_ffd)
+                            reconstructor->_transformations[inputIndex].Transform(x, y, z);
+                        else
+                            reconstructor->_mffd_transformations[inputIndex]->Transform(-1, 1, x, y, z);
+
+                        global_reconstructed.WorldToImage(x, y, z);
+                        const double cx = x, cy = y, cz = z;
+                        int tx = round(x);
+                        int ty = round(y);
+                        int tz = round(z);
+
+                        // Clear the transformed PSF
+                        memset(tPSF.Data(), 0, sizeof(RealPixel) * tPSF.NumberOfVoxels());
+
+                        //for each POINT3D of the PSF
+                        for (size_t p = 0; p < kernel->offset.size(); p++) {
+                            if (!reconstructor->_ffd) {
+                                //position of the PSF point in image coordinates of the reconstructed volume
+                                x = cx + mapped_offset[p]._x;
+                                y = cy + mapped_offset[p]._y;
+                                z = cz + mapped_offset[p]._z;
+                            } else {
+                                //position of the PSF point centred over current slice voxel in slice image coordinates
+                                //(slices can be oriented in any direction, in slice image coordinates z is through-plane)
+                                x = kernel->offset[p]._x + i;
+                                y = kernel->offset[p]._y + j;
+                                z = kernel->offset[p]._z;
 
-                        if (test_val > -0.01 && reconstructor->_structural_slice_weight[inputIndex] > 0 && !excluded_slice) {
-                            //calculate centrepoint of slice voxel in volume space (tx,ty,tz)
-                            double x = i;
-                            double y = j;
-                            double z = 0;
-                            global_slice.ImageToWorld(x, y, z);
+                                //convert from slice image coordinates to world coordinates
+                                global_slice.ImageToWorld(x, y, z);
 
-                            if (!reconstructor->_ffd)
-                                reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                            else
+                                //Transform to space of reconstructed volume
                                 reconstructor->_mffd_transformations[inputIndex]->Transform(-1, 1, x, y, z);
 
-                            global_reconstructed.WorldToImage(x, y, z);
-                            int tx = round(x);
-                            int ty = round(y);
-                            int tz = round(z);
+                                //Change to image coordinates
+                                global_reconstructed.WorldToImage(x, y, z);
+                            }
 
-                            // Clear the transformed PSF
-                            memset(tPSF.Data(), 0, sizeof(RealPixel) * tPSF.NumberOfVoxels());
+                            //determine coefficients of volume voxels for position x,y,z
+                            //using linear interpolation
 
-                            //for each POINT3D of the PSF
-                            for (int ii = 0; ii < xDim; ii++)
-                                for (int jj = 0; jj < yDim; jj++)
-                                    for (int kk = 0; kk < zDim; kk++) {
-                                        //Calculate the position of the POINT3D of PSF centred over current slice voxel
-                                        //This is a bit complicated because slices can be oriented in any direction
-
-                                        //PSF image coordinates
-                                        x = ii;
-                                        y = jj;
-                                        z = kk;
-                                        //change to PSF world coordinates - now real sizes in mm
-                                        PSF.ImageToWorld(x, y, z);
-                                        //centre around the centrepoint of the PSF
-                                        x -= cx;
-                                        y -= cy;
-                                        z -= cz;
-
-                                        //Need to convert (x,y,z) to slice image coordinates because slices can have
-                                        //transformations included in them (they are nifti) and those are not reflected in
-                                        //PSF. In slice image coordinates we are sure that z is through-plane
-
-                                        //adjust according to voxel size
-                                        x /= dx;
-                                        y /= dy;
-                                        z /= dz;
-                                        //centre over current voxel
-                                        x += i;
-                                        y += j;
-
-                                        //convert from slice image coordinates to world coordinates
-                                        global_slice.ImageToWorld(x, y, z);
-
-                                        //Transform to space of reconstructed volume
-                                        if (!reconstructor->_ffd)
-                                            reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                                        else
-                                            reconstructor->_mffd_transformations[inputIndex]->Transform(-1, 1, x, y, z);
-
-                                        //Change to image coordinates
-                                        global_reconstructed.WorldToImage(x, y, z);
-
-                                        //determine coefficients of volume voxels for position x,y,z
-                                        //using linear interpolation
-
-                                        //Find the 8 closest volume voxels
-
-                                        //lowest corner of the cube
-                                        int nx = (int)floor(x);
-                                        int ny = (int)floor(y);
-                                        int nz = (int)floor(z);
-
-                                        //not all neighbours might be in ROI, thus we need to normalize
-                                        //(l,m,n) are image coordinates of 8 neighbours in volume space
-                                        //for each we check whether it is in volume
-                                        sum = 0;
-                                        //to find wether the current slice voxel has overlap with ROI
-                                        bool inside = false;
-                                        for (int l = nx; l <= nx + 1; l++)
-                                            if ((l >= 0) && (l < global_reconstructed.GetX()))
-                                                for (int m = ny; m <= ny + 1; m++)
-                                                    if ((m >= 0) && (m < global_reconstructed.GetY()))
-                                                        for (int n = nz; n <= nz + 1; n++)
-                                                            if ((n >= 0) && (n < global_reconstructed.GetZ())) {
-                                                                const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-                                                                sum += weight;
-
-                                                                if (reconstructor->_mask(l, m, n) == 1 || reconstructor->_no_masking_background) {
-                                                                    inside = true;
-                                                                    slice_inside = true;
-                                                                }
-                                                            }
-
-                                        //if there were no voxels do nothing
-                                        if (sum <= 0 || !inside)
-                                            continue;
-
-                                        //now calculate the transformed PSF
-                                        for (int l = nx; l <= nx + 1; l++)
-                                            if ((l >= 0) && (l < global_reconstructed.GetX()))
-                                                for (int m = ny; m <= ny + 1; m++)
-                                                    if ((m >= 0) && (m < global_reconstructed.GetY()))
-                                                        for (int n = nz; n <= nz + 1; n++)
-                                                            if (n >= 0 && n < global_reconstructed.GetZ()) {
-                                                                const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-
-                                                                //image coordinates in tPSF
-                                                                //(centre,centre,centre) in tPSF is aligned with (tx,ty,tz)
-                                                                int aa = l - tx + centre;
-                                                                int bb = m - ty + centre;
-                                                                int cc = n - tz + centre;
-
-                                                                //resulting value
-                                                                const double value = PSF(ii, jj, kk) * weight / sum;
-
-                                                                //Check that we are in tPSF
-                                                                if (!(aa < 0 || aa >= dim || bb < 0 || bb >= dim || cc < 0 || cc >= dim))
-                                                                    //update transformed PSF
-                                                                    tPSF(aa, bb, cc) += value;
-                                                            }
-
-                                    } //end of the loop for PSF points
+                            //Find the 8 closest volume voxels
 
-                            //store tPSF values
-                            for (int ii = 0; ii < dim; ii++)
-                                for (int jj = 0; jj < dim; jj++)
-                                    for (int kk = 0; kk < dim; kk++)
-                                        if (tPSF(ii, jj, kk) > 0) {
-                                            POINT3D p;
-                                            p.x = ii + tx - centre;
-                                            p.y = jj + ty - centre;
-                                            p.z = kk + tz - centre;
-                                            p.value = tPSF(ii, jj, kk);
-                                            slicecoeffs[i][j].push_back(p);
-                                        }
-                        } //end of loop for slice voxels
-                        }
+                            //lowest corner of the cube
+                            int nx = (int)floor(x);
+                            int ny = (int)floor(y);
+                            int nz = (int)floor(z);
+
+                            //not all neighbours might be in ROI, thus we need to normalize
+                            //(l,m,n) are image coordinates of 8 neighbours in volume space
+                            //for each we check whether it is in volume
+                            double sum = 0;
+                            //to find wether the current slice voxel has overlap with ROI
+                            bool inside = false;
+                            for (int l = nx; l <= nx + 1; l++)
+                                if ((l >= 0) && (l < global_reconstructed.GetX()))
+                                    for (int m = ny; m <= ny + 1; m++)
+                                        if ((m >= 0) && (m < global_reconstructed.GetY()))
+                                            for (int n = nz; n <= nz + 1; n++)
+                                                if ((n >= 0) && (n < global_reconstructed.GetZ())) {
+                                                    const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+                                                    sum += weight;
+
+                                                    if (reconstructor->_mask(l, m, n) == 1 || reconstructor->_no_masking_background) {
+                                                        inside = true;
+                                                        slice_inside = true;
+                                                    }
+                                                }
+
+                            //if there were no voxels do nothing
+                            if (sum <= 0 || !inside)
+                                continue;
+
+                            //now calculate the transformed PSF
+                            for (int l = nx; l <= nx + 1; l++)
+                                if ((l >= 0) && (l < global_reconstructed.GetX()))
+                                    for (int m = ny; m <= ny + 1; m++)
+                                        if ((m >= 0) && (m < global_reconstructed.GetY()))
+                                            for (int n = nz; n <= nz + 1; n++)
+                                                if (n >= 0 && n < global_reconstructed.GetZ()) {
+                                                    const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+
+                                                    //image coordinates in tPSF
+                                                    //(centre,centre,centre) in tPSF is aligned with (tx,ty,tz)
+                                                    int aa = l - tx + centre;
+                                                    int bb = m - ty + centre;
+                                                    int cc = n - tz + centre;
+
+                                                    //resulting value
+                                                    const double value = kernel->value[p] * weight / sum;
+
+                                                    //Check that we are in tPSF
+                                                    if (!(aa < 0 || aa >= dim || bb < 0 || bb >= dim || cc < 0 || cc >= dim))
+                                                        //update transformed PSF
+                                                        tPSF(aa, bb, cc) += value;
+                                                }
+
+                        } //end of the loop for PSF points
+
+                        //store tPSF values
+                        for (int ii = 0; ii < dim; ii++)
+                            for (int jj = 0; jj < dim; jj++)
+                                for (int kk = 0; kk < dim; kk++)
+                                    if (tPSF(ii, jj, kk) > 0)
+                                        slicecoeffs.Add(global_reconstructed.VoxelToIndex(ii + tx - centre, jj + ty - centre, kk + tz - centre), tPSF(ii, jj, kk));
+                    } //end of loop for slice voxels
+                    slicecoeffs.EndRow();
+                }
+        }
 
-                reconstructor->_volcoeffs[inputIndex] = slicecoeffs; //move(slicecoeffs);
+        void operator()(const blocked_range<size_t>& r) const {
+            const RealImage global_reconstructed(reconstructor->_grey_reconstructed.Attributes());
+            RealImage tPSF;
+
+            for (size_t n = r.begin(); n != r.end(); n++) {
+                const size_t inputIndex = slice_indices ? (*slice_indices)[n] : n;
+                ProfileTask task("slice", inputIndex);
+
+                SliceCoeffs slicecoeffs;
+                bool slice_inside;
+                Compute(reconstructor, inputIndex, global_reconstructed, tPSF, slicecoeffs, slice_inside);
+
+                // copy assignment trims the capacity of the coefficient arrays to their size
+                reconstructor->_volcoeffs[inputIndex] = slicecoeffs;
                 reconstructor->_slice_inside[inputIndex] = slice_inside;
 
             }  //end of loop through the slices
         }
 
+        void operator()() const {
+            parallel_for(blocked_range<size_t>(0, slice_indices ? slice_indices->size() : reconstructor->_slices.size()), *this);
+        }
+    };
+
+    //-------------------------------------------------------------------
+
+    /// Class for evaluating the Jacobian threshold of the FFD transformations at the coefficients of the slices
+    class JacobianMask {
+        Reconstruction *reconstructor;
+
+    public:
+        JacobianMask(Reconstruction *reconstructor) : reconstructor(reconstructor) {
+            reconstructor->_coeffs_jac_mask.resize(reconstructor->_slices.size());
+        }
+
+        void operator()(const blocked_range<size_t>& r) const {
+            for (size_t inputIndex = r.begin(); inputIndex != r.end(); inputIndex++) {
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
+                Array<bool>& mask = reconstructor->_coeffs_jac_mask[inputIndex];
+                mask.assign(coeffs.NumberOfCoefficients(), true);
+
+                for (size_t k = 0; k < coeffs.NumberOfCoefficients(); k++) {
+                    int x, y, z;
+                    reconstructor->_reconstructed.IndexToVoxel(coeffs.Index(k), x, y, z);
+                    const double jac = reconstructor->_mffd_transformations[inputIndex]->Jacobian(x, y, z, 0, 0);
+                    if ((100*jac) < reconstructor->_global_JAC_threshold)
+                        mask[k] = false;
+                }
+            }
+        }
+
         void operator()() const {
             parallel_for(blocked_range<size_t>(0, reconstructor->_slices.size()), *this);
         }
@@ -1172,7 +1316,7 @@ namespace svrtk::Parallel {
             end(end) {}
 
         void operator()(const blocked_range<size_t>& r) const {
-            RealImage PSF, tPSF;
+            RealImage tPSF;
             //get resolution of the volume
             double vx, vy, vz;
             reconstructor->_reconstructed.GetPixelSize(&vx, &vy, &vz);
@@ -1183,7 +1327,8 @@ namespace svrtk::Parallel {
                 const RealImage& slice = reconstructor->_withMB ? reconstructor->_slicesRwithMB[inputIndex] : reconstructor->_slices[inputIndex];
 
                 //prepare structures for storage
-                SLICECOEFFS slicecoeffs(slice.GetX(), Array<VOXELCOEFFS>(slice.GetY()));
+                SliceCoeffs slicecoeffs;
+                slicecoeffs.Initialize(slice.GetX(), slice.GetY());
 
                 //to check whether the slice has an overlap with mask ROI
                 bool slice_inside = false;
@@ -1214,77 +1359,36 @@ namespace svrtk::Parallel {
                     break;
                 }
 
-                //calculate discretized PSF
-
-                //isotropic voxel size of PSF - derived from resolution of reconstructed volume
-                double size = res / reconstructor->_quality_factor;
-
-                //number of voxels in each direction
-                //the ROI is 2*voxel dimension
-                int xDim = round(2 * dx / size);
-                int yDim = round(2 * dy / size);
-                int zDim = round(2 * dz / size);
-
-                ///test to make dimension always odd
-                xDim = xDim / 2 * 2 + 1;
-                yDim = yDim / 2 * 2 + 1;
-                zDim = zDim / 2 * 2 + 1;
-
-                //image corresponding to PSF
-                ImageAttributes attr;
-                attr._x = xDim;
-                attr._y = yDim;
-                attr._z = zDim;
-                attr._dx = size;
-                attr._dy = size;
-                attr._dz = size;
-                PSF.Initialize(attr);
-
-                //centre of PSF
-                double cx = 0.5 * (xDim - 1);
-                double cy = 0.5 * (yDim - 1);
-                double cz = 0.5 * (zDim - 1);
-                PSF.ImageToWorld(cx, cy, cz);
-
-                double sum = 0;
-                for (int i = 0; i < xDim; i++)
-                    for (int j = 0; j < yDim; j++)
-                        for (int k = 0; k < zDim; k++) {
-                            double x = i;
-                            double y = j;
-                            double z = k;
-                            PSF.ImageToWorld(x, y, z);
-                            x -= cx;
-                            y -= cy;
-                            z -= cz;
-                            //continuous PSF does not need to be normalized as discrete will be
-                            PSF(i, j, k) = exp(-x * x / (2 * sigmax * sigmax) - y * y / (2 * sigmay * sigmay) - z * z / (2 * sigmaz * sigmaz));
-                            sum += PSF(i, j, k);
-                        }
-                PSF /= sum;
+                //discretised PSF, shared between slices with the same geometry
+                const shared_ptr<const PSFKernel> kernel = PSFCache::Instance().Get(dx, dy, dz, sigmax, sigmay, sigmaz, res / reconstructor->_quality_factor, res);
 
                 if (reconstructor->_debug && inputIndex == 0)
-                    PSF.Write("PSF.nii.gz");
+                    kernel->image.Write("PSF.nii.gz");
 
                 //prepare storage for PSF transformed and resampled to the space of reconstructed volume
-                //maximum dim of rotated kernel - the next higher odd integer plus two to accound for rounding error of tx,ty,tz.
-                //Note conversion from PSF image coordinates to tPSF image coordinates *size/res
-                int dim = floor(ceil(sqrt(double(xDim * xDim + yDim * yDim + zDim * zDim)) * size / res) / 2) * 2 + 1 + 2;
-                //prepare image attributes. Voxel dimension will be taken from the reconstructed volume
-                attr._x = dim;
-                attr._y = dim;
-                attr._z = dim;
-                attr._dx = res;
-                attr._dy = res;
-                attr._dz = res;
-                //create matrix from transformed PSF
-                tPSF.Initialize(attr);
+                const int dim = kernel->dim;
+                if (tPSF.GetX() != dim) {
+                    //voxel dimension will be taken from the reconstructed volume
+                    ImageAttributes attr;
+                    attr._x = dim;
+                    attr._y = dim;
+                    attr._z = dim;
+                    attr._dx = res;
+                    attr._dy = res;
+                    attr._dz = res;
+                    tPSF.Initialize(attr);
+                }
                 //calculate centre of tPSF in image coordinates
-                int centre = (dim - 1) / 2;
+                const int centre = kernel->centre;
+
+                //the offsets of the PSF points are mapped once per slice, except for the multiband transformations
+                Array<Point> mapped_offset;
+                if (!reconstructor->_withMB)
+                    mapped_offset = MapPSFOffsets(*kernel, reconstructor->_reconstructed.GetWorldToImageMatrix() * reconstructor->_transformations[inputIndex].GetMatrix() * slice.GetImageToWorldMatrix());
 
                 //for each voxel in current slice calculate matrix coefficients
                 for (int i = 0; i < slice.GetX(); i++)
-                    for (int j = 0; j < slice.GetY(); j++)
+                    for (int j = 0; j < slice.GetY(); j++) {
                         if (slice(i, j, 0) > -0.01) {
                             //calculate centrepoint of slice voxel in volume space (tx,ty,tz)
                             double x = i;
@@ -1298,6 +1402,7 @@ namespace svrtk::Parallel {
                                 reconstructor->_transformations[inputIndex].Transform(x, y, z);
 
                             reconstructor->_reconstructed.WorldToImage(x, y, z);
+                            const double cx = x, cy = y, cz = z;
                             int tx = round(x);
                             int ty = round(y);
                             int tz = round(z);
@@ -1306,134 +1411,106 @@ namespace svrtk::Parallel {
                             memset(tPSF.Data(), 0, sizeof(RealPixel) * tPSF.NumberOfVoxels());
 
                             //for each POINT3D of the PSF
-                            for (int ii = 0; ii < xDim; ii++)
-                                for (int jj = 0; jj < yDim; jj++)
-                                    for (int kk = 0; kk < zDim; kk++) {
-                                        //Calculate the position of the POINT3D of
-                                        //PSF centred over current slice voxel
-                                        //This is a bit complicated because slices
-                                        //can be oriented in any direction
-
-                                        //PSF image coordinates
-                                        x = ii;
-                                        y = jj;
-                                        z = kk;
-                                        //change to PSF world coordinates - now real sizes in mm
-                                        PSF.ImageToWorld(x, y, z);
-                                        //centre around the centrepoint of the PSF
-                                        x -= cx;
-                                        y -= cy;
-                                        z -= cz;
-
-                                        //Need to convert (x,y,z) to slice image
-                                        //coordinates because slices can have
-                                        //transformations included in them (they are
-                                        //nifti) and those are not reflected in
-                                        //PSF. In slice image coordinates we are
-                                        //sure that z is through-plane
-
-                                        //adjust according to voxel size
-                                        x /= dx;
-                                        y /= dy;
-                                        z /= dz;
-                                        //center over current voxel
-                                        x += i;
-                                        y += j;
-
-                                        //convert from slice image coordinates to world coordinates
-                                        slice.ImageToWorld(x, y, z);
-
-                                        //x+=(vx-cx); y+=(vy-cy); z+=(vz-cz);
-                                        //Transform to space of reconstructed volume
-                                        if (reconstructor->_withMB)
-                                            reconstructor->_transformationsRwithMB[inputIndex].Transform(x, y, z);
-                                        else
-                                            reconstructor->_transformations[inputIndex].Transform(x, y, z);
-
-                                        //Change to image coordinates
-                                        reconstructor->_reconstructed.WorldToImage(x, y, z);
-
-                                        //determine coefficients of volume voxels for position x,y,z
-                                        //using linear interpolation
-
-                                        //Find the 8 closest volume voxels
-
-                                        //lowest corner of the cube
-                                        int nx = (int)floor(x);
-                                        int ny = (int)floor(y);
-                                        int nz = (int)floor(z);
-
-                                        //not all neighbours might be in ROI, thus we need to normalize
-                                        //(l,m,n) are image coordinates of 8 neighbours in volume space
-                                        //for each we check whether it is in volume
-                                        sum = 0;
-                                        //to find wether the current slice voxel has overlap with ROI
-                                        bool inside = false;
-                                        for (int l = nx; l <= nx + 1; l++)
-                                            if ((l >= 0) && (l < reconstructor->_reconstructed.GetX()))
-                                                for (int m = ny; m <= ny + 1; m++)
-                                                    if ((m >= 0) && (m < reconstructor->_reconstructed.GetY()))
-                                                        for (int n = nz; n <= nz + 1; n++)
-                                                            if ((n >= 0) && (n < reconstructor->_reconstructed.GetZ())) {
-                                                                const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-                                                                sum += weight;
-                                                                if (reconstructor->_mask(l, m, n) == 1) {
-                                                                    inside = true;
-                                                                    slice_inside = true;
-                                                                }
-                                                            }
-
-                                        //if there were no voxels do nothing
-                                        if (sum <= 0 || !inside)
-                                            continue;
-
-                                        //now calculate the transformed PSF
-                                        for (int l = nx; l <= nx + 1; l++)
-                                            if ((l >= 0) && (l < reconstructor->_reconstructed.GetX()))
-                                                for (int m = ny; m <= ny + 1; m++)
-                                                    if ((m >= 0) && (m < reconstructor->_reconstructed.GetY()))
-                                                        for (int n = nz; n <= nz + 1; n++)
-                                                            if ((n >= 0) && (n < reconstructor->_reconstructed.GetZ())) {
-                                                                const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-
-                                                                //image coordinates in tPSF
-                                                                //(centre,centre,centre) in tPSF is aligned with (tx,ty,tz)
-                                                                int aa = l - tx + centre;
-                                                                int bb = m - ty + centre;
-                                                                int cc = n - tz + centre;
-
-                                                                //resulting value
-                                                                const double value = PSF(ii, jj, kk) * weight / sum;
-
-                                                                //Check that we are in tPSF
-                                                                if (aa < 0 || aa >= dim || bb < 0 || bb >= dim || cc < 0 || cc >= dim) {
-                                                                    stringstream err;
-                                                                    err << "Error while trying to populate tPSF. " << aa << " " << bb << " " << cc << endl;
-                                                                    err << l << " " << m << " " << n << endl;
-                                                                    err << tx << " " << ty << " " << tz << endl;
-                                                                    err << centre << endl;
-                                                                    tPSF.Write("tPSF.nii.gz");
-                                                                    throw runtime_error(err.str());
-                                                                } else
-                                                                    //update transformed PSF
-                                                                    tPSF(aa, bb, cc) += value;
-                                                            }
-
-                                    } //end of the loop for PSF points
+                            for (size_t p = 0; p < kernel->offset.size(); p++) {
+                                if (!reconstructor->_withMB) {
+                                    //position of the PSF point in image coordinates of the reconstructed volume
+                                    x = cx + mapped_offset[p]._x;
+                                    y = cy + mapped_offset[p]._y;
+                                    z = cz + mapped_offset[p]._z;
+                                } else {
+                                    //position of the PSF point centred over current slice voxel in slice image coordinates
+                                    //(slices can be oriented in any direction, in slice image coordinates z is through-plane)
+                                    x = kernel->offset[p]._x + i;
+                                    y = kernel->offset[p]._y + j;
+                                    z = kernel->offset[p]._z;
+
+                                    //convert from slice image coordinates to world coordinates
+                                    slice.ImageToWorld(x, y, z);
+
+                                    //Transform to space of reconstructed volume
+                                    reconstructor->_transformationsRwithMB[inputIndex].Transform(x, y, z);
+
+                                    //Change to image coordinates
+                                    reconstructor->_reconstructed.WorldToImage(x, y, z);
+                                }
+
+                                //determine coefficients of volume voxels for position x,y,z
+                                //using linear interpolation
+
+                                //Find the 8 closest volume voxels
+
+                                //lowest corner of the cube
+                                int nx = (int)floor(x);
+                                int ny = (int)floor(y);
+                                int nz = (int)floor(z);
+
+                                //not all neighbours might be in ROI, thus we need to normalize
+                                //(l,m,n) are image coordinates of 8 neighbours in volume space
+                                //for each we check whether it is in volume
+                                double sum = 0;
+                                //to find wether the current slice voxel has overlap with ROI
+                                bool inside = false;
+                                for (int l = nx; l <= nx + 1; l++)
+                                    if ((l >= 0) && (l < reconstructor->_reconstructed.GetX()))
+                                        for (int m = ny; m <= ny + 1; m++)
+                                            if ((m >= 0) && (m < reconstructor->_reconstructed.GetY()))
+                                                for (int n = nz; n <= nz + 1; n++)
+                                                    if ((n >= 0) && (n < reconstructor->_reconstructed.GetZ())) {
+                                                        const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+                                                        sum += weight;
+                                                        if (reconstructor->_mask(l, m, n) == 1) {
+                                                            inside = true;
+                                                            slice_inside = true;
+                                                        }
+                                                    }
+
+                                //if there were no voxels do nothing
+                                if (sum <= 0 || !inside)
+                                    continue;
+
+                                //now calculate the transformed PSF
+                                for (int l = nx; l <= nx + 1; l++)
+                                    if ((l >= 0) && (l < reconstructor->_reconstructed.GetX()))
+                                        for (int m = ny; m <= ny + 1; m++)
+                                            if ((m >= 0) && (m < reconstructor->_reconstructed.GetY()))
+                                                for (int n = nz; n <= nz + 1; n++)
+                                                    if ((n >= 0) && (n < reconstructor->_reconstructed.GetZ())) {
+                                                        const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+
+                                                        //image coordinates in tPSF
+                                                        //(centre,centre,centre) in tPSF is aligned with (tx,ty,tz)
+                                                        int aa = l - tx + centre;
+                                                        int bb = m - ty + centre;
+                                                        int cc = n - tz + centre;
+
+                                                        //resulting value
+                                                        const double value = kernel->value[p] * weight / sum;
+
+                                                        //Check that we are in tPSF
+                                                        if (aa < 0 || aa >= dim || bb < 0 || bb >= dim || cc < 0 || cc >= dim) {
+                                                            stringstream err;
+                                                            err << "Error while trying to populate tPSF. " << aa << " " << bb << " " << cc << endl;
+                                                            err << l << " " << m << " " << n << endl;
+                                                            err << tx << " " << ty << " " << tz << endl;
+                                                            err << centre << endl;
+                                                            tPSF.Write("tPSF.nii.gz");
+                                                            throw runtime_error(err.str());
+                                                        } else
+                                                            //update transformed PSF
+                                                            tPSF(aa, bb, cc) += value;
+                                                    }
+
+                            } //end of the loop for PSF points
 
                             //store tPSF values
                             for (int ii = 0; ii < dim; ii++)
                                 for (int jj = 0; jj < dim; jj++)
                                     for (int kk = 0; kk < dim; kk++)
-                                        if (tPSF(ii, jj, kk) > 0) {
-                                            POINT3D p;
-                                            p.x = ii + tx - centre;
-                                            p.y = jj + ty - centre;
-                                            p.z = kk + tz - centre;
-                                            p.value = tPSF(ii, jj, kk);
-                                            slicecoeffs[i][j].push_back(p);
-                                        }
+                                        if (tPSF(ii, jj, kk) > 0)
+                                            slicecoeffs.Add(reconstructor->_reconstructed.VoxelToIndex(ii + tx - centre, jj + ty - centre, kk + tz - centre), tPSF(ii, jj, kk));
                         } //end of loop for slice voxels
+                        slicecoeffs.EndRow();
+                    }
 
                 // move assignment operation for slicecoeffs should have been more performant and memory efficient
                 // but it turned out that it consumes more memory and it's less performant (GCC 9.3.0)
@@ -1457,7 +1534,7 @@ namespace svrtk::Parallel {
         CoeffInitCardiac4D(ReconstructionCardiac4D *reconstructor) : reconstructor(reconstructor) {}
 
         void operator()(const blocked_range<size_t>& r) const {
-            RealImage PSF, tPSF;
+            RealImage tPSF;
             //get resolution of the volume
             double vx, vy, vz;
             reconstructor->_reconstructed4D.GetPixelSize(&vx, &vy, &vz);
@@ -1472,7 +1549,8 @@ namespace svrtk::Parallel {
                 RealImage& slice = reconstructor->_slices[inputIndex];
 
                 //prepare structures for storage
-                SLICECOEFFS slicecoeffs(slice.GetX(), Array<VOXELCOEFFS>(slice.GetY()));
+                SliceCoeffs slicecoeffs;
+                slicecoeffs.Initialize(slice.GetX(), slice.GetY());
 
                 //to check whether the slice has an overlap with mask ROI
                 bool slice_inside = false;
@@ -1513,79 +1591,34 @@ namespace svrtk::Parallel {
                     sigmaz = 0.5 * dz / 2.3548;   // 1
                 }
 
-                //calculate discretized PSF
-
-                //isotropic voxel size of PSF - derived from resolution of reconstructed volume
-                const double size = res / reconstructor->_quality_factor;
-
-                //number of voxels in each direction
-                //the ROI is 2*voxel dimension
-
-                int xDim = round(2 * dx / size);
-                int yDim = round(2 * dy / size);
-                int zDim = round(2 * dz / size);
-                ///test to make dimension always odd
-                xDim = xDim / 2 * 2 + 1;
-                yDim = yDim / 2 * 2 + 1;
-                zDim = zDim / 2 * 2 + 1;
-                ///end test
-
-                //image corresponding to PSF
-                ImageAttributes attr;
-                attr._x = xDim;
-                attr._y = yDim;
-                attr._z = zDim;
-                attr._dx = size;
-                attr._dy = size;
-                attr._dz = size;
-                PSF.Initialize(attr);
-
-                //centre of PSF
-                double cx, cy, cz;
-                cx = 0.5 * (xDim - 1);
-                cy = 0.5 * (yDim - 1);
-                cz = 0.5 * (zDim - 1);
-                PSF.ImageToWorld(cx, cy, cz);
-
-                double sum = 0;
-                for (int i = 0; i < xDim; i++)
-                    for (int j = 0; j < yDim; j++)
-                        for (int k = 0; k < zDim; k++) {
-                            double x = i;
-                            double y = j;
-                            double z = k;
-                            PSF.ImageToWorld(x, y, z);
-                            x -= cx;
-                            y -= cy;
-                            z -= cz;
-                            //continuous PSF does not need to be normalized as discrete will be
-                            PSF(i, j, k) = exp(-x * x / (2 * sigmax * sigmax) - y * y / (2 * sigmay * sigmay) - z * z / (2 * sigmaz * sigmaz));
-                            sum += PSF(i, j, k);
-                        }
-                PSF /= sum;
+                //discretised PSF, shared between slices with the same geometry
+                const shared_ptr<const PSFKernel> kernel = PSFCache::Instance().Get(dx, dy, dz, sigmax, sigmay, sigmaz, res / reconstructor->_quality_factor, res);
 
                 if (reconstructor->_debug && inputIndex == 0)
-                    PSF.Write("PSF.nii.gz");
+                    kernel->image.Write("PSF.nii.gz");
 
                 //prepare storage for PSF transformed and resampled to the space of reconstructed volume
-                //maximum dim of rotated kernel - the next higher odd integer plus two to accound for rounding error of tx,ty,tz.
-                //Note conversion from PSF image coordinates to tPSF image coordinates *size/res
-                int dim = (floor(ceil(sqrt(double(xDim * xDim + yDim * yDim + zDim * zDim)) * size / res) / 2)) * 2 + 1 + 2;
-                //prepare image attributes. Voxel dimension will be taken from the reconstructed volume
-                attr._x = dim;
-                attr._y = dim;
-                attr._z = dim;
-                attr._dx = res;
-                attr._dy = res;
-                attr._dz = res;
-                //create matrix from transformed PSF
-                tPSF.Initialize(attr);
+                const int dim = kernel->dim;
+                if (tPSF.GetX() != dim) {
+                    //voxel dimension will be taken from the reconstructed volume
+                    ImageAttributes attr;
+                    attr._x = dim;
+                    attr._y = dim;
+                    attr._z = dim;
+                    attr._dx = res;
+                    attr._dy = res;
+                    attr._dz = res;
+                    tPSF.Initialize(attr);
+                }
                 //calculate centre of tPSF in image coordinates
-                int centre = (dim - 1) / 2;
+                const int centre = kernel->centre;
+
+                //the rigid transformation is affine, the offsets of the PSF points are mapped once per slice
+                const Array<Point> mapped_offset = MapPSFOffsets(*kernel, reconstructor->_reconstructed4D.GetWorldToImageMatrix() * reconstructor->_transformations[inputIndex].GetMatrix() * slice.GetImageToWorldMatrix());
 
                 //for each voxel in current slice calculate matrix coefficients
                 for (int i = 0; i < slice.GetX(); i++)
-                    for (int j = 0; j < slice.GetY(); j++)
+                    for (int j = 0; j < slice.GetY(); j++) {
                         if (slice(i, j, 0) != -1) {
                             //calculate centrepoint of slice voxel in volume space (tx,ty,tz)
                             double x = i;
@@ -1594,6 +1627,7 @@ namespace svrtk::Parallel {
                             slice.ImageToWorld(x, y, z);
                             reconstructor->_transformations[inputIndex].Transform(x, y, z);
                             reconstructor->_reconstructed4D.WorldToImage(x, y, z);
+                            const double cx = x, cy = y, cz = z;
                             int tx = round(x);
                             int ty = round(y);
                             int tz = round(z);
@@ -1602,131 +1636,90 @@ namespace svrtk::Parallel {
                             memset(tPSF.Data(), 0, sizeof(RealPixel) * tPSF.NumberOfVoxels());
 
                             //for each POINT3D of the PSF
-                            for (int ii = 0; ii < xDim; ii++)
-                                for (int jj = 0; jj < yDim; jj++)
-                                    for (int kk = 0; kk < zDim; kk++) {
-                                        //Calculate the position of the POINT3D of
-                                        //PSF centred over current slice voxel
-                                        //This is a bit complicated because slices
-                                        //can be oriented in any direction
-
-                                        //PSF image coordinates
-                                        x = ii;
-                                        y = jj;
-                                        z = kk;
-                                        //change to PSF world coordinates - now real sizes in mm
-                                        PSF.ImageToWorld(x, y, z);
-                                        //centre around the centrepoint of the PSF
-                                        x -= cx;
-                                        y -= cy;
-                                        z -= cz;
-
-                                        //Need to convert (x,y,z) to slice image
-                                        //coordinates because slices can have
-                                        //transformations included in them (they are
-                                        //nifti)  and those are not reflected in
-                                        //PSF. In slice image coordinates we are
-                                        //sure that z is through-plane
-
-                                        //adjust according to voxel size
-                                        x /= dx;
-                                        y /= dy;
-                                        z /= dz;
-                                        //center over current voxel
-                                        x += i;
-                                        y += j;
-
-                                        //convert from slice image coordinates to world coordinates
-                                        slice.ImageToWorld(x, y, z);
-
-                                        //x+=(vx-cx); y+=(vy-cy); z+=(vz-cz);
-                                        //Transform to space of reconstructed volume
-                                        reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                                        //Change to image coordinates
-                                        reconstructor->_reconstructed4D.WorldToImage(x, y, z);
-
-                                        //determine coefficients of volume voxels for position x,y,z
-                                        //using linear interpolation
-
-                                        //Find the 8 closest volume voxels
-
-                                        //lowest corner of the cube
-                                        int nx = (int)floor(x);
-                                        int ny = (int)floor(y);
-                                        int nz = (int)floor(z);
-
-                                        //not all neighbours might be in ROI, thus we need to normalize
-                                        //(l,m,n) are image coordinates of 8 neighbours in volume space
-                                        //for each we check whether it is in volume
-                                        sum = 0;
-                                        //to find wether the current slice voxel has overlap with ROI
-                                        bool inside = false;
-                                        for (int l = nx; l <= nx + 1; l++)
-                                            if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
-                                                for (int m = ny; m <= ny + 1; m++)
-                                                    if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
-                                                        for (int n = nz; n <= nz + 1; n++)
-                                                            if ((n >= 0) && (n < reconstructor->_reconstructed4D.GetZ())) {
-                                                                const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-                                                                sum += weight;
-                                                                if (reconstructor->_mask(l, m, n) == 1) {
-                                                                    inside = true;
-                                                                    slice_inside = true;
-                                                                }
-                                                            }
-
-                                        //if there were no voxels do nothing
-                                        if (sum <= 0 || !inside)
-                                            continue;
-
-                                        //now calculate the transformed PSF
-                                        for (int l = nx; l <= nx + 1; l++)
-                                            if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
-                                                for (int m = ny; m <= ny + 1; m++)
-                                                    if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
-                                                        for (int n = nz; n <= nz + 1; n++)
-                                                            if (n >= 0 && n < reconstructor->_reconstructed4D.GetZ()) {
-                                                                const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-
-                                                                //image coordinates in tPSF
-                                                                //(centre,centre,centre) in tPSF is aligned with (tx,ty,tz)
-                                                                int aa = l - tx + centre;
-                                                                int bb = m - ty + centre;
-                                                                int cc = n - tz + centre;
-
-                                                                //resulting value
-                                                                const double value = PSF(ii, jj, kk) * weight / sum;
-
-                                                                //Check that we are in tPSF
-                                                                if (aa < 0 || aa >= dim || bb < 0 || bb >= dim || cc < 0 || cc >= dim) {
-                                                                    stringstream err;
-                                                                    err << "Error while trying to populate tPSF. " << aa << " " << bb << " " << cc << endl;
-                                                                    err << l << " " << m << " " << n << endl;
-                                                                    err << tx << " " << ty << " " << tz << endl;
-                                                                    err << centre << endl;
-                                                                    tPSF.Write("tPSF.nii.gz");
-                                                                    throw runtime_error(err.str());
-                                                                } else
-                                                                    //update transformed PSF
-                                                                    tPSF(aa, bb, cc) += value;
-                                                            }
-
-                                    } //end of the loop for PSF points
+                            for (size_t p = 0; p < kernel->offset.size(); p++) {
+                                //position of the PSF point in image coordinates of the reconstructed volume
+                                x = cx + mapped_offset[p]._x;
+                                y = cy + mapped_offset[p]._y;
+                                z = cz + mapped_offset[p]._z;
+
+                                //determine coefficients of volume voxels for position x,y,z
+                                //using linear interpolation
+
+                                //Find the 8 closest volume voxels
+
+                                //lowest corner of the cube
+                                int nx = (int)floor(x);
+                                int ny = (int)floor(y);
+                                int nz = (int)floor(z);
+
+                                //not all neighbours might be in ROI, thus we need to normalize
+                                //(l,m,n) are image coordinates of 8 neighbours in volume space
+                                //for each we check whether it is in volume
+                                double sum = 0;
+                                //to find wether the current slice voxel has overlap with ROI
+                                bool inside = false;
+                                for (int l = nx; l <= nx + 1; l++)
+                                    if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
+                                        for (int m = ny; m <= ny + 1; m++)
+                                            if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
+                                                for (int n = nz; n <= nz + 1; n++)
+                                                    if ((n >= 0) && (n < reconstructor->_reconstructed4D.GetZ())) {
+                                                        const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+                                                        sum += weight;
+                                                        if (reconstructor->_mask(l, m, n) == 1) {
+                                                            inside = true;
+                                                            slice_inside = true;
+                                                        }
+                                                    }
+
+                                //if there were no voxels do nothing
+                                if (sum <= 0 || !inside)
+                                    continue;
+
+                                //now calculate the transformed PSF
+                                for (int l = nx; l <= nx + 1; l++)
+                                    if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
+                                        for (int m = ny; m <= ny + 1; m++)
+                                            if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
+                                                for (int n = nz; n <= nz + 1; n++)
+                                                    if (n >= 0 && n < reconstructor->_reconstructed4D.GetZ()) {
+                                                        const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+
+                                                        //image coordinates in tPSF
+                                                        //(centre,centre,centre) in tPSF is aligned with (tx,ty,tz)
+                                                        int aa = l - tx + centre;
+                                                        int bb = m - ty + centre;
+                                                        int cc = n - tz + centre;
+
+                                                        //resulting value
+                                                        const double value = kernel->value[p] * weight / sum;
+
+                                                        //Check that we are in tPSF
+                                                        if (aa < 0 || aa >= dim || bb < 0 || bb >= dim || cc < 0 || cc >= dim) {
+                                                            stringstream err;
+                                                            err << "Error while trying to populate tPSF. " << aa << " " << bb << " " << cc << endl;
+                                                            err << l << " " << m << " " << n << endl;
+                                                            err << tx << " " << ty << " " << tz << endl;
+                                                            err << centre << endl;
+                                                            tPSF.Write("tPSF.nii.gz");
+                                                            throw runtime_error(err.str());
+                                                        } else
+                                                            //update transformed PSF
+                                                            tPSF(aa, bb, cc) += value;
+                                                    }
+
+                            } //end of the loop for PSF points
 
                             //store tPSF values
                             for (int ii = 0; ii < dim; ii++)
                                 for (int jj = 0; jj < dim; jj++)
                                     for (int kk = 0; kk < dim; kk++)
-                                        if (tPSF(ii, jj, kk) > 0) {
-                                            POINT3D p;
-                                            p.x = ii + tx - centre;
-                                            p.y = jj + ty - centre;
-                                            p.z = kk + tz - centre;
-                                            p.value = tPSF(ii, jj, kk);
-                                            slicecoeffs[i][j].push_back(p);
-                                        }
+                                        if (tPSF(ii, jj, kk) > 0)
+                                            slicecoeffs.Add(reconstructor->_reconstructed4D.VoxelToIndex(ii + tx - centre, jj + ty - centre, kk + tz - centre), tPSF(ii, jj, kk));
 
                         } //end of loop for slice voxels
+                        slicecoeffs.EndRow();
+                    }
 
                 // move assignment operation for slicecoeffs should have been more performant and memory efficient
                 // but it turned out that it consumes more memory and it's less performant (GCC 9.3.0)
@@ -1750,7 +1743,7 @@ namespace svrtk::Parallel {
         SimulateStacksCardiac4D(ReconstructionCardiac4D *reconstructor) : reconstructor(reconstructor) {}
 
         void operator()(const blocked_range<size_t>& r) const {
-            RealImage PSF, tPSF;
+            RealImage tPSF;
             //get resolution of the volume
             double vx, vy, vz;
             reconstructor->_reconstructed4D.GetPixelSize(&vx, &vy, &vz);
@@ -1767,7 +1760,8 @@ namespace svrtk::Parallel {
                 RealImage& slice = reconstructor->_slices[inputIndex];
 
                 //prepare structures for storage
-                SLICECOEFFS slicecoeffs(slice.GetX(), Array<VOXELCOEFFS>(slice.GetY()));
+                SliceCoeffs slicecoeffs;
+                slicecoeffs.Initialize(slice.GetX(), slice.GetY());
 
                 //PSF will be calculated in slice space in higher resolution
 
@@ -1796,78 +1790,33 @@ namespace svrtk::Parallel {
                     sigmaz = 0.5 * dx / 2.3548;
                 }
 
-                //calculate discretized PSF
-
-                //isotropic voxel size of PSF - derived from resolution of reconstructed volume
-                double size = res / reconstructor->_quality_factor;
-
-                //number of voxels in each direction
-                //the ROI is 2*voxel dimension
-
-                int xDim = round(2 * dx / size);
-                int yDim = round(2 * dy / size);
-                int zDim = round(2 * dz / size);
-                ///test to make dimension always odd
-                xDim = xDim / 2 * 2 + 1;
-                yDim = yDim / 2 * 2 + 1;
-                zDim = zDim / 2 * 2 + 1;
-                ///end test
-
-                //image corresponding to PSF
-                ImageAttributes attr;
-                attr._x = xDim;
-                attr._y = yDim;
-                attr._z = zDim;
-                attr._dx = size;
-                attr._dy = size;
-                attr._dz = size;
-                PSF.Initialize(attr);
-
-                //centre of PSF
-                double cx, cy, cz;
-                cx = 0.5 * (xDim - 1);
-                cy = 0.5 * (yDim - 1);
-                cz = 0.5 * (zDim - 1);
-                PSF.ImageToWorld(cx, cy, cz);
-
                 double x, y, z;
-                double sum = 0;
-                int i, j, k;
-                for (i = 0; i < xDim; i++)
-                    for (j = 0; j < yDim; j++)
-                        for (k = 0; k < zDim; k++) {
-                            x = i;
-                            y = j;
-                            z = k;
-                            PSF.ImageToWorld(x, y, z);
-                            x -= cx;
-                            y -= cy;
-                            z -= cz;
-                            //continuous PSF does not need to be normalized as discrete will be
-                            PSF(i, j, k) = exp(-x * x / (2 * sigmax * sigmax) - y * y / (2 * sigmay * sigmay) - z * z / (2 * sigmaz * sigmaz));
-                            sum += PSF(i, j, k);
-                        }
-                PSF /= sum;
+                int i, j;
+
+                //discretised PSF, shared between slices with the same geometry
+                const shared_ptr<const PSFKernel> kernel = PSFCache::Instance().Get(dx, dy, dz, sigmax, sigmay, sigmaz, res / reconstructor->_quality_factor, res);
 
-                if (reconstructor->_debug)
-                    if (inputIndex == 0)
-                        PSF.Write("PSF.nii.gz");
+                if (reconstructor->_debug && inputIndex == 0)
+                    kernel->image.Write("PSF.nii.gz");
 
                 //prepare storage for PSF transformed and resampled to the space of reconstructed volume
-                //maximum dim of rotated kernel - the next higher odd integer plus two to accound for rounding error of tx,ty,tz.
-                //Note conversion from PSF image coordinates to tPSF image coordinates *size/res
-                int dim = (floor(ceil(sqrt(double(xDim * xDim + yDim * yDim + zDim * zDim)) * size / res) / 2)) * 2 + 1 + 2;
-                //prepare image attributes. Voxel dimension will be taken from the reconstructed volume
-                attr._x = dim;
-                attr._y = dim;
-                attr._z = dim;
-                attr._dx = res;
-                attr._dy = res;
-                attr._dz = res;
-                //create matrix from transformed PSF
-                tPSF.Initialize(attr);
+                const int dim = kernel->dim;
+                if (tPSF.GetX() != dim) {
+                    //voxel dimension will be taken from the reconstructed volume
+                    ImageAttributes attr;
+                    attr._x = dim;
+                    attr._y = dim;
+                    attr._z = dim;
+                    attr._dx = res;
+                    attr._dy = res;
+                    attr._dz = res;
+                    tPSF.Initialize(attr);
+                }
                 //calculate centre of tPSF in image coordinates
-                int centre = (dim - 1) / 2;
+                const int centre = kernel->centre;
+
+                //the rigid transformation is affine, the offsets of the PSF points are mapped once per slice
+                const Array<Point> mapped_offset = MapPSFOffsets(*kernel, reconstructor->_reconstructed4D.GetWorldToImageMatrix() * reconstructor->_transformations[inputIndex].GetMatrix() * slice.GetImageToWorldMatrix());
 
                 //for each voxel in current slice calculate matrix coefficients
                 int ii, jj, kk;
@@ -1875,7 +1824,7 @@ namespace svrtk::Parallel {
                 int nx, ny, nz;
                 int l, m, n;
                 for (i = 0; i < slice.GetX(); i++)
-                    for (j = 0; j < slice.GetY(); j++)
+                    for (j = 0; j < slice.GetY(); j++) {
                         if (slice(i, j, 0) != -1) {
                             //calculate centrepoint of slice voxel in volume space (tx,ty,tz)
                             x = i;
@@ -1884,6 +1833,7 @@ namespace svrtk::Parallel {
                             slice.ImageToWorld(x, y, z);
                             reconstructor->_transformations[inputIndex].Transform(x, y, z);
                             reconstructor->_reconstructed4D.WorldToImage(x, y, z);
+                            const double cx = x, cy = y, cz = z;
                             tx = round(x);
                             ty = round(y);
                             tz = round(z);
@@ -1892,142 +1842,103 @@ namespace svrtk::Parallel {
                             memset(tPSF.Data(), 0, sizeof(RealPixel) * tPSF.NumberOfVoxels());
 
                             //for each POINT3D of the PSF
-                            for (ii = 0; ii < xDim; ii++)
-                                for (jj = 0; jj < yDim; jj++)
-                                    for (kk = 0; kk < zDim; kk++) {
-                                        //Calculate the position of the POINT3D of
-                                        //PSF centred over current slice voxel
-                                        //This is a bit complicated because slices
-                                        //can be oriented in any direction
-
-                                        //PSF image coordinates
-                                        x = ii;
-                                        y = jj;
-                                        z = kk;
-                                        //change to PSF world coordinates - now real sizes in mm
-                                        PSF.ImageToWorld(x, y, z);
-                                        //centre around the centrepoint of the PSF
-                                        x -= cx;
-                                        y -= cy;
-                                        z -= cz;
-
-                                        //Need to convert (x,y,z) to slice image
-                                        //coordinates because slices can have
-                                        //transformations included in them (they are
-                                        //nifti)  and those are not reflected in
-                                        //PSF. In slice image coordinates we are
-                                        //sure that z is through-plane
-
-                                        //adjust according to voxel size
-                                        x /= dx;
-                                        y /= dy;
-                                        z /= dz;
-                                        //center over current voxel
-                                        x += i;
-                                        y += j;
-
-                                        //convert from slice image coordinates to world coordinates
-                                        slice.ImageToWorld(x, y, z);
-
-                                        //x+=(vx-cx); y+=(vy-cy); z+=(vz-cz);
-                                        //Transform to space of reconstructed volume
-                                        reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                                        //Change to image coordinates
-                                        reconstructor->_reconstructed4D.WorldToImage(x, y, z);
-
-                                        //determine coefficients of volume voxels for position x,y,z
-                                        //using linear interpolation
-
-                                        //Find the 8 closest volume voxels
-
-                                        //lowest corner of the cube
-                                        nx = (int)floor(x);
-                                        ny = (int)floor(y);
-                                        nz = (int)floor(z);
-
-                                        //not all neighbours might be in ROI, thus we need to normalize
-                                        //(l,m,n) are image coordinates of 8 neighbours in volume space
-                                        //for each we check whether it is in volume
-                                        sum = 0;
-                                        //to find wether the current slice voxel has overlap with ROI
-                                        bool inside = false;
-                                        for (l = nx; l <= nx + 1; l++)
-                                            if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
-                                                for (m = ny; m <= ny + 1; m++)
-                                                    if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
-                                                        for (n = nz; n <= nz + 1; n++)
-                                                            if ((n >= 0) && (n < reconstructor->_reconstructed4D.GetZ())) {
-                                                                const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-                                                                sum += weight;
-                                                                if (reconstructor->_mask(l, m, n) == 1)
-                                                                    inside = true;
-                                                            }
-                                        //if there were no voxels do nothing
-                                        if (sum <= 0 || !inside)
-                                            continue;
-                                        //now calculate the transformed PSF
-                                        for (l = nx; l <= nx + 1; l++)
-                                            if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
-                                                for (m = ny; m <= ny + 1; m++)
-                                                    if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
-                                                        for (n = nz; n <= nz + 1; n++)
-                                                            if ((n >= 0) && (n < reconstructor->_reconstructed4D.GetZ())) {
-                                                                const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-
-                                                                //image coordinates in tPSF
-                                                                //(centre,centre,centre) in tPSF is aligned with (tx,ty,tz)
-                                                                int aa = l - tx + centre;
-                                                                int bb = m - ty + centre;
-                                                                int cc = n - tz + centre;
-
-                                                                //resulting value
-                                                                double value = PSF(ii, jj, kk) * weight / sum;
-
-                                                                //Check that we are in tPSF
-                                                                if ((aa < 0) || (aa >= dim) || (bb < 0) || (bb >= dim) || (cc < 0) || (cc >= dim)) {
-                                                                    stringstream err;
-                                                                    err << "Error while trying to populate tPSF. " << aa << " " << bb << " " << cc << endl;
-                                                                    err << l << " " << m << " " << n << endl;
-                                                                    err << tx << " " << ty << " " << tz << endl;
-                                                                    err << centre << endl;
-                                                                    tPSF.Write("tPSF.nii.gz");
-                                                                    throw runtime_error(err.str());
-                                                                } else
-                                                                    //update transformed PSF
-                                                                    tPSF(aa, bb, cc) += value;
-                                                            }
-
-                                    } //end of the loop for PSF points
+                            for (size_t p = 0; p < kernel->offset.size(); p++) {
+                                //position of the PSF point in image coordinates of the reconstructed volume
+                                x = cx + mapped_offset[p]._x;
+                                y = cy + mapped_offset[p]._y;
+                                z = cz + mapped_offset[p]._z;
+
+                                //determine coefficients of volume voxels for position x,y,z
+                                //using linear interpolation
+
+                                //Find the 8 closest volume voxels
+
+                                //lowest corner of the cube
+                                nx = (int)floor(x);
+                                ny = (int)floor(y);
+                                nz = (int)floor(z);
+
+                                //not all neighbours might be in ROI, thus we need to normalize
+                                //(l,m,n) are image coordinates of 8 neighbours in volume space
+                                //for each we check whether it is in volume
+                                double sum = 0;
+                                //to find wether the current slice voxel has overlap with ROI
+                                bool inside = false;
+                                for (l = nx; l <= nx + 1; l++)
+                                    if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
+                                        for (m = ny; m <= ny + 1; m++)
+                                            if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
+                                                for (n = nz; n <= nz + 1; n++)
+                                                    if ((n >= 0) && (n < reconstructor->_reconstructed4D.GetZ())) {
+                                                        const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+                                                        sum += weight;
+                                                        if (reconstructor->_mask(l, m, n) == 1)
+                                                            inside = true;
+                                                    }
+                                //if there were no voxels do nothing
+                                if (sum <= 0 || !inside)
+                                    continue;
+                                //now calculate the transformed PSF
+                                for (l = nx; l <= nx + 1; l++)
+                                    if ((l >= 0) && (l < reconstructor->_reconstructed4D.GetX()))
+                                        for (m = ny; m <= ny + 1; m++)
+                                            if ((m >= 0) && (m < reconstructor->_reconstructed4D.GetY()))
+                                                for (n = nz; n <= nz + 1; n++)
+                                                    if ((n >= 0) && (n < reconstructor->_reconstructed4D.GetZ())) {
+                                                        const double weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+
+                                                        //image coordinates in tPSF
+                                                        //(centre,centre,centre) in tPSF is aligned with (tx,ty,tz)
+                                                        int aa = l - tx + centre;
+                                                        int bb = m - ty + centre;
+                                                        int cc = n - tz + centre;
+
+                                                        //resulting value
+                                                        double value = kernel->value[p] * weight / sum;
+
+                                                        //Check that we are in tPSF
+                                                        if ((aa < 0) || (aa >= dim) || (bb < 0) || (bb >= dim) || (cc < 0) || (cc >= dim)) {
+                                                            stringstream err;
+                                                            err << "Error while trying to populate tPSF. " << aa << " " << bb << " " << cc << endl;
+                                                            err << l << " " << m << " " << n << endl;
+                                                            err << tx << " " << ty << " " << tz << endl;
+                                                            err << centre << endl;
+                                                            tPSF.Write("tPSF.nii.gz");
+                                                            throw runtime_error(err.str());
+                                                        } else
+                                                            //update transformed PSF
+                                                            tPSF(aa, bb, cc) += value;
+                                                    }
+
+                            } //end of the loop for PSF points
 
                             //store tPSF values
                             for (ii = 0; ii < dim; ii++)
                                 for (jj = 0; jj < dim; jj++)
                                     for (kk = 0; kk < dim; kk++)
-                                        if (tPSF(ii, jj, kk) > 0) {
-                                            POINT3D p;
-                                            p.x = ii + tx - centre;
-                                            p.y = jj + ty - centre;
-                                            p.z = kk + tz - centre;
-                                            p.value = tPSF(ii, jj, kk);
-                                            slicecoeffs[i][j].push_back(p);
-                                        }
+                                        if (tPSF(ii, jj, kk) > 0)
+                                            slicecoeffs.Add(reconstructor->_reconstructed4D.VoxelToIndex(ii + tx - centre, jj + ty - centre, kk + tz - centre), tPSF(ii, jj, kk));
 
                         } //end of loop for slice voxels
+                        slicecoeffs.EndRow();
+                    }
 
                 //Calculate simulated slice
                 reconstructor->_simulated_slices[inputIndex].Initialize(reconstructor->_slices[inputIndex].Attributes());
                 reconstructor->_simulated_weights[inputIndex].Initialize(reconstructor->_slices[inputIndex].Attributes());
+                const RealPixel *preconstructed = reconstructor->_reconstructed4D.Data();
+                const int nvox = reconstructor->_reconstructed4D.NumberOfSpatialVoxels();
 
                 for (int i = 0; i < reconstructor->_slices[inputIndex].GetX(); i++)
                     for (int j = 0; j < reconstructor->_slices[inputIndex].GetY(); j++)
                         if (reconstructor->_slices[inputIndex](i, j, 0) != -1) {
                             double weight = 0;
-                            const size_t n = slicecoeffs[i][j].size();
-                            for (size_t k = 0; k < n; k++) {
-                                const POINT3D& p = slicecoeffs[i][j][k];
+                            for (int k = slicecoeffs.Begin(i, j); k < slicecoeffs.End(i, j); k++) {
+                                const int index = slicecoeffs.Index(k);
+                                const double value = slicecoeffs.Value(k);
                                 for (int outputIndex = 0; outputIndex < reconstructor->_reconstructed4D.GetT(); outputIndex++) {
-                                    reconstructor->_simulated_slices[inputIndex](i, j, 0) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * reconstructor->_reconstructed4D(p.x, p.y, p.z, outputIndex);
-                                    weight += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value;
+                                    reconstructor->_simulated_slices[inputIndex](i, j, 0) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * value * preconstructed[index + outputIndex * nvox];
+                                    weight += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * value;
                                 }
                             }
                             if (weight > 0) {
@@ -2072,16 +1983,18 @@ namespace svrtk::Parallel {
                 memset(weight.Data(), 0, sizeof(RealPixel) * weight.NumberOfVoxels());
 
                 double num = 0;
+                //in the matrix-free mode the simulated weights alone tell whether a slice voxel overlaps the volume
+                const SliceCoeffs *coeffs = reconstructor->_matrix_free ? nullptr : &reconstructor->_volcoeffs[inputIndex];
                 //Calculate error, voxel weights, and slice potential
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
+                for (int i = 0; i < slice.GetX(); i++)
+                    for (int j = 0; j < slice.GetY(); j++)
                         if (slice(i, j, 0) > -0.01) {
                             //bias correct and scale the slice
                             slice(i, j, 0) *= exp(-reconstructor->_bias[inputIndex](i, j, 0)) * reconstructor->_scale[inputIndex];
 
                             //number of volumetric voxels to which
                             // current slice voxel contributes
-                            const size_t n = reconstructor->_volcoeffs[inputIndex][i][j].size();
+                            const int n = coeffs ? coeffs->Size(i, j) : 1;
 
                             // if n == 0, slice voxel has no overlap with volumetric ROI, do not process it
 
@@ -2148,13 +2061,14 @@ namespace svrtk::Parallel {
                             slice(i, j, 0) = -15;
 
                 double num = 0;
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
                 //Calculate error, voxel weights, and slice potential
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
+                for (int i = 0; i < coeffs.GetX(); i++)
+                    for (int j = 0; j < coeffs.GetY(); j++)
                         if (slice(i, j, 0) > -10) {
                             //number of volumetric voxels to which
                             // current slice voxel contributes
-                            const int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
+                            const int n = coeffs.Size(i, j);
 
                             // if n == 0, slice voxel has no overlap with volumetric ROI, do not process it
                             if (n > 0 && reconstructor->_simulated_weights[inputIndex](i, j, 0) > 0) {
@@ -2347,77 +2261,354 @@ namespace svrtk::Parallel {
 
         void operator()(const blocked_range<size_t>& r) {
             //Update reconstructed volume using current slice
+            RealPixel *paddon = addon.Data();
+            RealPixel *pconfidence_map = confidence_map.Data();
+            SliceCoeffs buffer;
+
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
+                ProfileTask task("slice", inputIndex);
+                const SliceCoeffs& coeffs = reconstructor->GetSliceCoeffs(inputIndex, buffer);
+                const RealImage& slice = reconstructor->_no_masking_background ? reconstructor->_not_masked_slices[inputIndex] : reconstructor->_slices[inputIndex];
+                const RealImage& sim_slice = reconstructor->_simulated_slices[inputIndex];
+                const double slice_weight = reconstructor->_slice_weight[inputIndex];
+                //Jacobian threshold evaluated in CoeffInit, not available in matrix-free mode
+                const Array<bool> *jac_mask = reconstructor->_ffd && !reconstructor->_coeffs_jac_mask.empty() ? &reconstructor->_coeffs_jac_mask[inputIndex] : nullptr;
+
+                //weight of a pixel, which contributes if it is inside the slice
+                auto pixel_weight = [&](int i, int j, double& weight) {
+                    if (slice(i, j, 0) <= -0.01)
+                        return false;
+                    const double multiplier = reconstructor->_robust_slices_only ? 1 : reconstructor->_weights[inputIndex](i, j, 0);
+                    const double ssim_weight = reconstructor->_structural ? reconstructor->_slice_ssim_maps[inputIndex](i, j, 0) : 1;
+                    weight = ssim_weight * multiplier * slice_weight;
+                    return true;
+                };
+
+                //residual computed in the same pass (as in SliceDifference, zero where the simulated slice is empty)
+                auto residual = [&](int i, int j, double& error, double& weight) {
+                    if (!pixel_weight(i, j, weight))
+                        return false;
+                    RealPixel slice_dif = 0;
+                    if (sim_slice(i, j, 0) >= 0.01) {
+                        slice_dif = slice(i, j, 0);
+                        slice_dif *= exp(-reconstructor->_bias[inputIndex](i, j, 0)) * reconstructor->_scale[inputIndex];
+                        slice_dif -= sim_slice(i, j, 0);
+                    }
+                    error = slice_dif;
+                    return true;
+                };
+
+                //coefficients of voxels where the deformation is below the Jacobian threshold are excluded
+                auto include = [&](int k, int index) {
+                    if (jac_mask)
+                        return bool((*jac_mask)[k]);
+                    if (!reconstructor->_ffd)
+                        return true;
+                    int x, y, z;
+                    reconstructor->_reconstructed.IndexToVoxel(index, x, y, z);
+                    const double jac = reconstructor->_mffd_transformations[inputIndex]->Jacobian(x, y, z, 0, 0);
+                    return (100*jac) >= reconstructor->_global_JAC_threshold;
+                };
+
                 //Distribute error to the volume
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++) {
+                BackProjectSlice(coeffs, ScalarSignal(reconstructor->_reconstructed.Data()), residual, include, paddon, pconfidence_map);
 
-                        double test_val;
-                        if (reconstructor->_no_masking_background)
-                            test_val = reconstructor->_not_masked_slices[inputIndex](i, j, 0);
-                        else
-                            test_val = reconstructor->_slices[inputIndex](i, j, 0);
+                //the channels share the weights and the confidence of the reconstruction
+                for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
+                    const RealImage& mc_slice_dif = *reconstructor->_mc_slice_dif[inputIndex][nc];
+                    auto mc_residual = [&](int i, int j, double& error, double& weight) {
+                        if (!pixel_weight(i, j, weight))
+                            return false;
+                        error = mc_slice_dif(i, j, 0);
+                        return true;
+                    };
+                    BackProjectSlice(coeffs, ChannelSignal(reconstructor->_mc_reconstructed[nc].Data()), mc_residual, include, mc_addons[nc].Data(), pconfidence_map);
+                }
+            } //end of loop for a slice inputIndex
+        }
 
-                        if (test_val > -0.01) {
-                            if (reconstructor->_simulated_slices[inputIndex](i, j, 0) < 0.01) {
-                                reconstructor->_slice_dif[inputIndex](i, j, 0) = 0;
+        void join(const Superresolution& y) {
+            addon += y.addon;
+            confidence_map += y.confidence_map;
 
-                                if (reconstructor->_multiple_channels_flag) {
-                                    for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                                        reconstructor->_mc_slice_dif[inputIndex][nc]->PutAsDouble(i, j, 0, 0);
-                                    }
-                                }
-                            }
+            if (reconstructor->_multiple_channels_flag) {
+                for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
+                    mc_addons[nc] += y.mc_addons[nc];
+                }
+            }
 
+        }
 
-                            #pragma omp simd
-                            for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                const auto multiplier = reconstructor->_robust_slices_only ? 1 : reconstructor->_weights[inputIndex](i, j, 0);
-                                double ssim_weight = 1;
-                                if (reconstructor->_structural)
-                                    ssim_weight = reconstructor->_slice_ssim_maps[inputIndex](i, j, 0);
+        void operator()() {
+            parallel_reduce(blocked_range<size_t>(0, reconstructor->_slices.size()), *this);
+        }
+    };
 
-                                bool include_flag = true;
-                                if (reconstructor->_ffd) {
-                                    double jac = reconstructor->_mffd_transformations[inputIndex]->Jacobian(p.x, p.y, p.z, 0, 0);
-                                    if ((100*jac) < reconstructor->_global_JAC_threshold)
-                                        include_flag = false;
-                                }
+    //-------------------------------------------------------------------
 
-                                if (include_flag) {
-                                    addon(p.x, p.y, p.z) += ssim_weight * multiplier * p.value * reconstructor->_slice_weight[inputIndex] * reconstructor->_slice_dif[inputIndex](i, j, 0);
+    /// Class for superresolution as a gather over volume voxels using the transposed system matrix
+    class SuperresolutionGather {
+        Reconstruction *reconstructor;
+        RealPixel *paddon;
+        RealPixel *pconfidence_map;
+        Array<RealPixel*> pmc_addons;
 
-                                    confidence_map(p.x, p.y, p.z) += ssim_weight * multiplier * p.value * reconstructor->_slice_weight[inputIndex];
+    public:
+        RealImage confidence_map;
+        RealImage addon;
+        Array<RealImage> mc_addons;
 
-                                    if (reconstructor->_multiple_channels_flag) {
-                                        for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                                            mc_addons[nc](p.x, p.y, p.z) += ssim_weight * multiplier * p.value * reconstructor->_slice_weight[inputIndex] * reconstructor->_mc_slice_dif[inputIndex][nc]->GetAsDouble(i, j, 0);
-                                        }
-                                    }
+        SuperresolutionGather(Reconstruction *reconstructor) : reconstructor(reconstructor) {
+            addon.Initialize(reconstructor->_reconstructed.Attributes());
+            confidence_map.Initialize(reconstructor->_reconstructed.Attributes());
+            paddon = addon.Data();
+            pconfidence_map = confidence_map.Data();
 
-                                }
+            if (reconstructor->_multiple_channels_flag) {
+                mc_addons = Array<RealImage>(reconstructor->_number_of_channels, addon);
+                for (int nc=0; nc<reconstructor->_number_of_channels; nc++)
+                    pmc_addons.push_back(mc_addons[nc].Data());
+            }
+        }
+
+        void operator()(const blocked_range<size_t>& r) const {
+            const VolumeCoeffs& coeffs = reconstructor->_volcoeffs_transposed;
+            Array<double> mc_add(pmc_addons.size());
+
+            for (size_t v = r.begin(); v < r.end(); v++) {
+                if (coeffs.Begin(v) == coeffs.End(v))
+                    continue;
+
+                double add = 0, confidence = 0;
+                fill(mc_add.begin(), mc_add.end(), 0);
+
+                //Gather error from all slice pixels projecting onto the voxel
+                //(coefficients failing the FFD Jacobian threshold are not part of the transposed matrix)
+                for (size_t n = coeffs.Begin(v); n < coeffs.End(v); n++) {
+                    const int inputIndex = coeffs.Slice(n);
+                    const int pixel = coeffs.Pixel(n);
+
+                    const RealImage& slice = reconstructor->_no_masking_background ? reconstructor->_not_masked_slices[inputIndex] : reconstructor->_slices[inputIndex];
+                    if (slice.Data()[pixel] <= -0.01)
+                        continue;
+
+                    const double multiplier = reconstructor->_robust_slices_only ? 1 : reconstructor->_weights[inputIndex].Data()[pixel];
+                    const double ssim_weight = reconstructor->_structural ? reconstructor->_slice_ssim_maps[inputIndex].Data()[pixel] : 1;
+                    const double weight = ssim_weight * multiplier * coeffs.Value(n) * reconstructor->_slice_weight[inputIndex];
+
+                    add += weight * reconstructor->_slice_dif[inputIndex].Data()[pixel];
+                    confidence += weight;
+
+                    for (size_t nc = 0; nc < mc_add.size(); nc++)
+                        mc_add[nc] += weight * reconstructor->_mc_slice_dif[inputIndex][nc]->Data()[pixel];
+                }
 
+                paddon[v] = add;
+                pconfidence_map[v] = confidence;
+                for (size_t nc = 0; nc < mc_add.size(); nc++)
+                    pmc_addons[nc][v] = mc_add[nc];
+            }
+        }
+
+        void operator()() const {
+            parallel_for(blocked_range<size_t>(0, reconstructor->_reconstructed.NumberOfVoxels()), *this);
+        }
+    };
+
+    //-------------------------------------------------------------------
+
+    /// Class for the voxel-wise sum of volumes
+    class SumVolumes {
+        const Array<RealImage>& volumes;
+        RealImage& output;
+
+    public:
+        SumVolumes(const Array<RealImage>& volumes, RealImage& output) : volumes(volumes), output(output) {}
+
+        void operator()(const blocked_range<size_t>& r) const {
+            RealPixel *pout = output.Data();
+            for (size_t i = r.begin(); i < r.end(); i++) {
+                double sum = 0;
+                for (size_t n = 0; n < volumes.size(); n++)
+                    sum += volumes[n].Data()[i];
+                pout[i] = sum;
+            }
+        }
+
+        void operator()() const {
+            parallel_for(blocked_range<size_t>(0, output.NumberOfVoxels()), *this);
+        }
+    };
+
+    //-------------------------------------------------------------------
+
+    /**
+     * @brief Data term of the conjugate-gradient superresolution.
+     * @details Applies the weighted normal operator A^T W A of the slice acquisition model to an image,
+     * or computes the weighted back-projected residual A^T W (y - A x) and the confidence map A^T W 1.
+     * The slice pixels and weights are those of the gradient-descent superresolution, with the set of
+     * pixels fixed by the simulated slices at the start of the solve. The slices are split into one
+     * contiguous chunk per buffer, each chunk is back-projected into its own buffer and the buffers are
+     * summed. The buffers are allocated once per solve and reused by every application of the operator.
+     */
+    class SuperresolutionNormal {
+        Reconstruction *reconstructor;
+        const RealImage& image;
+        bool residual;
+        Array<RealImage>& buffers;
+        Array<RealImage>& confidence_buffers;
+
+    public:
+        /**
+         * @param image image the operator is applied to
+         * @param residual compute the residual and the confidence map instead of applying the operator
+         * @param buffers one volume per chunk of slices
+         * @param confidence_buffers one volume per chunk of slices for the confidence map, only used with residual
+         */
+        SuperresolutionNormal(Reconstruction *reconstructor, const RealImage& image, bool residual, Array<RealImage>& buffers, Array<RealImage>& confidence_buffers) :
+            reconstructor(reconstructor), image(image), residual(residual), buffers(buffers), confidence_buffers(confidence_buffers) {}
+
+        void operator()(const blocked_range<size_t>& r) const {
+            const size_t chunks = buffers.size();
+            const size_t number_of_slices = reconstructor->_slices.size();
+            const RealPixel *pimage = image.Data();
+            SliceCoeffs buffer;
+
+            for (size_t chunk = r.begin(); chunk < r.end(); chunk++) {
+                RealPixel *poutput = buffers[chunk].Data();
+                RealPixel *pconfidence_map = residual ? confidence_buffers[chunk].Data() : nullptr;
+                memset(poutput, 0, sizeof(RealPixel) * buffers[chunk].NumberOfVoxels());
+                if (residual)
+                    memset(pconfidence_map, 0, sizeof(RealPixel) * confidence_buffers[chunk].NumberOfVoxels());
+
+                for (size_t inputIndex = chunk * number_of_slices / chunks; inputIndex < (chunk + 1) * number_of_slices / chunks; inputIndex++) {
+                    const SliceCoeffs& coeffs = reconstructor->GetSliceCoeffs(inputIndex, buffer);
+                    const RealImage& slice = reconstructor->_no_masking_background ? reconstructor->_not_masked_slices[inputIndex] : reconstructor->_slices[inputIndex];
+                    const RealImage& sim_slice = reconstructor->_simulated_slices[inputIndex];
+                    const double slice_weight = reconstructor->_slice_weight[inputIndex];
+                    const Array<bool> *jac_mask = reconstructor->_ffd && !reconstructor->_coeffs_jac_mask.empty() ? &reconstructor->_coeffs_jac_mask[inputIndex] : nullptr;
+
+                    for (int i = 0; i < coeffs.GetX(); i++)
+                        for (int j = 0; j < coeffs.GetY(); j++) {
+                            if (slice(i, j, 0) <= -0.01 || sim_slice(i, j, 0) < 0.01)
+                                continue;
+
+                            const double multiplier = reconstructor->_robust_slices_only ? 1 : reconstructor->_weights[inputIndex](i, j, 0);
+                            const double ssim_weight = reconstructor->_structural ? reconstructor->_slice_ssim_maps[inputIndex](i, j, 0) : 1;
+                            const double weight = ssim_weight * multiplier * slice_weight;
+
+                            //project
+                            double projection = 0;
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
+                                if (!jac_mask || (*jac_mask)[k])
+                                    projection += coeffs.Value(k) * pimage[coeffs.Index(k)];
+
+                            double value = projection;
+                            if (residual)
+                                value = slice(i, j, 0) * exp(-reconstructor->_bias[inputIndex](i, j, 0)) * reconstructor->_scale[inputIndex] - projection;
+
+                            //back-project
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                                if (jac_mask && !(*jac_mask)[k])
+                                    continue;
+                                const int index = coeffs.Index(k);
+                                poutput[index] += weight * coeffs.Value(k) * value;
+                                if (residual)
+                                    pconfidence_map[index] += weight * coeffs.Value(k);
                             }
                         }
-                    }
-            } //end of loop for a slice inputIndex
+                }
+            }
         }
 
-        void join(const Superresolution& y) {
-            addon += y.addon;
-            confidence_map += y.confidence_map;
+        /**
+         * @brief Apply the operator.
+         * @param output result, with the geometry of the reconstruction
+         * @param confidence_map confidence map, only computed with residual
+         */
+        void operator()(RealImage& output, RealImage *confidence_map = nullptr) const {
+            parallel_for(blocked_range<size_t>(0, buffers.size(), 1), *this);
+            SumVolumes(buffers, output)();
+            if (residual && confidence_map)
+                SumVolumes(confidence_buffers, *confidence_map)();
+        }
+    };
 
-            if (reconstructor->_multiple_channels_flag) {
-                for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                    mc_addons[nc] += y.mc_addons[nc];
-                }
+    //-------------------------------------------------------------------
+
+    /**
+     * @brief Regularisation term of the conjugate-gradient superresolution.
+     * @details Symmetric edge-preserving operator L with (L p)(x) = lambda sum_n w(x, n) (p(x) - p(n))
+     * over the 26 neighbours n of the voxels with a positive confidence. The edge weights are those of
+     * the adaptive regularisation, computed on the fly from the image before the SR update and using the
+     * same weight for both directions of a pair, which makes L symmetric.
+     */
+    class SuperresolutionRegularizer {
+        Reconstruction *reconstructor;
+        const RealImage& original;
+        const RealImage& image;
+        RealImage& output;
+        /// Compute the diagonal of L instead of applying it
+        bool diagonal;
+        double factor[13];
+        double sqrt_factor[13];
+        double lambda;
+
+    public:
+        /**
+         * @param original image before the SR update, defines the edge weights
+         * @param image image L is applied to
+         * @param output result, only the voxels with a positive confidence are written
+         * @param diagonal compute the diagonal of L instead of applying it
+         */
+        SuperresolutionRegularizer(Reconstruction *reconstructor, const RealImage& original, const RealImage& image, RealImage& output, bool diagonal) :
+            reconstructor(reconstructor), original(original), image(image), output(output), diagonal(diagonal) {
+            for (int i = 0; i < 13; i++) {
+                factor[i] = 0;
+                for (int j = 0; j < 3; j++)
+                    factor[i] += fabs(double(reconstructor->_directions[i][j]));
+                factor[i] = 1 / factor[i];
+                sqrt_factor[i] = sqrt(factor[i]);
             }
+            lambda = reconstructor->_lambda / (reconstructor->_delta * reconstructor->_delta);
+        }
 
+        void operator()(const blocked_range<size_t>& r) const {
+            const VoxelRuns& runs = reconstructor->_confidence_runs;
+            const int dx = original.GetX(), dy = original.GetY(), dz = original.GetZ();
+            const double delta = reconstructor->_delta;
+            const RealPixel *po = original.Data();
+            const RealPixel *pi = image.Data();
+            const RealPixel *pc = reconstructor->_confidence_map.Data();
+            RealPixel *pout = output.Data();
+
+            for (size_t z = r.begin(); z != r.end(); ++z)
+                for (int y = 0; y < dy; y++)
+                    for (int k = runs.Begin(y, z); k < runs.End(y, z); k++)
+                        for (int x = runs.RunBegin(k); x < runs.RunEnd(k); x++) {
+                            const size_t index = (z * dy + y) * dx + x;
+                            double sum = 0;
+                            for (int i = 0; i < 13; i++)
+                                for (int sign = -1; sign <= 1; sign += 2) {
+                                    const int xx = x + sign * reconstructor->_directions[i][0];
+                                    const int yy = y + sign * reconstructor->_directions[i][1];
+                                    const int zz = z + sign * reconstructor->_directions[i][2];
+                                    if (xx < 0 || xx >= dx || yy < 0 || yy >= dy || zz < 0 || zz >= dz)
+                                        continue;
+                                    const size_t neighbour = (size_t(zz) * dy + yy) * dx + xx;
+                                    if (pc[neighbour] <= 0)
+                                        continue;
+
+                                    const double diff = (po[neighbour] - po[index]) * sqrt_factor[i] / delta;
+                                    const double w = factor[i] / sqrt(1 + diff * diff);
+                                    sum += diagonal ? w : w * (pi[index] - pi[neighbour]);
+                                }
+                            pout[index] = lambda * sum;
+                        }
         }
 
-        void operator()() {
-            parallel_reduce(blocked_range<size_t>(0, reconstructor->_slices.size()), *this);
+        void operator()() const {
+            parallel_for(blocked_range<size_t>(0, reconstructor->_reconstructed.GetZ()), *this);
         }
     };
 
@@ -2441,38 +2632,35 @@ namespace svrtk::Parallel {
         SuperresolutionCardiac4D(SuperresolutionCardiac4D& x, split) : SuperresolutionCardiac4D(x.reconstructor) {}
 
         void operator()(const blocked_range<size_t>& r) {
-            RealImage slice;
+            RealPixel *paddon = addon.Data();
+            RealPixel *pconfidence_map = confidence_map.Data();
 
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
-                if (reconstructor->_volcoeffs[inputIndex].empty())
+                if (reconstructor->_volcoeffs[inputIndex].Empty())
                     continue;
 
-                // read the current slice
-                slice = reconstructor->_slices[inputIndex];
+                const RealImage& slice = reconstructor->_slices[inputIndex];
+                const RealImage& sim_slice = reconstructor->_simulated_slices[inputIndex];
+                const RealImage& bias = reconstructor->_bias[inputIndex];
+                const RealImage& weights = reconstructor->_weights[inputIndex];
+                const double scale = reconstructor->_scale[inputIndex];
+                const double slice_weight = reconstructor->_slice_weight[inputIndex];
+                const TemporalSignal model(reconstructor->_reconstructed4D.Data(), reconstructor->_reconstructed4D.NumberOfSpatialVoxels(),
+                    reconstructor->_slice_temporal_weight, inputIndex);
 
                 //Update reconstructed volume using current slice
                 //Distribute error to the volume
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
-                        if (slice(i, j, 0) != -1) {
-                            //bias correct and scale the slice
-                            slice(i, j, 0) *= exp(-reconstructor->_bias[inputIndex](i, j, 0)) * reconstructor->_scale[inputIndex];
-
-                            if (reconstructor->_simulated_slices[inputIndex](i, j, 0) > 0)
-                                slice(i, j, 0) -= reconstructor->_simulated_slices[inputIndex](i, j, 0);
-                            else
-                                slice(i, j, 0) = 0;
-
-                            #pragma omp simd
-                            for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                for (int outputIndex = 0; outputIndex < reconstructor->_reconstructed4D.GetT(); outputIndex++) {
-                                    const auto multiplier = reconstructor->_robust_slices_only ? 1 : reconstructor->_weights[inputIndex](i, j, 0);
-                                    addon(p.x, p.y, p.z, outputIndex) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * slice(i, j, 0) * multiplier * reconstructor->_slice_weight[inputIndex];
-                                    confidence_map(p.x, p.y, p.z, outputIndex) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * multiplier * reconstructor->_slice_weight[inputIndex];
-                                }
-                            }
-                        }
+                auto residual = [&](int i, int j, double& error, double& weight) {
+                    if (slice(i, j, 0) == -1)
+                        return false;
+                    //bias correct and scale the slice
+                    error = 0;
+                    if (sim_slice(i, j, 0) > 0)
+                        error = slice(i, j, 0) * exp(-bias(i, j, 0)) * scale - sim_slice(i, j, 0);
+                    weight = (reconstructor->_robust_slices_only ? 1 : weights(i, j, 0)) * slice_weight;
+                    return true;
+                };
+                BackProjectSlice(reconstructor->_volcoeffs[inputIndex], model, residual, paddon, pconfidence_map);
             } //end of loop for a slice inputIndex
         }
 
@@ -2505,10 +2693,14 @@ namespace svrtk::Parallel {
         SuperresolutionCardiacVelocity4D(SuperresolutionCardiacVelocity4D& x, split) : SuperresolutionCardiacVelocity4D(x.reconstructor) {}
 
         void operator()(const blocked_range<size_t>& r) {
+            const int nvox = reconstructor->_reconstructed4D.NumberOfSpatialVoxels();
+
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
-                if (reconstructor->_volcoeffs[inputIndex].empty())
+                if (reconstructor->_volcoeffs[inputIndex].Empty())
                     continue;
 
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
+
                 // Read the current slice
                 const RealImage& current_slice = reconstructor->_slices[inputIndex];
 
@@ -2534,20 +2726,24 @@ namespace svrtk::Parallel {
                     // Compute current velocity component factor
                     const double v_component = reconstructor->_slice_g_directions[inputIndex][velocityIndex] / (3 * reconstructor->gamma * gval);
 
+                    RealPixel *paddon = addons[velocityIndex].Data();
+                    RealPixel *pconfidence_map = confidence_maps[velocityIndex].Data();
+
                     // Distribute error to the volume
-                    for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                        for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
+                    for (int i = 0; i < coeffs.GetX(); i++)
+                        for (int j = 0; j < coeffs.GetY(); j++)
                             if (slice(i, j, 0) > -10) {
                                 if (sim(i, j, 0) < -10)
                                     slice(i, j, 0) = 0;
 
-                                for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                    const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                    if (p.value > 0.0) {
+                                for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                                    const int index = coeffs.Index(k);
+                                    const double value = coeffs.Value(k);
+                                    if (value > 0.0) {
                                         for (int outputIndex = 0; outputIndex < reconstructor->_reconstructed4D.GetT(); outputIndex++) {
                                             const auto multiplier = reconstructor->_robust_slices_only ? 1 : reconstructor->_slice_weight[inputIndex];
-                                            addons[velocityIndex](p.x, p.y, p.z, outputIndex) += v_component * reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * slice(i, j, 0) * w(i, j, 0) * multiplier;
-                                            confidence_maps[velocityIndex](p.x, p.y, p.z, outputIndex) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * w(i, j, 0) * multiplier;
+                                            paddon[index + outputIndex * nvox] += v_component * reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * value * slice(i, j, 0) * w(i, j, 0) * multiplier;
+                                            pconfidence_map[index + outputIndex * nvox] += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * value * w(i, j, 0) * multiplier;
                                         }
                                     }
                                 }
@@ -2752,350 +2948,267 @@ namespace svrtk::Parallel {
 
     //-------------------------------------------------------------------
 
-    /// Class for adaptive regularisation (Part I)
-    class AdaptiveRegularization1 {
-        const Reconstruction *reconstructor;
-        Array<RealImage>& b;
-        const Array<double>& factor;
-        const RealImage& original;
-
-    public:
-        AdaptiveRegularization1(
-            const Reconstruction *reconstructor,
-            Array<RealImage>& b,
-            const Array<double>& factor,
-            const RealImage& original) :
-            reconstructor(reconstructor),
-            b(b),
-            factor(factor),
-            original(original) {}
-
-        void operator()(const blocked_range<size_t>& r) const {
-            const int dx = reconstructor->_reconstructed.GetX();
-            const int dy = reconstructor->_reconstructed.GetY();
-            const int dz = reconstructor->_reconstructed.GetZ();
-            for (size_t i = r.begin(); i != r.end(); i++) {
-                for (int x = 0; x < dx; x++)
-                    for (int y = 0; y < dy; y++)
-                        for (int z = 0; z < dz; z++) {
-                            const int xx = x + reconstructor->_directions[i][0];
-                            const int yy = y + reconstructor->_directions[i][1];
-                            const int zz = z + reconstructor->_directions[i][2];
-                            if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                && (reconstructor->_confidence_map(x, y, z) > 0) && (reconstructor->_confidence_map(xx, yy, zz) > 0)) {
-                                const double diff = (original(xx, yy, zz) - original(x, y, z)) * sqrt(factor[i]) / reconstructor->_delta;
-                                b[i](x, y, z) = factor[i] / sqrt(1 + diff * diff);
-                            } else
-                                b[i](x, y, z) = 0;
-                        }
+    /**
+     * @brief Edge-preserving smoothing step of the adaptive regularisation.
+     * @details The edge weights towards the 13 neighbour directions are computed on the fly from the
+     * image before the SR update, instead of being stored in 13 images of the size of the volume.
+     * They are rounded to RealPixel as the stored weights were, so the result is unchanged.
+     * Rows are split into the interior, where all 26 neighbours exist and a branch-free unit-stride
+     * kernel over precomputed linear offsets and a byte mask of the confidence map is vectorised,
+     * and the boundary shell, which keeps the bounds-checked per-voxel path.
+     */
+    class EdgePreservingSmoothing {
+        const int (*directions)[3];
+        double factor[13];
+        double sqrt_factor[13];
+        double delta;
+        double coefficient;
+        /// Image dimensions
+        int dx, dy, dz;
+        /// Linear offset of each neighbour direction
+        int offset[13];
+        /// Whether the confidence of a voxel is positive, shared by the copies made by the TBB loops
+        shared_ptr<const Array<uint8_t>> mask;
+
+        /// Regularised value of a voxel with a positive confidence, checking the bounds of each neighbour
+        inline double Voxel(const RealPixel *original, const RealPixel *current, const uint8_t *pmask, int x, int y, int z) const {
+            const size_t index = (size_t(z) * dy + y) * dx + x;
+            const RealPixel value = original[index];
+
+            RealPixel b[13];
+            for (int i = 0; i < 13; i++) {
+                const int xx = x + directions[i][0];
+                const int yy = y + directions[i][1];
+                const int zz = z + directions[i][2];
+                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
+                    && pmask[index + offset[i]]) {
+                    const double diff = (original[index + offset[i]] - value) * sqrt_factor[i] / delta;
+                    b[i] = factor[i] / sqrt(1 + diff * diff);
+                } else
+                    b[i] = 0;
             }
-        }
-
-        void operator()() const {
-            parallel_for(blocked_range<size_t>(0, 13), *this);
-        }
-    };
 
+            double val = 0;
+            double sum = 0;
 
-    //-------------------------------------------------------------------
+            // Don't combine the loops, it breaks the compiler optimisation (GCC 9)
+            for (int i = 0; i < 13; i++)
+                if (b[i] > 0) {
+                    val += b[i] * current[index + offset[i]];
+                    sum += b[i];
+                }
 
+            for (int i = 0; i < 13; i++) {
+                const int xx = x - directions[i][0];
+                const int yy = y - directions[i][1];
+                const int zz = z - directions[i][2];
+                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
+                    && pmask[index - offset[i]]) {
+                    val += b[i] * current[index - offset[i]];
+                    sum += b[i];
+                }
+            }
 
-    class AdaptiveRegularization1MC {
-        const Reconstruction *reconstructor;
-        Array<Array<RealImage>> &b;
-        const Array<double> &factor;
-        const Array<RealImage> &original;
+            val -= sum * current[index];
+            return current[index] + coefficient * val;
+        }
 
     public:
-        AdaptiveRegularization1MC(const Reconstruction *_reconstructor,
-                                  Array<Array<RealImage>> &_b,
-                                  const Array<double> &_factor,
-                                  const Array<RealImage> &_original) :
-        reconstructor(_reconstructor),
-        b(_b),
-        factor(_factor),
-        original(_original) { }
+        /**
+         * @brief Prepare the smoothing of images with the geometry of the given confidence map.
+         * @param directions neighbour directions, each component must be -1, 0 or 1
+         * @param confidence_map voxels with zero confidence are neither smoothed nor used as neighbours
+         */
+        EdgePreservingSmoothing(const int directions[13][3], const RealImage& confidence_map, double alpha, double lambda, double delta) :
+            directions(directions),
+            delta(delta),
+            dx(confidence_map.GetX()),
+            dy(confidence_map.GetY()),
+            dz(confidence_map.GetZ()) {
+            for (int i = 0; i < 13; i++) {
+                factor[i] = 0;
+                for (int j = 0; j < 3; j++)
+                    factor[i] += fabs(double(directions[i][j]));
+                factor[i] = 1 / factor[i];
+                sqrt_factor[i] = sqrt(factor[i]);
+                offset[i] = (directions[i][2] * dy + directions[i][1]) * dx + directions[i][0];
+            }
+            coefficient = alpha * lambda / (delta * delta);
+
+            shared_ptr<Array<uint8_t>> confidence_mask = make_shared<Array<uint8_t>>(confidence_map.NumberOfVoxels());
+            const RealPixel *pconfidence = confidence_map.Data();
+            for (size_t i = 0; i < confidence_mask->size(); i++)
+                (*confidence_mask)[i] = pconfidence[i] > 0;
+            mask = move(confidence_mask);
+        }
+
+        /**
+         * @brief Regularise the voxels x in [x0, x1) of row (y, z, t) that have a positive confidence.
+         * @param original image before the SR update, defines the edge weights
+         * @param current image being regularised
+         * @param output image receiving the regularised values, must not be current
+         */
+        void operator()(const RealImage& original, const RealImage& current, RealImage& output, int y, int z, int t, int x0, int x1) const {
+            const size_t volume = size_t(dx) * dy * dz;
+            const size_t row = (size_t(z) * dy + y) * dx;
+            const RealPixel *po = original.Data() + t * volume;
+            const RealPixel *pc = current.Data() + t * volume;
+            RealPixel *pout = output.Data() + t * volume + row;
+            const uint8_t *pm = mask->data() + t * volume;
+
+            if (y == 0 || y == dy - 1 || z == 0 || z == dz - 1 || dx < 3) {
+                for (int x = x0; x < x1; x++)
+                    if (pm[row + x])
+                        pout[x] = Voxel(po, pc, pm, x, y, z);
+                return;
+            }
 
-        void operator() (const blocked_range<size_t> &r) const {
-            const int dx = reconstructor->_reconstructed.GetX();
-            const int dy = reconstructor->_reconstructed.GetY();
-            const int dz = reconstructor->_reconstructed.GetZ();
-            for ( size_t i = r.begin(); i != r.end(); ++i ) {
+            if (x0 == 0 && pm[row])
+                pout[0] = Voxel(po, pc, pm, 0, y, z);
+            if (x1 == dx && pm[row + dx - 1])
+                pout[dx - 1] = Voxel(po, pc, pm, dx - 1, y, z);
+
+            // all neighbours of the interior voxels exist, out-of-mask neighbours get zero weight
+            po += row;
+            pc += row;
+            pm += row;
+            const int begin = max(x0, 1);
+            const int end = min(x1, dx - 1);
+            #pragma omp simd
+            for (int x = begin; x < end; x++) {
+                const RealPixel value = po[x];
+
+                RealPixel b[13];
+                for (int i = 0; i < 13; i++) {
+                    const double diff = (po[x + offset[i]] - value) * sqrt_factor[i] / delta;
+                    b[i] = pm[x + offset[i]] ? RealPixel(factor[i] / sqrt(1 + diff * diff)) : RealPixel(0);
+                }
 
-                for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
+                double val = 0;
+                double sum = 0;
 
-                    int x, y, z, xx, yy, zz;
-//                    double diff;
-                    for (x = 0; x < dx; x++)
-                    for (y = 0; y < dy; y++)
-                    for (z = 0; z < dz; z++) {
-                        xx = x + reconstructor->_directions[i][0];
-                        yy = y + reconstructor->_directions[i][1];
-                        zz = z + reconstructor->_directions[i][2];
-                        if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                            && (reconstructor->_confidence_map(x, y, z) > 0) && (reconstructor->_confidence_map(xx, yy, zz) > 0)) {
-                            const double diff = (original[nc](xx, yy, zz) - original[nc](x, y, z)) * sqrt(factor[i]) / reconstructor->_delta;
-                            b[i][nc](x, y, z) = factor[i] / sqrt(1 + diff * diff);
-                        }
-                        else {
-                            b[i][nc](x, y, z) = 0;
-                        }
-                    }
+                for (int i = 0; i < 13; i++) {
+                    val += b[i] * pc[x + offset[i]];
+                    sum += b[i];
+                }
 
+                for (int i = 0; i < 13; i++) {
+                    const RealPixel w = pm[x - offset[i]] ? b[i] : RealPixel(0);
+                    val += w * pc[x - offset[i]];
+                    sum += w;
                 }
+
+                val -= sum * pc[x];
+                const RealPixel result = pc[x] + coefficient * val;
+                pout[x] = pm[x] ? result : pout[x];
             }
         }
 
-        void operator() () const {
-            parallel_for( blocked_range<size_t>(0, 13), *this );
+        /// Regularise the voxels of row (y, z, t) that have a positive confidence
+        inline void operator()(const RealImage& original, const RealImage& current, RealImage& output, int y, int z, int t = 0) const {
+            (*this)(original, current, output, y, z, t, 0, dx);
         }
 
+        /// Regularise the active voxels of row (y, z) of a 3D image
+        inline void operator()(const RealImage& original, const RealImage& current, RealImage& output, const VoxelRuns& runs, int y, int z) const {
+            for (int k = runs.Begin(y, z); k < runs.End(y, z); k++)
+                (*this)(original, current, output, y, z, 0, runs.RunBegin(k), runs.RunEnd(k));
+        }
     };
 
-
     //-------------------------------------------------------------------
 
-    /// Class for adaptive regularisation (Part II)
-    class AdaptiveRegularization2 {
+    /// Class for adaptive regularisation
+    class AdaptiveRegularization {
         Reconstruction *reconstructor;
-        const Array<RealImage>& b;
+        const EdgePreservingSmoothing smoothing;
         const RealImage& original;
+        const RealImage& original2;
 
     public:
-        AdaptiveRegularization2(
+        AdaptiveRegularization(
             Reconstruction *reconstructor,
-            const Array<RealImage>& b,
-            const RealImage& original) :
+            const RealImage& original,
+            const RealImage& original2) :
             reconstructor(reconstructor),
-            b(b),
-            original(original) {}
+            smoothing(reconstructor->_directions, reconstructor->_confidence_map, reconstructor->_alpha, reconstructor->_lambda, reconstructor->_delta),
+            original(original),
+            original2(original2) {}
 
         void operator()(const blocked_range<size_t>& r) const {
-            const int dx = reconstructor->_reconstructed.GetX();
             const int dy = reconstructor->_reconstructed.GetY();
-            const int dz = reconstructor->_reconstructed.GetZ();
-            for (size_t x = r.begin(); x != r.end(); ++x) {
+            for (size_t z = r.begin(); z != r.end(); ++z)
                 for (int y = 0; y < dy; y++)
-                    for (int z = 0; z < dz; z++)
-                        if (reconstructor->_confidence_map(x, y, z) > 0) {
-                            double val = 0;
-                            double sum = 0;
-
-                            // Don't combine the loops, it breaks the compiler optimisation (GCC 9)
-                            for (int i = 0; i < 13; i++) {
-                                const int xx = x + reconstructor->_directions[i][0];
-                                const int yy = y + reconstructor->_directions[i][1];
-                                const int zz = z + reconstructor->_directions[i][2];
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                    && reconstructor->_confidence_map(xx, yy, zz) > 0) {
-                                    val += b[i](x, y, z) * original(xx, yy, zz);
-                                    sum += b[i](x, y, z);
-                                }
-                            }
-
-                            for (int i = 0; i < 13; i++) {
-                                const int xx = x - reconstructor->_directions[i][0];
-                                const int yy = y - reconstructor->_directions[i][1];
-                                const int zz = z - reconstructor->_directions[i][2];
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                    && reconstructor->_confidence_map(xx, yy, zz) > 0) {
-                                    val += b[i](x, y, z) * original(xx, yy, zz);
-                                    sum += b[i](x, y, z);
-                                }
-                            }
-
-                            val -= sum * original(x, y, z);
-                            val = original(x, y, z) + reconstructor->_alpha * reconstructor->_lambda / (reconstructor->_delta * reconstructor->_delta) * val;
-                            reconstructor->_reconstructed(x, y, z) = val;
-                        }
-            }
+                    smoothing(original, original2, reconstructor->_reconstructed, reconstructor->_confidence_runs, y, z);
         }
 
         void operator()() const {
-            parallel_for(blocked_range<size_t>(0, reconstructor->_reconstructed.GetX()), *this);
+            parallel_for(blocked_range<size_t>(0, reconstructor->_reconstructed.GetZ()), *this);
         }
     };
 
     //-------------------------------------------------------------------
 
-
-    class AdaptiveRegularization2MC {
+    /// Class for adaptive regularisation of multiple channels
+    class AdaptiveRegularizationMC {
         Reconstruction *reconstructor;
-        Array<Array<RealImage>> &b;
-        Array<double> &factor;
-        Array<RealImage> &original;
-
-        public:
-        AdaptiveRegularization2MC( Reconstruction *_reconstructor,
-                                           Array<Array<RealImage>> &_b,
-                                           Array<double> &_factor,
-                                           Array<RealImage> &_original) :
-        reconstructor(_reconstructor),
-        b(_b),
-        factor(_factor),
-        original(_original) { }
-
-        void operator() (const blocked_range<size_t> &r) const {
-            int dx = reconstructor->_reconstructed.GetX();
-            int dy = reconstructor->_reconstructed.GetY();
-            int dz = reconstructor->_reconstructed.GetZ();
-            for ( size_t x = r.begin(); x != r.end(); ++x ) {
-                int xx, yy, zz;
-                for (int y = 0; y < dy; y++)
-                for (int z = 0; z < dz; z++)
-                if(reconstructor->_confidence_map(x,y,z)>0)
-                {
-                    for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                        double val = 0;
-                        double sum = 0;
-
-                        for (int i = 0; i < 13; i++) {
-                            xx = x + reconstructor->_directions[i][0];
-                            yy = y + reconstructor->_directions[i][1];
-                            zz = z + reconstructor->_directions[i][2];
-                            if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz))
-                            if(reconstructor->_confidence_map(xx,yy,zz)>0)
-                            {
-                                val += b[i][nc](x, y, z) * original[nc](xx, yy, zz);
-                                sum += b[i][nc](x, y, z);
-                            }
-                        }
-
-                        for (int i = 0; i < 13; i++) {
-                            xx = x - reconstructor->_directions[i][0];
-                            yy = y - reconstructor->_directions[i][1];
-                            zz = z - reconstructor->_directions[i][2];
-                            if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz))
-                            if(reconstructor->_confidence_map(xx,yy,zz)>0)
-                            {
-                                val += b[i][nc](x, y, z) * original[nc](xx, yy, zz);
-                                sum += b[i][nc](x, y, z);
-                            }
-                        }
-                        val -= sum * original[nc](x, y, z);
-                        val = original[nc](x, y, z) + reconstructor->_alpha * reconstructor->_lambda / (reconstructor->_delta * reconstructor->_delta) * val;
-                        reconstructor->_mc_reconstructed[nc](x, y, z) = val;
-                    }
-                }
-
-            }
-        }
-
-        void operator() () const {
-            parallel_for( blocked_range<size_t>(0, reconstructor->_reconstructed.GetX()), *this );
-        }
-
-    };
-
-
-    //-------------------------------------------------------------------
-
-    class AdaptiveRegularization1Cardiac4D {
-        const ReconstructionCardiac4D *reconstructor;
-        Array<RealImage>& b;
-        const Array<double>& factor;
-        const RealImage& original;
+        const EdgePreservingSmoothing smoothing;
+        const Array<RealImage>& original;
+        const Array<RealImage>& original2;
 
     public:
-        AdaptiveRegularization1Cardiac4D(
-            const ReconstructionCardiac4D *reconstructor,
-            Array<RealImage>& b,
-            const Array<double>& factor,
-            const RealImage& original) :
+        AdaptiveRegularizationMC(
+            Reconstruction *reconstructor,
+            const Array<RealImage>& original,
+            const Array<RealImage>& original2) :
             reconstructor(reconstructor),
-            b(b),
-            factor(factor),
-            original(original) {}
+            smoothing(reconstructor->_directions, reconstructor->_confidence_map, reconstructor->_alpha, reconstructor->_lambda, reconstructor->_delta),
+            original(original),
+            original2(original2) {}
 
         void operator()(const blocked_range<size_t>& r) const {
-            const int dx = reconstructor->_reconstructed4D.GetX();
-            const int dy = reconstructor->_reconstructed4D.GetY();
-            const int dz = reconstructor->_reconstructed4D.GetZ();
-            const int dt = reconstructor->_reconstructed4D.GetT();
-            for (size_t i = r.begin(); i != r.end(); i++) {
-                for (int x = 0; x < dx; x++)
-                    for (int y = 0; y < dy; y++)
-                        for (int z = 0; z < dz; z++) {
-                            const int xx = x + reconstructor->_directions[i][0];
-                            const int yy = y + reconstructor->_directions[i][1];
-                            const int zz = z + reconstructor->_directions[i][2];
-                            for (int t = 0; t < dt; t++) {
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                    && (reconstructor->_confidence_map(x, y, z, t) > 0) && (reconstructor->_confidence_map(xx, yy, zz, t) > 0)) {
-                                    const double diff = (original(xx, yy, zz, t) - original(x, y, z, t)) * sqrt(factor[i]) / reconstructor->_delta;
-                                    b[i](x, y, z, t) = factor[i] / sqrt(1 + diff * diff);
-                                } else
-                                    b[i](x, y, z, t) = 0;
-                            }
-                        }
-            }
+            const int dy = reconstructor->_reconstructed.GetY();
+            for (size_t z = r.begin(); z != r.end(); ++z)
+                for (int y = 0; y < dy; y++)
+                    for (int nc = 0; nc < reconstructor->_number_of_channels; nc++)
+                        smoothing(original[nc], original2[nc], reconstructor->_mc_reconstructed[nc], reconstructor->_confidence_runs, y, z);
         }
 
         void operator()() const {
-            parallel_for(blocked_range<size_t>(0, 13), *this);
+            parallel_for(blocked_range<size_t>(0, reconstructor->_reconstructed.GetZ()), *this);
         }
     };
 
     //-------------------------------------------------------------------
 
-    class AdaptiveRegularization2Cardiac4D {
+    /// Class for adaptive regularisation of the 4D cardiac reconstruction
+    class AdaptiveRegularizationCardiac4D {
         ReconstructionCardiac4D *reconstructor;
-        const Array<RealImage>& b;
+        const EdgePreservingSmoothing smoothing;
         const RealImage& original;
+        const RealImage& original2;
 
     public:
-        AdaptiveRegularization2Cardiac4D(
+        AdaptiveRegularizationCardiac4D(
             ReconstructionCardiac4D *reconstructor,
-            const Array<RealImage>& b,
-            const RealImage& original) :
+            const RealImage& original,
+            const RealImage& original2) :
             reconstructor(reconstructor),
-            b(b),
-            original(original) {}
+            smoothing(reconstructor->_directions, reconstructor->_confidence_map, reconstructor->_alpha, reconstructor->_lambda, reconstructor->_delta),
+            original(original),
+            original2(original2) {}
 
         void operator()(const blocked_range<size_t>& r) const {
-            const int dx = reconstructor->_reconstructed4D.GetX();
             const int dy = reconstructor->_reconstructed4D.GetY();
-            const int dz = reconstructor->_reconstructed4D.GetZ();
             const int dt = reconstructor->_reconstructed4D.GetT();
-            for (size_t x = r.begin(); x != r.end(); ++x) {
-                for (int y = 0; y < dy; y++)
-                    for (int z = 0; z < dz; z++)
-                        for (int t = 0; t < dt; t++) {
-                            if (reconstructor->_confidence_map(x, y, z, t) > 0) {
-                                double val = 0;
-                                double sum = 0;
-                                for (int i = 0; i < 13; i++) {
-                                    const int xx = x + reconstructor->_directions[i][0];
-                                    const int yy = y + reconstructor->_directions[i][1];
-                                    const int zz = z + reconstructor->_directions[i][2];
-                                    if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                        && (reconstructor->_confidence_map(xx, yy, zz, t) > 0)) {
-                                        val += b[i](x, y, z, t) * original(xx, yy, zz, t);
-                                        sum += b[i](x, y, z, t);
-                                    }
-                                }
-
-                                for (int i = 0; i < 13; i++) {
-                                    const int xx = x - reconstructor->_directions[i][0];
-                                    const int yy = y - reconstructor->_directions[i][1];
-                                    const int zz = z - reconstructor->_directions[i][2];
-                                    if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                        && (reconstructor->_confidence_map(xx, yy, zz, t) > 0)) {
-                                            val += b[i](x, y, z, t) * original(xx, yy, zz, t);
-                                            sum += b[i](x, y, z, t);
-                                        }
-                                }
-
-                                val -= sum * original(x, y, z, t);
-                                val = original(x, y, z, t) + reconstructor->_alpha * reconstructor->_lambda / (reconstructor->_delta * reconstructor->_delta) * val;
-                                reconstructor->_reconstructed4D(x, y, z, t) = val;
-                            }
-                        }
-            }
+            for (size_t z = r.begin(); z != r.end(); ++z)
+                for (int t = 0; t < dt; t++)
+                    for (int y = 0; y < dy; y++)
+                        smoothing(original, original2, reconstructor->_reconstructed4D, y, z, t);
         }
 
         void operator()() const {
-            parallel_for(blocked_range<size_t>(0, reconstructor->_reconstructed4D.GetX()), *this);
+            parallel_for(blocked_range<size_t>(0, reconstructor->_reconstructed4D.GetZ()), *this);
         }
     };
 
@@ -3116,9 +3229,10 @@ namespace svrtk::Parallel {
 
         void operator()(const blocked_range<size_t>& r) {
             RealImage b;
+            SliceCoeffs buffer;
 
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
-                if (reconstructor->_volcoeffs[inputIndex].empty())
+                if (!reconstructor->_matrix_free && reconstructor->_volcoeffs[inputIndex].Empty())
                     continue;
 
                 if (reconstructor->_verbose)
@@ -3140,14 +3254,14 @@ namespace svrtk::Parallel {
                         pb[i] -= log(scale);
 
                 //Distribute slice intensities to the volume
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
+                const SliceCoeffs& coeffs = reconstructor->GetSliceCoeffs(inputIndex, buffer);
+                RealPixel *pbias = bias.Data();
+                for (int i = 0; i < coeffs.GetX(); i++)
+                    for (int j = 0; j < coeffs.GetY(); j++)
                         if (slice(i, j, 0) > -0.01) {
                             //add contribution of current slice voxel to all voxel volumes to which it contributes
-                            for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                bias(p.x, p.y, p.z) += p.value * b(i, j, 0);
-                            }
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
+                                pbias[coeffs.Index(k)] += coeffs.Value(k) * b(i, j, 0);
                         }
                 //end of loop for a slice inputIndex
             }
@@ -3183,7 +3297,7 @@ namespace svrtk::Parallel {
         void operator()(const blocked_range<size_t>& r) {
             RealImage b;
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
-                if (reconstructor->_volcoeffs[inputIndex].empty())
+                if (reconstructor->_volcoeffs[inputIndex].Empty())
                     continue;
 
                 if (reconstructor->_verbose)
@@ -3205,15 +3319,18 @@ namespace svrtk::Parallel {
                         pb[i] -= log(scale);
 
                 //Distribute slice intensities to the volume
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
+                RealPixel *pbias = bias.Data();
+                RealPixel *pvolweight3d = volweight3d.Data();
+                for (int i = 0; i < coeffs.GetX(); i++)
+                    for (int j = 0; j < coeffs.GetY(); j++)
                         if (slice(i, j, 0) != -1) {
                             //add contribution of current slice voxel to all voxel volumes
                             //to which it contributes
-                            for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                bias(p.x, p.y, p.z) += p.value * b(i, j, 0);
-                                volweight3d(p.x, p.y, p.z) += p.value;
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                                const int index = coeffs.Index(k);
+                                pbias[index] += coeffs.Value(k) * b(i, j, 0);
+                                pvolweight3d[index] += coeffs.Value(k);
                             }
                         }
                 //end of loop for a slice inputIndex
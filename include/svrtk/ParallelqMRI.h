@@ -19,6 +19,7 @@
 #pragma once
 
 // SVRTK
+#include "svrtk/Parallel.h"
 #include "svrtk/ReconstructionqMRI.h"
 
 using namespace mirtk;
@@ -48,26 +49,18 @@ namespace svrtk::ParallelqMRI {
                 memset(sim_inside.Data(), 0, sizeof(RealPixel) * sim_inside.NumberOfVoxels());
                 reconstructor->_slice_inside[inputIndex] = false;
 
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
-                        if (reconstructor->_slicesqMRI[inputIndex](i, j, 0) > -0.01) {
-                            double weight = 0;
-                            for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                int indstack =  reconstructor->_stack_index[inputIndex];
-                                int outputIndex =  reconstructor->_volume_index[indstack];
-                                const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                sim_slice(i, j, 0) += p.value * reconstructor->_reconstructed4D(p.x, p.y, p.z,outputIndex);
-                                weight += p.value;
-                                if (reconstructor->_mask(p.x, p.y, p.z) > 0.1) {
-                                    sim_inside(i, j, 0) = 1;
-                                    reconstructor->_slice_inside[inputIndex] = true;
-                                }
-                            }
-                            if (weight > 0) {
-                                sim_slice(i, j, 0) /= weight;
-                                sim_weight(i, j, 0) = weight;
-                            }
-                        };
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
+                const int indstack = reconstructor->_stack_index[inputIndex];
+                const int outputIndex = reconstructor->_volume_index[indstack];
+                //the slice samples the echo volume of its stack
+                const ScalarSignal model(reconstructor->_reconstructed4D.Data() + outputIndex * reconstructor->_reconstructed4D.NumberOfSpatialVoxels());
+                const RealImage& slice = reconstructor->_slicesqMRI[inputIndex];
+                const RealPixel *pmask = reconstructor->_mask.Data();
+
+                auto sample = [&](int i, int j) { return slice(i, j, 0) > -0.01; };
+                auto inside = [&](int index) { return pmask[index] > 0.1; };
+                if (SimulateSlice(coeffs, model, sample, inside, sim_slice, sim_weight, sim_inside))
+                    reconstructor->_slice_inside[inputIndex] = true;
             } //end of loop for a slice inputIndex
         }
 
@@ -105,16 +98,17 @@ namespace svrtk::ParallelqMRI {
                 memset(weight.Data(), 0, sizeof(RealPixel) * weight.NumberOfVoxels());
 
                 double num = 0;
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
                 //Calculate error, voxel weights, and slice potential
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
+                for (int i = 0; i < coeffs.GetX(); i++)
+                    for (int j = 0; j < coeffs.GetY(); j++)
                         if (slice(i, j, 0) > -0.01) {
                             //bias correct and scale the slice
                             slice(i, j, 0) *= exp(-reconstructor->_biasqMRI[inputIndex](i, j, 0)) * reconstructor->_scaleqMRI[inputIndex];
 
                             //number of volumetric voxels to which
                             // current slice voxel contributes
-                            const size_t n = reconstructor->_volcoeffs[inputIndex][i][j].size();
+                            const int n = coeffs.Size(i, j);
 
                             // if n == 0, slice voxel has no overlap with volumetric ROI, do not process it
 
@@ -341,25 +335,31 @@ namespace svrtk::ParallelqMRI {
         void operator()(const blocked_range<size_t>& r) {
             //Update reconstructed volume using current slice
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
+                const int indstack = reconstructor->_stack_index[inputIndex];
+                const int outputIndex = reconstructor->_volume_index[indstack];
+                const int offset = outputIndex * addon.NumberOfSpatialVoxels();
+                RealPixel *paddon = addon.Data() + offset;
+                RealPixel *pconfidence_map = confidence_map.Data() + offset;
+                const ScalarSignal model(reconstructor->_reconstructed4D.Data() + offset);
+
+                const RealImage& slice = reconstructor->_slicesqMRI[inputIndex];
+                const RealImage& sim_slice = reconstructor->_simulated_slicesqMRI[inputIndex];
+                RealImage& slice_dif = reconstructor->_slice_difqMRI[inputIndex];
+                const RealImage& weights = reconstructor->_weightsqMRI[inputIndex];
+                const double slice_weight = reconstructor->_slice_weightqMRI[inputIndex];
+
                 //Distribute error to the volume
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
-                        if (reconstructor->_slicesqMRI[inputIndex](i, j, 0) > -0.01) {
-                            if (reconstructor->_simulated_slicesqMRI[inputIndex](i, j, 0) < 0.01)
-                                reconstructor->_slice_difqMRI[inputIndex](i, j, 0) = 0;
-                            #pragma omp simd
-                            for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                const auto multiplier = reconstructor->_robust_slices_only ? 1 : reconstructor->_weightsqMRI[inputIndex](i, j, 0);
-                                double ssim_weight = 1;
-
-                                int indstack = reconstructor->_stack_index[inputIndex];
-                                int outputIndex = reconstructor->_volume_index[indstack];
-
-                                addon(p.x, p.y, p.z,outputIndex) += ssim_weight * multiplier * p.value * reconstructor->_slice_weightqMRI[inputIndex] * reconstructor->_slice_difqMRI[inputIndex](i, j, 0);
-                                confidence_map(p.x, p.y, p.z,outputIndex) += ssim_weight * multiplier * p.value * reconstructor->_slice_weightqMRI[inputIndex];
-                            }
-                        }
+                auto residual = [&](int i, int j, double& error, double& weight) {
+                    if (slice(i, j, 0) <= -0.01)
+                        return false;
+                    if (sim_slice(i, j, 0) < 0.01)
+                        slice_dif(i, j, 0) = 0;
+                    error = slice_dif(i, j, 0);
+                    weight = (reconstructor->_robust_slices_only ? 1 : weights(i, j, 0)) * slice_weight;
+                    return true;
+                };
+                BackProjectSlice(coeffs, model, residual, paddon, pconfidence_map);
             } //end of loop for a slice inputIndex
         }
 
@@ -741,119 +741,30 @@ namespace svrtk::ParallelqMRI {
 
     //-------------------------------------------------------------------
 
-    /// Class for adaptive regularisation (Part I)
-    class AdaptiveRegularization1qMRI {
-        const ReconstructionqMRI *reconstructor;
-        Array<RealImage>& b;
-        const Array<double>& factor;
-        const RealImage& original;
-
-    public:
-        AdaptiveRegularization1qMRI(
-                const ReconstructionqMRI *reconstructor,
-                Array<RealImage>& b,
-                const Array<double>& factor,
-                const RealImage& original) :
-                reconstructor(reconstructor),
-                b(b),
-                factor(factor),
-                original(original) {}
-
-        void operator()(const blocked_range<size_t>& r) const {
-            const int dx = reconstructor->_reconstructed4D.GetX();
-            const int dy = reconstructor->_reconstructed4D.GetY();
-            const int dz = reconstructor->_reconstructed4D.GetZ();
-            const int dt = reconstructor->_reconstructed4D.GetT();
-            for (size_t i = r.begin(); i != r.end(); i++) {
-                for (int t = 0; t < dt; t++) {
-                    for (int z = 0; z < dz; z++) {
-                        for (int y = 0; y < dy; y++) {
-                            for (int x = 0; x < dx; x++) {
-
-                                const int xx = x + reconstructor->_directions[i][0];
-                                const int yy = y + reconstructor->_directions[i][1];
-                                const int zz = z + reconstructor->_directions[i][2];
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                    && (reconstructor->_confidence_map4D(x, y, z, t) > 0) &&
-                                    (reconstructor->_confidence_map4D(xx, yy, zz, t) > 0)) {
-                                    const double diff =
-                                            (original(xx, yy, zz, t) - original(x, y, z, t)) * sqrt(factor[i]) /
-                                            reconstructor->_delta;
-                                    b[i](x, y, z, t) = factor[i] / sqrt(1 + diff * diff);
-                                } else
-                                    b[i](x, y, z, t) = 0;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-
-        void operator()() const {
-            parallel_for(blocked_range<size_t>(0, 13), *this);
-        }
-    };
-
-    //-------------------------------------------------------------------
-
-    /// Class for adaptive regularisation (Part II)
-    class AdaptiveRegularization2qMRI {
+    /// Class for adaptive regularisation
+    class AdaptiveRegularizationqMRI {
         ReconstructionqMRI *reconstructor;
-        const Array<RealImage>& b;
+        const Parallel::EdgePreservingSmoothing smoothing;
         const RealImage& original;
+        const RealImage& original2;
 
     public:
-        AdaptiveRegularization2qMRI(
+        AdaptiveRegularizationqMRI(
                 ReconstructionqMRI *reconstructor,
-                const Array<RealImage>& b,
-                const RealImage& original) :
+                const RealImage& original,
+                const RealImage& original2) :
                 reconstructor(reconstructor),
-                b(b),
-                original(original) {}
+                smoothing(reconstructor->_directions, reconstructor->_confidence_map4D, reconstructor->_alpha, reconstructor->_lambda, reconstructor->_delta),
+                original(original),
+                original2(original2) {}
 
         void operator()(const blocked_range<size_t>& r) const {
-            const int dx = reconstructor->_reconstructed4D.GetX();
             const int dy = reconstructor->_reconstructed4D.GetY();
-            const int dz = reconstructor->_reconstructed4D.GetZ();
             const int dt = reconstructor->_reconstructed4D.GetT();
             for (size_t z = r.begin(); z != r.end(); ++z) {
                 for (int t = 0; t < dt; t++) {
-                    for (int y = 0; y < dy; y++) {
-                        for (int x = 0; x < dx; x++) {
-                            if (reconstructor->_confidence_map4D(x, y, z, t) > 0) {
-                                double val = 0;
-                                double sum = 0;
-
-                                // Don't combine the loops, it breaks the compiler optimisation (GCC 9)
-                                for (int i = 0; i < 13; i++) {
-                                    const int xx = x + reconstructor->_directions[i][0];
-                                    const int yy = y + reconstructor->_directions[i][1];
-                                    const int zz = z + reconstructor->_directions[i][2];
-                                    if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                        && reconstructor->_confidence_map4D(xx, yy, zz, t) > 0) {
-                                        val += b[i](x, y, z, t) * original(xx, yy, zz, t);
-                                        sum += b[i](x, y, z, t);
-                                    }
-                                }
-
-                                for (int i = 0; i < 13; i++) {
-                                    const int xx = x - reconstructor->_directions[i][0];
-                                    const int yy = y - reconstructor->_directions[i][1];
-                                    const int zz = z - reconstructor->_directions[i][2];
-                                    if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                        && reconstructor->_confidence_map4D(xx, yy, zz, t) > 0) {
-                                        val += b[i](x, y, z, t) * original(xx, yy, zz, t);
-                                        sum += b[i](x, y, z, t);
-                                    }
-                                }
-
-                                val -= sum * original(x, y, z, t);
-                                val = original(x, y, z, t) + reconstructor->_alpha * reconstructor->_lambda /
-                                                             (reconstructor->_delta * reconstructor->_delta) * val;
-                                reconstructor->_reconstructed4D(x, y, z, t) = val;
-                            }
-                        }
-                    }
+                    for (int y = 0; y < dy; y++)
+                        smoothing(original, original2, reconstructor->_reconstructed4D, y, z, t);
                 }
             }
         }
@@ -865,110 +776,29 @@ namespace svrtk::ParallelqMRI {
 
     //-------------------------------------------------------------------
 
-    /// Class for adaptive regularisation (Part I)
-    class AdaptiveRegularization1T2Map {
-        const ReconstructionqMRI *reconstructor;
-        Array<RealImage>& b;
-        const Array<double>& factor;
-        const RealImage& original;
-
-    public:
-        AdaptiveRegularization1T2Map(
-                const ReconstructionqMRI *reconstructor,
-                Array<RealImage>& b,
-                const Array<double>& factor,
-                const RealImage& original) :
-                reconstructor(reconstructor),
-                b(b),
-                factor(factor),
-                original(original) {}
-
-        void operator()(const blocked_range<size_t>& r) const {
-            const int dx = reconstructor->_T2Map.GetX();
-            const int dy = reconstructor->_T2Map.GetY();
-            const int dz = reconstructor->_T2Map.GetZ();
-            for (size_t i = r.begin(); i != r.end(); i++) {
-                for (int z = 0; z < dz; z++)
-                    for (int y = 0; y < dy; y++)
-                        for (int x = 0; x < dx; x++) {
-                                const int xx = x + reconstructor->_directions[i][0];
-                                const int yy = y + reconstructor->_directions[i][1];
-                                const int zz = z + reconstructor->_directions[i][2];
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                    && (reconstructor->_confidence_map4D(x, y, z, 0) > 0) &&
-                                    (reconstructor->_confidence_map4D(xx, yy, zz, 0) > 0)) {
-                                    const double diff = (original(xx, yy, zz) - original(x, y, z)) * sqrt(factor[i]) /
-                                                        reconstructor->_delta;
-                                    b[i](x, y, z) = factor[i] / sqrt(1 + diff * diff);
-                                } else
-                                    b[i](x, y, z) = 0;
-                            }
-            }
-        }
-
-        void operator()() const {
-            parallel_for(blocked_range<size_t>(0, 13), *this);
-        }
-    };
-
-    //-------------------------------------------------------------------
-
-    /// Class for adaptive regularisation (Part II)
-    class AdaptiveRegularization2T2Map {
+    /// Class for adaptive regularisation of the T2 map
+    class AdaptiveRegularizationT2Map {
         ReconstructionqMRI *reconstructor;
-        const Array<RealImage>& b;
+        const Parallel::EdgePreservingSmoothing smoothing;
         const RealImage& original;
+        const RealImage& original2;
 
     public:
-        AdaptiveRegularization2T2Map(
+        AdaptiveRegularizationT2Map(
                 ReconstructionqMRI *reconstructor,
-                const Array<RealImage>& b,
-                const RealImage& original) :
+                const RealImage& original,
+                const RealImage& original2) :
                 reconstructor(reconstructor),
-                b(b),
-                original(original) {}
+                smoothing(reconstructor->_directions, reconstructor->_confidence_map4D, reconstructor->_alpha, reconstructor->_lambda, reconstructor->_delta),
+                original(original),
+                original2(original2) {}
 
         void operator()(const blocked_range<size_t>& r) const {
-            const int dx = reconstructor->_T2Map.GetX();
             const int dy = reconstructor->_T2Map.GetY();
-            const int dz = reconstructor->_T2Map.GetZ();
             for (size_t z = r.begin(); z != r.end(); ++z) {
-                for (int y = 0; y < dy; y++) {
-                    for (int x = 0; x < dx; x++) {
-                        if (reconstructor->_confidence_map4D(x, y, z, 0) > 0) {
-                            double val = 0;
-                            double sum = 0;
-
-                            // Don't combine the loops, it breaks the compiler optimisation (GCC 9)
-                            for (int i = 0; i < 13; i++) {
-                                const int xx = x + reconstructor->_directions[i][0];
-                                const int yy = y + reconstructor->_directions[i][1];
-                                const int zz = z + reconstructor->_directions[i][2];
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                    && reconstructor->_confidence_map4D(xx, yy, zz, 0) > 0) {
-                                    val += b[i](x, y, z) * original(xx, yy, zz);
-                                    sum += b[i](x, y, z);
-                                }
-                            }
-
-                            for (int i = 0; i < 13; i++) {
-                                const int xx = x - reconstructor->_directions[i][0];
-                                const int yy = y - reconstructor->_directions[i][1];
-                                const int zz = z - reconstructor->_directions[i][2];
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                    && reconstructor->_confidence_map4D(xx, yy, zz, 0) > 0) {
-                                    val += b[i](x, y, z) * original(xx, yy, zz);
-                                    sum += b[i](x, y, z);
-                                }
-                            }
-
-                            val -= sum * original(x, y, z);
-                            val = original(x, y, z) + reconstructor->_alpha * reconstructor->_lambda /
-                                                         (reconstructor->_delta * reconstructor->_delta) * val;
-                            reconstructor->_T2Map(x, y, z) = val;
-                        }
-                    }
-                }
+                // the confidence of the first echo time applies to the T2 map
+                for (int y = 0; y < dy; y++)
+                    smoothing(original, original2, reconstructor->_T2Map, y, z, 0);
             }
         }
 
@@ -996,7 +826,7 @@ namespace svrtk::ParallelqMRI {
             RealImage b;
 
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
-                if (reconstructor->_volcoeffs[inputIndex].empty())
+                if (reconstructor->_volcoeffs[inputIndex].Empty())
                     continue;
 
                 if (reconstructor->_verbose)
@@ -1021,14 +851,14 @@ namespace svrtk::ParallelqMRI {
                 int outputIndex = reconstructor->_volume_index[indstack];
 
                 //Distribute slice intensities to the volume
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
+                RealPixel *pbias = bias.Data() + outputIndex * bias.NumberOfSpatialVoxels();
+                for (int i = 0; i < coeffs.GetX(); i++)
+                    for (int j = 0; j < coeffs.GetY(); j++)
                         if (slice(i, j, 0) > -0.01) {
                             //add contribution of current slice voxel to all voxel volumes to which it contributes
-                            for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                bias(p.x, p.y, p.z,outputIndex) += p.value * b(i, j, 0);
-                            }
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
+                                pbias[coeffs.Index(k)] += coeffs.Value(k) * b(i, j, 0);
                         }
                 //end of loop for a slice inputIndex
             }
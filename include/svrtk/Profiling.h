@@ -19,15 +19,230 @@
 #pragma once
 
 #include "mirtk/Profiling.h"
+#include "mirtk/Array.h"
+
+// C++ Standard
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace svrtk {
+
+    /**
+     * @brief Hierarchical registry of execution times.
+     * @details Stages are timed by ProfileScope (through the SVRTK_*_TIMING macros) on the thread that
+     * enabled the profiler, nested stages become children of the enclosing stage and repeated calls of a
+     * stage with the same parent are accumulated into one node. Each node counts the calls, the wall time,
+     * the CPU time of the process (all threads), the resulting thread utilisation and the peak resident
+     * memory of the process at the end of the stage. Tasks executed by
+     * the parallel functors (e.g. the registration of a slice) are optionally timed with ProfileTask and
+     * added to the stage running at the time, with their thread CPU time. When the profiler is disabled
+     * scopes and tasks only check a flag. The registry is written as JSON (or CSV for file names ending in
+     * .csv) at program exit.
+     *
+     * Independently, the stages and tasks can be traced: every stage and task appends a complete event with
+     * its begin and duration to a buffer of the executing thread (no locking), and the events of all threads
+     * are written at exit in the Chrome trace-event format, which can be opened in chrome://tracing or Perfetto
+     * to see the load imbalance of the parallel functors.
+     */
+    class Profiler {
+    public:
+        struct Node {
+            std::string name;
+            size_t calls = 0;
+            /// Wall time [s]
+            double wall = 0;
+            /// CPU time [s], of all threads for stages and of the executing thread for tasks
+            double cpu = 0;
+            /// Longest call [s]
+            double max_wall = 0;
+            /// Peak resident memory of the process at the end of the stage [bytes]
+            size_t peak_rss = 0;
+            /// Whether the node is a task timed on the worker threads
+            bool task = false;
+            /// Index of the task for the individual tasks below a task node, -1 otherwise
+            long index = -1;
+            mirtk::Array<std::unique_ptr<Node>> children;
+            /// Children by name
+            std::unordered_map<std::string, Node*> children_by_name;
+            /// Individual tasks by index, so that a task is found without building its name
+            mirtk::Array<Node*> children_by_index;
+
+            /// Find or create a child
+            Node& Child(const std::string& name);
+            /// Find or create the individual task "<name> <index>" below this task node
+            Node& TaskChild(long index);
+            /// Accumulate the children of another node into the children of this node
+            void MergeChildren(Node& node);
+        };
+
+        /// Trace event of a stage (index < 0) or a task
+        struct TraceEvent {
+            std::string name;
+            long index;
+            /// Begin and duration [s]
+            double begin;
+            double duration;
+        };
+
+        /// Trace events of a thread
+        struct TraceBuffer {
+            int thread;
+            mirtk::Array<TraceEvent> events;
+        };
+
+    protected:
+        static std::atomic<bool> _enabled;
+        static std::atomic<bool> _tasks_enabled;
+        static std::atomic<bool> _tracing;
+
+        Node _root;
+        /// Nodes of the open stages of the profiled thread
+        mirtk::Array<Node*> _stack;
+        std::thread::id _owner;
+        std::mutex _mutex;
+        std::string _file_name;
+        /// Trace buffers of all threads that recorded events, kept until exit
+        mirtk::Array<std::unique_ptr<TraceBuffer>> _trace_buffers;
+        std::string _trace_file_name;
+        double _trace_start;
+        double _start_wall;
+        double _start_cpu;
+        int _threads;
+
+        Profiler();
+
+        /// Set the profiled thread, on the first call only
+        void SetOwner();
+
+        /// Trace buffer of the calling thread
+        static TraceBuffer& ThreadTraceBuffer();
+
+        /// Append an event to the trace buffer of the calling thread
+        static inline void Trace(const std::string& name, long index, double begin, double end) {
+            ThreadTraceBuffer().events.push_back(TraceEvent{name, index, begin, end - begin});
+        }
+
+        friend class ProfileScope;
+        friend class ProfileTask;
+
+    public:
+        static Profiler& Instance();
+
+        /**
+         * @brief Start profiling on the calling thread and write the registry to a file at exit.
+         * @param file_name output file (JSON, or CSV if the name ends in .csv)
+         * @param tasks also time the tasks of the parallel functors (e.g. every slice registration)
+         */
+        static void Enable(const std::string& file_name, bool tasks = false);
+
+        /// Whether stages are recorded
+        static inline bool Enabled() { return _enabled.load(std::memory_order_relaxed); }
+        /// Whether tasks are recorded
+        static inline bool TasksEnabled() { return _tasks_enabled.load(std::memory_order_relaxed); }
+
+        /**
+         * @brief Start tracing the stages of the calling thread and the tasks of all threads.
+         * @param file_name output file of the Chrome trace-event JSON written at exit
+         */
+        static void EnableTrace(const std::string& file_name);
+
+        /// Whether stages and tasks are traced
+        static inline bool Tracing() { return _tracing.load(std::memory_order_relaxed); }
+
+        /// Write the registry as JSON
+        void WriteJSON(std::ostream& out);
+        /// Write the registry as CSV with one line per node and the path of the node as its name
+        void WriteCSV(std::ostream& out);
+        /// Write the registry to the file given to Enable()
+        void Write();
+
+        /// Write the trace events of all threads in the Chrome trace-event format
+        void WriteTrace(std::ostream& out);
+        /// Write the trace to the file given to EnableTrace()
+        void WriteTrace();
+
+        /// Wall time since an arbitrary epoch [s]
+        static double WallTime();
+        /// CPU time of the process [s]
+        static double ProcessCPUTime();
+        /// CPU time of the calling thread [s]
+        static double ThreadCPUTime();
+        /// Current and peak resident memory of the process [bytes]
+        static void ResidentMemory(size_t& rss, size_t& peak_rss);
+    };
+
+    /**
+     * @brief Timer of a stage.
+     * @details Opens a stage on construction, End() adds the elapsed time since construction (or the last
+     * Reset()) under the given name to the enclosing stage, together with the stages nested since then.
+     * Scopes created on other threads than the profiled one, or while the profiler and the tracing are
+     * disabled, are inactive.
+     */
+    class ProfileScope {
+        Profiler::Node _node;
+        double _start_wall;
+        double _start_cpu;
+        bool _active;
+        /// Whether the scope is on the stack of the registry
+        bool _registered;
+        /// Name given on construction, ended by the destructor
+        std::string _name;
+
+    public:
+        ProfileScope();
+        explicit ProfileScope(const std::string& name);
+        ~ProfileScope();
+
+        ProfileScope(const ProfileScope&) = delete;
+        ProfileScope& operator=(const ProfileScope&) = delete;
+
+        /// Restart the timer
+        void Reset();
+        /// Record the stage
+        void End(const std::string& name);
+    };
+
+    /**
+     * @brief Timer of a task executed in a parallel functor.
+     * @details The tasks are accumulated under the given name in the stage running at the time, and
+     * individually as "<name> <index>" below it. When tracing, every task is also a trace event of the
+     * executing thread.
+     */
+    class ProfileTask {
+        const char *_name;
+        long _index;
+        double _start_wall;
+        double _start_cpu;
+        bool _active;
+
+    public:
+        ProfileTask(const char *name, long index = -1) : _name(name), _index(index), _active(Profiler::TasksEnabled() || Profiler::Tracing()) {
+            if (_active) {
+                _start_wall = Profiler::WallTime();
+                _start_cpu = Profiler::ThreadCPUTime();
+            }
+        }
+
+        ~ProfileTask();
+
+        ProfileTask(const ProfileTask&) = delete;
+        ProfileTask& operator=(const ProfileTask&) = delete;
+    };
+
+} // namespace svrtk
 
 /// Start measurement of execution time of current code block
-#define SVRTK_START_TIMING    MIRTK_START_TIMING
+#define SVRTK_START_TIMING()  MIRTK_START_TIMING(); svrtk::ProfileScope svrtk_profile_scope
 /// Reset measurement of starting execution time of current code block
-#define SVRTK_RESET_TIMING    MIRTK_RESET_TIMING
+#define SVRTK_RESET_TIMING()  MIRTK_RESET_TIMING(); svrtk_profile_scope.Reset()
 
 /// End measurement of execution time of current code block
 #ifdef  SVRTK_TOOL
-#define SVRTK_END_TIMING      if (debug || profile) MIRTK_END_TIMING
+#define SVRTK_END_TIMING(section)  do { svrtk_profile_scope.End(section); if (debug || profile) MIRTK_END_TIMING(section); } while (false)
 #else
-#define SVRTK_END_TIMING      if (_debug || _profile) MIRTK_END_TIMING
+#define SVRTK_END_TIMING(section)  do { svrtk_profile_scope.End(section); if (_debug || _profile) MIRTK_END_TIMING(section); } while (false)
 #endif
@@ -21,6 +21,12 @@
 
 // SVRTK
 #include "svrtk/Common.h"
+#include "svrtk/PSF.h"
+#include "svrtk/SystemMatrix.h"
+#include "svrtk/VoxelRuns.h"
+#include "svrtk/RegistrationWorkerPool.h"
+#include "svrtk/ExchangeArena.h"
+#include "svrtk/SliceRegistration.h"
 
 using namespace std;
 using namespace mirtk;
@@ -39,6 +45,10 @@ namespace svrtk {
         class CoeffInit;
         class CoeffInitSF;
         class Superresolution;
+        class SuperresolutionGather;
+        class SuperresolutionNormal;
+        class SuperresolutionRegularizer;
+        class JacobianMask;
         class SStep;
         class MStep;
         class EStep;
@@ -48,10 +58,8 @@ namespace svrtk {
         class SimulateSlices;
         class SimulateMasks;
         class Average;
-        class AdaptiveRegularization1;
-        class AdaptiveRegularization2;
-        class AdaptiveRegularization1MC;
-        class AdaptiveRegularization2MC;
+        class AdaptiveRegularization;
+        class AdaptiveRegularizationMC;
     }
 
     /**
@@ -62,9 +70,36 @@ namespace svrtk {
         /// Reconstruction type
         RECON_TYPE _recon_type;
 
-        /// Structures to store the matrix of transformation between volume and slices
-        Array<SLICECOEFFS> _volcoeffs;
-        Array<SLICECOEFFS> _volcoeffsSF;
+        /// Structures to store the matrix of transformation between volume and slices (CSR per slice)
+        Array<SliceCoeffs> _volcoeffs;
+        Array<SliceCoeffs> _volcoeffsSF;
+        /// Transposed (volume-major) matrix for gather-based superresolution
+        VolumeCoeffs _volcoeffs_transposed;
+        /// FFD mode: whether each coefficient of a slice passes the Jacobian threshold
+        Array<Array<bool>> _coeffs_jac_mask;
+        /// Use the transposed matrix in Superresolution
+        bool _transposed_sr;
+
+        /// Solve the SR step with preconditioned conjugate gradients instead of a gradient-descent step
+        bool _cg_sr;
+        /// Maximum number of CG iterations per SR step
+        int _cg_max_iterations;
+        /// Relative residual norm at which CG stops
+        double _cg_tolerance;
+
+        /// Incremental CoeffInit: recompute the matrix only for slices that moved
+        bool _incremental_coeffinit;
+        /// Slice corner displacement (mm) below which the matrix of a slice is kept
+        double _coeffinit_tolerance;
+        /// Transformations the current matrix was computed for
+        Array<RigidTransformation> _coeffs_transformations;
+        /// Whether slices contributed to the volume weights when the matrix was computed
+        Array<bool> _coeffs_included;
+        /// Volume weights accumulated in double precision, so that the incremental updates do not drift
+        Array<double> _volume_weights_sum;
+
+        /// Matrix-free mode: slice matrices are computed on the fly and never stored
+        bool _matrix_free;
 
         /// flags
         int _slicePerDyn;
@@ -94,6 +129,42 @@ namespace svrtk {
         bool _saved_slices;
         Array<int> _zero_slices;
 
+        /// Number of persistent remote registration workers (0: one register process per slice)
+        int _remote_workers;
+        /// Seconds after which a remote registration worker that hasn't replied is restarted (0: wait forever)
+        int _remote_timeout;
+        /// Persistent remote registration workers, started on first use
+        shared_ptr<RegistrationWorkerPool> _registration_pool;
+        /// Exchange the remote model through memory-mapped arena files instead of .nii.gz/.dof files
+        bool _exchange_arena;
+
+        /// Use the dedicated rigid slice-to-volume registration instead of the generic MIRTK registration
+        bool _fast_rigid_svr;
+        /// Number of resolution levels of the dedicated rigid registration
+        int _fast_rigid_svr_levels;
+
+        /// Skip the rigid SVR of slices that have converged
+        bool _svr_skip_converged;
+        /// Slice corner displacement (mm) below which a registration counts as converged
+        double _svr_convergence_tolerance;
+        /// Similarity improvement below which a registration counts as converged
+        double _svr_similarity_tolerance;
+        /// Number of iterations after which a converged slice is registered again
+        int _svr_recheck_interval;
+        /// Register all slices in the next SVR (e.g. after a resolution change)
+        bool _svr_force_full;
+        /// Number of consecutive converged registrations of each slice
+        Array<int> _svr_stable_count;
+        /// Number of consecutive skipped registrations of each slice
+        Array<int> _svr_skipped_count;
+        /// Whether each slice is skipped in the current SVR
+        Array<bool> _svr_skip;
+        /// Similarity improvement of the last registration of each slice (0 for the remote registration)
+        Array<double> _svr_improvement;
+
+        /// CSV file the memory usage of the large buffers is appended to after the main stages (empty: off)
+        string _memory_report;
+
         int _current_iteration;
         Array<int> _cp_spacing;
         int _global_cp_spacing;
@@ -150,6 +221,8 @@ namespace svrtk {
 
         /// Weights for regularization
         RealImage _confidence_map;
+        /// Runs of the voxels with positive confidence, rebuilt whenever the confidence map changes
+        VoxelRuns _confidence_runs;
         
         
         int _number_of_channels;
@@ -287,11 +360,25 @@ namespace svrtk {
         /// Scale volume common function
         void ScaleVolume(RealImage& reconstructed);
 
+        /// Persistent remote registration workers, started on first use
+        RegistrationWorkerPool& RemoteRegistrationPool(const string& str_mirtk_path);
+
+        /// Write the resampled slices of remote SVR to the exchange arena of the workers (target-N in svr-targets.arena)
+        void WriteRemoteTargets(const string& str_current_exchange_file_path, const Array<RealImage>& targets);
+
+        /**
+         * @brief Run the rigid remote registration of all slices with the persistent workers.
+         * @details The targets (target-N in svr-targets.arena) and sources (source[-K] in svr-source.arena)
+         * must have been written.
+         * @param source_indexes index K of the source volume of each slice, empty for a single source
+         */
+        void RemoteRigidRegistrationWithPool(const string& str_mirtk_path, const string& str_current_exchange_file_path, const Array<int>& source_indexes = {});
+
     public:
         /// Reconstruction constructor
         Reconstruction();
         /// Reconstruction destructor
-        ~Reconstruction() {}
+        virtual ~Reconstruction() {}
 
         int _number_of_slices_org;
         double _average_thickness_org;
@@ -428,6 +515,14 @@ namespace svrtk {
 
         /// Calculate transformation matrix between slices and voxels
         void CoeffInit();
+        /// Maximum displacement (mm) of the slice corners between the current and the given transformation
+        double SliceDisplacement(size_t inputIndex, const RigidTransformation& transformation) const;
+        /// Mark the converged slices to be skipped by the next rigid SVR (_svr_skip), returns their number
+        int SelectConvergedSlices();
+        /// Update the convergence of the registered slices after a rigid SVR and report the skipped slices
+        void UpdateSliceConvergence(const Array<RigidTransformation>& previous_transformations, int skipped);
+        /// Matrix of a slice, stored or (in the matrix-free mode) computed into the given buffer
+        const SliceCoeffs& GetSliceCoeffs(size_t inputIndex, SliceCoeffs& buffer) const;
         /// Calculate transformation matrix between slices and voxels
         void CoeffInitSF(int begin, int end);
 
@@ -459,9 +554,14 @@ namespace svrtk {
 
         /// Run superresolution reconstruction step
         void Superresolution(int iter);
+        /// Solve the data and regularisation terms of the SR step with preconditioned conjugate gradients
+        void SuperresolutionCG(int iter, const RealImage& original);
 
         /// Run MStep
         void MStep(int iter);
+
+        /// Update voxel-wise robust statistics parameters from the MStep sums
+        void UpdateMStepParameters(double sigma, double mix, double num, double min, double max, int iter);
         
         /// Run SStep 
         void SStep();
@@ -486,9 +586,9 @@ namespace svrtk {
          */
         void RemoteSliceToVolumeRegistration(int iter, const string& str_mirtk_path, const string& str_current_exchange_file_path);
 
-        /// Save the current reconstruction model
+        /// Save the current reconstruction model to the exchange arenas (slices.arena, model-N.arena)
         void SaveModelRemote(const string& str_current_exchange_file_path, int status_flag, int current_iteration);
-        /// Load the current reconstruction model
+        /// Load the current reconstruction model from the exchange arenas or, if missing, the .nii.gz/.dof files
         void LoadModelRemote(const string& str_current_exchange_file_path, int current_number_of_slices, double average_thickness, int current_iteration);
         /// Load remotely reconstructed volume
         void LoadResultsRemote(const string& str_current_exchange_file_path, int current_number_of_slices, int current_iteration);
@@ -502,6 +602,16 @@ namespace svrtk {
         /// Mask the volume
         inline void MaskVolume() { MaskImage(_reconstructed, _mask, -1); }
 
+        /// Bytes held by the large buffers, as pairs of buffer name and bytes
+        virtual void MemoryUsage(Array<pair<string, size_t>>& usage) const;
+
+        /**
+         * @brief Append the memory usage of the large buffers to the memory report, if enabled.
+         * @param stage stage after which the usage is measured
+         * @param transient estimated buffers that only existed during the stage
+         */
+        void ReportMemoryUsage(const string& stage, const Array<pair<string, size_t>>& transient = {});
+
         /// Save slices
         void SaveSlices();
         /// Save slices with timing info
@@ -563,6 +673,9 @@ namespace svrtk {
         /// Run simulation of slices from the reconstruction volume
         void SimulateSlices();
 
+        /// Run simulation of slices and MStep in a single pass over the slices
+        void SimulateSlicesMStep(int iter);
+
         /**
          * @brief Run package-to-volume registration.
          * @param stacks
@@ -620,8 +733,12 @@ namespace svrtk {
         friend class Parallel::SliceToVolumeRegistrationFFD;
         friend class Parallel::RemoteSliceToVolumeRegistration;
         friend class Parallel::CoeffInit;
+        friend class Parallel::JacobianMask;
         friend class Parallel::CoeffInitSF;
         friend class Parallel::Superresolution;
+        friend class Parallel::SuperresolutionGather;
+        friend class Parallel::SuperresolutionNormal;
+        friend class Parallel::SuperresolutionRegularizer;
         friend class Parallel::MStep;
         friend class Parallel::EStep;
         friend class Parallel::SStep;
@@ -631,10 +748,8 @@ namespace svrtk {
         friend class Parallel::SimulateSlices;
         friend class Parallel::SimulateMasks;
         friend class Parallel::Average;
-        friend class Parallel::AdaptiveRegularization1;
-        friend class Parallel::AdaptiveRegularization2;
-        friend class Parallel::AdaptiveRegularization1MC;
-        friend class Parallel::AdaptiveRegularization2MC;
+        friend class Parallel::AdaptiveRegularization;
+        friend class Parallel::AdaptiveRegularizationMC;
 
         ////////////////////////////////////////////////////////////////////////////////
         // Inline/template definitions
@@ -720,6 +835,72 @@ namespace svrtk {
             _no_sr = flag_sr;
         }
 
+        /// Set gather-based SR using the transposed system matrix
+        inline void SetTransposedSR(bool flag_transposed_sr) {
+            _transposed_sr = flag_transposed_sr;
+        }
+
+        /// Solve the SR step with preconditioned conjugate gradients (single channel only)
+        inline void SetConjugateGradientSR(bool flag_cg_sr, int max_iterations = 10, double tolerance = 0.01) {
+            _cg_sr = flag_cg_sr;
+            _cg_max_iterations = max_iterations;
+            _cg_tolerance = tolerance;
+        }
+
+        /// Recompute the matrix in CoeffInit only for slices that moved more than tolerance (mm)
+        inline void SetIncrementalCoeffInit(bool flag_incremental, double tolerance = 0.01) {
+            _incremental_coeffinit = flag_incremental;
+            _coeffinit_tolerance = tolerance;
+        }
+
+        /// Compute the slice matrices on the fly instead of storing them (less memory, more compute)
+        inline void SetMatrixFree(bool flag_matrix_free) {
+            _matrix_free = flag_matrix_free;
+        }
+
+        /**
+         * @brief Run the remote registration with persistent workers instead of one process per slice.
+         * @param remote_workers number of workers (0 to disable)
+         * @param timeout seconds after which a worker that hasn't replied is restarted and its slice skipped (0: wait forever)
+         */
+        inline void SetRemoteWorkers(int remote_workers, int timeout = 600) {
+            _remote_workers = remote_workers;
+            _remote_timeout = timeout;
+        }
+
+        /// Exchange the remote model through memory-mapped arena files (the .nii.gz/.dof files remain the default and the fallback)
+        inline void SetExchangeArena(bool flag_exchange_arena) {
+            _exchange_arena = flag_exchange_arena;
+        }
+
+        /// Use the dedicated rigid slice-to-volume registration for rigid SVR
+        inline void SetFastRigidSVR(bool flag_fast_rigid_svr, int levels = 3) {
+            _fast_rigid_svr = flag_fast_rigid_svr;
+            _fast_rigid_svr_levels = levels;
+        }
+
+        /**
+         * @brief Skip the rigid SVR of slices that moved less than tolerance (mm) in their last two registrations.
+         * @param recheck_interval converged slices are registered again after this many skipped iterations
+         * @param similarity_tolerance similarity improvement below which a registration counts as converged
+         */
+        inline void SetSkipConvergedSlices(bool flag_skip, double tolerance = 0.1, int recheck_interval = 3, double similarity_tolerance = 1e-3) {
+            _svr_skip_converged = flag_skip;
+            _svr_convergence_tolerance = tolerance;
+            _svr_recheck_interval = recheck_interval;
+            _svr_similarity_tolerance = similarity_tolerance;
+        }
+
+        /// Append the memory usage of the large buffers to a CSV file after the main stages
+        inline void SetMemoryReport(const string& file_name) {
+            _memory_report = file_name;
+        }
+
+        /// Register all slices in the next SVR, regardless of their convergence
+        inline void ForceFullRegistration() {
+            _svr_force_full = true;
+        }
+
         /// Set template flag
         inline void SetTemplateFlag(bool template_flag) {
             _template_flag = template_flag;
@@ -33,8 +33,7 @@ namespace svrtk {
         class SimulateStacksCardiac4D;
         class NormaliseBiasCardiac4D;
         class SuperresolutionCardiac4D;
-        class AdaptiveRegularization1Cardiac4D;
-        class AdaptiveRegularization2Cardiac4D;
+        class AdaptiveRegularizationCardiac4D;
         class CalculateError;
         class CalculateCorrectedSlices;
     }
@@ -154,6 +153,9 @@ namespace svrtk {
         /// ReconstructionCardiac4D Destructor
         ~ReconstructionCardiac4D() {}
 
+        /// Bytes held by the large buffers, as pairs of buffer name and bytes
+        void MemoryUsage(Array<pair<string, size_t>>& usage) const override;
+
         /// Get slice-location transformations
         void ReadSliceTransformations(const char *folder);
 
@@ -289,8 +291,7 @@ namespace svrtk {
         friend class Parallel::SimulateStacksCardiac4D;
         friend class Parallel::NormaliseBiasCardiac4D;
         friend class Parallel::SuperresolutionCardiac4D;
-        friend class Parallel::AdaptiveRegularization1Cardiac4D;
-        friend class Parallel::AdaptiveRegularization2Cardiac4D;
+        friend class Parallel::AdaptiveRegularizationCardiac4D;
         friend class Parallel::CalculateError;
         friend class Parallel::CalculateCorrectedSlices;
 
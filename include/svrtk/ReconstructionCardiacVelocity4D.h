@@ -67,6 +67,9 @@ namespace svrtk {
         /// ReconstructionCardiacVelocity4D destructor
         inline ~ReconstructionCardiacVelocity4D() {}
 
+        /// Bytes held by the large buffers, as pairs of buffer name and bytes
+        void MemoryUsage(Array<pair<string, size_t>>& usage) const override;
+
         /// Initialisation of slice gradients with respect to slice transformations
         void InitializeSliceGradients4D();
 
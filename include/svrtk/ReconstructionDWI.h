@@ -20,6 +20,8 @@
 
 // SVRTK
 #include "svrtk/Common.h"
+#include "svrtk/PSF.h"
+#include "svrtk/SystemMatrix.h"
 
 using namespace mirtk;
 
@@ -32,8 +34,8 @@ namespace svrtk {
 
         RECON_TYPE _recon_type;
 
-        Array<SLICECOEFFS> _volcoeffs;
-        Array<SLICECOEFFS> _volcoeffsSF;
+        Array<SliceCoeffs> _volcoeffs;
+        Array<SliceCoeffs> _volcoeffsSF;
 
 
         Array<RealImage> _original_slices;
@@ -158,12 +160,36 @@ namespace svrtk {
 
         SphericalHarmonics _sh_vol;
 
+        /// SH basis of the rotated gradient direction of every slice, a row of _sh_basis_coeffs values per slice
+        Array<float> _sh_basis;
+
+        /// Rotated gradient directions the rows of _sh_basis were computed for
+        Array<double> _sh_basis_directions;
+
+        int _sh_basis_order;
+
+        int _sh_basis_coeffs;
+
+        /// Row length of the coefficient-innermost buffers: _sh_basis_coeffs padded to a multiple of 8 values
+        int _sh_stride;
+
+        /// _SH_coeffs with the coefficients of each voxel contiguous, a row of _sh_stride values per voxel,
+        /// only held while the simulation kernels run
+        Array<RealPixel> _sh_coeffs_interleaved;
+
+        /// Groups of slices with disjoint voxel footprints, whose SR contributions can be added to shared buffers in parallel,
+        /// empty before CoeffInit, then the SR uses a per-thread reduction
+        Array<Array<int>> _slice_groups;
+
         double _motion_sigma;
 
         double _lambdaLB;
 
         Array<int> _slice_order;
 
+        /// CSV file the memory usage of the large buffers is appended to after the main stages (empty: off)
+        string _memory_report;
+
 
 
     public:
@@ -248,6 +274,10 @@ namespace svrtk {
 
         void CoeffInit();
 
+        void GroupSlicesByFootprint();
+
+        inline const SliceCoeffs& GetSliceCoeffs(size_t inputIndex) const { return _volcoeffs[inputIndex]; }
+
         int SliceCount(int inputIndex);
 
         void GaussianReconstruction(double small_slices_threshold = 0.1);
@@ -407,6 +437,11 @@ namespace svrtk {
         void CreateSliceDirections(Array< Array<double> >& directions, Array<double>& bvalues);
         void InitSH(Matrix dirs,int order);
         void InitSHT(Matrix dirs,int order);
+        void UpdateSHBasis();
+        inline const float *SHBasis(size_t inputIndex) const;
+        void InterleaveSHCoeffs();
+        void ReleaseSHCoeffs();
+        inline const RealPixel *SHCoeffs(int index) const;
         void SimulateSlicesDTI();
         void SimulateStacksDTI(Array<RealImage>& stacks, bool simulate_excluded=false);
         void SimulateStacksDTIIntensityMatching(Array<RealImage>& stacks, bool simulate_excluded=false);
@@ -440,6 +475,14 @@ namespace svrtk {
 
         double ConsistencyDTI();
 
+        /// Bytes held by the large buffers, as pairs of buffer name and bytes
+        void MemoryUsage(Array<pair<string, size_t>>& usage) const;
+
+        /// Append the memory usage of the large buffers and the estimated transient buffers of a stage to the memory report, if enabled
+        void ReportMemoryUsage(const string& stage, const Array<pair<string, size_t>>& transient = {});
+
+        inline void SetMemoryReport(const string& file_name);
+
 
 
 
@@ -652,4 +695,19 @@ namespace svrtk {
         _SH_coeffs=sh;
     }
 
+    inline const float *ReconstructionDWI::SHBasis(size_t inputIndex) const
+    {
+        return &_sh_basis[inputIndex * _sh_basis_coeffs];
+    }
+
+    inline const RealPixel *ReconstructionDWI::SHCoeffs(int index) const
+    {
+        return &_sh_coeffs_interleaved[(size_t)index * _sh_stride];
+    }
+
+    inline void ReconstructionDWI::SetMemoryReport(const string& file_name)
+    {
+        _memory_report=file_name;
+    }
+
 } // namespace svrtk
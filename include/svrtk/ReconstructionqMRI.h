@@ -40,10 +40,8 @@ namespace svrtk {
         class SliceToVolumeRegistrationqMRI;
         class SimulateStacksqMRI;*/
         class NormaliseBiasqMRI;
-        class AdaptiveRegularization1qMRI;
-        class AdaptiveRegularization2qMRI;
-        class AdaptiveRegularization1T2Map;
-        class AdaptiveRegularization2T2Map;
+        class AdaptiveRegularizationqMRI;
+        class AdaptiveRegularizationT2Map;
         class SimulateSlicesqMRI;
         class SuperresolutionqMRI;
         class MStepqMRI;
@@ -193,6 +191,9 @@ namespace svrtk {
         /// ReconstructionqMRI Destructor
         ~ReconstructionqMRI() {}
 
+        /// Bytes held by the large buffers, as pairs of buffer name and bytes
+        void MemoryUsage(Array<pair<string, size_t>>& usage) const override;
+
         // Set _epsilon
         void SetEpsilon(const double & epsilon){
             _epsilon = epsilon;
@@ -495,10 +496,8 @@ namespace svrtk {
 
         friend class ParallelqMRI::SuperresolutionqMRI;
         friend class ParallelqMRI::SimulateSlicesqMRI;
-        friend class ParallelqMRI::AdaptiveRegularization1qMRI;
-        friend class ParallelqMRI::AdaptiveRegularization2qMRI;
-        friend class ParallelqMRI::AdaptiveRegularization1T2Map;
-        friend class ParallelqMRI::AdaptiveRegularization2T2Map;
+        friend class ParallelqMRI::AdaptiveRegularizationqMRI;
+        friend class ParallelqMRI::AdaptiveRegularizationT2Map;
         friend class ParallelqMRI::NormaliseBiasqMRI;
         friend class ParallelqMRI::ModelFitqMRI;
         friend class ParallelqMRI::MStepqMRI;
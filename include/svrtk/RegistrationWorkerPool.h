@@ -0,0 +1,128 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// MIRTK
+#include "mirtk/Common.h"
+#include "mirtk/Array.h"
+#include "mirtk/RigidTransformation.h"
+
+// C++ Standard
+#include <cstdio>
+#include <sys/types.h>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Pool of persistent worker processes for remote slice-to-volume registration.
+     * @details Instead of starting a registration process per slice, the workers (the
+     * register-worker tool) run for the whole reconstruction. Each worker loads a source volume
+     * once per iteration and keeps it while it receives registration jobs over a Unix socket. Jobs
+     * and replies are single lines of tab-separated fields, and rigid transformations travel inline
+     * as their parameters instead of through .dof files. Images are given as file names or as
+     * entries of an exchange arena (file.arena#entry), which the worker maps instead of reading
+     * NIfTI files. The workers are separate processes, so registration memory stays isolated from
+     * the reconstruction. A worker that dies or does not reply within the timeout is killed and
+     * restarted, and its job is reported as failed.
+     *
+     * Protocol (requests from the pool, replies from the worker):
+     *  - reset: forget the cached source volumes -> ok
+     *  - rigid target source dof_1 ... dof_n -> ok dof_1 ... dof_n
+     *  - ffd target source dofin dofout cp_spacing -> ok
+     *  - quit: terminate the worker
+     * Failed jobs are answered with: error message
+     */
+    class RegistrationWorkerPool {
+        struct Worker {
+            pid_t pid = -1;
+            /// Pool end of the socket connected to the standard input and output of the worker
+            int channel = -1;
+            /// Received part of the next reply
+            string buffer;
+        };
+
+        /// Worker executable and its arguments
+        string _executable;
+        Array<string> _arguments;
+        Array<Worker> _workers;
+        /// Seconds to wait for a reply before a worker counts as hung (0: wait forever)
+        int _timeout;
+
+        /// Start a worker process
+        bool Start(Worker& worker);
+        /// Terminate a worker process
+        void Stop(Worker& worker);
+        /// Kill a failed or hung worker process
+        void Kill(Worker& worker);
+        /// Read the next reply line of a worker, returns false if the worker died or timed out
+        bool Receive(Worker& worker, string& reply);
+        /// Send a request to a worker and wait for its reply
+        bool Request(Worker& worker, const string& request, string& reply);
+
+    public:
+        /**
+         * @brief Start the workers.
+         * @param executable path to the register-worker tool
+         * @param arguments arguments of the workers (e.g. -ncc)
+         * @param number_of_workers number of worker processes
+         * @param timeout seconds to wait for the reply to a job before the worker is restarted (0: wait forever)
+         */
+        RegistrationWorkerPool(const string& executable, const Array<string>& arguments, int number_of_workers, int timeout = 0);
+
+        /// Terminate the workers
+        ~RegistrationWorkerPool();
+
+        RegistrationWorkerPool(const RegistrationWorkerPool&) = delete;
+        RegistrationWorkerPool& operator=(const RegistrationWorkerPool&) = delete;
+
+        /// Number of workers
+        inline size_t NumberOfWorkers() const { return _workers.size(); }
+
+        /// Make all workers forget their source volumes (the reconstruction changed)
+        void Reset();
+
+        /**
+         * @brief Distribute jobs over the workers and wait for all of them.
+         * @return the reply to each job, empty if the worker failed
+         */
+        Array<string> Run(const Array<string>& jobs);
+
+        /// Rigid registration job of target to source, starting from dofin
+        static string RigidJob(const string& target, const string& source, const RigidTransformation& dofin);
+        /// Parse the reply to a rigid job, returns whether the registration succeeded
+        static bool RigidResult(const string& reply, RigidTransformation& dofout);
+        /// FFD registration job of target to source, reading dofin and writing dofout
+        static string FFDJob(const string& target, const string& source, const string& dofin, const string& dofout, int cp_spacing);
+        /// Parse the reply to an FFD job, returns whether the registration succeeded
+        static bool FFDResult(const string& reply);
+
+        /**
+         * @brief Serve the requests read from input until quit or end of input.
+         * @details Main loop of the register-worker tool.
+         * @param input channel of the requests
+         * @param output channel of the replies
+         * @param ncc use NCC instead of the default similarity measure
+         */
+        static int Serve(FILE *input, FILE *output, bool ncc);
+    };
+
+} // namespace svrtk
@@ -0,0 +1,292 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/SystemMatrix.h"
+
+// MIRTK
+#include "mirtk/Parallel.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Signal model of a single volume.
+     * @details A signal model maps a coefficient (volume voxel index, PSF weight) of a slice pixel to the
+     * volume data: Project() adds the weighted signal of the voxel and the weight to the sums of the pixel,
+     * BackProject() distributes the weighted error of the pixel and the weight to the voxel data. The
+     * volume is e.g. the 3D reconstruction or the echo volume of a qMRI slice (a 4D volume offset by
+     * the volume index of the slice).
+     */
+    class ScalarSignal {
+        const RealPixel *_volume;
+
+    public:
+        ScalarSignal(const RealPixel *volume) : _volume(volume) {}
+
+        inline void Project(int index, double value, double& signal, double& weight) const {
+            signal += value * _volume[index];
+            weight += value;
+        }
+
+        inline void BackProject(int index, double value, double error, double weight, RealPixel *addon, RealPixel *confidence) const {
+            addon[index] += weight * value * error;
+            confidence[index] += weight * value;
+        }
+    };
+
+    /**
+     * @brief Signal model of an additional channel of a volume (e.g. a label or a second contrast).
+     * @details The channels are projected and back-projected with the weights of the main volume, so the
+     * back-projection only adds to the channel and leaves the confidence to the main volume.
+     */
+    class ChannelSignal : public ScalarSignal {
+    public:
+        ChannelSignal(const RealPixel *volume) : ScalarSignal(volume) {}
+
+        inline void BackProject(int index, double value, double error, double weight, RealPixel *addon, RealPixel *confidence) const {
+            addon[index] += weight * value * error;
+        }
+    };
+
+    /**
+     * @brief Signal model of a DWI slice with the signal of every voxel represented by spherical harmonics.
+     * @details The SH coefficients of a voxel are a contiguous row of stride values and the signal in the
+     * direction of the slice is their product with the SH basis of the direction. The back-projection adds
+     * the weighted error times the basis to the row of the voxel, the confidence is one value per voxel.
+     */
+    class SphericalHarmonicSignal {
+        const RealPixel *_coeffs;
+        const int _stride;
+        const float *_basis;
+        const int _ncoeffs;
+
+    public:
+        /**
+         * @param coeffs coefficient rows of all voxels
+         * @param basis SH basis of the direction of the slice
+         */
+        SphericalHarmonicSignal(const RealPixel *coeffs, int stride, const float *basis, int ncoeffs) :
+            _coeffs(coeffs), _stride(stride), _basis(basis), _ncoeffs(ncoeffs) {}
+
+        inline void Project(int index, double value, double& signal, double& weight) const {
+            const RealPixel *c = _coeffs + (size_t)index * _stride;
+            double s = 0;
+            for (int l = 0; l < _ncoeffs; l++)
+                s += c[l] * _basis[l];
+            signal += value * s;
+            weight += value;
+        }
+
+        inline void BackProject(int index, double value, double error, double weight, RealPixel *addon, RealPixel *confidence) const {
+            RealPixel *a = addon + (size_t)index * _stride;
+            const double v = value * error * weight;
+            for (int l = 0; l < _ncoeffs; l++)
+                a[l] += v * _basis[l];
+            confidence[index] += weight * value;
+        }
+    };
+
+    /**
+     * @brief Signal model of a slice acquired across the volumes of a 4D reconstruction (e.g. cardiac phases).
+     * @details The signal of a voxel is the sum over the volumes weighted by the temporal weights of the slice.
+     */
+    class TemporalSignal {
+        const RealPixel *_volume;
+        const int _nvox;
+        /// Temporal weight of every volume for the slice
+        Array<double> _temporal_weight;
+
+    public:
+        /**
+         * @param volume 4D volume with one volume after the other
+         * @param temporal_weight weights accessed as [volume][slice]
+         */
+        TemporalSignal(const RealPixel *volume, int nvox, const Array<Array<double>>& temporal_weight, size_t inputIndex) :
+            _volume(volume), _nvox(nvox) {
+            _temporal_weight.reserve(temporal_weight.size());
+            for (size_t t = 0; t < temporal_weight.size(); t++)
+                _temporal_weight.push_back(temporal_weight[t][inputIndex]);
+        }
+
+        inline void Project(int index, double value, double& signal, double& weight) const {
+            for (size_t t = 0; t < _temporal_weight.size(); t++) {
+                signal += _temporal_weight[t] * value * _volume[index + t * _nvox];
+                weight += _temporal_weight[t] * value;
+            }
+        }
+
+        inline void BackProject(int index, double value, double error, double weight, RealPixel *addon, RealPixel *confidence) const {
+            for (size_t t = 0; t < _temporal_weight.size(); t++) {
+                addon[index + t * _nvox] += _temporal_weight[t] * value * error * weight;
+                confidence[index + t * _nvox] += _temporal_weight[t] * value * weight;
+            }
+        }
+    };
+
+    /**
+     * @brief Project a slice from the volume data of a signal model.
+     * @param sample sample(i, j) tells whether pixel (i, j) is projected
+     * @param inside inside(index) tells whether a volume voxel is in the reconstruction mask
+     * @param store store(i, j, signal, weight, pixel_inside) receives the weighted sums of every projected pixel
+     * @details Every modality runs the same loop over the compressed rows of the system matrix, only the
+     * signal model differs.
+     */
+    template <class Signal, class Sample, class Inside, class Store>
+    void ProjectSlice(const SliceCoeffs& coeffs, const Signal& model, Sample sample, Inside inside, Store store) {
+        for (int i = 0; i < coeffs.GetX(); i++)
+            for (int j = 0; j < coeffs.GetY(); j++)
+                if (sample(i, j)) {
+                    double signal = 0, weight = 0;
+                    bool pixel_inside = false;
+                    for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                        const int index = coeffs.Index(k);
+                        model.Project(index, coeffs.Value(k), signal, weight);
+                        if (inside(index))
+                            pixel_inside = true;
+                    }
+                    store(i, j, signal, weight, pixel_inside);
+                }
+    }
+
+    /**
+     * @brief Simulate a slice from the volume data of a signal model.
+     * @param sample sample(i, j) tells whether pixel (i, j) is simulated
+     * @param inside inside(index) tells whether a volume voxel is in the reconstruction mask
+     * @return whether any simulated pixel overlaps the mask
+     * @details The outputs have to be cleared by the caller.
+     */
+    template <class Signal, class Sample, class Inside>
+    bool SimulateSlice(const SliceCoeffs& coeffs, const Signal& model, Sample sample, Inside inside,
+            RealImage& sim_slice, RealImage& sim_weight, RealImage& sim_inside) {
+        bool slice_inside = false;
+        ProjectSlice(coeffs, model, sample, inside, [&](int i, int j, double signal, double weight, bool pixel_inside) {
+            if (pixel_inside) {
+                sim_inside(i, j, 0) = 1;
+                slice_inside = true;
+            }
+            if (weight > 0) {
+                sim_slice(i, j, 0) = signal / weight;
+                sim_weight(i, j, 0) = weight;
+            }
+        });
+        return slice_inside;
+    }
+
+    /**
+     * @brief Distribute the weighted errors of a slice to the volume data of a signal model (superresolution).
+     * @param residual residual(i, j, error, weight) tells whether pixel (i, j) contributes and sets its error and weight
+     * @param include include(k, index) tells whether coefficient k, of volume voxel index, contributes
+     */
+    template <class Signal, class Residual, class Include>
+    void BackProjectSlice(const SliceCoeffs& coeffs, const Signal& model, Residual residual, Include include,
+            RealPixel *addon, RealPixel *confidence) {
+        for (int i = 0; i < coeffs.GetX(); i++)
+            for (int j = 0; j < coeffs.GetY(); j++) {
+                double error, weight;
+                if (residual(i, j, error, weight))
+                    for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
+                        if (include(k, coeffs.Index(k)))
+                            model.BackProject(coeffs.Index(k), coeffs.Value(k), error, weight, addon, confidence);
+            }
+    }
+
+    /// Distribute the weighted errors of a slice with all coefficients contributing (see above)
+    template <class Signal, class Residual>
+    void BackProjectSlice(const SliceCoeffs& coeffs, const Signal& model, Residual residual,
+            RealPixel *addon, RealPixel *confidence) {
+        BackProjectSlice(coeffs, model, residual, [](int, int) { return true; }, addon, confidence);
+    }
+
+    /**
+     * @brief Back-projection of a set of slices into addon and confidence buffers (superresolution).
+     * @details Body::AddSlice(inputIndex, addon, confidence) adds the contribution of a slice. With groups of
+     * slices whose footprints are disjoint (see DisjointSliceGroups), the groups run one after the other and
+     * the slices of a group in parallel on the same buffers, so no voxel is written by two threads at once.
+     * Without groups, the slices are reduced over per-thread copies of the buffers.
+     */
+    template <class Body>
+    class BackProjectSlices {
+        const Body& body;
+        size_t addon_size;
+        size_t confidence_size;
+
+        /// Slices of a group added to the shared buffers
+        class Group {
+            const Body& body;
+            const Array<int>& slices;
+            RealPixel *addon;
+            RealPixel *confidence;
+
+        public:
+            Group(const Body& body, const Array<int>& slices, RealPixel *addon, RealPixel *confidence) :
+                body(body), slices(slices), addon(addon), confidence(confidence) {}
+
+            void operator()(const blocked_range<size_t>& r) const {
+                for (size_t s = r.begin(); s < r.end(); ++s)
+                    body.AddSlice(slices[s], addon, confidence);
+            }
+        };
+
+    public:
+        Array<RealPixel> addon;
+        Array<RealPixel> confidence;
+
+        BackProjectSlices(const Body& body, size_t addon_size, size_t confidence_size) :
+            body(body), addon_size(addon_size), confidence_size(confidence_size) {
+            Clear();
+        }
+
+        BackProjectSlices(BackProjectSlices& x, split) :
+            body(x.body), addon_size(x.addon_size), confidence_size(x.confidence_size) {
+            Clear();
+        }
+
+        void Clear() {
+            addon.assign(addon_size, 0);
+            confidence.assign(confidence_size, 0);
+        }
+
+        void operator()(const blocked_range<size_t>& r) {
+            for (size_t inputIndex = r.begin(); inputIndex < r.end(); ++inputIndex)
+                body.AddSlice(inputIndex, addon.data(), confidence.data());
+        }
+
+        void join(const BackProjectSlices& y) {
+            for (size_t i = 0; i < addon.size(); i++)
+                addon[i] += y.addon[i];
+            for (size_t i = 0; i < confidence.size(); i++)
+                confidence[i] += y.confidence[i];
+        }
+
+        /// Back-project the given number of slices, by groups if there are any
+        void operator()(size_t number_of_slices, const Array<Array<int>>& groups) {
+            if (groups.empty()) {
+                parallel_reduce(blocked_range<size_t>(0, number_of_slices), *this);
+                return;
+            }
+            for (const Array<int>& slices : groups)
+                parallel_for(blocked_range<size_t>(0, slices.size()), Group(body, slices, addon.data(), confidence.data()));
+        }
+    };
+
+} // namespace svrtk
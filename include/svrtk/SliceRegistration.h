@@ -0,0 +1,130 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// MIRTK
+#include "mirtk/Common.h"
+#include "mirtk/Array.h"
+#include "mirtk/GenericImage.h"
+#include "mirtk/RigidTransformation.h"
+
+// C++ Standard
+#include <limits>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Multi-resolution pyramid of a registration source volume.
+     * @details Level 0 is the volume itself, every further level is smoothed with a
+     * [1 2 1] binomial kernel and subsampled by two. Background voxels (values at or
+     * below the background value) do not contribute to the smoothing and remain
+     * background, so that samples touching them are excluded from the similarity.
+     * The pyramid is built once per SVR iteration and shared by all slices.
+     */
+    class RegistrationPyramid {
+    public:
+        /// Marker of background voxels
+        static constexpr float Background = -numeric_limits<float>::max();
+
+        struct Level {
+            int x, y, z;
+            /// World to voxel transformation (rows of a 3x4 affine matrix)
+            double w2i[3][4];
+            /// Largest voxel size [mm]
+            double voxel_size;
+            Array<float> data;
+        };
+
+    protected:
+        Array<Level> _levels;
+        /// Intensity range of the foreground
+        double _min, _max;
+
+    public:
+        /**
+         * @brief Build the pyramid.
+         * @param volume source volume
+         * @param background background value, -infinity if all voxels are foreground
+         * @param levels maximum number of levels, coarse levels with less than 4 voxels in a dimension are skipped
+         */
+        void Initialize(const GreyImage& volume, double background, int levels);
+
+        inline int NumberOfLevels() const { return _levels.size(); }
+        inline const Level& operator[](int level) const { return _levels[level]; }
+        inline double Min() const { return _min; }
+        inline double Max() const { return _max; }
+    };
+
+    /**
+     * @brief Rigid 2D slice to 3D volume registration.
+     * @details Specialised replacement of the generic MIRTK registration for rigid SVR.
+     * Only the foreground pixels of the slice are mapped into the volume and the
+     * similarity (global NCC, or NMI with cubic B-spline Parzen windows) and its analytic
+     * gradient are accumulated over them, without resampling the volume into the slice
+     * domain. The transformation is optimised by gradient ascent with an adaptive step
+     * from the coarsest to the finest pyramid level. Updates are applied as incremental
+     * rotations about the slice centre and translations, with rotations scaled by the
+     * slice radius so that all parameters are in mm. The class holds no state per slice
+     * and can be used concurrently.
+     */
+    class RigidSliceRegistration {
+    public:
+        enum Similarity { NMI, NCC };
+
+    protected:
+        const RegistrationPyramid& _source;
+        Similarity _similarity;
+        int _bins;
+        int _max_iterations;
+        double _min_step;
+
+    public:
+        /**
+         * @param source pyramid of the source volume
+         * @param similarity similarity measure
+         * @param bins number of NMI histogram bins (<= 0 for the default of 64)
+         */
+        RigidSliceRegistration(const RegistrationPyramid& source, Similarity similarity, int bins = 0);
+
+        /// Maximum number of iterations per level
+        inline void SetMaxIterations(int max_iterations) { _max_iterations = max_iterations; }
+        /// Smallest step at the finest level [mm]
+        inline void SetMinStep(double min_step) { _min_step = min_step; }
+
+        /**
+         * @brief Register a slice to the source volume.
+         * @param target slice
+         * @param background background value of the slice, -infinity if all pixels are foreground
+         * @param transformation initial guess on input, result on output (maps slice to volume world coordinates)
+         * @param initial_similarity optional output of the similarity of the initial guess at the finest level
+         * @return final similarity, or -infinity if the slice has too little overlap with the volume
+         */
+        double Run(const GreyImage& target, double background, RigidTransformation& transformation, double *initial_similarity = nullptr) const;
+
+        /**
+         * @brief Similarity of a slice at the finest level for the given transformation, without optimisation.
+         * @details Used to measure the improvement of a registration made by another method.
+         */
+        double Evaluate(const GreyImage& target, double background, const RigidTransformation& transformation) const;
+    };
+
+} // namespace svrtk
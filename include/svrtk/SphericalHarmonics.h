@@ -42,29 +42,53 @@ namespace svrtk {
         
         Matrix _SHT;
         Matrix _iSHT;
-        
-        Matrix shTransform(Matrix directions, int lmax);
+
+        /// Row-major copies of _SHT and _iSHT (pseudo-inverse) used by the batched transforms
+        Array<double> _SHT_data;
+        Array<double> _iSHT_data;
+
+        /// Update the row-major copies after _SHT and _iSHT have been set
+        void UpdateTransformData();
+
+        /// Product of a row-major matrix with a block of voxels stored with one plane per row (as the volumes of a 4D image)
+        static void Transform(const Array<double>& matrix, int rows, int cols, const RealPixel *in, RealPixel *out, size_t nvox);
+
+        Matrix shTransform(const Matrix& directions, int lmax);
         void LegendrePolynomials(Vector& array, const int lmax, const int m, const double x);
         
-        Matrix cartesian2spherical (Matrix xyz);
+        Matrix cartesian2spherical (const Matrix& xyz);
         
-        Vector LSFit(Vector signal, Matrix dirs, int lmax);
+        Vector LSFit(const Vector& signal, const Matrix& dirs, int lmax);
         
-        void InitSHT(Matrix dirs, int lmax);
+        void InitSHT(const Matrix& dirs, int lmax);
         
-        Matrix SHbasis(Matrix dirs, int lmax);
+        Matrix SHbasis(const Matrix& dirs, int lmax);
         
-        Vector Coeff2Signal(Vector c);
+        Vector Coeff2Signal(const Vector& c);
         
-        Vector Signal2Coeff(Vector s);
+        Vector Signal2Coeff(const Vector& s);
         
-        RealImage Signal2Coeff(RealImage signal);
+        RealImage Signal2Coeff(const RealImage& signal);
         
-        RealImage Coeff2Signal(RealImage coeff);
+        RealImage Coeff2Signal(const RealImage& coeff);
+
+        /**
+         * @brief Fit the SH coefficients of a block of voxels as one matrix-matrix product with the pseudo-inverse.
+         * @param signal nvox values of each direction, direction after direction (as a 4D image)
+         * @param coeffs output, nvox values of each coefficient, coefficient after coefficient
+         */
+        void Signal2Coeff(const RealPixel *signal, RealPixel *coeffs, size_t nvox) const;
+
+        /**
+         * @brief Compute the signal of a block of voxels from their SH coefficients as one matrix-matrix product.
+         * @param coeffs nvox values of each coefficient, coefficient after coefficient (as a 4D image)
+         * @param signal output, nvox values of each direction, direction after direction
+         */
+        void Coeff2Signal(const RealPixel *coeffs, RealPixel *signal, size_t nvox) const;
         
         Matrix LaplaceBeltramiMatrix(int lmax);
         
-        void InitSHTRegul(Matrix dirs, double lambda, int lmax);
+        void InitSHTRegul(const Matrix& dirs, double lambda, int lmax);
         
         inline int NforL (int lmax);
         inline double LegendrePolynomialsHelper (const double x, const double m);
@@ -0,0 +1,239 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// MIRTK
+#include "mirtk/Common.h"
+#include "mirtk/Array.h"
+#include "mirtk/GenericImage.h"
+
+// C++ Standard
+#include <algorithm>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Slice-to-volume system matrix of a single slice in compressed sparse row (CSR) storage.
+     * @details Each slice pixel (i, j) is one row. All coefficients of a slice live in two
+     * contiguous arrays holding the linear index of the volume voxel and the PSF weight,
+     * and row (i, j) occupies the range [Begin(i, j), End(i, j)) of these arrays.
+     * Rows are appended in the order i-major, j-minor and every pixel must be closed with
+     * EndRow(), including pixels without coefficients.
+     */
+    class SliceCoeffs {
+    protected:
+        /// Slice dimensions
+        int _x = 0;
+        int _y = 0;
+        /// Row offsets (size _x * _y + 1)
+        Array<int> _row;
+        /// Linear volume voxel indices
+        Array<int> _index;
+        /// PSF weights
+        Array<double> _value;
+
+    public:
+        /// Start filling the matrix of a slice with the given dimensions
+        inline void Initialize(int x, int y) {
+            _x = x;
+            _y = y;
+            _row.clear();
+            _row.reserve(x * y + 1);
+            _row.push_back(0);
+            _index.clear();
+            _value.clear();
+        }
+
+        /// Release all storage
+        inline void Clear() {
+            _x = _y = 0;
+            Array<int>().swap(_row);
+            Array<int>().swap(_index);
+            Array<double>().swap(_value);
+        }
+
+        /// Append a coefficient to the current row
+        inline void Add(int index, double value) {
+            _index.push_back(index);
+            _value.push_back(value);
+        }
+
+        /// Close the current row
+        inline void EndRow() {
+            _row.push_back(_index.size());
+        }
+
+        /// Whether the matrix has not been filled (e.g. excluded slices)
+        inline bool Empty() const { return _row.empty(); }
+
+        inline int GetX() const { return _x; }
+        inline int GetY() const { return _y; }
+
+        /// First coefficient of pixel (i, j)
+        inline int Begin(int i, int j) const { return _row[i * _y + j]; }
+        /// One past the last coefficient of pixel (i, j)
+        inline int End(int i, int j) const { return _row[i * _y + j + 1]; }
+        /// Number of coefficients of pixel (i, j)
+        inline int Size(int i, int j) const { return End(i, j) - Begin(i, j); }
+
+        /// Linear volume voxel index of coefficient k
+        inline int Index(int k) const { return _index[k]; }
+        /// PSF weight of coefficient k
+        inline double Value(int k) const { return _value[k]; }
+
+        /// Total number of stored coefficients
+        inline size_t NumberOfCoefficients() const { return _index.size(); }
+
+        /// Bytes allocated for the matrix
+        inline size_t MemoryUsage() const {
+            return _row.capacity() * sizeof(int) + _index.capacity() * sizeof(int) + _value.capacity() * sizeof(double);
+        }
+    };
+
+    /**
+     * @brief Transposed (volume-major) slice-to-volume system matrix in CSR storage.
+     * @details Each volume voxel is one row listing the (slice, pixel, weight) entries of all
+     * slice pixels that project onto it. The pixel is the linear index into the slice image.
+     * Built from the per-slice matrices, it allows back-projection as a race-free gather over
+     * volume voxels instead of a scatter into per-thread copies of the volume.
+     */
+    class VolumeCoeffs {
+    protected:
+        /// Row offsets (size number of voxels + 1)
+        Array<size_t> _row;
+        /// Slice indices
+        Array<int> _slice;
+        /// Linear pixel indices within the slice
+        Array<int> _pixel;
+        /// PSF weights
+        Array<double> _value;
+
+    public:
+        /**
+         * @brief Transpose the per-slice matrices of a volume with the given number of voxels.
+         * @param include optional per-slice flags of the coefficients to keep, aligned with the coefficients of each slice
+         */
+        void Initialize(const Array<SliceCoeffs>& slicecoeffs, int nvox, const Array<Array<bool>> *include = nullptr) {
+            //count the coefficients of each voxel
+            _row.assign(nvox + 1, 0);
+            for (size_t s = 0; s < slicecoeffs.size(); s++)
+                for (size_t k = 0; k < slicecoeffs[s].NumberOfCoefficients(); k++)
+                    if (!include || (*include)[s][k])
+                        _row[slicecoeffs[s].Index(k) + 1]++;
+            for (int v = 0; v < nvox; v++)
+                _row[v + 1] += _row[v];
+
+            //fill the rows in slice order
+            _slice.resize(_row[nvox]);
+            _pixel.resize(_row[nvox]);
+            _value.resize(_row[nvox]);
+            Array<size_t> next(_row.begin(), _row.end() - 1);
+            for (size_t s = 0; s < slicecoeffs.size(); s++) {
+                const SliceCoeffs& coeffs = slicecoeffs[s];
+                for (int i = 0; i < coeffs.GetX(); i++)
+                    for (int j = 0; j < coeffs.GetY(); j++)
+                        for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                            if (include && !(*include)[s][k])
+                                continue;
+                            const size_t n = next[coeffs.Index(k)]++;
+                            _slice[n] = s;
+                            _pixel[n] = j * coeffs.GetX() + i;
+                            _value[n] = coeffs.Value(k);
+                        }
+            }
+        }
+
+        /// Release all storage
+        inline void Clear() {
+            Array<size_t>().swap(_row);
+            Array<int>().swap(_slice);
+            Array<int>().swap(_pixel);
+            Array<double>().swap(_value);
+        }
+
+        /// Whether the matrix has not been built
+        inline bool Empty() const { return _row.empty(); }
+
+        /// First entry of volume voxel v
+        inline size_t Begin(int v) const { return _row[v]; }
+        /// One past the last entry of volume voxel v
+        inline size_t End(int v) const { return _row[v + 1]; }
+
+        /// Slice index of entry n
+        inline int Slice(size_t n) const { return _slice[n]; }
+        /// Linear slice pixel index of entry n
+        inline int Pixel(size_t n) const { return _pixel[n]; }
+        /// PSF weight of entry n
+        inline double Value(size_t n) const { return _value[n]; }
+
+        /// Total number of stored coefficients
+        inline size_t NumberOfCoefficients() const { return _value.size(); }
+
+        /// Bytes allocated for the matrix
+        inline size_t MemoryUsage() const {
+            return _row.capacity() * sizeof(size_t) + _slice.capacity() * sizeof(int) + _pixel.capacity() * sizeof(int) + _value.capacity() * sizeof(double);
+        }
+    };
+
+    /**
+     * @brief Greedy colouring of slices into groups whose footprints are disjoint.
+     * @details The footprint of a slice is the set of blocks of block x block x block voxels of a volume
+     * with the given dimensions that its coefficients touch. Every slice joins the first group whose blocks
+     * it doesn't touch, so the back-projections of the slices of a group can be added to shared buffers in
+     * parallel. The cost of a test is the size of the footprint of the slice; groups are kept however few
+     * slices they hold.
+     */
+    inline Array<Array<int>> DisjointSliceGroups(const Array<SliceCoeffs>& slicecoeffs, int x, int y, int z, int block = 4) {
+        const int bx = (x + block - 1) / block;
+        const int by = (y + block - 1) / block;
+        const int bz = (z + block - 1) / block;
+
+        Array<Array<int>> groups;
+        Array<Array<bool>> occupied;
+        Array<int> footprint;
+        for (size_t s = 0; s < slicecoeffs.size(); s++) {
+            const SliceCoeffs& coeffs = slicecoeffs[s];
+            footprint.clear();
+            for (size_t k = 0; k < coeffs.NumberOfCoefficients(); k++) {
+                const int index = coeffs.Index(k);
+                const int i = index % x, j = index / x % y, l = index / (x * y);
+                footprint.push_back((l / block * by + j / block) * bx + i / block);
+            }
+            sort(footprint.begin(), footprint.end());
+            footprint.erase(unique(footprint.begin(), footprint.end()), footprint.end());
+
+            size_t g = 0;
+            for (; g < groups.size(); g++)
+                if (none_of(footprint.begin(), footprint.end(), [&](int b) { return occupied[g][b]; }))
+                    break;
+            if (g == groups.size()) {
+                groups.emplace_back();
+                occupied.emplace_back(bx * by * bz, false);
+            }
+            groups[g].push_back(s);
+            for (int b : footprint)
+                occupied[g][b] = true;
+        }
+        return groups;
+    }
+
+} // namespace svrtk
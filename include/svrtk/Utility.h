@@ -291,6 +291,16 @@ namespace svrtk::Utility {
      */
     void HalfImage(const RealImage& image, Array<RealImage>& stacks);
 
+    /**
+     * @brief Append the memory usage of named buffers to a CSV report.
+     * @details Writes one line per buffer, their total and the current and peak resident memory
+     * of the process, all tagged with the stage. The header is written when the file is created.
+     * @param file_name CSV file
+     * @param stage name of the stage the usage was measured after
+     * @param usage buffer names and bytes
+     */
+    void AppendMemoryReport(const string& file_name, const string& stage, const Array<pair<string, size_t>>& usage);
+
     ////////////////////////////////////////////////////////////////////////////////
     // Inline/template definitions
     ////////////////////////////////////////////////////////////////////////////////
@@ -313,6 +323,25 @@ namespace svrtk::Utility {
 
     //-------------------------------------------------------------------
 
+    /// Bytes held by the voxels of an image
+    template<typename ImageType>
+    inline size_t MemoryUsage(const GenericImage<ImageType>& image) {
+        return size_t(image.NumberOfVoxels()) * sizeof(ImageType);
+    }
+
+    //-------------------------------------------------------------------
+
+    /// Bytes held by the voxels of an array of images
+    template<typename ImageType>
+    inline size_t MemoryUsage(const Array<GenericImage<ImageType>>& images) {
+        size_t bytes = 0;
+        for (const auto& image : images)
+            bytes += MemoryUsage(image);
+        return bytes;
+    }
+
+    //-------------------------------------------------------------------
+
     /**
      * @brief Binarise mask.
      * If template image has been masked instead of creating the mask in separate
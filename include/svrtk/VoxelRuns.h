@@ -0,0 +1,116 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// MIRTK
+#include "mirtk/Common.h"
+#include "mirtk/Array.h"
+#include "mirtk/GenericImage.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Run-length list of the active voxels of a volume.
+     * @details For every row (y, z) of the volume, the runs of consecutive voxels along x with
+     * a positive value in the source image (e.g. the confidence map) are stored as ranges
+     * [RunBegin(k), RunEnd(k)) of x. The runs of row (y, z) are [Begin(y, z), End(y, z)).
+     * Volume-wide kernels iterating over the runs skip the background, which is most of
+     * the bounding grid of a fetal brain reconstruction.
+     */
+    class VoxelRuns {
+    protected:
+        /// Volume dimensions
+        int _x = 0;
+        int _y = 0;
+        int _z = 0;
+        /// Row offsets (size _y * _z + 1)
+        Array<int> _row;
+        /// First voxel of each run
+        Array<int> _begin;
+        /// One past the last voxel of each run
+        Array<int> _end;
+        /// Number of active voxels
+        size_t _count = 0;
+
+    public:
+        /// Build the runs of the positive voxels of the first frame of the image
+        void Initialize(const RealImage& image) {
+            _x = image.GetX();
+            _y = image.GetY();
+            _z = image.GetZ();
+            _row.clear();
+            _row.reserve(_y * _z + 1);
+            _row.push_back(0);
+            _begin.clear();
+            _end.clear();
+            _count = 0;
+
+            const RealPixel *pi = image.Data();
+            for (int z = 0; z < _z; z++)
+                for (int y = 0; y < _y; y++, pi += _x) {
+                    for (int x = 0; x < _x; x++) {
+                        if (pi[x] <= 0)
+                            continue;
+                        const int begin = x;
+                        while (x < _x && pi[x] > 0)
+                            x++;
+                        _begin.push_back(begin);
+                        _end.push_back(x);
+                        _count += x - begin;
+                    }
+                    _row.push_back(_begin.size());
+                }
+        }
+
+        /// Release all storage
+        inline void Clear() {
+            _x = _y = _z = 0;
+            _count = 0;
+            Array<int>().swap(_row);
+            Array<int>().swap(_begin);
+            Array<int>().swap(_end);
+        }
+
+        /// Whether the runs have not been built
+        inline bool Empty() const { return _row.empty(); }
+
+        inline int GetX() const { return _x; }
+        inline int GetY() const { return _y; }
+        inline int GetZ() const { return _z; }
+
+        /// First run of row (y, z)
+        inline int Begin(int y, int z) const { return _row[z * _y + y]; }
+        /// One past the last run of row (y, z)
+        inline int End(int y, int z) const { return _row[z * _y + y + 1]; }
+
+        /// First voxel (x) of run k
+        inline int RunBegin(int k) const { return _begin[k]; }
+        /// One past the last voxel (x) of run k
+        inline int RunEnd(int k) const { return _end[k]; }
+
+        /// Total number of runs
+        inline size_t NumberOfRuns() const { return _begin.size(); }
+        /// Total number of active voxels
+        inline size_t NumberOfVoxels() const { return _count; }
+    };
+
+} // namespace svrtk
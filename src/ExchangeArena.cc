@@ -0,0 +1,278 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SVRTK
+#include "svrtk/ExchangeArena.h"
+
+// C++ Standard
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    namespace {
+
+        const char ArenaMagic[8] = {'S', 'V', 'R', 'T', 'K', 'A', 'R', 'N'};
+        const uint32_t ArenaVersion = 1;
+        /// Payload alignment
+        const uint64_t ArenaAlignment = 64;
+
+        inline uint64_t Align(uint64_t offset) {
+            return (offset + ArenaAlignment - 1) / ArenaAlignment * ArenaAlignment;
+        }
+
+        ExchangeArena::Geometry ToGeometry(const ImageAttributes& attr) {
+            ExchangeArena::Geometry geometry;
+            geometry.x = attr._x;
+            geometry.y = attr._y;
+            geometry.z = attr._z;
+            geometry.t = attr._t;
+            geometry.dx = attr._dx;
+            geometry.dy = attr._dy;
+            geometry.dz = attr._dz;
+            geometry.dt = attr._dt;
+            geometry.xorigin = attr._xorigin;
+            geometry.yorigin = attr._yorigin;
+            geometry.zorigin = attr._zorigin;
+            geometry.torigin = attr._torigin;
+            for (int i = 0; i < 3; i++) {
+                geometry.xaxis[i] = attr._xaxis[i];
+                geometry.yaxis[i] = attr._yaxis[i];
+                geometry.zaxis[i] = attr._zaxis[i];
+            }
+            for (int r = 0; r < 4; r++)
+                for (int c = 0; c < 4; c++)
+                    geometry.smat[r * 4 + c] = attr._smat(r, c);
+            return geometry;
+        }
+
+        ImageAttributes ToAttributes(const ExchangeArena::Geometry& geometry) {
+            ImageAttributes attr;
+            attr._x = geometry.x;
+            attr._y = geometry.y;
+            attr._z = geometry.z;
+            attr._t = geometry.t;
+            attr._dx = geometry.dx;
+            attr._dy = geometry.dy;
+            attr._dz = geometry.dz;
+            attr._dt = geometry.dt;
+            attr._xorigin = geometry.xorigin;
+            attr._yorigin = geometry.yorigin;
+            attr._zorigin = geometry.zorigin;
+            attr._torigin = geometry.torigin;
+            for (int i = 0; i < 3; i++) {
+                attr._xaxis[i] = geometry.xaxis[i];
+                attr._yaxis[i] = geometry.yaxis[i];
+                attr._zaxis[i] = geometry.zaxis[i];
+            }
+            for (int r = 0; r < 4; r++)
+                for (int c = 0; c < 4; c++)
+                    attr._smat(r, c) = geometry.smat[r * 4 + c];
+            return attr;
+        }
+
+    } // namespace
+
+    //-------------------------------------------------------------------
+
+    ExchangeArena::ExchangeArena() : _data(nullptr), _size(0) {}
+
+    //-------------------------------------------------------------------
+
+    ExchangeArena::~ExchangeArena() {
+        Close();
+    }
+
+    //-------------------------------------------------------------------
+
+    void ExchangeArena::AddImage(const string& name, const RealImage& image) {
+        if (name.size() >= sizeof(Entry::name))
+            throw runtime_error("Exchange arena entry name too long: " + name);
+
+        Pending pending;
+        pending.name = name;
+        pending.kind = IMAGE;
+        pending.voxels = image.Data();
+        pending.count = image.NumberOfVoxels();
+        pending.geometry = ToGeometry(image.Attributes());
+        _pending.push_back(move(pending));
+    }
+
+    //-------------------------------------------------------------------
+
+    void ExchangeArena::AddParameters(const string& name, const Array<double>& parameters) {
+        if (name.size() >= sizeof(Entry::name))
+            throw runtime_error("Exchange arena entry name too long: " + name);
+
+        Pending pending;
+        pending.name = name;
+        pending.kind = PARAMETERS;
+        pending.voxels = nullptr;
+        pending.parameters = parameters;
+        pending.count = parameters.size();
+        memset(&pending.geometry, 0, sizeof(Geometry));
+        _pending.push_back(move(pending));
+    }
+
+    //-------------------------------------------------------------------
+
+    void ExchangeArena::Write(const string& file_name) {
+        //layout: header, entry table, aligned payloads
+        Array<uint64_t> offsets(_pending.size());
+        uint64_t size = Align(sizeof(Header) + _pending.size() * sizeof(Entry));
+        for (size_t i = 0; i < _pending.size(); i++) {
+            offsets[i] = size;
+            const size_t value_size = _pending[i].kind == IMAGE ? sizeof(RealPixel) : sizeof(double);
+            size = Align(size + _pending[i].count * value_size);
+        }
+
+        //write to a temporary file so that the rename replaces the previous arena atomically
+        const string tmp_name = file_name + ".tmp";
+        const int fd = open(tmp_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw runtime_error("Exchange arena " + tmp_name + " couldn't be created!");
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            throw runtime_error("Exchange arena " + tmp_name + " couldn't be resized!");
+        }
+        char *data = static_cast<char*>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+        close(fd);
+        if (data == MAP_FAILED)
+            throw runtime_error("Exchange arena " + tmp_name + " couldn't be mapped!");
+
+        Header *header = reinterpret_cast<Header*>(data);
+        memcpy(header->magic, ArenaMagic, sizeof(ArenaMagic));
+        header->version = ArenaVersion;
+        header->number_of_entries = _pending.size();
+        header->size = size;
+
+        Entry *entries = reinterpret_cast<Entry*>(data + sizeof(Header));
+        #pragma omp parallel for
+        for (size_t i = 0; i < _pending.size(); i++) {
+            const Pending& pending = _pending[i];
+            Entry& entry = entries[i];
+            memset(&entry, 0, sizeof(Entry));
+            strncpy(entry.name, pending.name.c_str(), sizeof(entry.name) - 1);
+            entry.kind = pending.kind;
+            entry.offset = offsets[i];
+            entry.count = pending.count;
+            entry.geometry = pending.geometry;
+
+            if (pending.kind == IMAGE)
+                memcpy(data + offsets[i], pending.voxels, pending.count * sizeof(RealPixel));
+            else
+                memcpy(data + offsets[i], pending.parameters.data(), pending.count * sizeof(double));
+        }
+
+        munmap(data, size);
+        _pending.clear();
+
+        if (rename(tmp_name.c_str(), file_name.c_str()) != 0)
+            throw runtime_error("Exchange arena " + file_name + " couldn't be written!");
+    }
+
+    //-------------------------------------------------------------------
+
+    bool ExchangeArena::Open(const string& file_name) {
+        Close();
+
+        const int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+            close(fd);
+            return false;
+        }
+
+        //copy-on-write, so that images can refer to the payloads
+        void *data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            return false;
+
+        _data = static_cast<char*>(data);
+        _size = st.st_size;
+
+        //validate the header and the entry table
+        const Header *header = reinterpret_cast<const Header*>(_data);
+        bool valid = memcmp(header->magic, ArenaMagic, sizeof(ArenaMagic)) == 0 && header->version == ArenaVersion
+            && header->size == _size && sizeof(Header) + header->number_of_entries * sizeof(Entry) <= _size;
+
+        const Entry *entries = reinterpret_cast<const Entry*>(_data + sizeof(Header));
+        for (uint32_t i = 0; valid && i < header->number_of_entries; i++) {
+            const Entry& entry = entries[i];
+            const size_t value_size = entry.kind == IMAGE ? sizeof(RealPixel) : sizeof(double);
+            //the payload must be aligned and inside the file, without overflowing offset + count * value_size
+            valid = entry.name[sizeof(entry.name) - 1] == '\0' && (entry.kind == IMAGE || entry.kind == PARAMETERS)
+                && entry.offset % ArenaAlignment == 0 && entry.offset <= _size && entry.count <= (_size - entry.offset) / value_size;
+            if (valid)
+                _entries[entry.name] = &entry;
+        }
+
+        if (!valid)
+            Close();
+        return valid;
+    }
+
+    //-------------------------------------------------------------------
+
+    void ExchangeArena::Close() {
+        if (_data)
+            munmap(_data, _size);
+        _data = nullptr;
+        _size = 0;
+        _entries.clear();
+    }
+
+    //-------------------------------------------------------------------
+
+    const ExchangeArena::Entry *ExchangeArena::Find(const string& name, EntryKind kind) const {
+        const auto it = _entries.find(name);
+        if (it == _entries.end() || it->second->kind != kind)
+            throw runtime_error("Exchange arena entry " + name + " not found!");
+        return it->second;
+    }
+
+    //-------------------------------------------------------------------
+
+    void ExchangeArena::GetImage(const string& name, RealImage& image) const {
+        const Entry *entry = Find(name, IMAGE);
+        const ImageAttributes attr = ToAttributes(entry->geometry);
+        if ((uint64_t)attr.NumberOfLatticePoints() != entry->count)
+            throw runtime_error("Exchange arena entry " + name + " has an inconsistent size!");
+        image.Initialize(attr, -1, reinterpret_cast<RealPixel*>(_data + entry->offset));
+    }
+
+    //-------------------------------------------------------------------
+
+    Array<double> ExchangeArena::GetParameters(const string& name) const {
+        const Entry *entry = Find(name, PARAMETERS);
+        const double *values = reinterpret_cast<const double*>(_data + entry->offset);
+        return Array<double>(values, values + entry->count);
+    }
+
+} // namespace svrtk
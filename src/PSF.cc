@@ -0,0 +1,131 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SVRTK
+#include "svrtk/PSF.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    PSFCache& PSFCache::Instance() {
+        static PSFCache cache;
+        return cache;
+    }
+
+    //-------------------------------------------------------------------
+
+    shared_ptr<const PSFKernel> PSFCache::Get(double dx, double dy, double dz, double sigmax, double sigmay, double sigmaz, double size, double res) {
+        const Key key(dx, dy, dz, sigmax, sigmay, sigmaz, size, res);
+
+        {
+            lock_guard<mutex> lock(_mutex);
+            const auto it = _kernels.find(key);
+            if (it != _kernels.end())
+                return it->second;
+        }
+
+        //compute outside of the lock, concurrent first requests for the same key yield identical kernels
+        shared_ptr<const PSFKernel> kernel = Compute(dx, dy, dz, sigmax, sigmay, sigmaz, size, res);
+
+        lock_guard<mutex> lock(_mutex);
+        return _kernels.emplace(key, move(kernel)).first->second;
+    }
+
+    //-------------------------------------------------------------------
+
+    void PSFCache::Clear() {
+        lock_guard<mutex> lock(_mutex);
+        _kernels.clear();
+    }
+
+    //-------------------------------------------------------------------
+
+    shared_ptr<const PSFKernel> PSFCache::Compute(double dx, double dy, double dz, double sigmax, double sigmay, double sigmaz, double size, double res) {
+        shared_ptr<PSFKernel> kernel = make_shared<PSFKernel>();
+
+        //number of voxels in each direction
+        //the ROI is 2*voxel dimension
+        int xDim = round(2 * dx / size);
+        int yDim = round(2 * dy / size);
+        int zDim = round(2 * dz / size);
+
+        ///test to make dimension always odd
+        xDim = xDim / 2 * 2 + 1;
+        yDim = yDim / 2 * 2 + 1;
+        zDim = zDim / 2 * 2 + 1;
+
+        //image corresponding to PSF
+        ImageAttributes attr;
+        attr._x = xDim;
+        attr._y = yDim;
+        attr._z = zDim;
+        attr._dx = size;
+        attr._dy = size;
+        attr._dz = size;
+        RealImage& PSF = kernel->image;
+        PSF.Initialize(attr);
+
+        //centre of PSF
+        double cx = 0.5 * (xDim - 1);
+        double cy = 0.5 * (yDim - 1);
+        double cz = 0.5 * (zDim - 1);
+        PSF.ImageToWorld(cx, cy, cz);
+
+        kernel->offset.reserve(PSF.NumberOfVoxels());
+        kernel->value.reserve(PSF.NumberOfVoxels());
+
+        double sum = 0;
+        for (int i = 0; i < xDim; i++)
+            for (int j = 0; j < yDim; j++)
+                for (int k = 0; k < zDim; k++) {
+                    double x = i;
+                    double y = j;
+                    double z = k;
+                    PSF.ImageToWorld(x, y, z);
+                    x -= cx;
+                    y -= cy;
+                    z -= cz;
+                    //continuous PSF does not need to be normalized as discrete will be
+                    PSF(i, j, k) = exp(-x * x / (2 * sigmax * sigmax) - y * y / (2 * sigmay * sigmay) - z * z / (2 * sigmaz * sigmaz));
+                    sum += PSF(i, j, k);
+
+                    //offset in slice image coordinates, in slice image coordinates z is through-plane
+                    kernel->offset.push_back(Point(x / dx, y / dy, z / dz));
+                }
+        PSF /= sum;
+
+        for (int i = 0; i < xDim; i++)
+            for (int j = 0; j < yDim; j++)
+                for (int k = 0; k < zDim; k++)
+                    kernel->value.push_back(PSF(i, j, k));
+
+        kernel->xDim = xDim;
+        kernel->yDim = yDim;
+        kernel->zDim = zDim;
+
+        //maximum dim of rotated kernel - the next higher odd integer plus two to accound for rounding error of tx,ty,tz.
+        //Note conversion from PSF image coordinates to tPSF image coordinates *size/res
+        kernel->dim = floor(ceil(sqrt(double(xDim * xDim + yDim * yDim + zDim * zDim)) * size / res) / 2) * 2 + 1 + 2;
+        kernel->centre = (kernel->dim - 1) / 2;
+
+        return kernel;
+    }
+
+} // namespace svrtk
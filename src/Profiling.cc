@@ -0,0 +1,478 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SVRTK
+#include "svrtk/Profiling.h"
+
+// C++ Standard
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sys/resource.h>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    namespace {
+
+        inline double ClockTime(clockid_t clock) {
+            timespec ts;
+            clock_gettime(clock, &ts);
+            return ts.tv_sec + ts.tv_nsec * 1e-9;
+        }
+
+        string JSONString(const string& str) {
+            string escaped = "\"";
+            for (const char c : str) {
+                if (c == '"' || c == '\\')
+                    escaped += '\\';
+                escaped += c;
+            }
+            return escaped + "\"";
+        }
+
+        string CSVString(const string& str) {
+            string escaped = "\"";
+            for (const char c : str) {
+                if (c == '"')
+                    escaped += '"';
+                escaped += c;
+            }
+            return escaped + "\"";
+        }
+
+        /// Thread utilisation of a stage: CPU time over the wall time of all threads
+        inline double Utilisation(const Profiler::Node& node, int threads) {
+            return node.wall > 0 ? node.cpu / (node.wall * threads) : 0;
+        }
+
+        void WriteNodeJSON(ostream& out, const Profiler::Node& node, int threads, const string& indent) {
+            out << indent << "{\"name\": " << JSONString(node.name) << ", \"type\": \"" << (node.task ? "task" : "stage")
+                << "\", \"calls\": " << node.calls << ", \"wall\": " << node.wall << ", \"cpu\": " << node.cpu
+                << ", \"max_wall\": " << node.max_wall;
+            if (!node.task)
+                out << ", \"utilisation\": " << Utilisation(node, threads) << ", \"peak_rss\": " << node.peak_rss;
+            if (!node.children.empty()) {
+                out << ", \"children\": [\n";
+                for (size_t i = 0; i < node.children.size(); i++) {
+                    WriteNodeJSON(out, *node.children[i], threads, indent + "  ");
+                    out << (i + 1 < node.children.size() ? ",\n" : "\n");
+                }
+                out << indent << "]";
+            }
+            out << "}";
+        }
+
+        void WriteNodeCSV(ostream& out, const Profiler::Node& node, int threads, const string& path) {
+            for (const auto& child : node.children) {
+                const string child_path = path.empty() ? child->name : path + "/" + child->name;
+                out << CSVString(child_path) << "," << (child->task ? "task" : "stage") << "," << child->calls << ","
+                    << child->wall << "," << child->cpu << "," << child->max_wall << ",";
+                if (!child->task)
+                    out << Utilisation(*child, threads) << "," << child->peak_rss;
+                else
+                    out << ",";
+                out << "\n";
+                WriteNodeCSV(out, *child, threads, child_path);
+            }
+        }
+
+        void WriteProfileAtExit() {
+            Profiler::Instance().Write();
+        }
+
+        void WriteTraceAtExit() {
+            Profiler::Instance().WriteTrace();
+        }
+
+    } // namespace
+
+    //-------------------------------------------------------------------
+
+    atomic<bool> Profiler::_enabled(false);
+    atomic<bool> Profiler::_tasks_enabled(false);
+    atomic<bool> Profiler::_tracing(false);
+
+    //-------------------------------------------------------------------
+
+    Profiler::Node& Profiler::Node::Child(const string& name) {
+        Node*& child = children_by_name[name];
+        if (!child) {
+            children.push_back(unique_ptr<Node>(new Node));
+            child = children.back().get();
+            child->name = name;
+        }
+        return *child;
+    }
+
+    //-------------------------------------------------------------------
+
+    Profiler::Node& Profiler::Node::TaskChild(long index) {
+        if (index >= (long)children_by_index.size())
+            children_by_index.resize(index + 1, nullptr);
+        Node*& child = children_by_index[index];
+        if (!child) {
+            child = &Child(name + " " + to_string(index));
+            child->index = index;
+        }
+        return *child;
+    }
+
+    //-------------------------------------------------------------------
+
+    void Profiler::Node::MergeChildren(Node& node) {
+        for (auto& child : node.children) {
+            Node& target = child->index >= 0 ? TaskChild(child->index) : Child(child->name);
+            target.calls += child->calls;
+            target.wall += child->wall;
+            target.cpu += child->cpu;
+            target.max_wall = max(target.max_wall, child->max_wall);
+            target.peak_rss = max(target.peak_rss, child->peak_rss);
+            target.task = child->task;
+            target.MergeChildren(*child);
+        }
+        node.children.clear();
+        node.children_by_name.clear();
+        node.children_by_index.clear();
+    }
+
+    //-------------------------------------------------------------------
+
+    Profiler::Profiler() : _trace_start(0), _start_wall(0), _start_cpu(0), _threads(1) {
+        _root.name = "total";
+    }
+
+    //-------------------------------------------------------------------
+
+    Profiler& Profiler::Instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    //-------------------------------------------------------------------
+
+    void Profiler::SetOwner() {
+        if (_owner == thread::id()) {
+            _owner = this_thread::get_id();
+            _threads = max(1u, thread::hardware_concurrency());
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    void Profiler::Enable(const string& file_name, bool tasks) {
+        Profiler& profiler = Instance();
+        {
+            lock_guard<mutex> lock(profiler._mutex);
+            if (Enabled())
+                return;
+            profiler._file_name = file_name;
+            profiler.SetOwner();
+            profiler._start_wall = WallTime();
+            profiler._start_cpu = ProcessCPUTime();
+        }
+        _tasks_enabled = tasks;
+        _enabled = true;
+        atexit(WriteProfileAtExit);
+    }
+
+    //-------------------------------------------------------------------
+
+    void Profiler::EnableTrace(const string& file_name) {
+        Profiler& profiler = Instance();
+        {
+            lock_guard<mutex> lock(profiler._mutex);
+            if (Tracing())
+                return;
+            profiler._trace_file_name = file_name;
+            profiler.SetOwner();
+            profiler._trace_start = WallTime();
+        }
+        _tracing = true;
+        atexit(WriteTraceAtExit);
+    }
+
+    //-------------------------------------------------------------------
+
+    Profiler::TraceBuffer& Profiler::ThreadTraceBuffer() {
+        thread_local TraceBuffer *buffer = nullptr;
+        if (!buffer) {
+            Profiler& profiler = Instance();
+            lock_guard<mutex> lock(profiler._mutex);
+            profiler._trace_buffers.push_back(unique_ptr<TraceBuffer>(new TraceBuffer));
+            buffer = profiler._trace_buffers.back().get();
+            buffer->thread = this_thread::get_id() == profiler._owner ? 0 : profiler._trace_buffers.size();
+        }
+        return *buffer;
+    }
+
+    //-------------------------------------------------------------------
+
+    void Profiler::WriteJSON(ostream& out) {
+        lock_guard<mutex> lock(_mutex);
+        _root.calls = 1;
+        _root.wall = WallTime() - _start_wall;
+        _root.cpu = ProcessCPUTime() - _start_cpu;
+        _root.max_wall = _root.wall;
+        size_t rss;
+        ResidentMemory(rss, _root.peak_rss);
+
+        out << setprecision(9);
+        out << "{\n  \"threads\": " << _threads << ",\n  \"profile\":\n";
+        WriteNodeJSON(out, _root, _threads, "  ");
+        out << "\n}\n";
+    }
+
+    //-------------------------------------------------------------------
+
+    void Profiler::WriteCSV(ostream& out) {
+        lock_guard<mutex> lock(_mutex);
+        _root.calls = 1;
+        _root.wall = WallTime() - _start_wall;
+        _root.cpu = ProcessCPUTime() - _start_cpu;
+        _root.max_wall = _root.wall;
+        size_t rss;
+        ResidentMemory(rss, _root.peak_rss);
+
+        out << setprecision(9);
+        out << "path,type,calls,wall,cpu,max_wall,utilisation,peak_rss\n";
+        out << CSVString(_root.name) << ",stage,1," << _root.wall << "," << _root.cpu << "," << _root.max_wall << "," << Utilisation(_root, _threads) << "," << _root.peak_rss << "\n";
+        WriteNodeCSV(out, _root, _threads, _root.name);
+    }
+
+    //-------------------------------------------------------------------
+
+    void Profiler::Write() {
+        if (!Enabled() || _file_name.empty())
+            return;
+
+        ofstream out(_file_name);
+        if (!out) {
+            cerr << "Profile " << _file_name << " couldn't be written!" << endl;
+            return;
+        }
+
+        const bool csv = _file_name.size() >= 4 && _file_name.compare(_file_name.size() - 4, 4, ".csv") == 0;
+        if (csv)
+            WriteCSV(out);
+        else
+            WriteJSON(out);
+    }
+
+    //-------------------------------------------------------------------
+
+    void Profiler::WriteTrace(ostream& out) {
+        lock_guard<mutex> lock(_mutex);
+
+        //complete events with microsecond timestamps, one track per thread
+        out << fixed << setprecision(3);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        for (const auto& buffer : _trace_buffers) {
+            out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->thread
+                << ", \"args\": {\"name\": \"" << (buffer->thread == 0 ? "main" : "worker " + to_string(buffer->thread)) << "\"}}";
+            first = false;
+            for (const TraceEvent& event : buffer->events) {
+                const bool task = event.index >= 0;
+                out << ",\n{\"name\": " << JSONString(task ? event.name + " " + to_string(event.index) : event.name)
+                    << ", \"cat\": \"" << (task ? "task" : "stage") << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->thread
+                    << ", \"ts\": " << (event.begin - _trace_start) * 1e6 << ", \"dur\": " << event.duration * 1e6;
+                if (task)
+                    out << ", \"args\": {\"index\": " << event.index << "}";
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+    }
+
+    //-------------------------------------------------------------------
+
+    void Profiler::WriteTrace() {
+        if (!Tracing() || _trace_file_name.empty())
+            return;
+
+        ofstream out(_trace_file_name);
+        if (!out) {
+            cerr << "Trace " << _trace_file_name << " couldn't be written!" << endl;
+            return;
+        }
+        WriteTrace(out);
+    }
+
+    //-------------------------------------------------------------------
+
+    double Profiler::WallTime() {
+        return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //-------------------------------------------------------------------
+
+    double Profiler::ProcessCPUTime() {
+        return ClockTime(CLOCK_PROCESS_CPUTIME_ID);
+    }
+
+    //-------------------------------------------------------------------
+
+    double Profiler::ThreadCPUTime() {
+        return ClockTime(CLOCK_THREAD_CPUTIME_ID);
+    }
+
+    //-------------------------------------------------------------------
+
+    void Profiler::ResidentMemory(size_t& rss, size_t& peak_rss) {
+        rss = peak_rss = 0;
+        ifstream status("/proc/self/status");
+        string line;
+        while (getline(status, line)) {
+            //values are given in kB
+            if (line.compare(0, 6, "VmRSS:") == 0)
+                rss = stoull(line.substr(6)) * 1024;
+            else if (line.compare(0, 6, "VmHWM:") == 0)
+                peak_rss = stoull(line.substr(6)) * 1024;
+        }
+
+        if (peak_rss == 0) {
+            rusage usage;
+            if (getrusage(RUSAGE_SELF, &usage) == 0)
+                peak_rss = size_t(usage.ru_maxrss) * 1024;
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    ProfileScope::ProfileScope() : _start_wall(0), _start_cpu(0), _active(false), _registered(false) {
+        if (!Profiler::Enabled() && !Profiler::Tracing())
+            return;
+
+        Profiler& profiler = Profiler::Instance();
+        if (this_thread::get_id() != profiler._owner)
+            return;
+
+        _active = true;
+        if (Profiler::Enabled()) {
+            lock_guard<mutex> lock(profiler._mutex);
+            profiler._stack.push_back(&_node);
+            _registered = true;
+        }
+        Reset();
+    }
+
+    //-------------------------------------------------------------------
+
+    ProfileScope::ProfileScope(const string& name) : ProfileScope() {
+        _name = name;
+    }
+
+    //-------------------------------------------------------------------
+
+    ProfileScope::~ProfileScope() {
+        if (!_active)
+            return;
+
+        if (!_name.empty())
+            End(_name);
+
+        if (!_registered)
+            return;
+
+        //stages nested after the last End() are kept in the enclosing stage
+        Profiler& profiler = Profiler::Instance();
+        lock_guard<mutex> lock(profiler._mutex);
+        profiler._stack.pop_back();
+        Profiler::Node& parent = profiler._stack.empty() ? profiler._root : *profiler._stack.back();
+        parent.MergeChildren(_node);
+    }
+
+    //-------------------------------------------------------------------
+
+    void ProfileScope::Reset() {
+        if (!_active)
+            return;
+        _start_wall = Profiler::WallTime();
+        _start_cpu = Profiler::ProcessCPUTime();
+    }
+
+    //-------------------------------------------------------------------
+
+    void ProfileScope::End(const string& name) {
+        if (!_active)
+            return;
+
+        const double end = Profiler::WallTime();
+        if (Profiler::Tracing())
+            Profiler::Trace(name, -1, _start_wall, end);
+        if (!_registered)
+            return;
+
+        const double wall = end - _start_wall;
+        const double cpu = Profiler::ProcessCPUTime() - _start_cpu;
+        size_t rss, peak_rss;
+        Profiler::ResidentMemory(rss, peak_rss);
+
+        Profiler& profiler = Profiler::Instance();
+        lock_guard<mutex> lock(profiler._mutex);
+        //the scope is at the top of the stack, its parent below it
+        const size_t depth = profiler._stack.size();
+        Profiler::Node& parent = depth < 2 ? profiler._root : *profiler._stack[depth - 2];
+        Profiler::Node& node = parent.Child(name);
+        node.calls++;
+        node.wall += wall;
+        node.cpu += cpu;
+        node.max_wall = max(node.max_wall, wall);
+        node.peak_rss = max(node.peak_rss, peak_rss);
+        node.MergeChildren(_node);
+    }
+
+    //-------------------------------------------------------------------
+
+    ProfileTask::~ProfileTask() {
+        if (!_active)
+            return;
+
+        const double end = Profiler::WallTime();
+        if (Profiler::Tracing())
+            Profiler::Trace(_name, _index, _start_wall, end);
+        if (!Profiler::TasksEnabled())
+            return;
+
+        const double wall = end - _start_wall;
+        const double cpu = Profiler::ThreadCPUTime() - _start_cpu;
+
+        Profiler& profiler = Profiler::Instance();
+        lock_guard<mutex> lock(profiler._mutex);
+        Profiler::Node& stage = profiler._stack.empty() ? profiler._root : *profiler._stack.back();
+        Profiler::Node& node = stage.Child(_name);
+        Profiler::Node *nodes[2] = {&node, _index >= 0 ? &node.TaskChild(_index) : nullptr};
+        for (Profiler::Node *n : nodes) {
+            if (!n)
+                continue;
+            n->task = true;
+            n->calls++;
+            n->wall += wall;
+            n->cpu += cpu;
+            n->max_wall = max(n->max_wall, wall);
+        }
+    }
+
+} // namespace svrtk
@@ -75,6 +75,23 @@ namespace svrtk {
         _no_masking_background = false;
         _combined_rigid_ffd = false;
         _no_offset_registration = false;
+        _transposed_sr = false;
+        _cg_sr = false;
+        _cg_max_iterations = 10;
+        _cg_tolerance = 0.01;
+        _incremental_coeffinit = false;
+        _coeffinit_tolerance = 0.01;
+        _matrix_free = false;
+        _remote_workers = 0;
+        _remote_timeout = 600;
+        _exchange_arena = false;
+        _fast_rigid_svr = false;
+        _fast_rigid_svr_levels = 3;
+        _svr_skip_converged = false;
+        _svr_convergence_tolerance = 0.1;
+        _svr_similarity_tolerance = 1e-3;
+        _svr_recheck_interval = 3;
+        _svr_force_full = false;
 
     }
 
@@ -224,6 +241,7 @@ namespace svrtk {
         if (!_template_created)
             throw runtime_error("Please create the template before setting the mask, so that the mask can be resampled to the correct dimensions.");
 
+        _coeffs_transformations.clear();
         _mask.Initialize(_reconstructed.Attributes());
 
         if (mask != NULL) {
@@ -464,6 +482,17 @@ namespace svrtk {
 
     //-------------------------------------------------------------------
 
+    // run simulation of slices and MStep in a single pass over the slices
+    void Reconstruction::SimulateSlicesMStep(int iter) {
+        SVRTK_START_TIMING();
+        Parallel::SimulateSlices p_sim(this, true);
+        p_sim();
+        UpdateMStepParameters(p_sim.sigma, p_sim.mix, p_sim.num, p_sim.min, p_sim.max, iter);
+        SVRTK_END_TIMING("SimulateSlicesMStep");
+    }
+
+    //-------------------------------------------------------------------
+
     // simulate stacks from the reconstructed volume
     void Reconstruction::SimulateStacks(Array<RealImage>& stacks) {
         RealImage sim;
@@ -479,15 +508,17 @@ namespace svrtk {
 
             //do not simulate excluded slice
             if (_slice_weight[inputIndex] > 0.5) {
+                SliceCoeffs buffer;
+                const SliceCoeffs& coeffs = GetSliceCoeffs(inputIndex, buffer);
+                const RealPixel *preconstructed = _reconstructed.Data();
                 #pragma omp parallel for
-                for (size_t i = 0; i < _volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < _volcoeffs[inputIndex][i].size(); j++)
+                for (int i = 0; i < coeffs.GetX(); i++)
+                    for (int j = 0; j < coeffs.GetY(); j++)
                         if (slice(i, j, 0) > -0.01) {
                             double weight = 0;
-                            for (size_t k = 0; k < _volcoeffs[inputIndex][i][j].size(); k++) {
-                                const POINT3D& p = _volcoeffs[inputIndex][i][j][k];
-                                sim(i, j, 0) += p.value * _reconstructed(p.x, p.y, p.z);
-                                weight += p.value;
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                                sim(i, j, 0) += coeffs.Value(k) * preconstructed[coeffs.Index(k)];
+                                weight += coeffs.Value(k);
                             }
                             if (weight > 0.98)
                                 sim(i, j, 0) /= weight;
@@ -894,6 +925,9 @@ namespace svrtk {
 
     // create slices from the input stacks
     void Reconstruction::CreateSlicesAndTransformations(const Array<RealImage>& stacks, const Array<RigidTransformation>& stack_transformations, const Array<double>& thickness, const Array<RealImage>& probability_maps) {
+        // invalidate the system matrix kept for incremental CoeffInit
+        _coeffs_transformations.clear();
+
         double average_thickness = 0;
 
         // Reset and allocate memory
@@ -1014,6 +1048,9 @@ namespace svrtk {
 
     // create slices from the input stacks
     void Reconstruction::CreateSlicesAndTransformationsMC(const Array<RealImage>& stacks, const Array<Array<RealImage>> mc_stacks, const Array<RigidTransformation>& stack_transformations, const Array<double>& thickness, const Array<RealImage>& probability_maps) {
+        // invalidate the system matrix kept for incremental CoeffInit
+        _coeffs_transformations.clear();
+
         double average_thickness = 0;
 
         // Reset and allocate memory
@@ -1171,6 +1208,9 @@ namespace svrtk {
 
     // set slices and transformation from the given array
     void Reconstruction::SetSlicesAndTransformations(const Array<RealImage>& slices, const Array<RigidTransformation>& slice_transformations, const Array<int>& stack_ids, const Array<double>& thickness) {
+        // invalidate the system matrix kept for incremental CoeffInit
+        _coeffs_transformations.clear();
+
         ClearAndReserve(_slices, slices.size());
         ClearAndReserve(_stack_index, slices.size());
         ClearAndReserve(_transformations, slices.size());
@@ -1196,6 +1236,9 @@ namespace svrtk {
 
     // update slices array based on the given stacks
     void Reconstruction::UpdateSlices(Array<RealImage>& stacks, Array<double>& thickness) {
+        // invalidate the system matrix kept for incremental CoeffInit
+        _coeffs_transformations.clear();
+
         ClearAndReserve(_slices, stacks.size() * stacks[0].Attributes()._z);
 
         //for each stack
@@ -1226,6 +1269,9 @@ namespace svrtk {
             return;
         }
 
+        // invalidate the system matrix kept for incremental CoeffInit
+        _coeffs_transformations.clear();
+
         if (_no_masking_background)
             _not_masked_slices.insert(_not_masked_slices.end(), _slices.begin(), _slices.end());
 
@@ -1458,26 +1504,91 @@ namespace svrtk {
         _grey_reconstructed = _reconstructed;
 
         if (!_ffd) {
+            const int skipped = SelectConvergedSlices();
+            const Array<RigidTransformation> previous_transformations = _transformations;
+
             Parallel::SliceToVolumeRegistration p_reg(this);
             p_reg();
+
+            UpdateSliceConvergence(previous_transformations, skipped);
         } else {
 //            _reconstructed.Write("ffd.nii.gz");
             Parallel::SliceToVolumeRegistrationFFD p_reg(this);
             p_reg();
         }
 
+        ReportMemoryUsage("SliceToVolumeRegistration");
+
         SVRTK_END_TIMING("SliceToVolumeRegistration");
     }
 
     //-------------------------------------------------------------------
 
+    // select the converged slices that the next rigid SVR skips
+    int Reconstruction::SelectConvergedSlices() {
+        const bool skip = _svr_skip_converged && !_svr_force_full && _svr_stable_count.size() == _slices.size();
+        _svr_skip.assign(_slices.size(), false);
+        _svr_improvement.assign(_slices.size(), 0);
+        if (_svr_stable_count.size() != _slices.size()) {
+            _svr_stable_count.assign(_slices.size(), 0);
+            _svr_skipped_count.assign(_slices.size(), 0);
+        }
+
+        //converged slices are skipped, unless they are due for a re-check
+        int skipped = 0;
+        if (skip) {
+            for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+                if (_svr_stable_count[inputIndex] >= 2 && _svr_skipped_count[inputIndex] < _svr_recheck_interval) {
+                    _svr_skip[inputIndex] = true;
+                    _svr_skipped_count[inputIndex]++;
+                    skipped++;
+                }
+            }
+        }
+        _svr_force_full = false;
+
+        return skipped;
+    }
+
+    //-------------------------------------------------------------------
+
+    // update the convergence of the slices registered by the last rigid SVR
+    void Reconstruction::UpdateSliceConvergence(const Array<RigidTransformation>& previous_transformations, int skipped) {
+        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+            if (_svr_skip[inputIndex])
+                continue;
+            _svr_skipped_count[inputIndex] = 0;
+            if (SliceDisplacement(inputIndex, previous_transformations[inputIndex]) < _svr_convergence_tolerance && _svr_improvement[inputIndex] < _svr_similarity_tolerance)
+                _svr_stable_count[inputIndex]++;
+            else
+                _svr_stable_count[inputIndex] = 0;
+        }
+
+        if (_svr_skip_converged) {
+            cout << "SVR: skipped " << skipped << " of " << _slices.size() << " converged slices" << endl;
+            if (_verbose)
+                _verbose_log << "SVR: skipped " << skipped << " of " << _slices.size() << " converged slices" << endl;
+        }
+    }
+
+    //-------------------------------------------------------------------
+
     // run remote SVR
     void Reconstruction::RemoteSliceToVolumeRegistration(int iter, const string& str_mirtk_path, const string& str_current_exchange_file_path) {
         SVRTK_START_TIMING();
 
         const ImageAttributes& attr_recon = _reconstructed.Attributes();
-        const string str_source = str_current_exchange_file_path + "/current-source.nii.gz";
-        _reconstructed.Write(str_source.c_str());
+        //the persistent workers map the images from exchange arenas instead of reading .nii.gz files
+        const bool pool = _remote_workers > 0;
+        const string str_source = pool ? str_current_exchange_file_path + "/svr-source.arena#source" : str_current_exchange_file_path + "/current-source.nii.gz";
+        if (pool) {
+            ExchangeArena arena;
+            arena.AddImage("source", _reconstructed);
+            arena.Write(str_current_exchange_file_path + "/svr-source.arena");
+        } else {
+            _reconstructed.Write(str_source.c_str());
+        }
+        Array<RealImage> targets;
 
         RealImage target;
         ResamplingWithPadding<RealPixel> resampling(attr_recon._dx, attr_recon._dx, attr_recon._dx, -1);
@@ -1490,7 +1601,10 @@ namespace svrtk {
         int svr_range_stop = svr_range_start + stride;
 
         if (!_ffd) {
-            // rigid SVR
+            // rigid SVR, converged slices are skipped as in the local registration
+            const int skipped = SelectConvergedSlices();
+            const Array<RigidTransformation> previous_transformations = _transformations;
+
             if (iter < 3) {
                 _offset_matrices.clear();
 
@@ -1509,41 +1623,55 @@ namespace svrtk {
                     target.GetMinMax(&tmin, &tmax);
                     _zero_slices[inputIndex] = tmax > 1 && (tmax - tmin) > 1 ? 1 : -1;
 
-                    const string str_target = str_current_exchange_file_path + "/res-slice-" + to_string(inputIndex) + ".nii.gz";
-                    target.Write(str_target.c_str());
+                    if (pool) {
+                        targets.push_back(target);
+                    } else {
+                        const string str_target = str_current_exchange_file_path + "/res-slice-" + to_string(inputIndex) + ".nii.gz";
+                        target.Write(str_target.c_str());
+                    }
 
                     _offset_matrices.push_back(offset.GetMatrix());
                 }
+
+                if (pool)
+                    WriteRemoteTargets(str_current_exchange_file_path, targets);
             }
 
-            // save slice transformations
-            #pragma omp parallel for
-            for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
-                RigidTransformation r_transform = _transformations[inputIndex];
-                r_transform.PutMatrix(r_transform.GetMatrix() * _offset_matrices[inputIndex]);
+            if (pool) {
+                // the transformations are exchanged with the workers directly
+                RemoteRigidRegistrationWithPool(str_mirtk_path, str_current_exchange_file_path);
+            } else {
+                // save slice transformations
+                #pragma omp parallel for
+                for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+                    RigidTransformation r_transform = _transformations[inputIndex];
+                    r_transform.PutMatrix(r_transform.GetMatrix() * _offset_matrices[inputIndex]);
 
-                const string str_dofin = str_current_exchange_file_path + "/res-transformation-" + to_string(inputIndex) + ".dof";
-                r_transform.Write(str_dofin.c_str());
-            }
+                    const string str_dofin = str_current_exchange_file_path + "/res-transformation-" + to_string(inputIndex) + ".dof";
+                    r_transform.Write(str_dofin.c_str());
+                }
 
-            // run remote SVR in strides
-            while (svr_range_start < _slices.size()) {
-                Parallel::RemoteSliceToVolumeRegistration registration(this, svr_range_start, svr_range_stop, str_mirtk_path, str_current_exchange_file_path);
-                registration();
+                // run remote SVR in strides
+                while (svr_range_start < _slices.size()) {
+                    Parallel::RemoteSliceToVolumeRegistration registration(this, svr_range_start, svr_range_stop, str_mirtk_path, str_current_exchange_file_path);
+                    registration();
 
-                svr_range_start = svr_range_stop;
-                svr_range_stop = min(svr_range_start + stride, (int)_slices.size());
-            }
+                    svr_range_start = svr_range_stop;
+                    svr_range_stop = min(svr_range_start + stride, (int)_slices.size());
+                }
 
-            // read output transformations
-            #pragma omp parallel for
-            for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
-                const string str_dofout = str_current_exchange_file_path + "/res-transformation-" + to_string(inputIndex) + ".dof";
-                _transformations[inputIndex].Read(str_dofout.c_str());
+                // read output transformations
+                #pragma omp parallel for
+                for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+                    const string str_dofout = str_current_exchange_file_path + "/res-transformation-" + to_string(inputIndex) + ".dof";
+                    _transformations[inputIndex].Read(str_dofout.c_str());
 
-                //undo the offset
-                _transformations[inputIndex].PutMatrix(_transformations[inputIndex].GetMatrix() * _offset_matrices[inputIndex].Inverse());
+                    //undo the offset
+                    _transformations[inputIndex].PutMatrix(_transformations[inputIndex].GetMatrix() * _offset_matrices[inputIndex].Inverse());
+                }
             }
+
+            UpdateSliceConvergence(previous_transformations, skipped);
         } else {
             // FFD SVR
             if (iter < 3) {
@@ -1558,21 +1686,52 @@ namespace svrtk {
                     target.GetMinMax(&tmin, &tmax);
                     _zero_slices[inputIndex] = tmax > 1 && (tmax - tmin) > 1 ? 1 : -1;
 
-                    string str_target = str_current_exchange_file_path + "/slice-" + to_string(inputIndex) + ".nii.gz";
-                    target.Write(str_target.c_str());
+                    if (pool) {
+                        targets.push_back(target);
+                    } else {
+                        string str_target = str_current_exchange_file_path + "/slice-" + to_string(inputIndex) + ".nii.gz";
+                        target.Write(str_target.c_str());
+                    }
 
                     string str_dofin = str_current_exchange_file_path + "/transformation-" + to_string(inputIndex) + ".dof";
                     _mffd_transformations[inputIndex]->Write(str_dofin.c_str());
                 }
+
+                if (pool)
+                    WriteRemoteTargets(str_current_exchange_file_path, targets);
             }
 
-            // run parallel remote FFD SVR in strides
-            while (svr_range_start < _slices.size()) {
-                Parallel::RemoteSliceToVolumeRegistration registration(this, svr_range_start, svr_range_stop, str_mirtk_path, str_current_exchange_file_path, false);
-                registration();
+            if (pool) {
+                // run remote FFD SVR with the persistent workers, the FFDs are still exchanged as .dof files
+                // since the worker creates the control point lattice of the registration output
+                RegistrationWorkerPool& pool = RemoteRegistrationPool(str_mirtk_path);
+                pool.Reset();
 
-                svr_range_start = svr_range_stop;
-                svr_range_stop = min(svr_range_start + stride, (int)_slices.size());
+                const int cp_spacing = _cp_spacing.size() > 0 ? _cp_spacing[_current_iteration] : 0;
+                Array<size_t> job_slices;
+                Array<string> jobs;
+                for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+                    if (_zero_slices[inputIndex] <= 0)
+                        continue;
+                    const string str_target = str_current_exchange_file_path + "/svr-targets.arena#target-" + to_string(inputIndex);
+                    const string str_dof = str_current_exchange_file_path + "/transformation-" + to_string(inputIndex) + ".dof";
+                    jobs.push_back(RegistrationWorkerPool::FFDJob(str_target, str_source, str_dof, str_dof, cp_spacing));
+                    job_slices.push_back(inputIndex);
+                }
+
+                const Array<string> replies = pool.Run(jobs);
+                for (size_t n = 0; n < jobs.size(); n++)
+                    if (!RegistrationWorkerPool::FFDResult(replies[n]))
+                        cerr << "Remote registration of slice " << job_slices[n] << " failed: " << replies[n] << endl;
+            } else {
+                // run parallel remote FFD SVR in strides
+                while (svr_range_start < _slices.size()) {
+                    Parallel::RemoteSliceToVolumeRegistration registration(this, svr_range_start, svr_range_stop, str_mirtk_path, str_current_exchange_file_path, false);
+                    registration();
+
+                    svr_range_start = svr_range_stop;
+                    svr_range_stop = min(svr_range_start + stride, (int)_slices.size());
+                }
             }
 
             // read output transformations
@@ -1588,11 +1747,95 @@ namespace svrtk {
 
     //-------------------------------------------------------------------
 
+    // persistent workers for remote SVR
+    RegistrationWorkerPool& Reconstruction::RemoteRegistrationPool(const string& str_mirtk_path) {
+        if (!_registration_pool) {
+            Array<string> arguments;
+            if (_ncc_reg)
+                arguments.push_back("-ncc");
+            _registration_pool = make_shared<RegistrationWorkerPool>(str_mirtk_path + "/register-worker", arguments, _remote_workers, _remote_timeout);
+        }
+        return *_registration_pool;
+    }
+
+    //-------------------------------------------------------------------
+
+    // stage the resampled slices of remote SVR for the persistent workers
+    void Reconstruction::WriteRemoteTargets(const string& str_current_exchange_file_path, const Array<RealImage>& targets) {
+        ExchangeArena arena;
+        for (size_t inputIndex = 0; inputIndex < targets.size(); inputIndex++)
+            arena.AddImage("target-" + to_string(inputIndex), targets[inputIndex]);
+        arena.Write(str_current_exchange_file_path + "/svr-targets.arena");
+    }
+
+    //-------------------------------------------------------------------
+
+    // run rigid remote SVR with the persistent workers
+    void Reconstruction::RemoteRigidRegistrationWithPool(const string& str_mirtk_path, const string& str_current_exchange_file_path, const Array<int>& source_indexes) {
+        RegistrationWorkerPool& pool = RemoteRegistrationPool(str_mirtk_path);
+        // the source volumes have been rewritten for this iteration
+        pool.Reset();
+
+        Array<size_t> job_slices;
+        Array<string> jobs;
+        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+            // empty and converged slices
+            if (_zero_slices[inputIndex] <= 0 || (_svr_skip.size() == _slices.size() && _svr_skip[inputIndex]))
+                continue;
+
+            RigidTransformation r_transform = _transformations[inputIndex];
+            r_transform.PutMatrix(r_transform.GetMatrix() * _offset_matrices[inputIndex]);
+
+            const string str_target = str_current_exchange_file_path + "/svr-targets.arena#target-" + to_string(inputIndex);
+            const string str_source = str_current_exchange_file_path + "/svr-source.arena#source" + (source_indexes.empty() ? "" : "-" + to_string(source_indexes[inputIndex]));
+            jobs.push_back(RegistrationWorkerPool::RigidJob(str_target, str_source, r_transform));
+            job_slices.push_back(inputIndex);
+        }
+
+        const Array<string> replies = pool.Run(jobs);
+
+        for (size_t n = 0; n < jobs.size(); n++) {
+            const size_t inputIndex = job_slices[n];
+            RigidTransformation r_transform;
+            if (!RegistrationWorkerPool::RigidResult(replies[n], r_transform)) {
+                cerr << "Remote registration of slice " << inputIndex << " failed: " << replies[n] << endl;
+                continue;
+            }
+
+            //undo the offset
+            _transformations[inputIndex].PutMatrix(r_transform.GetMatrix() * _offset_matrices[inputIndex].Inverse());
+        }
+    }
+
+    //-------------------------------------------------------------------
+
     // save the current recon model (for remote reconstruction option) - can be deleted
     void Reconstruction::SaveModelRemote(const string& str_current_exchange_file_path, int status_flag, int current_iteration) {
         if (_verbose)
             _verbose_log << "SaveModelRemote : " << current_iteration << endl;
 
+        if (_exchange_arena) {
+            // slices and mask do not change between iterations and are kept in their own arena
+            if (status_flag > 0) {
+                ExchangeArena arena;
+                for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
+                    arena.AddImage("slice-" + to_string(inputIndex), _slices[inputIndex]);
+                arena.AddImage("mask", _mask);
+                arena.Write(str_current_exchange_file_path + "/slices.arena");
+            }
+
+            ExchangeArena arena;
+            for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+                Array<double> parameters(_transformations[inputIndex].NumberOfDOFs());
+                for (size_t i = 0; i < parameters.size(); i++)
+                    parameters[i] = _transformations[inputIndex].Get(i);
+                arena.AddParameters("transformation-" + to_string(inputIndex), parameters);
+            }
+            arena.AddImage("recon", _reconstructed);
+            arena.Write(str_current_exchange_file_path + "/model-" + to_string(current_iteration) + ".arena");
+            return;
+        }
+
         // save slices
         if (status_flag > 0) {
             #pragma omp parallel for
@@ -1633,6 +1876,15 @@ namespace svrtk {
         if (_verbose)
             _verbose_log << "LoadResultsRemote : " << current_iteration << endl;
 
+        ExchangeArena arena;
+        if (_exchange_arena && arena.Open(str_current_exchange_file_path + "/model-" + to_string(current_iteration) + ".arena")) {
+            // copy the volume, the arena image is only valid while the file is mapped
+            RealImage recon;
+            arena.GetImage("recon", recon);
+            _reconstructed = recon;
+            return;
+        }
+
         const string str_recon = str_current_exchange_file_path + "/latest-out-recon.nii.gz";
         _reconstructed.Read(str_recon.c_str());
     }
@@ -1642,11 +1894,25 @@ namespace svrtk {
         if (_verbose)
             _verbose_log << "LoadModelRemote : " << current_iteration << endl;
 
-        const string str_recon = str_current_exchange_file_path + "/latest-out-recon.nii.gz";
-        const string str_mask = str_current_exchange_file_path + "/current-mask.nii.gz";
+        // with the arena exchange, use the arena files if both are available, otherwise the individual files
+        ExchangeArena slices_arena, model_arena;
+        const bool arena = _exchange_arena && slices_arena.Open(str_current_exchange_file_path + "/slices.arena")
+            && model_arena.Open(str_current_exchange_file_path + "/model-" + to_string(current_iteration) + ".arena");
+
+        if (arena) {
+            // the arena images are only valid while the files are mapped and are copied
+            RealImage recon, mask;
+            model_arena.GetImage("recon", recon);
+            slices_arena.GetImage("mask", mask);
+            _reconstructed = recon;
+            _mask = mask;
+        } else {
+            const string str_recon = str_current_exchange_file_path + "/latest-out-recon.nii.gz";
+            const string str_mask = str_current_exchange_file_path + "/current-mask.nii.gz";
 
-        _reconstructed.Read(str_recon.c_str());
-        _mask.Read(str_mask.c_str());
+            _reconstructed.Read(str_recon.c_str());
+            _mask.Read(str_mask.c_str());
+        }
 
         _template_created = true;
         _grey_reconstructed = _reconstructed;
@@ -1657,16 +1923,30 @@ namespace svrtk {
         for (int inputIndex = 0; inputIndex < current_number_of_slices; inputIndex++) {
             // load slices
             RealImage slice;
-            const string str_slice = str_current_exchange_file_path + "/org-slice-" + to_string(inputIndex) + ".nii.gz";
-            slice.Read(str_slice.c_str());
+            if (arena) {
+                RealImage view;
+                slices_arena.GetImage("slice-" + to_string(inputIndex), view);
+                slice = view;
+            } else {
+                const string str_slice = str_current_exchange_file_path + "/org-slice-" + to_string(inputIndex) + ".nii.gz";
+                slice.Read(str_slice.c_str());
+            }
             slice.PutPixelSize(slice.GetXSize(), slice.GetYSize(), average_thickness);
             _slices.push_back(slice);
 
             // load transformations
-            const string str_dofin = str_current_exchange_file_path + "/org-transformation-" + to_string(current_iteration) + "-" + to_string(inputIndex) + ".dof";
-            Transformation *t = Transformation::New(str_dofin.c_str());
-            unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(t));
-            _transformations.push_back(*rigidTransf);
+            if (arena) {
+                const Array<double> parameters = model_arena.GetParameters("transformation-" + to_string(inputIndex));
+                RigidTransformation rigidTransf;
+                for (size_t i = 0; i < parameters.size(); i++)
+                    rigidTransf.Put(i, parameters[i]);
+                _transformations.push_back(rigidTransf);
+            } else {
+                const string str_dofin = str_current_exchange_file_path + "/org-transformation-" + to_string(current_iteration) + "-" + to_string(inputIndex) + ".dof";
+                Transformation *t = Transformation::New(str_dofin.c_str());
+                unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(t));
+                _transformations.push_back(*rigidTransf);
+            }
 
             RealPixel tmin, tmax;
             slice.GetMinMax(&tmin, &tmax);
@@ -1730,61 +2010,182 @@ namespace svrtk {
 
     //-------------------------------------------------------------------
 
-    // run calculation of transformation matrices
-    void Reconstruction::CoeffInit() {
-        SVRTK_START_TIMING();
+    // maximum displacement of the slice corners between the current and the given transformation
+    double Reconstruction::SliceDisplacement(size_t inputIndex, const RigidTransformation& transformation) const {
+        const RealImage& slice = _slices[inputIndex];
+        double displacement = 0;
 
-        //resize slice-volume matrix from previous iteration
-        ClearAndResize(_volcoeffs, _slices.size());
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 2; j++) {
+                double x = i * (slice.GetX() - 1), y = j * (slice.GetY() - 1), z = 0;
+                slice.ImageToWorld(x, y, z);
+                double px = x, py = y, pz = z;
+                _transformations[inputIndex].Transform(x, y, z);
+                transformation.Transform(px, py, pz);
+                displacement = max(displacement, sqrt((x - px) * (x - px) + (y - py) * (y - py) + (z - pz) * (z - pz)));
+            }
 
-        //resize indicator of slice having and overlap with volumetric mask
-        ClearAndResize(_slice_inside, _slices.size());
-        _attr_reconstructed = _reconstructed.Attributes();
+        return displacement;
+    }
 
-        Parallel::CoeffInit coeffinit(this);
-        coeffinit();
+    //-------------------------------------------------------------------
 
-        //prepare image for volume weights, will be needed for Gaussian Reconstruction
-        _volume_weights.Initialize(_reconstructed.Attributes());
+    // matrix of a slice, computed on the fly in the matrix-free mode
+    const SliceCoeffs& Reconstruction::GetSliceCoeffs(size_t inputIndex, SliceCoeffs& buffer) const {
+        if (!_matrix_free)
+            return _volcoeffs[inputIndex];
 
-        // Do not parallelise: It would cause data inconsistencies
-        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
-            bool excluded = false;
+        //the transformed PSF buffer is reused by all calls on the same thread
+        static thread_local RealImage tPSF;
+        bool slice_inside;
+        Parallel::CoeffInit::Compute(this, inputIndex, _grey_reconstructed, tPSF, buffer, slice_inside);
+
+        return buffer;
+    }
+
+    //-------------------------------------------------------------------
 
+    // run calculation of transformation matrices
+    void Reconstruction::CoeffInit() {
+        SVRTK_START_TIMING();
+
+        //slices contributing to the volume weights
+        Array<bool> included(_slices.size(), true);
+        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
             for (size_t fe = 0; fe < _force_excluded.size(); fe++) {
                 if (inputIndex == _force_excluded[fe]) {
-                    excluded = true;
+                    included[inputIndex] = false;
                     break;
                 }
             }
 
             if (_structural_slice_weight[inputIndex] < 0.5)
-                excluded = true;
+                included[inputIndex] = false;
+        }
 
-            if (!excluded) {
+        //the FFD volume weights depend on the Jacobian of the previous deformation, so they are always rebuilt
+        const bool incremental = _incremental_coeffinit && !_ffd && !_matrix_free
+            && _volcoeffs.size() == _slices.size()
+            && _coeffs_transformations.size() == _slices.size()
+            && _volume_weights.Attributes() == _reconstructed.Attributes()
+            && _volume_weights_sum.size() == (size_t)_reconstructed.NumberOfVoxels();
+
+        //slices whose matrix has to be (re)computed
+        Array<size_t> changed;
+        changed.reserve(_slices.size());
+
+        if (incremental) {
+            for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
+                if (included[inputIndex] != _coeffs_included[inputIndex] || SliceDisplacement(inputIndex, _coeffs_transformations[inputIndex]) > _coeffinit_tolerance)
+                    changed.push_back(inputIndex);
+
+            //remove the old contribution of the changed slices from the volume weights
+            for (size_t n = 0; n < changed.size(); n++) {
+                const size_t inputIndex = changed[n];
+                if (!_coeffs_included[inputIndex])
+                    continue;
+
+                const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
+                for (size_t k = 0; k < coeffs.NumberOfCoefficients(); k++)
+                    _volume_weights_sum[coeffs.Index(k)] -= coeffs.Value(k);
+            }
+
+            if (_verbose)
+                _verbose_log << "Recomputing matrix coefficients for " << changed.size() << " of " << _slices.size() << " slices" << endl;
+        } else {
+            //resize slice-volume matrix from previous iteration
+            ClearAndResize(_volcoeffs, _slices.size());
+
+            //resize indicator of slice having and overlap with volumetric mask
+            ClearAndResize(_slice_inside, _slices.size());
+
+            //prepare image for volume weights, will be needed for Gaussian Reconstruction
+            _volume_weights.Initialize(_reconstructed.Attributes());
+            _volume_weights_sum.assign(_reconstructed.NumberOfVoxels(), 0);
+
+            for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
+                changed.push_back(inputIndex);
+        }
+        _attr_reconstructed = _reconstructed.Attributes();
+
+        double *pvolume_weights = _volume_weights_sum.data();
+
+        //add the contribution of a slice to the volume weights
+        auto add_volume_weights = [&](size_t inputIndex) {
+            if (!included[inputIndex])
+                return;
+
+            const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
+
+            // Do not parallelise: It would cause data inconsistencies
+            for (int i = 0; i < coeffs.GetX(); i++)
+                for (int j = 0; j < coeffs.GetY(); j++) {
+                    if (coeffs.Size(i, j) == 0)
+                        continue;
+
+                    //the Jacobian only depends on the slice pixel, evaluate it once for all its coefficients
+                    if (_ffd) {
+                        double x = i, y = j, z = 0;
+                        _slices[inputIndex].ImageToWorld(x, y, z);
+                        const double jac = _mffd_transformations[inputIndex]->Jacobian(x, y, z, 0, 0);
+                        if (!((100*jac) > _global_JAC_threshold))
+                            continue;
+                    }
+
+                    for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
+                        pvolume_weights[coeffs.Index(k)] += coeffs.Value(k);
+                }
+        };
+
+        if (_matrix_free) {
+            //compute the matrices in small batches, only the volume weights and the overlap with the mask are kept
+            const size_t batch_size = 2 * max(1u, thread::hardware_concurrency());
+            for (size_t begin = 0; begin < changed.size(); begin += batch_size) {
+                const Array<size_t> batch(changed.begin() + begin, changed.begin() + min(begin + batch_size, changed.size()));
+
+                Parallel::CoeffInit coeffinit(this, &batch);
+                coeffinit();
 
                 // Do not parallelise: It would cause data inconsistencies
-                for (int i = 0; i < _slices[inputIndex].GetX(); i++)
-                    for (int j = 0; j < _slices[inputIndex].GetY(); j++)
-                        for (size_t k = 0; k < _volcoeffs[inputIndex][i][j].size(); k++) {
-                            const POINT3D& p = _volcoeffs[inputIndex][i][j][k];
-
-                            if (_ffd) {
-                                double x = i, y = j, z = 0;
-                                _slices[inputIndex].ImageToWorld(x, y, z);
-                                double jac = _mffd_transformations[inputIndex]->Jacobian(x, y, z, 0, 0);
-                                if ((100*jac) > _global_JAC_threshold) {
-                                    _volume_weights(p.x, p.y, p.z) += p.value;
-                                }
-                            } else {
-                                _volume_weights(p.x, p.y, p.z) += p.value;
-                            }
+                for (size_t n = 0; n < batch.size(); n++) {
+                    add_volume_weights(batch[n]);
+                    _volcoeffs[batch[n]].Clear();
+                }
+            }
 
-                        }
+            _volcoeffs_transposed.Clear();
+            _coeffs_jac_mask.clear();
+        } else {
+            Parallel::CoeffInit coeffinit(this, &changed);
+            coeffinit();
+
+            //the FFD is fixed until the next registration, evaluate its Jacobian threshold once instead of in every SR iteration
+            if (_ffd) {
+                Parallel::JacobianMask jacobianMask(this);
+                jacobianMask();
+            } else {
+                _coeffs_jac_mask.clear();
             }
 
+            //transposed matrix for gather-based superresolution
+            if (_transposed_sr)
+                _volcoeffs_transposed.Initialize(_volcoeffs, _reconstructed.NumberOfVoxels(), _ffd ? &_coeffs_jac_mask : nullptr);
+            else
+                _volcoeffs_transposed.Clear();
+
+            // Do not parallelise: It would cause data inconsistencies
+            for (size_t n = 0; n < changed.size(); n++)
+                add_volume_weights(changed[n]);
         }
 
+        //remember the state the matrix was computed for
+        _coeffs_transformations = _transformations;
+        _coeffs_included = move(included);
+
+        RealPixel *pweights = _volume_weights.Data();
+        for (size_t i = 0; i < _volume_weights_sum.size(); i++)
+            pweights[i] = _volume_weights_sum[i];
+
         if (_ffd) {
         for (int z = 0; z < _volume_weights.GetZ(); z++)
             for (int y = 0; y < _volume_weights.GetY(); y++)
@@ -1815,6 +2216,8 @@ namespace svrtk {
         if (_verbose)
             _verbose_log << "Average volume weight is " << _average_volume_weight << endl;
 
+        ReportMemoryUsage("CoeffInit");
+
         SVRTK_END_TIMING("CoeffInit");
     }
 
@@ -1837,10 +2240,14 @@ namespace svrtk {
             }
         }
 
+        SliceCoeffs buffer;
+
         for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
-            if (_volcoeffs[inputIndex].empty())
+            if (!_matrix_free && _volcoeffs[inputIndex].Empty())
                 continue;
 
+            const SliceCoeffs& coeffs = GetSliceCoeffs(inputIndex, buffer);
+            RealPixel *preconstructed = _reconstructed.Data();
             int slice_vox_num = 0;
             //copy the current slice
             slice = _no_masking_background ? _not_masked_slices[inputIndex] : _slices[inputIndex];
@@ -1858,8 +2265,8 @@ namespace svrtk {
             }
 
             //Distribute slice intensities to the volume
-            for (size_t i = 0; i < _volcoeffs[inputIndex].size(); i++)
-                for (size_t j = 0; j < _volcoeffs[inputIndex][i].size(); j++)
+            for (int i = 0; i < coeffs.GetX(); i++)
+                for (int j = 0; j < coeffs.GetY(); j++)
                     if (slice(i, j, 0) > -0.01) {
 
                         double jac = 1;
@@ -1883,7 +2290,7 @@ namespace svrtk {
 
                             //number of volume voxels with non-zero coefficients
                             //for current slice voxel
-                            const size_t n = _volcoeffs[inputIndex][i][j].size();
+                            const int n = coeffs.Size(i, j);
 
                             //if given voxel is not present in reconstructed volume at all, pad it
 
@@ -1893,15 +2300,15 @@ namespace svrtk {
 
                             //add contribution of current slice voxel to all voxel volumes
                             //to which it contributes
-                            for (size_t k = 0; k < n; k++) {
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
 
-                                const POINT3D& p = _volcoeffs[inputIndex][i][j][k];
+                                const int index = coeffs.Index(k);
 
-                                _reconstructed(p.x, p.y, p.z) += p.value * slice(i, j, 0);
+                                preconstructed[index] += coeffs.Value(k) * slice(i, j, 0);
 
                                 if (_multiple_channels_flag && (_number_of_channels > 0)) {
                                     for (int n=0; n<_number_of_channels; n++) {
-                                        _mc_reconstructed[n](p.x, p.y, p.z) += p.value * mc_slices[n](i, j, 0);
+                                        _mc_reconstructed[n].Data()[index] += coeffs.Value(k) * mc_slices[n](i, j, 0);
                                     }
                                 }
 
@@ -1944,6 +2351,8 @@ namespace svrtk {
             _verbose_log << endl;
         }
 
+        ReportMemoryUsage("GaussianReconstruction");
+
         SVRTK_END_TIMING("GaussianReconstruction");
     }
 
@@ -1963,14 +2372,16 @@ namespace svrtk {
         //prepare image for volume weights, will be needed for Gaussian Reconstruction
         _volume_weightsSF.Initialize(_reconstructed.Attributes());
 
+        RealPixel *pvolume_weights = _volume_weightsSF.Data();
+
         // Do not parallelise: It would cause data inconsistencies
-        for (int inputIndex = begin; inputIndex < end; inputIndex++)
-            for (size_t i = 0; i < _volcoeffsSF[inputIndex].size(); i++)
-                for (size_t j = 0; j < _volcoeffsSF[inputIndex][i].size(); j++)
-                    for (size_t k = 0; k < _volcoeffsSF[inputIndex % _slicePerDyn][i][j].size(); k++) {
-                        const POINT3D& p = _volcoeffsSF[inputIndex % _slicePerDyn][i][j][k];
-                        _volume_weightsSF(p.x, p.y, p.z) += p.value;
-                    }
+        for (int inputIndex = begin; inputIndex < end; inputIndex++) {
+            const SliceCoeffs& coeffs = _volcoeffsSF[inputIndex % _slicePerDyn];
+            for (int i = 0; i < coeffs.GetX(); i++)
+                for (int j = 0; j < coeffs.GetY(); j++)
+                    for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
+                        pvolume_weights[coeffs.Index(k)] += coeffs.Value(k);
+        }
 
         if (_debug)
             _volume_weightsSF.Write("volume_weights.nii.gz");
@@ -2030,9 +2441,12 @@ namespace svrtk {
             interpolated.Initialize(_reconstructed.Attributes());
 
             for (size_t s = 0; s < currentSlices.size(); s++) {
-                if (_volcoeffsSF[s].empty())
+                if (_volcoeffsSF[s].Empty())
                     continue;
 
+                const SliceCoeffs& coeffs = _volcoeffsSF[s];
+                RealPixel *pinterpolated = interpolated.Data();
+
                 //copy the current slice
                 slice = currentSlices[s];
                 //alias the current bias image
@@ -2041,14 +2455,14 @@ namespace svrtk {
                 const double scale = currentScales[s];
 
                 int slice_vox_num = 0;
-                for (size_t i = 0; i < _volcoeffsSF[s].size(); i++)
-                    for (size_t j = 0; j < _volcoeffsSF[s][i].size(); j++)
+                for (int i = 0; i < coeffs.GetX(); i++)
+                    for (int j = 0; j < coeffs.GetY(); j++)
                         if (slice(i, j, 0) > -0.01) {
                             //biascorrect and scale the slice
                             slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
 
                             //number of volume voxels with non-zero coefficients for current slice voxel
-                            const size_t n = _volcoeffsSF[s][i][j].size();
+                            const int n = coeffs.Size(i, j);
 
                             //if given voxel is not present in reconstructed volume at all, pad it
 
@@ -2058,10 +2472,8 @@ namespace svrtk {
 
                             //add contribution of current slice voxel to all voxel volumes
                             //to which it contributes
-                            for (size_t k = 0; k < n; k++) {
-                                const POINT3D& p = _volcoeffsSF[s][i][j][k];
-                                interpolated(p.x, p.y, p.z) += p.value * slice(i, j, 0);
-                            }
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
+                                pinterpolated[coeffs.Index(k)] += coeffs.Value(k) * slice(i, j, 0);
                         }
                 voxel_num.push_back(slice_vox_num);
             }
@@ -2485,7 +2897,7 @@ namespace svrtk {
                         }
                     }
 
-                    if (slice(i, j, 0) > -0.01) {
+                    if (slice(i, j, 0) > -0.01 && _simulated_slices[inputIndex](i, j, 0) >= 0.01) {
                         _slice_dif[inputIndex](i, j, 0) *= exp(-(_bias[inputIndex])(i, j, 0)) * _scale[inputIndex];
                         _slice_dif[inputIndex](i, j, 0) -= _simulated_slices[inputIndex](i, j, 0);
 
@@ -2496,6 +2908,7 @@ namespace svrtk {
                             }
                         }
                     } else {
+                        //no difference outside the ROI or where the simulated slice is empty
                         _slice_dif[inputIndex](i, j, 0) = 0;
 
                         if (_multiple_channels_flag) {
@@ -2524,85 +2937,97 @@ namespace svrtk {
         // save current reconstruction for edge-preserving smoothing
         RealImage original = _reconstructed;
 
-        SliceDifference();
-
-        Parallel::Superresolution parallelSuperresolution(this);
-        parallelSuperresolution();
-
-        RealImage& addon = parallelSuperresolution.addon;
-        _confidence_map = move(parallelSuperresolution.confidence_map);
-        //_confidence4mask = _confidence_map;
-
-        Array<RealImage> mc_addons;
-        Array<RealImage> mc_originals;
+        if (_cg_sr && !_multiple_channels_flag) {
+            //data term and regularisation are solved together
+            SuperresolutionCG(iter, original);
+        } else {
+            //the scatter pass computes the residual on the fly, only the gather pass and the additional channels read it from memory
+            const bool gather = _transposed_sr && !_volcoeffs_transposed.Empty();
+            if (gather || _multiple_channels_flag)
+                SliceDifference();
+
+            RealImage addon;
+            Array<RealImage> mc_addons;
+            Array<RealImage> mc_originals;
+
+            if (gather) {
+                Parallel::SuperresolutionGather parallelSuperresolution(this);
+                parallelSuperresolution();
+                addon = move(parallelSuperresolution.addon);
+                _confidence_map = move(parallelSuperresolution.confidence_map);
+                if (_multiple_channels_flag)
+                    mc_addons = move(parallelSuperresolution.mc_addons);
+            } else {
+                Parallel::Superresolution parallelSuperresolution(this);
+                parallelSuperresolution();
+                addon = move(parallelSuperresolution.addon);
+                _confidence_map = move(parallelSuperresolution.confidence_map);
+                if (_multiple_channels_flag)
+                    mc_addons = move(parallelSuperresolution.mc_addons);
+            }
+            //_confidence4mask = _confidence_map;
 
-        if (_multiple_channels_flag) {
-            mc_addons = move(parallelSuperresolution.mc_addons);
-            mc_originals = _mc_reconstructed;
-        }
+            //only voxels with positive confidence are updated, the volume-wide kernels below iterate over their runs
+            _confidence_runs.Initialize(_confidence_map);
 
+            if (_multiple_channels_flag)
+                mc_originals = _mc_reconstructed;
 
 
 
-        if (_debug) {
-            _confidence_map.Write((boost::format("confidence-map%1%.nii.gz") % iter).str().c_str());
-            addon.Write((boost::format("addon%1%.nii.gz") % iter).str().c_str());
-        }
 
-        if (!_adaptive) {
+            if (_debug) {
+                _confidence_map.Write((boost::format("confidence-map%1%.nii.gz") % iter).str().c_str());
+                addon.Write((boost::format("addon%1%.nii.gz") % iter).str().c_str());
+            }
 
-            for (int i = 0; i < addon.GetX(); i++) {
-                for (int j = 0; j < addon.GetY(); j++) {
-                    for (int k = 0; k < addon.GetZ(); k++) {
-                        if (_confidence_map(i, j, k) > 0) {
-                            if (_multiple_channels_flag) {
-                                for (int nc=0; nc<_number_of_channels; nc++) {
-                                    mc_addons[nc](i, j, k) /= _confidence_map(i, j, k);
+            if (!_adaptive) {
+                RealPixel *pa = addon.Data();
+                RealPixel *pcm = _confidence_map.Data();
+                const int dy = _confidence_runs.GetY();
+                #pragma omp parallel for
+                for (int z = 0; z < _confidence_runs.GetZ(); z++)
+                    for (int y = 0; y < dy; y++) {
+                        const int row = addon.VoxelToIndex(0, y, z);
+                        for (int k = _confidence_runs.Begin(y, z); k < _confidence_runs.End(y, z); k++)
+                            for (int i = row + _confidence_runs.RunBegin(k); i < row + _confidence_runs.RunEnd(k); i++) {
+                                if (_multiple_channels_flag) {
+                                    for (int nc=0; nc<_number_of_channels; nc++) {
+                                        mc_addons[nc].Data()[i] /= pcm[i];
+                                    }
                                 }
+                                // ISSUES if pcm[i] is too small leading to bright pixels
+                                pa[i] /= pcm[i];
+                                //this is to revert to normal (non-adaptive) regularisation
+                                pcm[i] = 1;
                             }
-                        }
                     }
-                }
             }
 
-            RealPixel *pa = addon.Data();
-            RealPixel *pcm = _confidence_map.Data();
-            #pragma omp parallel for
-            for (int i = 0; i < addon.NumberOfVoxels(); i++) {
-                if (pcm[i] > 0) {
-                    // ISSUES if pcm[i] is too small leading to bright pixels
-                    pa[i] /= pcm[i];
-                    //this is to revert to normal (non-adaptive) regularisation
-                    pcm[i] = 1;
+            // update the volume with computed addon
+            _reconstructed += addon * _alpha; //_average_volume_weight;
+
+            if (_multiple_channels_flag) {
+                for (int nc=0; nc<_number_of_channels; nc++) {
+                    _mc_reconstructed[nc] += mc_addons[nc] * _alpha;
                 }
             }
 
-        }
-
-        // update the volume with computed addon
-        _reconstructed += addon * _alpha; //_average_volume_weight;
-
-        if (_multiple_channels_flag) {
-            for (int nc=0; nc<_number_of_channels; nc++) {
-                _mc_reconstructed[nc] += mc_addons[nc] * _alpha;
-            }
-        }
+            if (_multiple_channels_flag) {
+                for (int nc=0; nc<_number_of_channels; nc++) {
+                    for (int i = 0; i < _reconstructed.GetX(); i++)
+                    for (int j = 0; j < _reconstructed.GetY(); j++)
+                    for (int k = 0; k < _reconstructed.GetZ(); k++) {
+                        if (_mc_reconstructed[nc](i, j, k) < _min_intensity_mc[nc] * 0.9)
+                            _mc_reconstructed[nc](i, j, k) = _min_intensity_mc[nc] * 0.9;
+                        if (_mc_reconstructed[nc](i, j, k) > _max_intensity_mc[nc] * 1.1)
+                            _mc_reconstructed[nc](i, j, k) = _max_intensity_mc[nc] * 1.1;
+                    }
 
-        if (_multiple_channels_flag) {
-            for (int nc=0; nc<_number_of_channels; nc++) {
-                for (int i = 0; i < _reconstructed.GetX(); i++)
-                for (int j = 0; j < _reconstructed.GetY(); j++)
-                for (int k = 0; k < _reconstructed.GetZ(); k++) {
-                    if (_mc_reconstructed[nc](i, j, k) < _min_intensity_mc[nc] * 0.9)
-                        _mc_reconstructed[nc](i, j, k) = _min_intensity_mc[nc] * 0.9;
-                    if (_mc_reconstructed[nc](i, j, k) > _max_intensity_mc[nc] * 1.1)
-                        _mc_reconstructed[nc](i, j, k) = _max_intensity_mc[nc] * 1.1;
                 }
-
             }
         }
 
-
         /*
         if (_debug) {
             _reconstructed.Write((boost::format("recon%1%.nii.gz") % iter).str().c_str());
@@ -2632,8 +3057,9 @@ namespace svrtk {
             _reconstructed.Write((boost::format("recon_tr%1%.nii.gz") % iter).str().c_str());
         }
         */
-        //Smooth the reconstructed image with regularisation
-        AdaptiveRegularization(iter, original);
+        //Smooth the reconstructed image with regularisation (part of the system solved by CG)
+        if (!_cg_sr || _multiple_channels_flag)
+            AdaptiveRegularization(iter, original);
 
         if (_multiple_channels_flag) {
             AdaptiveRegularizationMC(iter, mc_originals);
@@ -2653,21 +3079,154 @@ namespace svrtk {
             _reconstructed.Write((boost::format("recon_reg_bias%1%.nii.gz") % iter).str().c_str());
         }
 
+        if (!_memory_report.empty()) {
+            //the reductions hold per-thread copies of their output volumes
+            const size_t volume_bytes = Utility::MemoryUsage(_reconstructed) * max(1u, thread::hardware_concurrency());
+            Array<pair<string, size_t>> transient;
+            if (_cg_sr && !_multiple_channels_flag)
+                transient.push_back({"SR normal operator buffers (estimate)", 2 * volume_bytes});
+            else if (!_transposed_sr || _volcoeffs_transposed.Empty())
+                transient.push_back({"SR reduction (estimate)", (2 + (_multiple_channels_flag ? _number_of_channels : 0)) * volume_bytes});
+            ReportMemoryUsage("Superresolution", transient);
+        }
+
         SVRTK_END_TIMING("Superresolution");
     }
 
     //-------------------------------------------------------------------
 
+    // solve (s A^T W A + L) x = s A^T W y for the voxels with positive confidence with preconditioned conjugate gradients
+    // with adaptive regularisation s = 1, which has the fixed point of the gradient-descent update with _alpha; without it
+    // the gradient-descent update divides the data term by the confidence of every voxel, which would make the operator
+    // non-symmetric, so s = 1 / mean confidence replaces the per-voxel division and the fixed points agree where the
+    // confidence is uniform (alpha itself cancels at the fixed point, as it scales both terms of the update)
+    void Reconstruction::SuperresolutionCG(int iter, const RealImage& original) {
+        const int n = _reconstructed.NumberOfVoxels();
+
+        //reduction buffers, one per chunk of slices, shared by all applications of the normal operator
+        const size_t chunks = min<size_t>(max(1u, thread::hardware_concurrency()), max<size_t>(1, _slices.size()));
+        Array<RealImage> buffers(chunks, RealImage(_reconstructed.Attributes()));
+        Array<RealImage> confidence_buffers(chunks, RealImage(_reconstructed.Attributes()));
+
+        //weighted back-projected residual of the current reconstruction and the confidence map
+        RealImage r(_reconstructed.Attributes());
+        _confidence_map.Initialize(_reconstructed.Attributes());
+        Parallel::SuperresolutionNormal(this, _reconstructed, true, buffers, confidence_buffers)(r, &_confidence_map);
+        Array<RealImage>().swap(confidence_buffers);
+        _confidence_runs.Initialize(_confidence_map);
+
+        if (_debug)
+            _confidence_map.Write((boost::format("confidence-map%1%.nii.gz") % iter).str().c_str());
+
+        //scale of the data term
+        const RealPixel *pcm = _confidence_map.Data();
+        double data_scale = 1;
+        if (!_adaptive) {
+            double sum = 0;
+            int num = 0;
+            #pragma omp parallel for reduction(+: sum, num)
+            for (int i = 0; i < n; i++) {
+                if (pcm[i] > 0) {
+                    sum += pcm[i];
+                    num++;
+                }
+            }
+            if (sum > 0)
+                data_scale = num / sum;
+        }
+
+        //r = s A^T W (y - A x) - L x, Jacobi preconditioner diag(s A^T W A + L) ~ s confidence + diag(L)
+        RealImage q(_reconstructed.Attributes()), preconditioner(_reconstructed.Attributes());
+        Parallel::SuperresolutionRegularizer(this, original, _reconstructed, q, false)();
+        Parallel::SuperresolutionRegularizer(this, original, _reconstructed, preconditioner, true)();
+
+        RealImage p(_reconstructed.Attributes()), normal(_reconstructed.Attributes());
+        RealPixel *px = _reconstructed.Data();
+        RealPixel *pr = r.Data();
+        RealPixel *pq = q.Data();
+        RealPixel *pp = p.Data();
+        RealPixel *pm = preconditioner.Data();
+        const RealPixel *pn = normal.Data();
+
+        double rz = 0, rr = 0;
+        #pragma omp parallel for reduction(+: rz, rr)
+        for (int i = 0; i < n; i++) {
+            if (pcm[i] > 0) {
+                pr[i] = data_scale * pr[i] - pq[i];
+                pm[i] += data_scale * pcm[i];
+                pp[i] = pr[i] / pm[i];
+                rz += pr[i] * pp[i];
+                rr += pr[i] * pr[i];
+            } else {
+                pr[i] = 0;
+            }
+        }
+
+        const double rr0 = rr;
+        int k = 0;
+        for (; k < _cg_max_iterations && rr > _cg_tolerance * _cg_tolerance * rr0 && rz > 0; k++) {
+            //q = (s A^T W A + L) p
+            Parallel::SuperresolutionNormal(this, p, false, buffers, confidence_buffers)(normal);
+            Parallel::SuperresolutionRegularizer(this, original, p, q, false)();
+
+            double pAp = 0;
+            #pragma omp parallel for reduction(+: pAp)
+            for (int i = 0; i < n; i++) {
+                if (pcm[i] > 0) {
+                    pq[i] += data_scale * pn[i];
+                    pAp += pp[i] * pq[i];
+                }
+            }
+            if (pAp <= 0)
+                break;
+
+            const double alpha = rz / pAp;
+            double rz_new = 0;
+            rr = 0;
+            #pragma omp parallel for reduction(+: rz_new, rr)
+            for (int i = 0; i < n; i++) {
+                if (pcm[i] > 0) {
+                    px[i] += alpha * pp[i];
+                    pr[i] -= alpha * pq[i];
+                    rz_new += pr[i] * pr[i] / pm[i];
+                    rr += pr[i] * pr[i];
+                }
+            }
+
+            const double beta = rz_new / rz;
+            rz = rz_new;
+            #pragma omp parallel for
+            for (int i = 0; i < n; i++)
+                if (pcm[i] > 0)
+                    pp[i] = pr[i] / pm[i] + beta * pp[i];
+        }
+
+        if (_verbose)
+            _verbose_log << "CG superresolution: " << k << " iterations, relative residual " << (rr0 > 0 ? sqrt(rr / rr0) : 0) << endl;
+
+        //this is to revert to normal (non-adaptive) regularisation
+        if (!_adaptive) {
+            RealPixel *pc = _confidence_map.Data();
+            #pragma omp parallel for
+            for (int i = 0; i < n; i++)
+                if (pc[i] > 0)
+                    pc[i] = 1;
+        }
+    }
+
+    //-------------------------------------------------------------------
+
     // run MStep (RS)
     void Reconstruction::MStep(int iter) {
         Parallel::MStep parallelMStep(this);
         parallelMStep();
-        const double sigma = parallelMStep.sigma;
-        const double mix = parallelMStep.mix;
-        const double num = parallelMStep.num;
-        const double min = parallelMStep.min;
-        const double max = parallelMStep.max;
+        UpdateMStepParameters(parallelMStep.sigma, parallelMStep.mix, parallelMStep.num, parallelMStep.min, parallelMStep.max, iter);
+    }
+
+    //-------------------------------------------------------------------
 
+    // update voxel-wise robust statistics parameters from the MStep sums
+    void Reconstruction::UpdateMStepParameters(double sigma, double mix, double num, double min, double max, int iter) {
         //Calculate sigma and mix
         if (mix > 0) {
             _sigma = sigma / mix;
@@ -2690,21 +3249,12 @@ namespace svrtk {
 
     // run adaptive regularisation of the SR reconstructed volume
     void Reconstruction::AdaptiveRegularization(int iter, const RealImage& original) {
-        Array<double> factor(13);
-        for (int i = 0; i < 13; i++) {
-            for (int j = 0; j < 3; j++)
-                factor[i] += fabs(double(_directions[i][j]));
-            factor[i] = 1 / factor[i];
-        }
-
-        Array<RealImage> b(13, _reconstructed);
-
-        Parallel::AdaptiveRegularization1 parallelAdaptiveRegularization1(this, b, factor, original);
-        parallelAdaptiveRegularization1();
+        if (_confidence_runs.Empty())
+            _confidence_runs.Initialize(_confidence_map);
 
         const RealImage original2 = _reconstructed;
-        Parallel::AdaptiveRegularization2 parallelAdaptiveRegularization2(this, b, original2);
-        parallelAdaptiveRegularization2();
+        Parallel::AdaptiveRegularization parallelAdaptiveRegularization(this, original, original2);
+        parallelAdaptiveRegularization();
 
         if (_alpha * _lambda / (_delta * _delta) > 0.068)
             cerr << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below 0.068." << endl;
@@ -2714,25 +3264,12 @@ namespace svrtk {
 
     void Reconstruction::AdaptiveRegularizationMC( int iter, Array<RealImage>& mc_originals)
     {
+        if (_confidence_runs.Empty())
+            _confidence_runs.Initialize(_confidence_map);
 
-        Array<double> factor(13,0);
-        for (int i = 0; i < 13; i++) {
-            for (int j = 0; j < 3; j++)
-            factor[i] += fabs(double(_directions[i][j]));
-            factor[i] = 1 / factor[i];
-        }
-
-        Array<Array<RealImage>> b;//(13);
-        for (int i = 0; i < 13; i++) {
-            b.push_back( _mc_reconstructed );
-        }
-
-        Parallel::AdaptiveRegularization1MC parallelAdaptiveRegularization1MC( this, b, factor,  mc_originals );
-        parallelAdaptiveRegularization1MC();
-
-        Array<RealImage> mc_originals2 = _mc_reconstructed;
-        Parallel::AdaptiveRegularization2MC parallelAdaptiveRegularization2MC( this, b, factor, mc_originals2 );
-        parallelAdaptiveRegularization2MC();
+        const Array<RealImage> mc_originals2 = _mc_reconstructed;
+        Parallel::AdaptiveRegularizationMC parallelAdaptiveRegularizationMC(this, mc_originals, mc_originals2);
+        parallelAdaptiveRegularizationMC();
 
         if (_alpha * _lambda / (_delta * _delta) > 0.068) {
             cerr << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below 0.068." << endl;
@@ -2863,10 +3400,24 @@ namespace svrtk {
 
         RealPixel *pi = _reconstructed.Data();
         const RealPixel *pb = bias.Data();
-        #pragma omp parallel for
-        for (int i = 0; i < _reconstructed.NumberOfVoxels(); i++)
-            if (pi[i] != -1)
-                pi[i] /= exp(-(pb[i]));
+        if (_confidence_runs.GetX() == _reconstructed.GetX() && _confidence_runs.GetY() == _reconstructed.GetY() && _confidence_runs.GetZ() == _reconstructed.GetZ()) {
+            //the SR step zeroes the voxels without confidence, so only its active voxels need normalising
+            const int dy = _confidence_runs.GetY();
+            #pragma omp parallel for
+            for (int z = 0; z < _confidence_runs.GetZ(); z++)
+                for (int y = 0; y < dy; y++) {
+                    const int row = _reconstructed.VoxelToIndex(0, y, z);
+                    for (int k = _confidence_runs.Begin(y, z); k < _confidence_runs.End(y, z); k++)
+                        for (int i = row + _confidence_runs.RunBegin(k); i < row + _confidence_runs.RunEnd(k); i++)
+                            if (pi[i] != -1)
+                                pi[i] /= exp(-(pb[i]));
+                }
+        } else {
+            #pragma omp parallel for
+            for (int i = 0; i < _reconstructed.NumberOfVoxels(); i++)
+                if (pi[i] != -1)
+                    pi[i] /= exp(-(pb[i]));
+        }
 
         SVRTK_END_TIMING("NormaliseBias");
     }
@@ -2910,6 +3461,65 @@ namespace svrtk {
 
     //-------------------------------------------------------------------
 
+    // bytes held by the large buffers of the reconstruction
+    void Reconstruction::MemoryUsage(Array<pair<string, size_t>>& usage) const {
+        size_t volcoeffs = 0, volcoeffsSF = 0;
+        for (const auto& coeffs : _volcoeffs)
+            volcoeffs += coeffs.MemoryUsage();
+        for (const auto& coeffs : _volcoeffsSF)
+            volcoeffsSF += coeffs.MemoryUsage();
+
+        size_t jac_mask = 0;
+        for (const auto& mask : _coeffs_jac_mask)
+            jac_mask += mask.capacity() / 8;
+
+        size_t mc_images = Utility::MemoryUsage(_mc_reconstructed);
+        for (const auto& channels : {&_mc_slices, &_mc_simulated_slices, &_mc_slice_dif})
+            for (const auto& images : *channels)
+                for (const RealImage *image : images)
+                    if (image)
+                        mc_images += Utility::MemoryUsage(*image);
+
+        usage.push_back({"_volcoeffs", volcoeffs});
+        usage.push_back({"_volcoeffsSF", volcoeffsSF});
+        usage.push_back({"_volcoeffs_transposed", _volcoeffs_transposed.MemoryUsage()});
+        usage.push_back({"_coeffs_jac_mask", jac_mask});
+        usage.push_back({"_slices", Utility::MemoryUsage(_slices)});
+        usage.push_back({"_slicesRwithMB", Utility::MemoryUsage(_slicesRwithMB)});
+        usage.push_back({"_not_masked_slices", Utility::MemoryUsage(_not_masked_slices)});
+        usage.push_back({"_grey_slices", Utility::MemoryUsage(_grey_slices)});
+        usage.push_back({"_simulated_slices", Utility::MemoryUsage(_simulated_slices)});
+        usage.push_back({"_simulated_weights", Utility::MemoryUsage(_simulated_weights)});
+        usage.push_back({"_simulated_inside", Utility::MemoryUsage(_simulated_inside)});
+        usage.push_back({"_slice_masks", Utility::MemoryUsage(_slice_masks)});
+        usage.push_back({"_slice_ssim_maps", Utility::MemoryUsage(_slice_ssim_maps)});
+        usage.push_back({"_slice_dif", Utility::MemoryUsage(_slice_dif)});
+        usage.push_back({"_weights", Utility::MemoryUsage(_weights)});
+        usage.push_back({"_bias", Utility::MemoryUsage(_bias)});
+        usage.push_back({"_probability_maps", Utility::MemoryUsage(_probability_maps)});
+        usage.push_back({"volumes", Utility::MemoryUsage(_reconstructed) + Utility::MemoryUsage(_mask) + Utility::MemoryUsage(_evaluation_mask)
+            + Utility::MemoryUsage(_target) + Utility::MemoryUsage(_brain_probability) + Utility::MemoryUsage(_grey_reconstructed)
+            + Utility::MemoryUsage(_volume_weights) + _volume_weights_sum.capacity() * sizeof(double) + Utility::MemoryUsage(_volume_weightsSF) + Utility::MemoryUsage(_confidence_map)});
+        usage.push_back({"multi-channel images", mc_images});
+    }
+
+    //-------------------------------------------------------------------
+
+    // append the memory usage after a stage to the memory report
+    void Reconstruction::ReportMemoryUsage(const string& stage, const Array<pair<string, size_t>>& transient) {
+        if (_memory_report.empty())
+            return;
+
+        Array<pair<string, size_t>> usage;
+        MemoryUsage(usage);
+        for (const auto& entry : transient)
+            usage.push_back({"transient: " + entry.first, entry.second});
+
+        Utility::AppendMemoryReport(_memory_report, stage, usage);
+    }
+
+    //-------------------------------------------------------------------
+
     void Reconstruction::SaveSlices() {
         #pragma omp parallel for
         for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
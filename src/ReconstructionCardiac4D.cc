@@ -343,6 +343,7 @@ namespace svrtk {
 
         //resize indicator of slice having and overlap with volumetric mask
         ClearAndResize(_slice_inside, _slices.size());
+        _coeffs_transformations.clear();
 
         if (_verbose)
             _verbose_log << "Initialising matrix coefficients... ";
@@ -358,18 +359,19 @@ namespace svrtk {
 
         if (_verbose)
             _verbose_log << "    ... for input slice: ";
+        RealPixel *pvolume_weights = _volume_weights.Data();
+        const int nvox = _volume_weights.NumberOfSpatialVoxels();
         // Do not parallelise: It would cause data inconsistencies
         for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
             if (_verbose)
                 _verbose_log << inputIndex << ", ";
+            const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
             // Do not parallelise: It would cause data inconsistencies
-            for (size_t i = 0; i < _volcoeffs[inputIndex].size(); i++)
-                for (size_t j = 0; j < _volcoeffs[inputIndex][i].size(); j++)
-                    for (size_t k = 0; k < _volcoeffs[inputIndex][i][j].size(); k++) {
-                        const POINT3D& p = _volcoeffs[inputIndex][i][j][k];
+            for (int i = 0; i < coeffs.GetX(); i++)
+                for (int j = 0; j < coeffs.GetY(); j++)
+                    for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
                         for (int outputIndex = 0; outputIndex < _reconstructed4D.GetT(); outputIndex++)
-                            _volume_weights(p.x, p.y, p.z, outputIndex) += _slice_temporal_weight[outputIndex][inputIndex] * p.value;
-                    }
+                            pvolume_weights[coeffs.Index(k) + outputIndex * nvox] += _slice_temporal_weight[outputIndex][inputIndex] * coeffs.Value(k);
         }
         if (_verbose)
             _verbose_log << "\b\b" << endl;
@@ -394,6 +396,8 @@ namespace svrtk {
         if (_verbose)
             _verbose_log << "Average volume weight is " << _average_volume_weight << endl;
 
+        ReportMemoryUsage("CoeffInitCardiac4D");
+
         SVRTK_END_TIMING("CoeffInitCardiac4D");
     }
 
@@ -430,17 +434,20 @@ namespace svrtk {
             const double scale = _scale[inputIndex];
 
             int slice_vox_num = 0;
+            const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
+            RealPixel *preconstructed = _reconstructed4D.Data();
+            const int nvox = _reconstructed4D.NumberOfSpatialVoxels();
 
             //Distribute slice intensities to the volume
-            for (size_t i = 0; i < _volcoeffs[inputIndex].size(); i++)
-                for (size_t j = 0; j < _volcoeffs[inputIndex][i].size(); j++)
+            for (int i = 0; i < coeffs.GetX(); i++)
+                for (int j = 0; j < coeffs.GetY(); j++)
                     if (slice(i, j, 0) != -1) {
                         //biascorrect and scale the slice
                         slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
 
                         //number of volume voxels with non-zero coefficients
                         //for current slice voxel
-                        const size_t n = _volcoeffs[inputIndex][i][j].size();
+                        const int n = coeffs.Size(i, j);
 
                         //if given voxel is not present in reconstructed volume at all,
                         //pad it
@@ -453,11 +460,9 @@ namespace svrtk {
 
                         //add contribution of current slice voxel to all voxel volumes
                         //to which it contributes
-                        for (size_t k = 0; k < n; k++) {
-                            const POINT3D& p = _volcoeffs[inputIndex][i][j][k];
+                        for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
                             for (size_t outputIndex = 0; outputIndex < _reconstructed_cardiac_phases.size(); outputIndex++)
-                                _reconstructed4D(p.x, p.y, p.z, outputIndex) += _slice_temporal_weight[outputIndex][inputIndex] * p.value * slice(i, j, 0);
-                        }
+                                preconstructed[coeffs.Index(k) + outputIndex * nvox] += _slice_temporal_weight[outputIndex][inputIndex] * coeffs.Value(k) * slice(i, j, 0);
                     }
             voxel_num.push_back(slice_vox_num);
         } //end of loop for a slice inputIndex
@@ -649,6 +654,8 @@ namespace svrtk {
         Parallel::SliceToVolumeRegistrationCardiac4D registration(this);
         registration();
 
+        ReportMemoryUsage("SliceToVolumeRegistrationCardiac4D");
+
         SVRTK_END_TIMING("SliceToVolumeRegistrationCardiac4D");
     }
 
@@ -662,15 +669,28 @@ namespace svrtk {
         if (_verbose)
             _verbose_log << "RemoteSliceToVolumeRegistrationCardiac4D" << endl;
 
-        #pragma omp parallel for
-        for (int t = 0; t < _reconstructed4D.GetT(); t++) {
-            string str_source = str_current_exchange_file_path + "/current-source-" + to_string(t) + ".nii.gz";
-            source = _reconstructed4D.GetRegion(0, 0, 0, t, attr_recon._x, attr_recon._y, attr_recon._z, t + 1);
-            source.Write(str_source.c_str());
+        //the persistent workers map the images from exchange arenas instead of reading .nii.gz files
+        const bool pool = _remote_workers > 0;
+        if (pool) {
+            Array<RealImage> sources(_reconstructed4D.GetT());
+            ExchangeArena arena;
+            for (int t = 0; t < _reconstructed4D.GetT(); t++) {
+                sources[t] = _reconstructed4D.GetRegion(0, 0, 0, t, attr_recon._x, attr_recon._y, attr_recon._z, t + 1);
+                arena.AddImage("source-" + to_string(t), sources[t]);
+            }
+            arena.Write(str_current_exchange_file_path + "/svr-source.arena");
+        } else {
+            #pragma omp parallel for
+            for (int t = 0; t < _reconstructed4D.GetT(); t++) {
+                string str_source = str_current_exchange_file_path + "/current-source-" + to_string(t) + ".nii.gz";
+                source = _reconstructed4D.GetRegion(0, 0, 0, t, attr_recon._x, attr_recon._y, attr_recon._z, t + 1);
+                source.Write(str_source.c_str());
+            }
         }
 
         if (iter == 1) {
             ClearAndReserve(_offset_matrices, _slices.size());
+            Array<RealImage> targets;
 
             GenericLinearInterpolateImageFunction<RealImage> interpolator;
             ResamplingWithPadding<RealPixel> resampling(attr_recon._dx, attr_recon._dx, attr_recon._dx, -1);
@@ -691,11 +711,24 @@ namespace svrtk {
                 target.GetMinMax(&tmin, &tmax);
                 _zero_slices[inputIndex] = tmax > 1 && (tmax - tmin) > 1 ? 1 : -1;
 
-                const string str_target = str_current_exchange_file_path + "/res-slice-" + to_string(inputIndex) + ".nii.gz";
-                target.Write(str_target.c_str());
+                if (pool) {
+                    targets.push_back(target);
+                } else {
+                    const string str_target = str_current_exchange_file_path + "/res-slice-" + to_string(inputIndex) + ".nii.gz";
+                    target.Write(str_target.c_str());
+                }
 
                 _offset_matrices.push_back(offset.GetMatrix());
             }
+
+            if (pool)
+                WriteRemoteTargets(str_current_exchange_file_path, targets);
+        }
+
+        if (pool) {
+            // the transformations are exchanged with the workers directly
+            RemoteRigidRegistrationWithPool(str_mirtk_path, str_current_exchange_file_path, _slice_svr_card_index);
+            return;
         }
 
         #pragma omp parallel for
@@ -1245,6 +1278,10 @@ namespace svrtk {
          BiasCorrectVolume(original);
          */
 
+        //the reduction holds per-thread copies of its output volumes
+        if (!_memory_report.empty())
+            ReportMemoryUsage("SuperresolutionCardiac4D", {{"SR reduction (estimate)", 2 * Utility::MemoryUsage(_reconstructed4D) * max(1u, thread::hardware_concurrency())}});
+
         SVRTK_END_TIMING("SuperresolutionCardiac4D");
     }
 
@@ -1256,21 +1293,9 @@ namespace svrtk {
             _verbose_log << "AdaptiveRegularizationCardiac4D." << endl;
         //_verbose_log << "AdaptiveRegularizationCardiac4D: _delta = "<<_delta<<" _lambda = "<<_lambda <<" _alpha = "<<_alpha<< endl;
 
-        Array<double> factor(13);
-        for (int i = 0; i < 13; i++) {
-            for (int j = 0; j < 3; j++)
-                factor[i] += fabs(double(_directions[i][j]));
-            factor[i] = 1 / factor[i];
-        }
-
-        Array<RealImage> b(13, _reconstructed4D);
-
-        Parallel::AdaptiveRegularization1Cardiac4D parallelAdaptiveRegularization1(this, b, factor, original);
-        parallelAdaptiveRegularization1();
-
-        RealImage original2 = _reconstructed4D;
-        Parallel::AdaptiveRegularization2Cardiac4D parallelAdaptiveRegularization2(this, b, original2);
-        parallelAdaptiveRegularization2();
+        const RealImage original2 = _reconstructed4D;
+        Parallel::AdaptiveRegularizationCardiac4D parallelAdaptiveRegularization(this, original, original2);
+        parallelAdaptiveRegularization();
 
         if (_alpha * _lambda / (_delta * _delta) > 0.068)
             cerr << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below 0.068." << endl;
@@ -1471,5 +1496,21 @@ namespace svrtk {
     }
 
     // -----------------------------------------------------------------------------
+    // Memory Usage of the Large Buffers
+    // -----------------------------------------------------------------------------
+    void ReconstructionCardiac4D::MemoryUsage(Array<pair<string, size_t>>& usage) const {
+        Reconstruction::MemoryUsage(usage);
+
+        size_t temporal_weights = 0;
+        for (const auto& weights : _slice_temporal_weight)
+            temporal_weights += weights.capacity() * sizeof(double);
+
+        usage.push_back({"_reconstructed4D", Utility::MemoryUsage(_reconstructed4D)});
+        usage.push_back({"_error", Utility::MemoryUsage(_error)});
+        usage.push_back({"_corrected_slices", Utility::MemoryUsage(_corrected_slices)});
+        usage.push_back({"_slice_temporal_weight", temporal_weights});
+    }
+
+    // -----------------------------------------------------------------------------
 
 } // namespace svrtk
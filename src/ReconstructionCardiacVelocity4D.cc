@@ -235,6 +235,10 @@ namespace svrtk {
         //  if (_global_bias_correction)
         //  BiasCorrectVolume(original);
 
+        //the reduction holds per-thread copies of its output volumes
+        if (!_memory_report.empty())
+            ReportMemoryUsage("SuperresolutionCardiacVelocity4D", {{"SR reduction (estimate)", 4 * _reconstructed5DVelocity.size() * Utility::MemoryUsage(_reconstructed4D) * max(1u, thread::hardware_concurrency())}});
+
         SVRTK_END_TIMING("Superresolution");
     }
 
@@ -245,39 +249,26 @@ namespace svrtk {
         if (_debug)
             cout << "AdaptiveRegularizationCardiacVelocity4D" << endl;
 
-        Array<double> factor(13, 0);
-        for (int i = 0; i < 13; i++) {
-            for (int j = 0; j < 3; j++)
-                factor[i] += fabs(double(_directions[i][j]));
-            factor[i] = 1 / factor[i];
-        }
-
         RealImage original;
-        Array<RealImage> b(13);
 
         if (_alpha * _lambda / (_delta * _delta) > 0.068)
             cerr << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below 0.068." << endl;
 
+        RealImage reconstructed4D = move(_reconstructed4D);
+
         for (size_t i = 0; i < _reconstructed5DVelocity.size(); i++) {
             _reconstructed4D = move(_reconstructed5DVelocity[i]);
             _confidence_map = _confidence_maps_velocity[i];
 
-            #pragma omp parallel for
-            for (size_t j = 0; j < b.size(); j++)
-                b[j] = _reconstructed4D;
-
-            Parallel::AdaptiveRegularization1Cardiac4D parallelAdaptiveRegularization1(this, b, factor, originals[i]);
-            parallelAdaptiveRegularization1();
-
             original = _reconstructed4D;
-            Parallel::AdaptiveRegularization2Cardiac4D parallelAdaptiveRegularization2(this, b, original);
-            parallelAdaptiveRegularization2();
+            Parallel::AdaptiveRegularizationCardiac4D parallelAdaptiveRegularization(this, originals[i], original);
+            parallelAdaptiveRegularization();
 
             _reconstructed5DVelocity[i] = move(_reconstructed4D);
         }
 
         // Restore to its original value
-        _reconstructed4D = move(b[0]);
+        _reconstructed4D = move(reconstructed4D);
     }
 
     // -----------------------------------------------------------------------------
@@ -813,4 +804,18 @@ namespace svrtk {
         cout << ".............................................." << endl;
     }
 
+    //-------------------------------------------------------------------
+
+    void ReconstructionCardiacVelocity4D::MemoryUsage(Array<pair<string, size_t>>& usage) const {
+        ReconstructionCardiac4D::MemoryUsage(usage);
+
+        size_t simulated_velocities = 0;
+        for (const auto& velocities : _simulated_velocities)
+            simulated_velocities += Utility::MemoryUsage(velocities);
+
+        usage.push_back({"_reconstructed5DVelocity", Utility::MemoryUsage(_reconstructed5DVelocity)});
+        usage.push_back({"_confidence_maps_velocity", Utility::MemoryUsage(_confidence_maps_velocity)});
+        usage.push_back({"_simulated_velocities", simulated_velocities});
+    }
+
 } // namespace svrtk
@@ -17,6 +17,11 @@
  */
 
 #include "svrtk/ReconstructionDWI.h"
+#include "svrtk/SignalModel.h"
+
+// C++ Standard
+#include <algorithm>
+#include <limits>
 
 using namespace std;
 using namespace mirtk;
@@ -48,6 +53,9 @@ namespace svrtk {
         _recon_type = _3D;
         _regul_steps = 1;
         _intensity_matching_GD = false;
+        _sh_basis_order = -1;
+        _sh_basis_coeffs = 0;
+        _sh_stride = 0;
 
         int directions[13][3] = {
             { 1, 0, -1 },
@@ -195,6 +203,8 @@ namespace svrtk {
         Array<RigidTransformation> &slice_transformations;
         RealImage &average;
         RealImage &weights;
+        //affine mapping from image coordinates of the average to image coordinates of each slice
+        Array<Matrix> volume_to_slice;
 
     public:
 
@@ -202,19 +212,11 @@ namespace svrtk {
             for ( int k0 = r.begin(); k0 < r.end(); k0++) {
                 for ( int j0 = 0; j0 < average.GetY(); j0++) {
                     for ( int i0 = 0; i0 < average.GetX(); i0++) {
-                        double x0 = i0;
-                        double y0 = j0;
-                        double z0 = k0;
-
-                        average.ImageToWorld(x0, y0, z0);
                         for (int inputIndex = 0; inputIndex < slices.size(); inputIndex++ ) {
-                            double x = x0;
-                            double y = y0;
-                            double z = z0;
-
-                            slice_transformations[inputIndex].Transform(x, y, z);
-
-                            slices[inputIndex].WorldToImage(x, y, z);
+                            const Matrix& m = volume_to_slice[inputIndex];
+                            const double x = m(0, 0) * i0 + m(0, 1) * j0 + m(0, 2) * k0 + m(0, 3);
+                            const double y = m(1, 0) * i0 + m(1, 1) * j0 + m(1, 2) * k0 + m(1, 3);
+                            const double z = m(2, 0) * i0 + m(2, 1) * j0 + m(2, 2) * k0 + m(2, 3);
                             int i = round(x);
                             int j = round(y);
                             int k = round(z);
@@ -248,6 +250,11 @@ namespace svrtk {
             average = 0;
             weights.Initialize( reconstructor->_reconstructed.Attributes() );
             weights = 0;
+
+            //the rigid transformations are affine, the mapping of a voxel is a single matrix product
+            volume_to_slice.resize(slices.size());
+            for (size_t inputIndex = 0; inputIndex < slices.size(); inputIndex++)
+                volume_to_slice[inputIndex] = slices[inputIndex].GetWorldToImageMatrix() * slice_transformations[inputIndex].GetMatrix() * average.GetImageToWorldMatrix();
         }
 
         // execute
@@ -959,17 +966,18 @@ namespace svrtk {
 
                 reconstructor->_slice_inside[inputIndex] = false;
 
-                POINT3D p;
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
+                const RealPixel *preconstructed = reconstructor->_reconstructed.Data();
+                const RealPixel *pmask = reconstructor->_mask.Data();
                 for ( unsigned int i = 0; i < reconstructor->_slices[inputIndex].GetX(); i++ )
                     for ( unsigned int j = 0; j < reconstructor->_slices[inputIndex].GetY(); j++ )
                         if ( reconstructor->_slices[inputIndex](i, j, 0) != -1 ) {
                             double weight = 0;
-                            int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
-                            for ( unsigned int k = 0; k < n; k++ ) {
-                                p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                reconstructor->_simulated_slices[inputIndex](i, j, 0) += p.value * reconstructor->_reconstructed(p.x, p.y, p.z);
-                                weight += p.value;
-                                if (reconstructor->_mask(p.x, p.y, p.z) == 1) {
+                            for ( int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++ ) {
+                                const int index = coeffs.Index(k);
+                                reconstructor->_simulated_slices[inputIndex](i, j, 0) += coeffs.Value(k) * preconstructed[index];
+                                weight += coeffs.Value(k);
+                                if (pmask[index] == 1) {
                                     reconstructor->_simulated_inside[inputIndex](i, j, 0) = 1;
                                     reconstructor->_slice_inside[inputIndex] = true;
                                 }
@@ -1010,7 +1018,6 @@ namespace svrtk {
         unsigned int inputIndex;
         int i, j, k, n;
         RealImage sim;
-        POINT3D p;
         double weight;
 
         int z, current_stack;
@@ -1033,15 +1040,15 @@ namespace svrtk {
 
             if(_slice_weight[inputIndex]>threshold)
             {
+                const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
+                const RealPixel *preconstructed = _reconstructed.Data();
                 for (i = 0; i < slice.GetX(); i++)
                     for (j = 0; j < slice.GetY(); j++)
                         if (slice(i, j, 0) != -1) {
                             weight=0;
-                            n = _volcoeffs[inputIndex][i][j].size();
-                            for (k = 0; k < n; k++) {
-                                p = _volcoeffs[inputIndex][i][j][k];
-                                sim(i, j, 0) += p.value * _reconstructed(p.x, p.y, p.z);
-                                weight += p.value;
+                            for (k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                                sim(i, j, 0) += coeffs.Value(k) * preconstructed[coeffs.Index(k)];
+                                weight += coeffs.Value(k);
                             }
                             if(weight>0.98)
                                 sim(i,j,0)/=weight;
@@ -1586,6 +1593,8 @@ namespace svrtk {
             cout << "SliceToVolumeRegistration" << endl;
         ParallelSliceToVolumeRegistration_DWI registration(this);
         registration();
+
+        ReportMemoryUsage("SliceToVolumeRegistration");
     }
 
 
@@ -1612,9 +1621,8 @@ namespace svrtk {
 
                 RealImage& slice = reconstructor->_slices[inputIndex];
 
-                POINT3D p;
-                VOXELCOEFFS empty;
-                SLICECOEFFS slicecoeffs(slice.GetX(), Array < VOXELCOEFFS > (slice.GetY(), empty));
+                SliceCoeffs slicecoeffs;
+                slicecoeffs.Initialize(slice.GetX(), slice.GetY());
 
                 slice_inside = false;
 
@@ -1643,59 +1651,15 @@ namespace svrtk {
                     sigmaz = 0.5 * dx / 2.3548;
                 }
 
-                double size = res / reconstructor->_quality_factor;
-
-                int xDim = round(2 * dx / size);
-                int yDim = round(2 * dy / size);
-                int zDim = round(2 * dz / size);
-
-                xDim = xDim/2*2+1;
-                yDim = yDim/2*2+1;
-                zDim = zDim/2*2+1;
-
-                ImageAttributes attr;
-                attr._x = xDim;
-                attr._y = yDim;
-                attr._z = zDim;
-                attr._dx = size;
-                attr._dy = size;
-                attr._dz = size;
-                RealImage PSF(attr);
-
-                double cx, cy, cz;
-                cx = 0.5 * (xDim - 1);
-                cy = 0.5 * (yDim - 1);
-                cz = 0.5 * (zDim - 1);
-                PSF.ImageToWorld(cx, cy, cz);
-
-                double x, y, z;
-                double sum = 0;
-                int i, j, k;
-                for (i = 0; i < xDim; i++)
-                    for (j = 0; j < yDim; j++)
-                        for (k = 0; k < zDim; k++) {
-                            x = i;
-                            y = j;
-                            z = k;
-                            PSF.ImageToWorld(x, y, z);
-                            x -= cx;
-                            y -= cy;
-                            z -= cz;
-
-                            PSF(i, j, k) = exp(
-                                               -x * x / (2 * sigmax * sigmax) - y * y / (2 * sigmay * sigmay)
-                                               - z * z / (2 * sigmaz * sigmaz));
-                            sum += PSF(i, j, k);
-                        }
-                PSF /= sum;
+                const shared_ptr<const PSFKernel> kernel = PSFCache::Instance().Get(dx, dy, dz, sigmax, sigmay, sigmaz, res / reconstructor->_quality_factor, res);
 
                 if (reconstructor->_debug)
                     if (inputIndex == 0)
-                        PSF.Write("PSF.nii.gz");
+                        kernel->image.Write("PSF.nii.gz");
 
-                int dim = (floor(ceil(sqrt(double(xDim * xDim + yDim * yDim + zDim * zDim)) * size / res) / 2))
-                * 2 + 1 + 2;
+                int dim = kernel->dim;
 
+                ImageAttributes attr;
                 attr._x = dim;
                 attr._y = dim;
                 attr._z = dim;
@@ -1705,7 +1669,11 @@ namespace svrtk {
 
                 RealImage tPSF(attr);
 
-                int centre = (dim - 1) / 2;
+                int centre = kernel->centre;
+
+                double x, y, z;
+                double sum;
+                int i, j;
 
                 int ii, jj, kk;
                 int tx, ty, tz;
@@ -1713,122 +1681,99 @@ namespace svrtk {
                 int l, m, n;
                 double weight;
 
-                if (reconstructor->_intensity_weights[inputIndex] > 0) {
+                //the rigid transformation is affine, the offsets of the PSF points are mapped once per slice
+                const Array<Point> mapped_offset = MapPSFOffsets(*kernel, reconstructor->_reconstructed.GetWorldToImageMatrix() * reconstructor->_transformations[inputIndex].GetMatrix() * slice.GetImageToWorldMatrix());
 
-                    for (i = 0; i < slice.GetX(); i++)
-                        for (j = 0; j < slice.GetY(); j++)
-                            if (slice(i, j, 0) != -1) {
+                for (i = 0; i < slice.GetX(); i++)
+                    for (j = 0; j < slice.GetY(); j++) {
+                        if (reconstructor->_intensity_weights[inputIndex] > 0 && slice(i, j, 0) != -1) {
+
+                            x = i;
+                            y = j;
+                            z = 0;
+                            slice.ImageToWorld(x, y, z);
+                            reconstructor->_transformations[inputIndex].Transform(x, y, z);
+                            reconstructor->_reconstructed.WorldToImage(x, y, z);
+                            const double cx = x, cy = y, cz = z;
+                            tx = round(x);
+                            ty = round(y);
+                            tz = round(z);
+
+                            for (ii = 0; ii < dim; ii++)
+                                for (jj = 0; jj < dim; jj++)
+                                    for (kk = 0; kk < dim; kk++)
+                                        tPSF(ii, jj, kk) = 0;
+
+                            for (size_t k = 0; k < kernel->offset.size(); k++) {
+
+                                x = cx + mapped_offset[k]._x;
+                                y = cy + mapped_offset[k]._y;
+                                z = cz + mapped_offset[k]._z;
+
+                                nx = (int) floor(x);
+                                ny = (int) floor(y);
+                                nz = (int) floor(z);
+
+                                sum = 0;
+
+                                bool inside = false;
+                                for (l = nx; l <= nx + 1; l++)
+                                    if ((l >= 0) && (l < reconstructor->_reconstructed.GetX()))
+                                        for (m = ny; m <= ny + 1; m++)
+                                            if ((m >= 0) && (m < reconstructor->_reconstructed.GetY()))
+                                                for (n = nz; n <= nz + 1; n++)
+                                                    if ((n >= 0) && (n < reconstructor->_reconstructed.GetZ())) {
+                                                        weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+                                                        sum += weight;
+                                                        if (reconstructor->_mask(l, m, n) == 1) {
+                                                            inside = true;
+                                                            slice_inside = true;
+                                                        }
+                                                    }
+
+                                if ((sum <= 0) || (!inside))
+                                    continue;
+
+                                for (l = nx; l <= nx + 1; l++)
+                                    if ((l >= 0) && (l < reconstructor->_reconstructed.GetX()))
+                                        for (m = ny; m <= ny + 1; m++)
+                                            if ((m >= 0) && (m < reconstructor->_reconstructed.GetY()))
+                                                for (n = nz; n <= nz + 1; n++)
+                                                    if ((n >= 0) && (n < reconstructor->_reconstructed.GetZ())) {
+                                                        weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
+
+                                                        int aa, bb, cc;
+                                                        aa = l - tx + centre;
+                                                        bb = m - ty + centre;
+                                                        cc = n - tz + centre;
+
+                                                        double value = kernel->value[k] * weight / sum;
+
+                                                        if ((aa < 0) || (aa >= dim) || (bb < 0) || (bb >= dim) || (cc < 0) || (cc >= dim)) {
+                                                            stringstream err;
+                                                            err << "Error while trying to populate tPSF. " << aa << " " << bb << " " << cc << endl;
+                                                            err << l << " " << m << " " << n << endl;
+                                                            err << tx << " " << ty << " " << tz << endl;
+                                                            err << centre << endl;
+                                                            tPSF.Write("tPSF.nii.gz");
+                                                            throw runtime_error(err.str());
+                                                        }
+                                                        else
+                                                            tPSF(aa, bb, cc) += value;
+                                                    }
 
-                                x = i;
-                                y = j;
-                                z = 0;
-                                slice.ImageToWorld(x, y, z);
-                                reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                                reconstructor->_reconstructed.WorldToImage(x, y, z);
-                                tx = round(x);
-                                ty = round(y);
-                                tz = round(z);
-
-                                for (ii = 0; ii < dim; ii++)
-                                    for (jj = 0; jj < dim; jj++)
-                                        for (kk = 0; kk < dim; kk++)
-                                            tPSF(ii, jj, kk) = 0;
-
-                                for (ii = 0; ii < xDim; ii++)
-                                    for (jj = 0; jj < yDim; jj++)
-                                        for (kk = 0; kk < zDim; kk++) {
-
-                                            x = ii;
-                                            y = jj;
-                                            z = kk;
-
-                                            PSF.ImageToWorld(x, y, z);
-
-                                            x -= cx;
-                                            y -= cy;
-                                            z -= cz;
-
-                                            x /= dx;
-                                            y /= dy;
-                                            z /= dz;
-
-                                            x += i;
-                                            y += j;
-
-                                            slice.ImageToWorld(x, y, z);
-
-                                            reconstructor->_transformations[inputIndex].Transform(x, y, z);
-
-                                            reconstructor->_reconstructed.WorldToImage(x, y, z);
-
-                                            nx = (int) floor(x);
-                                            ny = (int) floor(y);
-                                            nz = (int) floor(z);
-
-                                            sum = 0;
-
-                                            bool inside = false;
-                                            for (l = nx; l <= nx + 1; l++)
-                                                if ((l >= 0) && (l < reconstructor->_reconstructed.GetX()))
-                                                    for (m = ny; m <= ny + 1; m++)
-                                                        if ((m >= 0) && (m < reconstructor->_reconstructed.GetY()))
-                                                            for (n = nz; n <= nz + 1; n++)
-                                                                if ((n >= 0) && (n < reconstructor->_reconstructed.GetZ())) {
-                                                                    weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-                                                                    sum += weight;
-                                                                    if (reconstructor->_mask(l, m, n) == 1) {
-                                                                        inside = true;
-                                                                        slice_inside = true;
-                                                                    }
-                                                                }
-
-                                            if ((sum <= 0) || (!inside))
-                                                continue;
-
-                                            for (l = nx; l <= nx + 1; l++)
-                                                if ((l >= 0) && (l < reconstructor->_reconstructed.GetX()))
-                                                    for (m = ny; m <= ny + 1; m++)
-                                                        if ((m >= 0) && (m < reconstructor->_reconstructed.GetY()))
-                                                            for (n = nz; n <= nz + 1; n++)
-                                                                if ((n >= 0) && (n < reconstructor->_reconstructed.GetZ())) {
-                                                                    weight = (1 - fabs(l - x)) * (1 - fabs(m - y)) * (1 - fabs(n - z));
-
-                                                                    int aa, bb, cc;
-                                                                    aa = l - tx + centre;
-                                                                    bb = m - ty + centre;
-                                                                    cc = n - tz + centre;
-
-                                                                    double value = PSF(ii, jj, kk) * weight / sum;
-
-                                                                    if ((aa < 0) || (aa >= dim) || (bb < 0) || (bb >= dim) || (cc < 0) || (cc >= dim)) {
-                                                                        stringstream err;
-                                                                        err << "Error while trying to populate tPSF. " << aa << " " << bb << " " << cc << endl;
-                                                                        err << l << " " << m << " " << n << endl;
-                                                                        err << tx << " " << ty << " " << tz << endl;
-                                                                        err << centre << endl;
-                                                                        tPSF.Write("tPSF.nii.gz");
-                                                                        throw runtime_error(err.str());
-                                                                    }
-                                                                    else
-                                                                        tPSF(aa, bb, cc) += value;
-                                                                }
-
-                                        }
-
-                                for (ii = 0; ii < dim; ii++)
-                                    for (jj = 0; jj < dim; jj++)
-                                        for (kk = 0; kk < dim; kk++)
-                                            if (tPSF(ii, jj, kk) > 0) {
-                                                p.x = ii + tx - centre;
-                                                p.y = jj + ty - centre;
-                                                p.z = kk + tz - centre;
-                                                p.value = tPSF(ii, jj, kk);
-                                                slicecoeffs[i][j].push_back(p);
-                                            }
                             }
 
-                }
+                            for (ii = 0; ii < dim; ii++)
+                                for (jj = 0; jj < dim; jj++)
+                                    for (kk = 0; kk < dim; kk++)
+                                        if (tPSF(ii, jj, kk) > 0)
+                                            slicecoeffs.Add(reconstructor->_reconstructed.VoxelToIndex(ii + tx - centre, jj + ty - centre, kk + tz - centre), tPSF(ii, jj, kk));
+                        }
+                        slicecoeffs.EndRow();
+                    }
 
+                // copy assignment trims the capacity of the coefficient arrays to their size
                 reconstructor->_volcoeffs[inputIndex] = slicecoeffs;
                 reconstructor->_slice_inside[inputIndex] = slice_inside;
 
@@ -1862,17 +1807,11 @@ namespace svrtk {
         _volume_weights.Initialize( _reconstructed.Attributes() );
         _volume_weights = 0;
 
-        int inputIndex, i, j, n, k;
-        POINT3D p;
-        for ( inputIndex = 0; inputIndex < _slices.size(); ++inputIndex) {
-            for ( i = 0; i < _slices[inputIndex].GetX(); i++)
-                for ( j = 0; j < _slices[inputIndex].GetY(); j++) {
-                    n = _volcoeffs[inputIndex][i][j].size();
-                    for (k = 0; k < n; k++) {
-                        p = _volcoeffs[inputIndex][i][j][k];
-                        _volume_weights(p.x, p.y, p.z) += p.value;
-                    }
-                }
+        RealPixel *pvolume_weights = _volume_weights.Data();
+        for (size_t inputIndex = 0; inputIndex < _slices.size(); ++inputIndex) {
+            const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
+            for (size_t k = 0; k < coeffs.NumberOfCoefficients(); k++)
+                pvolume_weights[coeffs.Index(k)] += coeffs.Value(k);
         }
         if (_debug)
             _volume_weights.Write("volume_weights.nii.gz");
@@ -1895,6 +1834,17 @@ namespace svrtk {
             cout<<"Average volume weight is "<<_average_volume_weight<<endl;
         }
 
+        GroupSlicesByFootprint();
+
+        ReportMemoryUsage("CoeffInit");
+    }
+
+    void ReconstructionDWI::GroupSlicesByFootprint()
+    {
+        //slices in groups with disjoint footprints are back-projected into shared buffers, even small groups
+        //keep the memory of the SR independent of the number of threads
+        _slice_groups = DisjointSliceGroups(_volcoeffs, _reconstructed.GetX(), _reconstructed.GetY(), _reconstructed.GetZ());
+        cout<<_slices.size()<<" slices in "<<_slice_groups.size()<<" groups with disjoint footprints."<<endl;
     }
 
 
@@ -1905,16 +1855,17 @@ namespace svrtk {
         int i, j, k, n;
         RealImage slice;
         double scale;
-        POINT3D p;
         Array<int> voxel_num;
         int slice_vox_num;
 
         _reconstructed = 0;
+        RealPixel *preconstructed = _reconstructed.Data();
 
         for (inputIndex = 0; inputIndex < _slices.size(); ++inputIndex) {
             slice = _slices[inputIndex];
             RealImage& b = _bias[inputIndex];
             scale = _scale[inputIndex];
+            const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
 
             slice_vox_num=0;
 
@@ -1927,14 +1878,12 @@ namespace svrtk {
                         else
                             slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
 
-                        n = _volcoeffs[inputIndex][i][j].size();
+                        n = coeffs.Size(i, j);
                         if (n>0)
                             slice_vox_num++;
 
-                        for (k = 0; k < n; k++) {
-                            p = _volcoeffs[inputIndex][i][j][k];
-                            _reconstructed(p.x, p.y, p.z) += p.value * slice(i, j, 0);
-                        }
+                        for (k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
+                            preconstructed[coeffs.Index(k)] += coeffs.Value(k) * slice(i, j, 0);
                     }
             voxel_num.push_back(slice_vox_num);
         }
@@ -2151,7 +2100,7 @@ namespace svrtk {
                             else
                                 slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
 
-                            int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
+                            int n = reconstructor->_volcoeffs[inputIndex].Size(i, j);
 
                             if ( (n>0) &&
                                 (reconstructor->_simulated_weights[inputIndex](i,j,0) > 0) ) {
@@ -2604,7 +2553,9 @@ namespace svrtk {
 
                 double scale = reconstructor->_scale[inputIndex];
 
-                POINT3D p;
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
+                RealPixel *paddon = addon.Data();
+                RealPixel *pconfidence_map = confidence_map.Data();
                 for ( int i = 0; i < slice.GetX(); i++)
                     for ( int j = 0; j < slice.GetY(); j++)
                         if (slice(i, j, 0) != -1) {
@@ -2619,19 +2570,18 @@ namespace svrtk {
                             else
                                 slice(i,j,0) = 0;
 
-                            int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
-                            for (int k = 0; k < n; k++) {
-                                p = reconstructor->_volcoeffs[inputIndex][i][j][k];
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                                const int index = coeffs.Index(k);
                                 if(reconstructor->_robust_slices_only)
                                 {
-                                    addon(p.x, p.y, p.z) += p.value * slice(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                                    confidence_map(p.x, p.y, p.z) += p.value * reconstructor->_slice_weight[inputIndex];
+                                    paddon[index] += coeffs.Value(k) * slice(i, j, 0) * reconstructor->_slice_weight[inputIndex];
+                                    pconfidence_map[index] += coeffs.Value(k) * reconstructor->_slice_weight[inputIndex];
 
                                 }
                                 else
                                 {
-                                    addon(p.x, p.y, p.z) += p.value * slice(i, j, 0) * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                                    confidence_map(p.x, p.y, p.z) += p.value * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
+                                    paddon[index] += coeffs.Value(k) * slice(i, j, 0) * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
+                                    pconfidence_map[index] += coeffs.Value(k) * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
                                 }
                             }
                         }
@@ -2689,6 +2639,10 @@ namespace svrtk {
         addon = ParallelSuperresolution_DWI.addon;
         _confidence_map = ParallelSuperresolution_DWI.confidence_map;
 
+        //the reduction holds per-thread copies of its output volumes
+        if (!_memory_report.empty())
+            ReportMemoryUsage("Superresolution", {{"SR reduction (estimate)", 2 * Utility::MemoryUsage(addon) * max(1u, thread::hardware_concurrency())}});
+
 
         if(_debug) {
             char buffer[256];
@@ -3535,18 +3489,15 @@ namespace svrtk {
                     pi++;
                 }
 
-                POINT3D p;
+                const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
+                RealPixel *pbias = bias.Data();
                 for (int i = 0; i < slice.GetX(); i++)
                     for (int j = 0; j < slice.GetY(); j++)
                         if (slice(i, j, 0) != -1) {
-                            //number of volume voxels with non-zero coefficients for current slice voxel
-                            int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
                             //add contribution of current slice voxel to all voxel volumes
                             //to which it contributes
-                            for (int k = 0; k < n; k++) {
-                                p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                bias(p.x, p.y, p.z) += p.value * b(i, j, 0);
-                            }
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
+                                pbias[coeffs.Index(k)] += coeffs.Value(k) * b(i, j, 0);
                         }
                 //end of loop for a slice inputIndex
             }
@@ -4276,13 +4227,15 @@ namespace svrtk {
         int i, j, k, t, n;
         RealImage slice;
         double scale;
-        POINT3D p;
 
         ImageAttributes attr = _reconstructed.Attributes();
         attr._t = nStacks;
         cout<<nStacks<<" stacks."<<endl;
         RealImage recon4D(attr);
         RealImage weights(attr);
+        const size_t nvox = _reconstructed.NumberOfVoxels();
+        RealPixel *precon4D = recon4D.Data();
+        RealPixel *pweights = weights.Data();
 
         for (inputIndex = 0; inputIndex < _slices.size(); ++inputIndex) {
             //copy the current slice
@@ -4291,6 +4244,7 @@ namespace svrtk {
             RealImage& b = _bias[inputIndex];
             //read current scale factor
             scale = _scale[inputIndex];
+            const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
             //cout<<scale<<" ";
 
             //Distribute slice intensities to the volume
@@ -4302,16 +4256,12 @@ namespace svrtk {
                         //if(origDir==1)
                         slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
 
-                        //number of volume voxels with non-zero coefficients
-                        //for current slice voxel
-                        n = _volcoeffs[inputIndex][i][j].size();
-
                         //add contribution of current slice voxel to all voxel volumes
                         //to which it contributes
-                        for (k = 0; k < n; k++) {
-                            p = _volcoeffs[inputIndex][i][j][k];
-                            recon4D(p.x, p.y, p.z, _stack_index[inputIndex]) += _slice_weight[inputIndex] * p.value * slice(i, j, 0);
-                            weights(p.x, p.y, p.z, _stack_index[inputIndex]) += _slice_weight[inputIndex] * p.value;
+                        for (k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                            const size_t index = coeffs.Index(k) + (size_t)_stack_index[inputIndex] * nvox;
+                            precon4D[index] += _slice_weight[inputIndex] * coeffs.Value(k) * slice(i, j, 0);
+                            pweights[index] += _slice_weight[inputIndex] * coeffs.Value(k);
                         }
                     }
             //} //end of loop for origDir
@@ -4352,13 +4302,15 @@ namespace svrtk {
         int i, j, k, t, n;
         RealImage slice;
         double scale;
-        POINT3D p;
 
         ImageAttributes attr = _reconstructed.Attributes();
         attr._t = nStacks;
         cout<<nStacks<<" stacks."<<endl;
         RealImage recon4D(attr);
         RealImage weights(attr);
+        const size_t nvox = _reconstructed.NumberOfVoxels();
+        RealPixel *precon4D = recon4D.Data();
+        RealPixel *pweights = weights.Data();
 
         for (inputIndex = 0; inputIndex < _slices.size(); ++inputIndex) {
             //copy the current slice
@@ -4367,6 +4319,7 @@ namespace svrtk {
             RealImage& b = _bias[inputIndex];
             //read current scale factor
             scale = _scale[inputIndex];
+            const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
             //cout<<scale<<" ";
 
             //Distribute slice intensities to the volume
@@ -4378,16 +4331,12 @@ namespace svrtk {
                         //if(origDir==1)
                         slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
 
-                        //number of volume voxels with non-zero coefficients
-                        //for current slice voxel
-                        n = _volcoeffs[inputIndex][i][j].size();
-
                         //add contribution of current recon-test4D-gauss-weightedslice voxel to all voxel volumes
                         //to which it contributes
-                        for (k = 0; k < n; k++) {
-                            p = _volcoeffs[inputIndex][i][j][k];
-                            recon4D(p.x, p.y, p.z, _stack_index[inputIndex]) += _slice_weight[inputIndex] * p.value * slice(i, j, 0);
-                            weights(p.x, p.y, p.z, _stack_index[inputIndex]) += _slice_weight[inputIndex] * p.value;
+                        for (k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                            const size_t index = coeffs.Index(k) + (size_t)_stack_index[inputIndex] * nvox;
+                            precon4D[index] += _slice_weight[inputIndex] * coeffs.Value(k) * slice(i, j, 0);
+                            pweights[index] += _slice_weight[inputIndex] * coeffs.Value(k);
                         }
                     }
             //} //end of loop for origDir
@@ -4663,7 +4612,6 @@ namespace svrtk {
         int i, j, k, t, n;
         RealImage slice;
         double scale;
-        POINT3D p;
         int dirIndex;
         double gx,gy,gz;
         ImageAttributes attr = _reconstructed.Attributes();
@@ -4701,6 +4649,9 @@ namespace svrtk {
         cout<<nStacks<<" stacks."<<endl;
         RealImage recon4D(attr);
         RealImage weights(attr);
+        const size_t nvox = _reconstructed.NumberOfVoxels();
+        RealPixel *precon4D = recon4D.Data();
+        RealPixel *pweights = weights.Data();
 
         for (inputIndex = 0; inputIndex < _slices.size(); ++inputIndex) {
             //copy the current slice
@@ -4709,6 +4660,7 @@ namespace svrtk {
             RealImage& b = _bias[inputIndex];
             //read current scale factor
             scale = _scale[inputIndex];
+            const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
             //cout<<scale<<" ";
 
             //Distribute slice intensities to the volume
@@ -4720,16 +4672,12 @@ namespace svrtk {
                         //if(origDir==1)
                         slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
 
-                        //number of volume voxels with non-zero coefficients
-                        //for current slice voxel
-                        n = _volcoeffs[inputIndex][i][j].size();
-
                         //add contribution of current slice voxel to all voxel volumes
                         //to which it contributes
-                        for (k = 0; k < n; k++) {
-                            p = _volcoeffs[inputIndex][i][j][k];
-                            recon4D(p.x, p.y, p.z, _stack_index[inputIndex]) += _slice_weight[inputIndex] * p.value * slice(i, j, 0);
-                            weights(p.x, p.y, p.z, _stack_index[inputIndex]) += _slice_weight[inputIndex] * p.value;
+                        for (k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                            const size_t index = coeffs.Index(k) + (size_t)_stack_index[inputIndex] * nvox;
+                            precon4D[index] += _slice_weight[inputIndex] * coeffs.Value(k) * slice(i, j, 0);
+                            pweights[index] += _slice_weight[inputIndex] * coeffs.Value(k);
                         }
                     }
             //} //end of loop for origDir
@@ -4804,7 +4752,6 @@ namespace svrtk {
         int i, j, k, n;
         RealImage slice;
         double scale;
-        POINT3D p;
         int dirIndex, origDir;
         double bval,gx,gy,gz,dx,dy,dz,dotp,sigma=0.02,w,tw;
 
@@ -4814,6 +4761,9 @@ namespace svrtk {
         cout<<nStacks<<" stacks."<<endl;
         RealImage recon4D(attr);
         RealImage weights(attr);
+        const size_t nvox = _reconstructed.NumberOfVoxels();
+        RealPixel *precon4D = recon4D.Data();
+        RealPixel *pweights = weights.Data();
 
         for (inputIndex = 0; inputIndex < _slices.size(); ++inputIndex) {
             //copy the current slice
@@ -4822,6 +4772,7 @@ namespace svrtk {
             RealImage& b = _bias[inputIndex];
             //read current scale factor
             scale = _scale[inputIndex];
+            const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
             cout<<scale<<" ";
 
             //direction for current slice
@@ -4856,16 +4807,12 @@ namespace svrtk {
                             if(origDir==1)
                                 slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
 
-                            //number of volume voxels with non-zero coefficients
-                            //for current slice voxel
-                            n = _volcoeffs[inputIndex][i][j].size();
-
                             //add contribution of current slice voxel to all voxel volumes
                             //to which it contributes
-                            for (k = 0; k < n; k++) {
-                                p = _volcoeffs[inputIndex][i][j][k];
-                                recon4D(p.x, p.y, p.z,origDir-1) += _slice_weight[inputIndex] * w * p.value * slice(i, j, 0);
-                                weights(p.x, p.y, p.z,origDir-1) += _slice_weight[inputIndex] * w * p.value;
+                            for (k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                                const size_t index = coeffs.Index(k) + (size_t)(origDir - 1) * nvox;
+                                precon4D[index] += _slice_weight[inputIndex] * w * coeffs.Value(k) * slice(i, j, 0);
+                                pweights[index] += _slice_weight[inputIndex] * w * coeffs.Value(k);
                             }
                         }
             } //end of loop for origDir
@@ -4899,7 +4846,6 @@ namespace svrtk {
         int i, j, k, n;
         RealImage slice;
         double scale;
-        POINT3D p;
         int dirIndex;
         double bval,gx,gy,gz;
 
@@ -4908,6 +4854,9 @@ namespace svrtk {
         cout<<_coeffNum<<" SH coefficients."<<endl;
         RealImage recon4D(attr);
         RealImage weights(attr);
+        const size_t nvox = _reconstructed.NumberOfVoxels();
+        RealPixel *precon4D = recon4D.Data();
+        RealPixel *pweights = weights.Data();
 
         for (inputIndex = 0; inputIndex < _slices.size(); ++inputIndex) {
             //copy the current slice
@@ -4916,6 +4865,7 @@ namespace svrtk {
             RealImage& b = _bias[inputIndex];
             //read current scale factor
             scale = _scale[inputIndex];
+            const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
             //cout<<scale<<" ";
 
             //direction for current slice
@@ -4943,20 +4893,16 @@ namespace svrtk {
                         //biascorrect and scale the slice
                         slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
 
-                        //number of volume voxels with non-zero coefficients
-                        //for current slice voxel
-                        n = _volcoeffs[inputIndex][i][j].size();
-
                         //add contribution of current slice voxel to all voxel volumes
                         //to which it contributes
-                        for (k = 0; k < n; k++) {
-                            p = _volcoeffs[inputIndex][i][j][k];
+                        for (k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
                             for(unsigned int l = 0; l < basis.Cols(); l++ )
                             {
                                 if(l==0)
                                 {
-                                    recon4D(p.x, p.y, p.z,l) += basis(0,l) *_slice_weight[inputIndex] * p.value * slice(i, j, 0);
-                                    weights(p.x, p.y, p.z,l) += basis(0,l) * _slice_weight[inputIndex] * p.value;
+                                    const size_t index = coeffs.Index(k) + l * nvox;
+                                    precon4D[index] += basis(0,l) *_slice_weight[inputIndex] * coeffs.Value(k) * slice(i, j, 0);
+                                    pweights[index] += basis(0,l) * _slice_weight[inputIndex] * coeffs.Value(k);
                                 }
                             }
                         }
@@ -4989,7 +4935,6 @@ namespace svrtk {
         unsigned int inputIndex;
         int i, j, k, n;
         RealImage sim;
-        POINT3D p;
         double weight;
 
         int z, current_stack;
@@ -5000,6 +4945,9 @@ namespace svrtk {
         if (simulate_excluded)
             threshold = -1;
 
+        UpdateSHBasis();
+        InterleaveSHCoeffs();
+
         _reconstructed.Write("reconstructed.nii.gz");
         for (inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
 
@@ -5012,38 +4960,27 @@ namespace svrtk {
             sim.Initialize( slice.Attributes() );
             sim = 0;
 
-            //direction for current slice
-            int dirIndex = _stack_index[inputIndex]+1;
-            double gx=_directionsDTI[0][dirIndex];
-            double gy=_directionsDTI[1][dirIndex];
-            double gz=_directionsDTI[2][dirIndex];
-            RotateDirections(gx,gy,gz,inputIndex);
-            double bval=_bvalues[dirIndex];
-            SphericalHarmonics sh;
-            Matrix dir(1,3);
-            dir(0,0)=gx;
-            dir(0,1)=gy;
-            dir(0,2)=gz;
-            Matrix basis = sh.SHbasis(dir,_order);
+            //SH basis of the rotated direction of the current slice
+            const float *basis = SHBasis(inputIndex);
             double sim_signal;
 
             //do not simulate excluded slice
             if(_slice_weight[inputIndex]>threshold)
             {
+                const SliceCoeffs& slicecoeffs = _volcoeffs[inputIndex];
                 for (i = 0; i < slice.GetX(); i++)
                     for (j = 0; j < slice.GetY(); j++)
                         if (slice(i, j, 0) != -1) {
                             weight=0;
-                            n = _volcoeffs[inputIndex][i][j].size();
-                            for (k = 0; k < n; k++) {
-                                p = _volcoeffs[inputIndex][i][j][k];
+                            for (k = slicecoeffs.Begin(i, j); k < slicecoeffs.End(i, j); k++) {
                                 //signal simulated from SH
                                 sim_signal = 0;
-                                for(unsigned int l = 0; l < basis.Cols(); l++ )
-                                    sim_signal += _SH_coeffs(p.x, p.y, p.z,l)*basis(0,l);
+                                const RealPixel *coeffs = SHCoeffs(slicecoeffs.Index(k));
+                                for(int l = 0; l < _sh_basis_coeffs; l++ )
+                                    sim_signal += coeffs[l]*basis[l];
                                 //update slice
-                                sim(i, j, 0) += p.value *sim_signal;
-                                weight += p.value;
+                                sim(i, j, 0) += slicecoeffs.Value(k) *sim_signal;
+                                weight += slicecoeffs.Value(k);
                             }
                             if(weight>0.98)
                                 sim(i,j,0)/=weight;
@@ -5065,6 +5002,8 @@ namespace svrtk {
                 }
             //end of loop for a slice inputIndex
         }
+
+        ReleaseSHCoeffs();
     }
 
     void ReconstructionDWI::SimulateStacksDTIIntensityMatching(Array<RealImage>& stacks, bool simulate_excluded)
@@ -5076,7 +5015,6 @@ namespace svrtk {
         unsigned int inputIndex;
         int i, j, k, n;
         RealImage sim;
-        POINT3D p;
         double weight;
 
         int z, current_stack;
@@ -5087,6 +5025,9 @@ namespace svrtk {
         if (simulate_excluded)
             threshold = -1;
 
+        UpdateSHBasis();
+        InterleaveSHCoeffs();
+
         _reconstructed.Write("reconstructed.nii.gz");
         for (inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
 
@@ -5105,38 +5046,27 @@ namespace svrtk {
             sim = 0;
             RealImage simulatedslice(sim), simulatedsliceint(sim), simulatedweights(sim);
 
-            //direction for current slice
-            int dirIndex = _stack_index[inputIndex]+1;
-            double gx=_directionsDTI[0][dirIndex];
-            double gy=_directionsDTI[1][dirIndex];
-            double gz=_directionsDTI[2][dirIndex];
-            RotateDirections(gx,gy,gz,inputIndex);
-            double bval=_bvalues[dirIndex];
-            SphericalHarmonics sh;
-            Matrix dir(1,3);
-            dir(0,0)=gx;
-            dir(0,1)=gy;
-            dir(0,2)=gz;
-            Matrix basis = sh.SHbasis(dir,_order);
+            //SH basis of the rotated direction of the current slice
+            const float *basis = SHBasis(inputIndex);
             double sim_signal;
 
             //do not simulate excluded slice
             if(_slice_weight[inputIndex]>threshold)
             {
+                const SliceCoeffs& slicecoeffs = _volcoeffs[inputIndex];
                 for (i = 0; i < slice.GetX(); i++)
                     for (j = 0; j < slice.GetY(); j++)
                         if (slice(i, j, 0) != -1) {
                             weight=0;
-                            n = _volcoeffs[inputIndex][i][j].size();
-                            for (k = 0; k < n; k++) {
-                                p = _volcoeffs[inputIndex][i][j][k];
+                            for (k = slicecoeffs.Begin(i, j); k < slicecoeffs.End(i, j); k++) {
                                 //signal simulated from SH
                                 sim_signal = 0;
-                                for(unsigned int l = 0; l < basis.Cols(); l++ )
-                                    sim_signal += _SH_coeffs(p.x, p.y, p.z,l)*basis(0,l);
+                                const RealPixel *coeffs = SHCoeffs(slicecoeffs.Index(k));
+                                for(int l = 0; l < _sh_basis_coeffs; l++ )
+                                    sim_signal += coeffs[l]*basis[l];
                                 //update slice
-                                sim(i, j, 0) += p.value *sim_signal;
-                                weight += p.value;
+                                sim(i, j, 0) += slicecoeffs.Value(k) *sim_signal;
+                                weight += slicecoeffs.Value(k);
                             }
                             simulatedweights(i,j,0)=weight;
                             if(weight>0.98)
@@ -5192,6 +5122,8 @@ namespace svrtk {
                 simulatedweights.Write(buffer);
             }
         }
+
+        ReleaseSHCoeffs();
     }
 
 
@@ -5241,51 +5173,18 @@ namespace svrtk {
 
                 reconstructor->_slice_inside[inputIndex] = false;
 
-
-                //direction for current slice
-                int dirIndex = reconstructor->_stack_index[inputIndex]+1;
-                double gx=reconstructor->_directionsDTI[0][dirIndex];
-                double gy=reconstructor->_directionsDTI[1][dirIndex];
-                double gz=reconstructor->_directionsDTI[2][dirIndex];
-                reconstructor->RotateDirections(gx,gy,gz,inputIndex);
-                double bval=reconstructor->_bvalues[dirIndex];
-                SphericalHarmonics sh;
-                Matrix dir(1,3);
-                dir(0,0)=gx;
-                dir(0,1)=gy;
-                dir(0,2)=gz;
-                Matrix basis = sh.SHbasis(dir,reconstructor->_order);
-                if (basis.Cols() != reconstructor->_SH_coeffs.GetT())
-                    throw runtime_error("ParallelSimulateSlicesDTI:basis numbers does not match SH coefficients number.");
-
-                double sim_signal;
-                POINT3D p;
-                for ( unsigned int i = 0; i < reconstructor->_slices[inputIndex].GetX(); i++ )
-                    for ( unsigned int j = 0; j < reconstructor->_slices[inputIndex].GetY(); j++ )
-                        if ( reconstructor->_slices[inputIndex](i, j, 0) != -1 ) {
-                            double weight = 0;
-                            int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
-                            for ( unsigned int k = 0; k < n; k++ ) {
-                                //PSF
-                                p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                //signal simulated from SH
-                                sim_signal = 0;
-                                for(unsigned int l = 0; l < basis.Cols(); l++ )
-                                    sim_signal += reconstructor->_SH_coeffs(p.x, p.y, p.z,l)*basis(0,l);
-                                //update slice
-                                reconstructor->_simulated_slices[inputIndex](i, j, 0) += p.value * sim_signal;
-                                weight += p.value;
-                                if (reconstructor->_mask(p.x, p.y, p.z) == 1) {
-                                    reconstructor->_simulated_inside[inputIndex](i, j, 0) = 1;
-                                    reconstructor->_slice_inside[inputIndex] = true;
-                                }
-                            }
-                            if( weight > 0 ) {
-                                reconstructor->_simulated_slices[inputIndex](i,j,0) /= weight;
-                                reconstructor->_simulated_weights[inputIndex](i,j,0) = weight;
-                            }
-                        }
-
+                //SH signal in the rotated direction of the current slice
+                const SphericalHarmonicSignal model(reconstructor->_sh_coeffs_interleaved.data(), reconstructor->_sh_stride,
+                                                    reconstructor->SHBasis(inputIndex), reconstructor->_sh_basis_coeffs);
+                const RealImage& slice = reconstructor->_slices[inputIndex];
+                const RealPixel *pmask = reconstructor->_mask.Data();
+
+                const SliceCoeffs& coeffs = reconstructor->GetSliceCoeffs(inputIndex);
+                auto sample = [&](int i, int j) { return slice(i, j, 0) != -1; };
+                auto inside = [&](int index) { return pmask[index] == 1; };
+                if (SimulateSlice(coeffs, model, sample, inside, reconstructor->_simulated_slices[inputIndex],
+                                  reconstructor->_simulated_weights[inputIndex], reconstructor->_simulated_inside[inputIndex]))
+                    reconstructor->_slice_inside[inputIndex] = true;
             }
         }
 
@@ -5304,9 +5203,16 @@ namespace svrtk {
         if (_debug)
             cout<<"Simulating slices DTI."<<endl;
 
+        UpdateSHBasis();
+        InterleaveSHCoeffs();
+
         ParallelSimulateSlicesDTI parallelSimulateSlicesDTI( this );
         parallelSimulateSlicesDTI();
 
+        if (!_memory_report.empty())
+            ReportMemoryUsage("SimulateSlicesDTI", {{"_sh_coeffs_interleaved", _sh_coeffs_interleaved.capacity() * sizeof(RealPixel)}});
+        ReleaseSHCoeffs();
+
         if (_debug)
             cout<<"done."<<endl;
     }
@@ -5333,117 +5239,61 @@ namespace svrtk {
 
     class ParallelSuperresolutionDTI {
         ReconstructionDWI* reconstructor;
-    public:
-        RealImage confidence_map;
-        RealImage addon;
-
-        void operator()( const blocked_range<size_t>& r ) {
-            for ( size_t inputIndex = r.begin(); inputIndex < r.end(); ++inputIndex) {
-                // read the current slice
-                RealImage slice = reconstructor->_slices[inputIndex];
 
-                //read the current weight image
-                RealImage& w = reconstructor->_weights[inputIndex];
+    public:
+        //coefficient-innermost addon (a row of _sh_stride values per voxel) and confidence per voxel,
+        //which is the same for all coefficients
+        Array<RealPixel> addon;
+        Array<RealPixel> confidence;
 
-                //read the current bias image
-                RealImage& b = reconstructor->_bias[inputIndex];
+        //add the contribution of a slice to the addon and the confidence
+        void AddSlice( int inputIndex, RealPixel *addon, RealPixel *confidence ) const {
+            const RealImage& slice = reconstructor->_slices[inputIndex];
+            const RealImage& sim_slice = reconstructor->_simulated_slices[inputIndex];
 
-                //identify scale factor
-                double scale = reconstructor->_scale[inputIndex];
+            //read the current weight image
+            const RealImage& w = reconstructor->_weights[inputIndex];
 
-                //direction for current slice
-                int dirIndex = reconstructor->_stack_index[inputIndex]+1;
-                double gx=reconstructor->_directionsDTI[0][dirIndex];
-                double gy=reconstructor->_directionsDTI[1][dirIndex];
-                double gz=reconstructor->_directionsDTI[2][dirIndex];
-                reconstructor->RotateDirections(gx,gy,gz,inputIndex);
-                double bval=reconstructor->_bvalues[dirIndex];
-                SphericalHarmonics sh;
-                Matrix dir(1,3);
-                dir(0,0)=gx;
-                dir(0,1)=gy;
-                dir(0,2)=gz;
-                Matrix basis = sh.SHbasis(dir,reconstructor->_order);
-                if (basis.Cols() != reconstructor->_SH_coeffs.GetT())
-                    throw runtime_error("ParallelSimulateSlicesDTI:basis numbers does not match SH coefficients number.");
-
-                //Update reconstructed volume using current slice
-
-                //Distribute error to the volume
-                POINT3D p;
-                for ( int i = 0; i < slice.GetX(); i++)
-                    for ( int j = 0; j < slice.GetY(); j++)
-                        if (slice(i, j, 0) != -1) {
-                            //bias correct and scale the slice
-                            if(reconstructor->_intensity_matching_GD)
-                                slice(i, j, 0) *= b(i, j, 0) * scale;
-                            else
-                                slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
-
-                            if ( reconstructor->_simulated_slices[inputIndex](i,j,0) > 0 )
-                                slice(i,j,0) = slice(i,j,0) - reconstructor->_simulated_slices[inputIndex](i,j,0);
-                            else
-                                slice(i,j,0) = 0;
-
-                            int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
-                            for (int k = 0; k < n; k++) {
-                                p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                if(reconstructor->_robust_slices_only)
-                                {
-                                    for(unsigned int l = 0; l < basis.Cols(); l++ )
-                                    {
-                                        addon(p.x, p.y, p.z,l) += p.value * basis(0,l) * slice(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                                        confidence_map(p.x, p.y, p.z,l) += p.value *reconstructor->_slice_weight[inputIndex];
-                                    }
+            //read the current bias image
+            const RealImage& b = reconstructor->_bias[inputIndex];
 
-                                }
-                                else
-                                {
-                                    for(unsigned int l = 0; l < basis.Cols(); l++ )
-                                    {
-                                        addon(p.x, p.y, p.z, l) += p.value * basis(0,l) * slice(i, j, 0) * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                                        confidence_map(p.x, p.y, p.z, l) += p.value * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                                        //p.value * basis(0,l) * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                                    }
-                                }
-                            }
-                        }
-            } //end of loop for a slice inputIndex
-        }
+            //identify scale factor
+            const double scale = reconstructor->_scale[inputIndex];
+
+            //bias corrected and scaled error of a pixel and its weight
+            auto residual = [&](int i, int j, double& error, double& weight) {
+                if (slice(i, j, 0) == -1)
+                    return false;
+                RealPixel value = slice(i, j, 0);
+                if(reconstructor->_intensity_matching_GD)
+                    value *= b(i, j, 0) * scale;
+                else
+                    value *= exp(-b(i, j, 0)) * scale;
+                error = sim_slice(i, j, 0) > 0 ? value - sim_slice(i, j, 0) : 0;
 
-        ParallelSuperresolutionDTI( ParallelSuperresolutionDTI& x, split ) :
-        reconstructor(x.reconstructor)
-        {
-            //Clear addon
-            addon.Initialize( reconstructor->_SH_coeffs.Attributes() );
-            addon = 0;
+                weight = reconstructor->_slice_weight[inputIndex];
+                if(!reconstructor->_robust_slices_only)
+                    weight *= w(i, j, 0);
+                return true;
+            };
 
-            //Clear confidence map
-            confidence_map.Initialize( reconstructor->_SH_coeffs.Attributes() );
-            confidence_map = 0;
-        }
-
-        void join( const ParallelSuperresolutionDTI& y ) {
-            addon += y.addon;
-            confidence_map += y.confidence_map;
+            //Distribute error to the volume along the SH basis of the rotated direction of the slice,
+            //the SH coefficients are only read by the projection
+            const SphericalHarmonicSignal model(nullptr, reconstructor->_sh_stride,
+                                                reconstructor->SHBasis(inputIndex), reconstructor->_sh_basis_coeffs);
+            BackProjectSlice(reconstructor->GetSliceCoeffs(inputIndex), model, residual, addon, confidence);
         }
 
         ParallelSuperresolutionDTI( ReconstructionDWI *reconstructor ) :
-        reconstructor(reconstructor)
-        {
-            //Clear addon
-            addon.Initialize( reconstructor->_SH_coeffs.Attributes() );
-            addon = 0;
-
-            //Clear confidence map
-            confidence_map.Initialize( reconstructor->_SH_coeffs.Attributes() );
-            confidence_map = 0;
-        }
+        reconstructor(reconstructor) { }
 
         // execute
         void operator() () {
-            parallel_reduce( blocked_range<size_t>(0,reconstructor->_slices.size()),
-                            *this );
+            const size_t nvox = reconstructor->_SH_coeffs.GetX() * reconstructor->_SH_coeffs.GetY() * reconstructor->_SH_coeffs.GetZ();
+            BackProjectSlices<ParallelSuperresolutionDTI> backprojection(*this, nvox * reconstructor->_sh_stride, nvox);
+            backprojection(reconstructor->_slices.size(), reconstructor->_slice_groups);
+            addon.swap(backprojection.addon);
+            confidence.swap(backprojection.confidence);
         }
     };
 
@@ -5459,10 +5309,33 @@ namespace svrtk {
         //Remember current reconstruction for edge-preserving smoothing
         original = _SH_coeffs;
 
+        UpdateSHBasis();
+
         ParallelSuperresolutionDTI parallelSuperresolutionDTI(this);
         parallelSuperresolutionDTI();
-        addon = parallelSuperresolutionDTI.addon;
-        _confidence_map = parallelSuperresolutionDTI.confidence_map;
+        const Array<RealPixel>& sh_addon = parallelSuperresolutionDTI.addon;
+        const Array<RealPixel>& sh_confidence = parallelSuperresolutionDTI.confidence;
+
+        //without groups the reduction holds per-thread copies of its output buffers
+        if (!_memory_report.empty()) {
+            const size_t buffer_bytes = (sh_addon.capacity() + sh_confidence.capacity()) * sizeof(RealPixel);
+            if (_slice_groups.empty())
+                ReportMemoryUsage("SuperresolutionDTI", {{"SR reduction (estimate)", buffer_bytes * max(1u, thread::hardware_concurrency())}});
+            else
+                ReportMemoryUsage("SuperresolutionDTI", {{"SR buffers", buffer_bytes}});
+        }
+
+        //convert the reduction to the 4D layout of the SH coefficients
+        addon.Initialize( _SH_coeffs.Attributes() );
+        _confidence_map.Initialize( _SH_coeffs.Attributes() );
+        const int nvox = _SH_coeffs.GetX() * _SH_coeffs.GetY() * _SH_coeffs.GetZ();
+        RealPixel *pa = addon.Data();
+        RealPixel *pc = _confidence_map.Data();
+        for (l = 0; l < _SH_coeffs.GetT(); l++)
+            for (int v = 0; v < nvox; v++) {
+                pa[(size_t)l * nvox + v] = sh_addon[(size_t)v * _sh_stride + l];
+                pc[(size_t)l * nvox + v] = sh_confidence[v];
+            }
         //_confidence4mask = _confidence_map;
 
         if(_debug) {
@@ -5667,6 +5540,82 @@ namespace svrtk {
         cout<<endl;
     }
 
+    void ReconstructionDWI::UpdateSHBasis()
+    {
+        int ncoeffs = _sh.NforL(_order);
+        if (ncoeffs != _SH_coeffs.GetT())
+            throw runtime_error("UpdateSHBasis: basis numbers does not match SH coefficients number.");
+
+        //the table is reset when the order or the number of slices changes
+        if (_sh_basis_order != _order || _sh_basis.size() != _slices.size() * ncoeffs) {
+            _sh_basis.assign(_slices.size() * ncoeffs, 0);
+            _sh_basis_directions.assign(3 * _slices.size(), numeric_limits<double>::quiet_NaN());
+            _sh_basis_order = _order;
+            _sh_basis_coeffs = ncoeffs;
+            _sh_stride = (ncoeffs + 7) / 8 * 8;
+        }
+
+        //only the rows of slices whose rotated direction changed (i.e. after registration) are recomputed
+        Array<int> changed;
+        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+            int dirIndex = _stack_index[inputIndex]+1;
+            double gx=_directionsDTI[0][dirIndex];
+            double gy=_directionsDTI[1][dirIndex];
+            double gz=_directionsDTI[2][dirIndex];
+            RotateDirections(gx,gy,gz,inputIndex);
+
+            double *direction = &_sh_basis_directions[3 * inputIndex];
+            if (direction[0] != gx || direction[1] != gy || direction[2] != gz) {
+                direction[0] = gx;
+                direction[1] = gy;
+                direction[2] = gz;
+                changed.push_back(inputIndex);
+            }
+        }
+
+        if (changed.empty())
+            return;
+
+        //the basis of all changed slices is computed at once
+        Matrix dirs(changed.size(), 3);
+        for (size_t n = 0; n < changed.size(); n++)
+            for (int d = 0; d < 3; d++)
+                dirs(n, d) = _sh_basis_directions[3 * changed[n] + d];
+
+        SphericalHarmonics sh;
+        Matrix basis = sh.SHbasis(dirs,_order);
+        for (size_t n = 0; n < changed.size(); n++) {
+            float *row = &_sh_basis[changed[n] * ncoeffs];
+            for (int l = 0; l < ncoeffs; l++)
+                row[l] = basis(n, l);
+        }
+
+        if (_debug)
+            cout<<"SH basis updated for "<<changed.size()<<" slices."<<endl;
+    }
+
+    void ReconstructionDWI::InterleaveSHCoeffs()
+    {
+        //the coefficients of a voxel become one contiguous row, so that a PSF point reads a single short vector
+        const int nvox = _SH_coeffs.GetX() * _SH_coeffs.GetY() * _SH_coeffs.GetZ();
+        const int ncoeffs = _SH_coeffs.GetT();
+        if (ncoeffs > _sh_stride)
+            throw runtime_error("InterleaveSHCoeffs: SH basis has not been initialised.");
+
+        _sh_coeffs_interleaved.assign((size_t)nvox * _sh_stride, 0);
+        const RealPixel *pc = _SH_coeffs.Data();
+        for (int v = 0; v < nvox; v++) {
+            RealPixel *row = &_sh_coeffs_interleaved[(size_t)v * _sh_stride];
+            for (int l = 0; l < ncoeffs; l++)
+                row[l] = pc[(size_t)l * nvox + v];
+        }
+    }
+
+    void ReconstructionDWI::ReleaseSHCoeffs()
+    {
+        Array<RealPixel>().swap(_sh_coeffs_interleaved);
+    }
+
     void ReconstructionDWI::InitSH(Matrix dirs, int order)
     {
         //SphericalHarmonics sh;
@@ -6880,6 +6829,8 @@ namespace svrtk {
                 cout << "SliceToVolumeRegistration" << endl;
             ParallelSliceToVolumeRegistrationSH registration(this);
             registration();
+
+            ReportMemoryUsage("SliceToVolumeRegistrationSH");
         }
 
 
@@ -6914,20 +6865,20 @@ namespace svrtk {
                     }
 
                     //Distribute slice intensities to the volume
-                    POINT3D p;
+                    const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
                     int stackIndex = reconstructor->_stack_index[inputIndex];
                     double sliceWeight = reconstructor->_slice_weight[inputIndex];
+                    const size_t offset = (size_t)stackIndex * bias.GetX() * bias.GetY() * bias.GetZ();
+                    RealPixel *pbias = bias.Data() + offset;
+                    RealPixel *pweights = weights.Data() + offset;
                     for (int i = 0; i < slice.GetX(); i++)
                         for (int j = 0; j < slice.GetY(); j++)
                             if (slice(i, j, 0) != -1) {
-                                //number of volume voxels with non-zero coefficients for current slice voxel
-                                int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
                                 //add contribution of current slice voxel to all voxel volumes
                                 //to which it contributes
-                                for (int k = 0; k < n; k++) {
-                                    p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                    bias(p.x, p.y, p.z,stackIndex) += sliceWeight * p.value * b(i, j, 0);
-                                    weights(p.x, p.y, p.z,stackIndex) += sliceWeight * p.value;
+                                for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                                    pbias[coeffs.Index(k)] += sliceWeight * coeffs.Value(k) * b(i, j, 0);
+                                    pweights[coeffs.Index(k)] += sliceWeight * coeffs.Value(k);
                                 }
                             }
                     //end of loop for a slice inputIndex
@@ -6989,21 +6940,19 @@ namespace svrtk {
                     //sprintf(buffer,"biaszero%i.nii.gz",ii);
                     //b.Write(buffer);
 
-                    POINT3D p;
+                    const SliceCoeffs& coeffs = reconstructor->_volcoeffs[inputIndex];
                     int stackIndex = reconstructor->_stack_index[inputIndex];
                     double sliceWeight = reconstructor->_slice_weight[inputIndex];
+                    const RealPixel *pbias = bias.Data() + (size_t)stackIndex * bias.GetX() * bias.GetY() * bias.GetZ();
                     for (int i = 0; i < slice.GetX(); i++)
                         for (int j = 0; j < slice.GetY(); j++)
                             if (slice(i, j, 0) != -1) {
                                 double weight = 0;
-                                //number of volume voxels with non-zero coefficients for current slice voxel
-                                int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
                                 //add contribution of current slice voxel to all voxel volumes
                                 //to which it contributes
-                                for (int k = 0; k < n; k++) {
-                                    p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                    b(i,j,0) += p.value * bias(p.x, p.y, p.z,stackIndex);
-                                    weight += p.value;
+                                for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
+                                    b(i,j,0) += coeffs.Value(k) * pbias[coeffs.Index(k)];
+                                    weight += coeffs.Value(k);
                                 }
                                 if( weight > 0 ) {
                                     b(i,j,0)/=weight;
@@ -7244,8 +7193,44 @@ namespace svrtk {
 
         }
 
+    // bytes held by the large buffers of the reconstruction
+    void ReconstructionDWI::MemoryUsage(Array<pair<string, size_t>>& usage) const
+    {
+        size_t volcoeffs = 0, volcoeffsSF = 0;
+        for (const SliceCoeffs& coeffs : _volcoeffs)
+            volcoeffs += coeffs.MemoryUsage();
+        for (const SliceCoeffs& coeffs : _volcoeffsSF)
+            volcoeffsSF += coeffs.MemoryUsage();
+
+        usage.push_back({"_volcoeffs", volcoeffs});
+        usage.push_back({"_volcoeffsSF", volcoeffsSF});
+        usage.push_back({"_original_slices", Utility::MemoryUsage(_original_slices)});
+        usage.push_back({"_slices", Utility::MemoryUsage(_slices)});
+        usage.push_back({"_simulated_slices", Utility::MemoryUsage(_simulated_slices)});
+        usage.push_back({"_simulated_weights", Utility::MemoryUsage(_simulated_weights)});
+        usage.push_back({"_simulated_inside", Utility::MemoryUsage(_simulated_inside)});
+        usage.push_back({"_weights", Utility::MemoryUsage(_weights)});
+        usage.push_back({"_bias", Utility::MemoryUsage(_bias)});
+        usage.push_back({"_probability_maps", Utility::MemoryUsage(_probability_maps)});
+        usage.push_back({"_SH_coeffs", Utility::MemoryUsage(_SH_coeffs)});
+        usage.push_back({"_sh_basis", _sh_basis.capacity() * sizeof(float) + _sh_basis_directions.capacity() * sizeof(double)});
+        usage.push_back({"_simulated_signal", Utility::MemoryUsage(_simulated_signal)});
+        usage.push_back({"volumes", Utility::MemoryUsage(_reconstructed) + Utility::MemoryUsage(_mask) + Utility::MemoryUsage(_mask_internal)
+            + Utility::MemoryUsage(_brain_probability) + Utility::MemoryUsage(_volume_weights) + Utility::MemoryUsage(_confidence_map)});
+    }
 
+    // append the memory usage after a stage to the memory report
+    void ReconstructionDWI::ReportMemoryUsage(const string& stage, const Array<pair<string, size_t>>& transient)
+    {
+        if (_memory_report.empty())
+            return;
 
+        Array<pair<string, size_t>> usage;
+        MemoryUsage(usage);
+        for (const auto& entry : transient)
+            usage.push_back({"transient: " + entry.first, entry.second});
 
+        Utility::AppendMemoryReport(_memory_report, stage, usage);
+    }
 
 } // namespace svrtk
@@ -326,6 +326,9 @@ namespace svrtk {
 
         // Regularise with the model fit
         if (_jointSR){
+            //the reduction holds per-thread copies of its output volumes
+            if (!_memory_report.empty())
+                ReportMemoryUsage("SuperresolutionqMRI", {{"SR reduction (estimate)", 2 * Utility::MemoryUsage(_reconstructed4D) * max(1u, thread::hardware_concurrency())}});
             SVRTK_END_TIMING("SuperresolutionqMRI");
             SVRTK_RESET_TIMING();
             ParallelqMRI::ModelFitqMRI ModelFit(this);
@@ -468,6 +471,9 @@ namespace svrtk {
                 }
             }*/
 
+            //the reduction holds per-thread copies of its output volumes
+            if (!_memory_report.empty())
+                ReportMemoryUsage("SuperresolutionqMRI", {{"SR reduction (estimate)", 2 * Utility::MemoryUsage(_reconstructed4D) * max(1u, thread::hardware_concurrency())}});
             SVRTK_END_TIMING("SuperresolutionqMRI");
             SVRTK_RESET_TIMING();
 
@@ -495,21 +501,9 @@ namespace svrtk {
 
     // run adaptive regularisation of the SR reconstructed volume
     void ReconstructionqMRI::AdaptiveRegularizationqMRI(int iter, const RealImage& original) {
-        Array<double> factor(13);
-        for (int i = 0; i < 13; i++) {
-            for (int j = 0; j < 3; j++)
-                factor[i] += fabs(double(_directions[i][j]));
-            factor[i] = 1 / factor[i];
-        }
-
-        Array<RealImage> b(13, _reconstructed4D);
-
-        ParallelqMRI::AdaptiveRegularization1qMRI parallelAdaptiveRegularization1(this, b, factor, original);
-        parallelAdaptiveRegularization1();
-
         const RealImage original2 = _reconstructed4D;
-        ParallelqMRI::AdaptiveRegularization2qMRI parallelAdaptiveRegularization2(this, b, original2);
-        parallelAdaptiveRegularization2();
+        ParallelqMRI::AdaptiveRegularizationqMRI parallelAdaptiveRegularization(this, original, original2);
+        parallelAdaptiveRegularization();
 
         if (_alpha * _lambda / (_delta * _delta) > 0.068)
             cerr << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below 0.068." << endl;
@@ -518,21 +512,9 @@ namespace svrtk {
 
     // run adaptive regularisation of the SR reconstructed volume
     void ReconstructionqMRI::AdaptiveRegularizationT2Map(int iter, const RealImage& original) {
-        Array<double> factor(13);
-        for (int i = 0; i < 13; i++) {
-            for (int j = 0; j < 3; j++)
-                factor[i] += fabs(double(_directions[i][j]));
-            factor[i] = 1 / factor[i];
-        }
-
-        Array<RealImage> b(13, _T2Map);
-
-        ParallelqMRI::AdaptiveRegularization1T2Map parallelAdaptiveRegularization1(this, b, factor, original);
-        parallelAdaptiveRegularization1();
-
         const RealImage original2 = _T2Map;
-        ParallelqMRI::AdaptiveRegularization2T2Map parallelAdaptiveRegularization2(this, b, original2);
-        parallelAdaptiveRegularization2();
+        ParallelqMRI::AdaptiveRegularizationT2Map parallelAdaptiveRegularization(this, original, original2);
+        parallelAdaptiveRegularization();
 
         if (_alpha * _lambda / (_delta * _delta) > 0.068)
             cerr << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below 0.068." << endl;
@@ -555,9 +537,11 @@ namespace svrtk {
         for (size_t inputIndex = 0; inputIndex < _slicesqMRI.size(); inputIndex++) {
             int indstack = _stack_index[inputIndex];
             int outputIndex = _volume_index[indstack];
-            if (_volcoeffs[inputIndex].empty())
+            if (_volcoeffs[inputIndex].Empty())
                 continue;
 
+            const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
+            RealPixel *preconstructed = _reconstructed4D.Data() + outputIndex * _reconstructed4D.NumberOfSpatialVoxels();
             int slice_vox_num = 0;
             //copy the current slice
             slice = _slicesqMRI[inputIndex];
@@ -567,8 +551,8 @@ namespace svrtk {
             const double scale = _scaleqMRI[inputIndex];
 
             //Distribute slice intensities to the volume
-            for (size_t i = 0; i < _volcoeffs[inputIndex].size(); i++)
-                for (size_t j = 0; j < _volcoeffs[inputIndex][i].size(); j++)
+            for (int i = 0; i < coeffs.GetX(); i++)
+                for (int j = 0; j < coeffs.GetY(); j++)
                     if (slice(i, j, 0) > -0.01) {
 
                         double jac = 1;
@@ -587,7 +571,7 @@ namespace svrtk {
 
                             //number of volume voxels with non-zero coefficients
                             //for current slice voxel
-                            const size_t n = _volcoeffs[inputIndex][i][j].size();
+                            const int n = coeffs.Size(i, j);
 
                             //if given voxel is not present in reconstructed volume at all, pad it
 
@@ -597,10 +581,8 @@ namespace svrtk {
 
                             //add contribution of current slice voxel to all voxel volumes
                             //to which it contributes
-                            for (size_t k = 0; k < n; k++) {
-                                const POINT3D& p = _volcoeffs[inputIndex][i][j][k];
-                                _reconstructed4D(p.x, p.y, p.z, outputIndex) += p.value * slice(i, j, 0);
-                            }
+                            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
+                                preconstructed[coeffs.Index(k)] += coeffs.Value(k) * slice(i, j, 0);
                         }
                     }
             voxel_num.push_back(slice_vox_num);
@@ -661,6 +643,8 @@ namespace svrtk {
             _verbose_log << endl;
         }
 
+        ReportMemoryUsage("GaussianReconstructionqMRI");
+
         SVRTK_END_TIMING("GaussianReconstructionqMRI");
 
     }
@@ -676,6 +660,7 @@ namespace svrtk {
 
         //resize indicator of slice having and overlap with volumetric mask
         ClearAndResize(_slice_inside, _slicesqMRI.size());
+        _coeffs_transformations.clear();
         _attr_reconstructed4D = _reconstructed4D.Attributes();
         _attr_reconstructed = _reconstructed.Attributes();
 
@@ -702,28 +687,27 @@ namespace svrtk {
                 excluded = true;
 
             if (!excluded) {
+                const SliceCoeffs& coeffs = _volcoeffs[inputIndex];
+                const int indstack = _stack_index[inputIndex];
+                const int outputIndex = _volume_index[indstack];
+                RealPixel *pvolume_weights = _volume_weights.Data();
+                RealPixel *pvolume_weightsqMRI = _volume_weightsqMRI.Data() + outputIndex * _volume_weightsqMRI.NumberOfSpatialVoxels();
 
                 // Do not parallelise: It would cause data inconsistencies
-                for (int i = 0; i < _slicesqMRI[inputIndex].GetX(); i++)
-                    for (int j = 0; j < _slicesqMRI[inputIndex].GetY(); j++)
-                        for (size_t k = 0; k < _volcoeffs[inputIndex][i][j].size(); k++) {
-                            const POINT3D& p = _volcoeffs[inputIndex][i][j][k];
-
+                for (int i = 0; i < coeffs.GetX(); i++)
+                    for (int j = 0; j < coeffs.GetY(); j++)
+                        for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++) {
                             if (_ffd) {
                                 double x = i, y = j, z = 0;
                                 _slicesqMRI[inputIndex].ImageToWorld(x, y, z);
                                 double jac = _mffd_transformations[inputIndex]->Jacobian(x, y, z, 0, 0);
                                 if ((100*jac) > 50) {
-                                    int indstack = _stack_index[inputIndex];
-                                    int outputIndex = _volume_index[indstack];
-                                    _volume_weights(p.x, p.y, p.z) += p.value;
-                                    _volume_weightsqMRI(p.x, p.y, p.z,outputIndex) += p.value;
+                                    pvolume_weights[coeffs.Index(k)] += coeffs.Value(k);
+                                    pvolume_weightsqMRI[coeffs.Index(k)] += coeffs.Value(k);
                                 }
                             } else {
-                                int indstack = _stack_index[inputIndex];
-                                int outputIndex = _volume_index[indstack];
-                                _volume_weights(p.x, p.y, p.z) += p.value;
-                                _volume_weightsqMRI(p.x, p.y, p.z,outputIndex) += p.value;
+                                pvolume_weights[coeffs.Index(k)] += coeffs.Value(k);
+                                pvolume_weightsqMRI[coeffs.Index(k)] += coeffs.Value(k);
                             }
 
                         }
@@ -763,6 +747,8 @@ namespace svrtk {
         if (_verbose)
             _verbose_log << "Average volume weight is " << _average_volume_weight << endl;
 
+        ReportMemoryUsage("CoeffInitqMRI");
+
         SVRTK_END_TIMING("CoeffInitqMRI");
     }
 
@@ -2072,5 +2058,23 @@ namespace svrtk {
         return rmse_total;
     }
 
+    //-------------------------------------------------------------------
+
+    void ReconstructionqMRI::MemoryUsage(Array<pair<string, size_t>>& usage) const {
+        Reconstruction::MemoryUsage(usage);
+
+        usage.push_back({"_slicesqMRI", Utility::MemoryUsage(_slicesqMRI)});
+        usage.push_back({"_simulated_slicesqMRI", Utility::MemoryUsage(_simulated_slicesqMRI)});
+        usage.push_back({"_simulated_weightsqMRI", Utility::MemoryUsage(_simulated_weightsqMRI)});
+        usage.push_back({"_simulated_insideqMRI", Utility::MemoryUsage(_simulated_insideqMRI)});
+        usage.push_back({"_slice_difqMRI", Utility::MemoryUsage(_slice_difqMRI)});
+        usage.push_back({"_weightsqMRI", Utility::MemoryUsage(_weightsqMRI)});
+        usage.push_back({"_biasqMRI", Utility::MemoryUsage(_biasqMRI)});
+        usage.push_back({"_arrayVols", Utility::MemoryUsage(_arrayVols)});
+        usage.push_back({"_Masks", Utility::MemoryUsage(_Masks)});
+        usage.push_back({"4D volumes", Utility::MemoryUsage(_reconstructed4D) + Utility::MemoryUsage(_confidence_map4D)
+            + Utility::MemoryUsage(_volumeLabel4D) + Utility::MemoryUsage(_volume_weightsqMRI) + Utility::MemoryUsage(_T2Map)
+            + Utility::MemoryUsage(_volumestackfactor)});
+    }
 
 } // namespace svrtk
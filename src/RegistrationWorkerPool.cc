@@ -0,0 +1,423 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SVRTK
+#include "svrtk/RegistrationWorkerPool.h"
+#include "svrtk/ExchangeArena.h"
+
+// MIRTK
+#include "mirtk/GenericImage.h"
+#include "mirtk/GenericRegistrationFilter.h"
+#include "mirtk/Transformation.h"
+
+// C++ Standard
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <poll.h>
+#include <spawn.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+// TBB
+#include <tbb/task_arena.h>
+
+extern char **environ;
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    namespace {
+
+        /// Split a protocol line into its tab-separated fields
+        Array<string> SplitFields(const string& line) {
+            Array<string> fields;
+            size_t begin = 0;
+            while (true) {
+                const size_t end = line.find('\t', begin);
+                fields.push_back(line.substr(begin, end - begin));
+                if (end == string::npos)
+                    break;
+                begin = end + 1;
+            }
+            return fields;
+        }
+
+        /// Read a line without the trailing newline
+        bool ReadLine(FILE *input, string& line) {
+            char *buffer = nullptr;
+            size_t size = 0;
+            const ssize_t length = getline(&buffer, &size, input);
+            if (length >= 0) {
+                line.assign(buffer, length);
+                if (!line.empty() && line.back() == '\n')
+                    line.pop_back();
+            }
+            free(buffer);
+            return length >= 0;
+        }
+
+        /// Write a line and flush it to the other process
+        bool WriteLine(FILE *output, const string& line) {
+            return fputs(line.c_str(), output) >= 0 && fputc('\n', output) != EOF && fflush(output) == 0;
+        }
+
+        /// Send a line to a worker, a dead worker fails the send instead of raising SIGPIPE
+        bool SendLine(int channel, const string& line) {
+            const string data = line + '\n';
+            for (size_t sent = 0; sent < data.size();) {
+                const ssize_t length = send(channel, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+                if (length < 0 && errno == EINTR)
+                    continue;
+                if (length <= 0)
+                    return false;
+                sent += length;
+            }
+            return true;
+        }
+
+        /// Read an image given as a file name or as an entry of an exchange arena (file.arena#entry)
+        void ReadImage(const string& spec, map<string, unique_ptr<ExchangeArena>>& arenas, RealImage& image) {
+            const size_t separator = spec.rfind('#');
+            if (separator == string::npos) {
+                image.Read(spec.c_str());
+                return;
+            }
+
+            const string file_name = spec.substr(0, separator);
+            unique_ptr<ExchangeArena>& arena = arenas[file_name];
+            if (!arena) {
+                arena.reset(new ExchangeArena);
+                if (!arena->Open(file_name)) {
+                    arena.reset();
+                    throw runtime_error("exchange arena " + file_name + " couldn't be opened");
+                }
+            }
+            arena->GetImage(spec.substr(separator + 1), image);
+        }
+
+        /// Register target to source with the parameters of the in-process SVR
+        Transformation *Register(const RealImage& target, const RealImage& source, const Transformation *dofin, bool rigid, bool ncc, int cp_spacing) {
+            ParameterList params;
+            Insert(params, "Transformation model", rigid ? "Rigid" : "FFD");
+            Insert(params, "Background value for image 1", 0);
+            Insert(params, "Background value for image 2", -1);
+
+            if (ncc) {
+                Insert(params, "Image (dis-)similarity measure", "NCC");
+                if (rigid)
+                    Insert(params, "Local window size [sigma]", "0mm");
+                else
+                    Insert(params, "Local window size [box]", "5vox");
+            }
+
+            if (!rigid && cp_spacing > 0) {
+                Insert(params, "Control point spacing in X", cp_spacing);
+                Insert(params, "Control point spacing in Y", cp_spacing);
+                Insert(params, "Control point spacing in Z", cp_spacing);
+            }
+
+            GenericRegistrationFilter registration;
+            registration.Parameter(params);
+            registration.Input(&target, &source);
+            Transformation *dofout;
+            registration.Output(&dofout);
+            registration.InitialGuess(dofin);
+            registration.GuessParameter();
+
+            // the pool runs one worker per core, so each registration is single-threaded
+            tbb::task_arena arena(1);
+            arena.execute([&] { registration.Run(); });
+
+            return dofout;
+        }
+
+    } // namespace
+
+    //-------------------------------------------------------------------
+
+    RegistrationWorkerPool::RegistrationWorkerPool(const string& executable, const Array<string>& arguments, int number_of_workers, int timeout) :
+        _executable(executable), _arguments(arguments), _workers(max(number_of_workers, 1)), _timeout(timeout) {
+        for (size_t i = 0; i < _workers.size(); i++)
+            if (!Start(_workers[i]))
+                throw runtime_error("Registration worker " + _executable + " couldn't be started!");
+    }
+
+    //-------------------------------------------------------------------
+
+    RegistrationWorkerPool::~RegistrationWorkerPool() {
+        for (size_t i = 0; i < _workers.size(); i++)
+            Stop(_workers[i]);
+    }
+
+    //-------------------------------------------------------------------
+
+    bool RegistrationWorkerPool::Start(Worker& worker) {
+        // the pool end of the socket must not leak into other workers
+        int channel[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, channel) != 0)
+            return false;
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, channel[1], STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, channel[1], STDOUT_FILENO);
+
+        Array<char*> argv;
+        argv.push_back(const_cast<char*>(_executable.c_str()));
+        for (size_t i = 0; i < _arguments.size(); i++)
+            argv.push_back(const_cast<char*>(_arguments[i].c_str()));
+        argv.push_back(nullptr);
+
+        const int status = posix_spawn(&worker.pid, _executable.c_str(), &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(channel[1]);
+
+        if (status != 0) {
+            worker.pid = -1;
+            close(channel[0]);
+            return false;
+        }
+
+        worker.channel = channel[0];
+        worker.buffer.clear();
+        return true;
+    }
+
+    //-------------------------------------------------------------------
+
+    void RegistrationWorkerPool::Stop(Worker& worker) {
+        if (worker.channel >= 0) {
+            SendLine(worker.channel, "quit");
+            close(worker.channel);
+            worker.channel = -1;
+        }
+        if (worker.pid > 0) {
+            waitpid(worker.pid, nullptr, 0);
+            worker.pid = -1;
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    void RegistrationWorkerPool::Kill(Worker& worker) {
+        if (worker.pid > 0)
+            kill(worker.pid, SIGKILL);
+        if (worker.channel >= 0) {
+            close(worker.channel);
+            worker.channel = -1;
+        }
+        if (worker.pid > 0) {
+            waitpid(worker.pid, nullptr, 0);
+            worker.pid = -1;
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    bool RegistrationWorkerPool::Receive(Worker& worker, string& reply) {
+        const auto deadline = chrono::steady_clock::now() + chrono::seconds(_timeout);
+
+        size_t end;
+        while ((end = worker.buffer.find('\n')) == string::npos) {
+            int wait = -1;
+            if (_timeout > 0) {
+                wait = max(0, (int)chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count());
+                if (wait == 0) {
+                    cerr << "Registration worker " << worker.pid << " didn't reply within " << _timeout << " s." << endl;
+                    return false;
+                }
+            }
+
+            pollfd fd = {worker.channel, POLLIN, 0};
+            const int ready = poll(&fd, 1, wait);
+            if (ready < 0 && errno == EINTR)
+                continue;
+            if (ready < 0)
+                return false;
+            if (ready == 0)
+                continue;
+
+            char data[4096];
+            const ssize_t length = read(worker.channel, data, sizeof(data));
+            if (length < 0 && errno == EINTR)
+                continue;
+            if (length <= 0)
+                return false;
+            worker.buffer.append(data, length);
+        }
+
+        reply = worker.buffer.substr(0, end);
+        worker.buffer.erase(0, end + 1);
+        return true;
+    }
+
+    //-------------------------------------------------------------------
+
+    bool RegistrationWorkerPool::Request(Worker& worker, const string& request, string& reply) {
+        if (worker.pid <= 0 && !Start(worker))
+            return false;
+
+        if (SendLine(worker.channel, request) && Receive(worker, reply))
+            return true;
+
+        // the worker died or hangs, restart it for the next job
+        cerr << "Registration worker " << worker.pid << " failed, restarting it." << endl;
+        Kill(worker);
+        Start(worker);
+        return false;
+    }
+
+    //-------------------------------------------------------------------
+
+    void RegistrationWorkerPool::Reset() {
+        for (size_t i = 0; i < _workers.size(); i++) {
+            string reply;
+            Request(_workers[i], "reset", reply);
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    Array<string> RegistrationWorkerPool::Run(const Array<string>& jobs) {
+        Array<string> replies(jobs.size());
+        atomic<size_t> next(0);
+
+        // one thread per worker feeds it the next job as soon as it is idle
+        Array<thread> feeders;
+        for (size_t i = 0; i < _workers.size(); i++)
+            feeders.emplace_back([&, i] {
+                for (size_t n = next++; n < jobs.size(); n = next++)
+                    if (!Request(_workers[i], jobs[n], replies[n]))
+                        replies[n].clear();
+            });
+        for (size_t i = 0; i < feeders.size(); i++)
+            feeders[i].join();
+
+        return replies;
+    }
+
+    //-------------------------------------------------------------------
+
+    string RegistrationWorkerPool::RigidJob(const string& target, const string& source, const RigidTransformation& dofin) {
+        ostringstream job;
+        job << setprecision(17) << "rigid\t" << target << "\t" << source;
+        for (int i = 0; i < dofin.NumberOfDOFs(); i++)
+            job << "\t" << dofin.Get(i);
+        return job.str();
+    }
+
+    //-------------------------------------------------------------------
+
+    bool RegistrationWorkerPool::RigidResult(const string& reply, RigidTransformation& dofout) {
+        const Array<string> fields = SplitFields(reply);
+        if (fields[0] != "ok" || (int)fields.size() != dofout.NumberOfDOFs() + 1)
+            return false;
+
+        for (int i = 0; i < dofout.NumberOfDOFs(); i++)
+            dofout.Put(i, stod(fields[i + 1]));
+        return true;
+    }
+
+    //-------------------------------------------------------------------
+
+    string RegistrationWorkerPool::FFDJob(const string& target, const string& source, const string& dofin, const string& dofout, int cp_spacing) {
+        return "ffd\t" + target + "\t" + source + "\t" + dofin + "\t" + dofout + "\t" + to_string(cp_spacing);
+    }
+
+    //-------------------------------------------------------------------
+
+    bool RegistrationWorkerPool::FFDResult(const string& reply) {
+        return reply == "ok";
+    }
+
+    //-------------------------------------------------------------------
+
+    int RegistrationWorkerPool::Serve(FILE *input, FILE *output, bool ncc) {
+        // source volumes and arenas are loaded on first use and kept until the next reset
+        map<string, unique_ptr<ExchangeArena>> arenas;
+        map<string, unique_ptr<RealImage>> sources;
+        auto get_source = [&](const string& spec) -> const RealImage& {
+            unique_ptr<RealImage>& source = sources[spec];
+            if (!source) {
+                source.reset(new RealImage);
+                ReadImage(spec, arenas, *source);
+            }
+            return *source;
+        };
+
+        string request;
+        while (ReadLine(input, request)) {
+            const Array<string> fields = SplitFields(request);
+            string reply = "ok";
+
+            try {
+                if (fields[0] == "quit") {
+                    break;
+                } else if (fields[0] == "reset") {
+                    sources.clear();
+                    arenas.clear();
+                } else if (fields[0] == "rigid" && fields.size() > 3) {
+                    RealImage target;
+                    ReadImage(fields[1], arenas, target);
+                    const RealImage& source = get_source(fields[2]);
+
+                    RigidTransformation dofin;
+                    if ((int)fields.size() != dofin.NumberOfDOFs() + 3)
+                        throw runtime_error("wrong number of rigid parameters");
+                    for (int i = 0; i < dofin.NumberOfDOFs(); i++)
+                        dofin.Put(i, stod(fields[i + 3]));
+
+                    unique_ptr<Transformation> dofout(Register(target, source, &dofin, true, ncc, 0));
+                    ostringstream parameters;
+                    parameters << setprecision(17) << reply;
+                    for (int i = 0; i < dofout->NumberOfDOFs(); i++)
+                        parameters << "\t" << dofout->Get(i);
+                    reply = parameters.str();
+                } else if (fields[0] == "ffd" && fields.size() == 6) {
+                    RealImage target;
+                    ReadImage(fields[1], arenas, target);
+                    const RealImage& source = get_source(fields[2]);
+                    unique_ptr<Transformation> dofin(Transformation::New(fields[3].c_str()));
+
+                    unique_ptr<Transformation> dofout(Register(target, source, dofin.get(), false, ncc, stoi(fields[5])));
+                    dofout->Write(fields[4].c_str());
+                } else {
+                    throw runtime_error("unknown request");
+                }
+            } catch (const exception& e) {
+                reply = string("error\t") + e.what();
+            }
+
+            if (!WriteLine(output, reply))
+                return 1;
+        }
+
+        return 0;
+    }
+
+} // namespace svrtk
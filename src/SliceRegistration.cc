@@ -0,0 +1,565 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SVRTK
+#include "svrtk/SliceRegistration.h"
+
+// C++ Standard
+#include <cmath>
+#include <limits>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    namespace {
+
+        /// Minimum number of overlapping samples for a valid similarity
+        constexpr int MinSamples = 16;
+
+        /// 3x4 affine matrix
+        struct Affine {
+            double m[3][4];
+
+            inline void Apply(double x, double y, double z, double out[3]) const {
+                for (int r = 0; r < 3; r++)
+                    out[r] = m[r][0] * x + m[r][1] * y + m[r][2] * z + m[r][3];
+            }
+        };
+
+        Affine ToAffine(const Matrix& matrix) {
+            Affine a;
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 4; c++)
+                    a.m[r][c] = matrix(r, c);
+            return a;
+        }
+
+        /// a after b
+        Affine Compose(const double a[3][4], const Affine& b) {
+            Affine ab;
+            for (int r = 0; r < 3; r++) {
+                for (int c = 0; c < 4; c++) {
+                    ab.m[r][c] = a[r][0] * b.m[0][c] + a[r][1] * b.m[1][c] + a[r][2] * b.m[2][c];
+                    if (c == 3)
+                        ab.m[r][c] += a[r][3];
+                }
+            }
+            return ab;
+        }
+
+        /**
+         * Apply the incremental rigid update p (translation, rotation vector scaled by radius)
+         * about centre c after transformation m.
+         */
+        Affine Update(const Affine& m, const double p[6], const double c[3], double radius) {
+            const double w[3] = {p[3] / radius, p[4] / radius, p[5] / radius};
+            const double angle = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+
+            //Rodrigues' formula
+            double R[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+            if (angle > 0) {
+                const double k[3] = {w[0] / angle, w[1] / angle, w[2] / angle};
+                const double K[3][3] = {{0, -k[2], k[1]}, {k[2], 0, -k[0]}, {-k[1], k[0], 0}};
+                const double s = sin(angle), t = 1 - cos(angle);
+                for (int r = 0; r < 3; r++)
+                    for (int q = 0; q < 3; q++) {
+                        double KK = 0;
+                        for (int n = 0; n < 3; n++)
+                            KK += K[r][n] * K[n][q];
+                        R[r][q] += s * K[r][q] + t * KK;
+                    }
+            }
+
+            double delta[3][4];
+            for (int r = 0; r < 3; r++) {
+                delta[r][3] = c[r] + p[r];
+                for (int q = 0; q < 3; q++) {
+                    delta[r][q] = R[r][q];
+                    delta[r][3] -= R[r][q] * c[q];
+                }
+            }
+            return Compose(delta, m);
+        }
+
+        /// Cubic B-spline
+        inline double BSpline(double u) {
+            u = fabs(u);
+            if (u < 1)
+                return 2.0 / 3 - u * u + 0.5 * u * u * u;
+            if (u < 2)
+                return (2 - u) * (2 - u) * (2 - u) / 6;
+            return 0;
+        }
+
+        /// Derivative of the cubic B-spline
+        inline double BSplineDerivative(double u) {
+            const double a = fabs(u);
+            const double s = u < 0 ? -1 : 1;
+            if (a < 1)
+                return s * (-2 * a + 1.5 * a * a);
+            if (a < 2)
+                return -s * 0.5 * (2 - a) * (2 - a);
+            return 0;
+        }
+
+        /**
+         * Smooth with a [1 2 1] kernel and subsample by two along the dimensions with more than one voxel.
+         * Background voxels are excluded, output voxels with less than half of the kernel weight in the
+         * foreground become background.
+         */
+        Array<float> Downsample(const Array<float>& in, int x, int y, int z, int& nx, int& ny, int& nz) {
+            constexpr float bg = RegistrationPyramid::Background;
+            nx = x > 1 ? (x + 1) / 2 : 1;
+            ny = y > 1 ? (y + 1) / 2 : 1;
+            nz = z > 1 ? (z + 1) / 2 : 1;
+            const int rx = x > 1, ry = y > 1, rz = z > 1;
+
+            Array<float> out(size_t(nx) * ny * nz);
+            for (int k = 0; k < nz; k++)
+                for (int j = 0; j < ny; j++)
+                    for (int i = 0; i < nx; i++) {
+                        double sum = 0, weight = 0, total = 0;
+                        for (int dk = -rz; dk <= rz; dk++) {
+                            const int kk = (rz ? 2 * k : k) + dk;
+                            if (kk < 0 || kk >= z)
+                                continue;
+                            for (int dj = -ry; dj <= ry; dj++) {
+                                const int jj = (ry ? 2 * j : j) + dj;
+                                if (jj < 0 || jj >= y)
+                                    continue;
+                                for (int di = -rx; di <= rx; di++) {
+                                    const int ii = (rx ? 2 * i : i) + di;
+                                    if (ii < 0 || ii >= x)
+                                        continue;
+                                    const double w = (2 - abs(di)) * (2 - abs(dj)) * (2 - abs(dk));
+                                    total += w;
+                                    const float v = in[(size_t(kk) * y + jj) * x + ii];
+                                    if (v != bg) {
+                                        sum += w * v;
+                                        weight += w;
+                                    }
+                                }
+                            }
+                        }
+                        out[(size_t(k) * ny + j) * nx + i] = 2 * weight >= total ? sum / weight : bg;
+                    }
+            return out;
+        }
+
+        /// Trilinear interpolation with the gradient in voxel coordinates, false outside or next to the background
+        inline bool Sample(const RegistrationPyramid::Level& level, const double v[3], double& value, double *gradient) {
+            if (!(v[0] >= 0 && v[1] >= 0 && v[2] >= 0 && v[0] <= level.x - 1 && v[1] <= level.y - 1 && v[2] <= level.z - 1))
+                return false;
+
+            const int i = min(int(v[0]), level.x - 2);
+            const int j = min(int(v[1]), level.y - 2);
+            const int k = min(int(v[2]), level.z - 2);
+            const double fx = v[0] - i, fy = v[1] - j, fz = v[2] - k;
+
+            const size_t sx = 1, sy = level.x, sz = size_t(level.x) * level.y;
+            const float *p = level.data.data() + k * sz + j * sy + i;
+            const float v000 = p[0], v100 = p[sx], v010 = p[sy], v110 = p[sx + sy];
+            const float v001 = p[sz], v101 = p[sx + sz], v011 = p[sy + sz], v111 = p[sx + sy + sz];
+
+            constexpr float bg = RegistrationPyramid::Background;
+            if (v000 == bg || v100 == bg || v010 == bg || v110 == bg || v001 == bg || v101 == bg || v011 == bg || v111 == bg)
+                return false;
+
+            const double c00 = v000 + fx * (v100 - v000), c10 = v010 + fx * (v110 - v010);
+            const double c01 = v001 + fx * (v101 - v001), c11 = v011 + fx * (v111 - v011);
+            const double c0 = c00 + fy * (c10 - c00), c1 = c01 + fy * (c11 - c01);
+            value = c0 + fz * (c1 - c0);
+
+            if (gradient) {
+                const double dx0 = (v100 - v000) + fy * ((v110 - v010) - (v100 - v000));
+                const double dx1 = (v101 - v001) + fy * ((v111 - v011) - (v101 - v001));
+                gradient[0] = dx0 + fz * (dx1 - dx0);
+                gradient[1] = (c10 - c00) + fz * ((c11 - c01) - (c10 - c00));
+                gradient[2] = c1 - c0;
+            }
+            return true;
+        }
+
+        /// Foreground pixels of a slice level
+        struct SliceLevel {
+            /// World coordinates
+            Array<double> position;
+            Array<double> value;
+            /// NMI histogram bin
+            Array<int> bin;
+        };
+
+        /// Similarity and its gradient with respect to the incremental update at the current transformation
+        class Evaluator {
+            const RegistrationPyramid& source;
+            RigidSliceRegistration::Similarity similarity;
+            int bins;
+            double bin_width;
+
+            /// Per-evaluation buffers
+            mutable Array<double> a, b, derivative;
+            mutable Array<int> abin;
+            mutable Array<double> joint, weight;
+
+        public:
+            Evaluator(const RegistrationPyramid& source, RigidSliceRegistration::Similarity similarity, int bins) :
+                source(source), similarity(similarity), bins(bins) {
+                //the volume intensities map to bins [1, bins - 2] so that the B-spline support stays inside
+                bin_width = max(source.Max() - source.Min(), 1.0) / (bins - 3);
+                if (similarity == RigidSliceRegistration::NMI) {
+                    joint.resize(bins * bins);
+                    weight.resize(bins * bins);
+                }
+            }
+
+            double operator()(int l, const SliceLevel& slice, const Affine& m, const double centre[3], double radius, double *gradient) const {
+                const RegistrationPyramid::Level& level = source[l];
+                Affine w2i;
+                for (int r = 0; r < 3; r++)
+                    for (int c = 0; c < 4; c++)
+                        w2i.m[r][c] = level.w2i[r][c];
+                const Affine m2v = Compose(w2i.m, m);
+
+                //sample the volume at the foreground pixels
+                a.clear();
+                b.clear();
+                abin.clear();
+                derivative.clear();
+                const size_t n = slice.value.size();
+                for (size_t i = 0; i < n; i++) {
+                    const double *x = &slice.position[3 * i];
+                    double v[3], value, g[3];
+                    m2v.Apply(x[0], x[1], x[2], v);
+                    if (!Sample(level, v, value, gradient ? g : nullptr))
+                        continue;
+
+                    a.push_back(slice.value[i]);
+                    b.push_back(value);
+                    if (similarity == RigidSliceRegistration::NMI)
+                        abin.push_back(slice.bin[i]);
+
+                    if (gradient) {
+                        //gradient in world coordinates
+                        double gw[3];
+                        for (int q = 0; q < 3; q++)
+                            gw[q] = g[0] * level.w2i[0][q] + g[1] * level.w2i[1][q] + g[2] * level.w2i[2][q];
+                        double y[3];
+                        m.Apply(x[0], x[1], x[2], y);
+                        const double u[3] = {y[0] - centre[0], y[1] - centre[1], y[2] - centre[2]};
+                        derivative.push_back(gw[0]);
+                        derivative.push_back(gw[1]);
+                        derivative.push_back(gw[2]);
+                        derivative.push_back((u[1] * gw[2] - u[2] * gw[1]) / radius);
+                        derivative.push_back((u[2] * gw[0] - u[0] * gw[2]) / radius);
+                        derivative.push_back((u[0] * gw[1] - u[1] * gw[0]) / radius);
+                    }
+                }
+
+                const int samples = b.size();
+                if (samples < MinSamples)
+                    return -numeric_limits<double>::infinity();
+
+                if (gradient)
+                    fill(gradient, gradient + 6, 0.0);
+
+                return similarity == RigidSliceRegistration::NCC ? NCC(samples, gradient) : NMI(samples, gradient);
+            }
+
+        protected:
+            double NCC(int samples, double *gradient) const {
+                double ma = 0, mb = 0;
+                for (int i = 0; i < samples; i++) {
+                    ma += a[i];
+                    mb += b[i];
+                }
+                ma /= samples;
+                mb /= samples;
+
+                double saa = 0, sbb = 0, sab = 0;
+                for (int i = 0; i < samples; i++) {
+                    saa += (a[i] - ma) * (a[i] - ma);
+                    sbb += (b[i] - mb) * (b[i] - mb);
+                    sab += (a[i] - ma) * (b[i] - mb);
+                }
+                if (saa <= 0 || sbb <= 0)
+                    return 0;
+
+                const double norm = sqrt(saa * sbb);
+                const double ncc = sab / norm;
+
+                if (gradient) {
+                    for (int i = 0; i < samples; i++) {
+                        const double d = (a[i] - ma) / norm - ncc * (b[i] - mb) / sbb;
+                        for (int q = 0; q < 6; q++)
+                            gradient[q] += d * derivative[6 * i + q];
+                    }
+                }
+                return ncc;
+            }
+
+            double NMI(int samples, double *gradient) const {
+                //joint histogram with a cubic B-spline Parzen window for the volume
+                fill(joint.begin(), joint.end(), 0.0);
+                for (int i = 0; i < samples; i++) {
+                    const double psi = 1 + (b[i] - source.Min()) / bin_width;
+                    const int first = int(floor(psi)) - 1;
+                    double *row = &joint[abin[i] * bins];
+                    for (int k = max(first, 0); k <= min(first + 3, bins - 1); k++)
+                        row[k] += BSpline(k - psi);
+                }
+
+                Array<double> pa(bins, 0.0), pb(bins, 0.0);
+                for (int r = 0; r < bins; r++)
+                    for (int k = 0; k < bins; k++) {
+                        const double p = joint[r * bins + k] /= samples;
+                        pa[r] += p;
+                        pb[k] += p;
+                    }
+
+                double ha = 0, hb = 0, hab = 0;
+                for (int r = 0; r < bins; r++) {
+                    if (pa[r] > 0)
+                        ha -= pa[r] * log(pa[r]);
+                    if (pb[r] > 0)
+                        hb -= pb[r] * log(pb[r]);
+                }
+                for (size_t k = 0; k < joint.size(); k++)
+                    if (joint[k] > 0)
+                        hab -= joint[k] * log(joint[k]);
+                if (hab <= 0)
+                    return 0;
+
+                const double nmi = (ha + hb) / hab;
+
+                if (gradient) {
+                    //derivative of the NMI with respect to the joint probabilities, the constant terms cancel as the Parzen window derivatives sum to zero
+                    for (int r = 0; r < bins; r++)
+                        for (int k = 0; k < bins; k++) {
+                            const double p = joint[r * bins + k];
+                            weight[r * bins + k] = p > 0 ? (-log(pb[k]) * hab + (ha + hb) * log(p)) / (hab * hab) : 0;
+                        }
+
+                    const double scale = 1.0 / (samples * bin_width);
+                    for (int i = 0; i < samples; i++) {
+                        const double psi = 1 + (b[i] - source.Min()) / bin_width;
+                        const int first = int(floor(psi)) - 1;
+                        const double *row = &weight[abin[i] * bins];
+                        double d = 0;
+                        for (int k = max(first, 0); k <= min(first + 3, bins - 1); k++)
+                            d -= row[k] * BSplineDerivative(k - psi);
+                        d *= scale;
+                        for (int q = 0; q < 6; q++)
+                            gradient[q] += d * derivative[6 * i + q];
+                    }
+                }
+                return nmi;
+            }
+        };
+
+    } // namespace
+
+    //-------------------------------------------------------------------
+
+    void RegistrationPyramid::Initialize(const GreyImage& volume, double background, int levels) {
+        _levels.clear();
+        _min = numeric_limits<double>::max();
+        _max = -numeric_limits<double>::max();
+
+        Level level;
+        level.x = volume.GetX();
+        level.y = volume.GetY();
+        level.z = volume.GetZ();
+        level.voxel_size = max(max(volume.GetXSize(), volume.GetYSize()), volume.GetZSize());
+        const Matrix w2i = volume.GetWorldToImageMatrix();
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 4; c++)
+                level.w2i[r][c] = w2i(r, c);
+
+        const GreyPixel *pv = volume.Data();
+        level.data.resize(size_t(level.x) * level.y * level.z);
+        for (size_t i = 0; i < level.data.size(); i++) {
+            if (pv[i] <= background) {
+                level.data[i] = Background;
+            } else {
+                level.data[i] = pv[i];
+                _min = min(_min, double(pv[i]));
+                _max = max(_max, double(pv[i]));
+            }
+        }
+        if (_min > _max)
+            _min = _max = 0;
+        _levels.push_back(move(level));
+
+        while ((int)_levels.size() < levels) {
+            const Level& fine = _levels.back();
+            if (fine.x < 8 || fine.y < 8 || fine.z < 8)
+                break;
+
+            Level coarse;
+            coarse.data = Downsample(fine.data, fine.x, fine.y, fine.z, coarse.x, coarse.y, coarse.z);
+            coarse.voxel_size = 2 * fine.voxel_size;
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 4; c++)
+                    coarse.w2i[r][c] = 0.5 * fine.w2i[r][c];
+            _levels.push_back(move(coarse));
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    RigidSliceRegistration::RigidSliceRegistration(const RegistrationPyramid& source, Similarity similarity, int bins) :
+        _source(source), _similarity(similarity), _bins(bins > 0 ? bins : 64), _max_iterations(100), _min_step(0.01) {}
+
+    //-------------------------------------------------------------------
+
+    double RigidSliceRegistration::Run(const GreyImage& target, double background, RigidTransformation& transformation, double *initial_similarity) const {
+        const int levels = _source.NumberOfLevels();
+        const int x = target.GetX(), y = target.GetY();
+        const Matrix i2w = target.GetImageToWorldMatrix();
+        const Affine pixel2world = ToAffine(i2w);
+
+        //slice pyramid, smoothed in-plane like the volume
+        Array<Array<float>> pixels(levels);
+        Array<int> dx(levels), dy(levels);
+        pixels[0].resize(size_t(x) * y);
+        const GreyPixel *pt = target.Data();
+        double amin = numeric_limits<double>::max(), amax = -numeric_limits<double>::max();
+        for (int i = 0; i < x * y; i++) {
+            if (pt[i] <= background) {
+                pixels[0][i] = RegistrationPyramid::Background;
+            } else {
+                pixels[0][i] = pt[i];
+                amin = min(amin, double(pt[i]));
+                amax = max(amax, double(pt[i]));
+            }
+        }
+        if (amin > amax) {
+            if (initial_similarity)
+                *initial_similarity = -numeric_limits<double>::infinity();
+            return -numeric_limits<double>::infinity();
+        }
+        dx[0] = x;
+        dy[0] = y;
+        for (int l = 1; l < levels; l++) {
+            int nz;
+            pixels[l] = Downsample(pixels[l - 1], dx[l - 1], dy[l - 1], 1, dx[l], dy[l], nz);
+        }
+
+        //foreground pixels of each level, their centre and radius
+        Array<SliceLevel> slice(levels);
+        double centre[3] = {0, 0, 0}, radius = 0;
+        for (int l = 0; l < levels; l++) {
+            const int scale = 1 << l;
+            for (int j = 0; j < dy[l]; j++)
+                for (int i = 0; i < dx[l]; i++) {
+                    const float v = pixels[l][j * dx[l] + i];
+                    if (v == RegistrationPyramid::Background)
+                        continue;
+                    double w[3];
+                    pixel2world.Apply(scale * i, scale * j, 0, w);
+                    slice[l].position.insert(slice[l].position.end(), w, w + 3);
+                    slice[l].value.push_back(v);
+                    slice[l].bin.push_back(amax > amin ? int(round((v - amin) / (amax - amin) * (_bins - 1))) : 0);
+                }
+        }
+        const size_t n = slice[0].value.size();
+        for (size_t i = 0; i < n; i++)
+            for (int q = 0; q < 3; q++)
+                centre[q] += slice[0].position[3 * i + q] / n;
+        for (size_t i = 0; i < n; i++)
+            for (int q = 0; q < 3; q++)
+                radius += (slice[0].position[3 * i + q] - centre[q]) * (slice[0].position[3 * i + q] - centre[q]) / n;
+        radius = max(sqrt(radius), 1.0);
+
+        const Evaluator evaluate(_source, _similarity, _bins);
+        Affine m = ToAffine(transformation.GetMatrix());
+        double similarity = -numeric_limits<double>::infinity();
+
+        if (initial_similarity) {
+            double c[3];
+            m.Apply(centre[0], centre[1], centre[2], c);
+            *initial_similarity = evaluate(0, slice[0], m, c, radius, nullptr);
+        }
+
+        for (int l = levels - 1; l >= 0; l--) {
+            double step = _source[l].voxel_size;
+            const double min_step = _min_step * (1 << l);
+
+            double c[3];
+            m.Apply(centre[0], centre[1], centre[2], c);
+            double gradient[6], candidate_gradient[6];
+            similarity = evaluate(l, slice[l], m, c, radius, gradient);
+
+            for (int iter = 0; iter < _max_iterations && similarity > -numeric_limits<double>::infinity(); iter++) {
+                double norm = 0;
+                for (int q = 0; q < 6; q++)
+                    norm += gradient[q] * gradient[q];
+                norm = sqrt(norm);
+                if (norm == 0)
+                    break;
+
+                //step along the normalised gradient, grow the step after a success and halve it after a failure
+                double p[6];
+                for (int q = 0; q < 6; q++)
+                    p[q] = step * gradient[q] / norm;
+                const Affine candidate = Update(m, p, c, radius);
+
+                double cc[3];
+                candidate.Apply(centre[0], centre[1], centre[2], cc);
+                const double candidate_similarity = evaluate(l, slice[l], candidate, cc, radius, candidate_gradient);
+
+                if (candidate_similarity > similarity) {
+                    m = candidate;
+                    similarity = candidate_similarity;
+                    copy(candidate_gradient, candidate_gradient + 6, gradient);
+                    copy(cc, cc + 3, c);
+                    step *= 1.2;
+                } else {
+                    step *= 0.5;
+                    if (step < min_step)
+                        break;
+                }
+            }
+        }
+
+        if (similarity > -numeric_limits<double>::infinity()) {
+            Matrix matrix(4, 4);
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 4; c++)
+                    matrix(r, c) = m.m[r][c];
+            matrix(3, 3) = 1;
+            transformation.PutMatrix(matrix);
+        }
+        return similarity;
+    }
+
+    //-------------------------------------------------------------------
+
+    double RigidSliceRegistration::Evaluate(const GreyImage& target, double background, const RigidTransformation& transformation) const {
+        //without iterations, Run() only evaluates the similarity of the initial guess
+        RigidSliceRegistration evaluation(*this);
+        evaluation.SetMaxIterations(0);
+        RigidTransformation unchanged(transformation);
+        double similarity;
+        evaluation.Run(target, background, unchanged, &similarity);
+        return similarity;
+    }
+
+} // namespace svrtk
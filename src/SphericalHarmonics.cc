@@ -18,6 +18,9 @@
 
 #include "svrtk/SphericalHarmonics.h"
 
+// MIRTK
+#include "mirtk/Parallel.h"
+
 using namespace std;
 using namespace mirtk;
 
@@ -32,7 +35,7 @@ namespace svrtk {
 
     }
 
-    Matrix SphericalHarmonics::shTransform(Matrix dirs, int lmax)
+    Matrix SphericalHarmonics::shTransform(const Matrix& dirs, int lmax)
     {
         if (dirs.Cols() != 2)
             throw runtime_error("direction matrix should have 2 columns: [ azimuth elevation ]");
@@ -87,7 +90,7 @@ namespace svrtk {
         }
     }
 
-    Matrix SphericalHarmonics::cartesian2spherical (Matrix xyz)
+    Matrix SphericalHarmonics::cartesian2spherical (const Matrix& xyz)
     {
         double r,x,y,z;
         Matrix az_el_r(xyz.Rows(),2);
@@ -104,7 +107,7 @@ namespace svrtk {
         return az_el_r;
     }
 
-    Vector SphericalHarmonics::LSFit(Vector signal, Matrix dirs, int lmax)
+    Vector SphericalHarmonics::LSFit(const Vector& signal, const Matrix& dirs, int lmax)
     {
         // check that sizes correspond
         if (signal.Rows() != dirs.Rows())
@@ -127,7 +130,7 @@ namespace svrtk {
         return c;
     }
 
-    void SphericalHarmonics::InitSHT(Matrix dirs, int lmax)
+    void SphericalHarmonics::InitSHT(const Matrix& dirs, int lmax)
     {
         Matrix dirs_sph;
         dirs_sph = cartesian2spherical(dirs);
@@ -141,12 +144,12 @@ namespace svrtk {
         _iSHT = shtt*_SHT;
         _iSHT.Invert();
         _iSHT=_iSHT*shtt;
-
+        UpdateTransformData();
 
         //_iSHT.Print();
     }
 
-    Matrix SphericalHarmonics::SHbasis(Matrix dirs, int lmax)
+    Matrix SphericalHarmonics::SHbasis(const Matrix& dirs, int lmax)
     {
         Matrix dirs_sph;
         dirs_sph = cartesian2spherical(dirs);
@@ -155,7 +158,7 @@ namespace svrtk {
         return SHT;
     }
 
-    void SphericalHarmonics::InitSHTRegul(Matrix dirs, double lambda, int lmax)
+    void SphericalHarmonics::InitSHTRegul(const Matrix& dirs, double lambda, int lmax)
     {
         Matrix dirs_sph;
         dirs_sph = cartesian2spherical(dirs);
@@ -169,6 +172,72 @@ namespace svrtk {
         _iSHT = shtt*_SHT+LB*lambda;
         _iSHT.Invert();
         _iSHT=_iSHT*shtt;
+        UpdateTransformData();
+    }
+
+    void SphericalHarmonics::UpdateTransformData()
+    {
+        _SHT_data.resize((size_t)_SHT.Rows() * _SHT.Cols());
+        for (int r = 0; r < _SHT.Rows(); r++)
+            for (int c = 0; c < _SHT.Cols(); c++)
+                _SHT_data[(size_t)r * _SHT.Cols() + c] = _SHT(r, c);
+
+        _iSHT_data.resize((size_t)_iSHT.Rows() * _iSHT.Cols());
+        for (int r = 0; r < _iSHT.Rows(); r++)
+            for (int c = 0; c < _iSHT.Cols(); c++)
+                _iSHT_data[(size_t)r * _iSHT.Cols() + c] = _iSHT(r, c);
+    }
+
+    /// Class for the product of a matrix with blocks of voxels
+    class ParallelSHTransform {
+        const Array<double>& matrix;
+        const int rows;
+        const int cols;
+        const RealPixel *in;
+        RealPixel *out;
+        const size_t nvox;
+
+    public:
+        /// Number of voxels of a block, small enough for the input and output rows to stay in cache
+        static constexpr size_t block = 1024;
+
+        ParallelSHTransform(const Array<double>& matrix, int rows, int cols, const RealPixel *in, RealPixel *out, size_t nvox) :
+        matrix(matrix), rows(rows), cols(cols), in(in), out(out), nvox(nvox) {}
+
+        void operator()(const blocked_range<size_t>& r) const {
+            //the products are accumulated in double and converted when stored
+            double sum[block];
+            for (size_t begin = r.begin(); begin < r.end(); begin += block) {
+                const size_t n = min(block, r.end() - begin);
+                for (int o = 0; o < rows; o++) {
+                    fill(sum, sum + n, 0);
+                    const double *m = &matrix[(size_t)o * cols];
+                    //the innermost loop runs over contiguous voxels and is vectorised
+                    for (int i = 0; i < cols; i++) {
+                        if (m[i] == 0)
+                            continue;
+                        const double mi = m[i];
+                        const RealPixel *pi = in + (size_t)i * nvox + begin;
+                        for (size_t v = 0; v < n; v++)
+                            sum[v] += mi * pi[v];
+                    }
+                    RealPixel *po = out + (size_t)o * nvox + begin;
+                    for (size_t v = 0; v < n; v++)
+                        po[v] = sum[v];
+                }
+            }
+        }
+
+        // execute
+        void operator()() const {
+            parallel_for(blocked_range<size_t>(0, nvox, block), *this);
+        }
+    };
+
+    void SphericalHarmonics::Transform(const Array<double>& matrix, int rows, int cols, const RealPixel *in, RealPixel *out, size_t nvox)
+    {
+        ParallelSHTransform transform(matrix, rows, cols, in, out, nvox);
+        transform();
     }
 
 
@@ -188,14 +257,14 @@ namespace svrtk {
         return LB;
     }
 
-    Vector SphericalHarmonics::Coeff2Signal(Vector c)
+    Vector SphericalHarmonics::Coeff2Signal(const Vector& c)
     {
         if (c.Rows() != _SHT.Cols())
             throw runtime_error("dimensions of SH coeffs and number of basis do not match: " + to_string(c.Rows()) + " " + to_string(_SHT.Cols()));
         return _SHT*c;
     }
 
-    Vector SphericalHarmonics::Signal2Coeff(Vector s)
+    Vector SphericalHarmonics::Signal2Coeff(const Vector& s)
     {
         if (s.Rows() != _iSHT.Cols())
             throw runtime_error("dimensions of signal and number of directions do not match: " + to_string(s.Rows()) + " " + to_string(_iSHT.Cols()));
@@ -203,7 +272,21 @@ namespace svrtk {
 
     }
 
-    RealImage SphericalHarmonics::Signal2Coeff(RealImage signal)
+    void SphericalHarmonics::Signal2Coeff(const RealPixel *signal, RealPixel *coeffs, size_t nvox) const
+    {
+        if (_iSHT_data.size() != (size_t)_iSHT.Rows() * _iSHT.Cols())
+            throw runtime_error("Signal2Coeff: SH transform has not been initialised.");
+        Transform(_iSHT_data, _iSHT.Rows(), _iSHT.Cols(), signal, coeffs, nvox);
+    }
+
+    void SphericalHarmonics::Coeff2Signal(const RealPixel *coeffs, RealPixel *signal, size_t nvox) const
+    {
+        if (_SHT_data.size() != (size_t)_SHT.Rows() * _SHT.Cols())
+            throw runtime_error("Coeff2Signal: SH transform has not been initialised.");
+        Transform(_SHT_data, _SHT.Rows(), _SHT.Cols(), coeffs, signal, nvox);
+    }
+
+    RealImage SphericalHarmonics::Signal2Coeff(const RealImage& signal)
     {
         if (signal.GetT() != _iSHT.Cols())
             throw runtime_error("dimensions of signal and number of directions do not match: " + to_string(signal.GetT()) + " " + to_string(_iSHT.Cols()));
@@ -213,34 +296,23 @@ namespace svrtk {
         attr._t = _iSHT.Rows();
         RealImage coeffs(attr);
 
-        coeffs = 0;
-
-        Vector s(signal.GetT());
-        Vector a;
-        int i,j,k,t;
-        for(k=0;k<signal.GetZ();k++)
-            for(j=0;j<signal.GetY();j++)
-                for(i=0;i<signal.GetX();i++)
-                {
-                    if(signal(i,j,k,0)>0)
-                    {
-                        for(t=0;t<signal.GetT();t++)
-                            s(t)=signal(i,j,k,t);
-
-                        a=Signal2Coeff(s);
+        //all voxels are fitted at once
+        const size_t nvox = (size_t)signal.GetX() * signal.GetY() * signal.GetZ();
+        Signal2Coeff(signal.Data(), coeffs.Data(), nvox);
 
-                        cout << t << endl;
-
-                        for(t=0;t<coeffs.GetT();t++)
-                            coeffs(i,j,k,t)=a(t);
-                    }
-                }
+        //only voxels with positive signal in the first volume are kept
+        const RealPixel *ps = signal.Data();
+        RealPixel *pc = coeffs.Data();
+        for (size_t v = 0; v < nvox; v++)
+            if (!(ps[v] > 0))
+                for (int t = 0; t < coeffs.GetT(); t++)
+                    pc[t * nvox + v] = 0;
 
         return coeffs;
     }
 
 
-    RealImage SphericalHarmonics::Coeff2Signal(RealImage coeffs)
+    RealImage SphericalHarmonics::Coeff2Signal(const RealImage& coeffs)
     {
         if (coeffs.GetT() != _SHT.Cols())
             throw runtime_error("dimensions of SH coeffs and number of basis do not match: " + to_string(coeffs.GetT()) + " " + to_string(_SHT.Cols()));
@@ -249,24 +321,10 @@ namespace svrtk {
         ImageAttributes attr = coeffs.Attributes();
         attr._t = _SHT.Rows();
         RealImage signal(attr);
-        Vector c(coeffs.GetT());
-        Vector s;
-        int i,j,k,t;
-        for(k=0;k<coeffs.GetZ();k++)
-            for(j=0;j<coeffs.GetY();j++)
-                for(i=0;i<coeffs.GetX();i++)
-                {
-                    //it should be ok - the first coeff should not be negative for positive signal
-                    //if(coeffs(i,j,k,0)>0)
-                    //{
-                    for(t=0;t<coeffs.GetT();t++)
-                        c(t)=coeffs(i,j,k,t);
-                    s=Coeff2Signal(c);
-                    for(t=0;t<signal.GetT();t++)
-                        signal(i,j,k,t)=s(t);
-                    //}
-                }
 
+        //all voxels are transformed at once
+        //it should be ok - the first coeff should not be negative for positive signal
+        Coeff2Signal(coeffs.Data(), signal.Data(), (size_t)coeffs.GetX() * coeffs.GetY() * coeffs.GetZ());
 
         return signal;
     }
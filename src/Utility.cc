@@ -19,6 +19,7 @@
 // SVRTK
 #include "svrtk/Utility.h"
 #include "svrtk/Parallel.h"
+#include "svrtk/Profiling.h"
 
 namespace svrtk::Utility {
 
@@ -1364,5 +1365,29 @@ namespace svrtk::Utility {
         } else
             stacks.push_back(image);
     }
+    //-------------------------------------------------------------------
+
+    // append the memory usage of named buffers and of the process to a CSV report
+    void AppendMemoryReport(const string& file_name, const string& stage, const Array<pair<string, size_t>>& usage) {
+        const bool exists = boost::filesystem::exists(file_name);
+        ofstream report(file_name, ios::app);
+        if (!report)
+            throw runtime_error("Memory report " + file_name + " couldn't be written!");
+
+        if (!exists)
+            report << "stage,buffer,bytes" << endl;
+
+        size_t total = 0;
+        for (const auto& entry : usage) {
+            report << stage << "," << entry.first << "," << entry.second << "\n";
+            total += entry.second;
+        }
+
+        size_t rss, peak_rss;
+        Profiler::ResidentMemory(rss, peak_rss);
+        report << stage << ",total," << total << "\n";
+        report << stage << ",rss," << rss << "\n";
+        report << stage << ",peak_rss," << peak_rss << endl;
+    }
 
 }
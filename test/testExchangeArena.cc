@@ -0,0 +1,149 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testExchangeArena
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/ExchangeArena.h"
+
+// C++ Standard
+#include <cstdint>
+#include <limits>
+
+using namespace svrtk;
+
+/// Byte offset of the count of the first entry: header (magic, version, number of entries, size), name, kind, reserved, offset
+constexpr size_t FirstEntryCount = 8 + 4 + 4 + 8 + 64 + 4 + 4 + 8;
+
+/// 3x2x2 image with distinct voxel values and a non-default geometry
+static RealImage TestImage() {
+    ImageAttributes attr(3, 2, 2);
+    attr._dx = 0.5;
+    attr._dz = 2;
+    attr._xorigin = -7;
+    attr._zaxis[2] = -1;
+    RealImage image;
+    image.Initialize(attr);
+    for (int n = 0; n < image.NumberOfVoxels(); n++)
+        image.Data()[n] = n - 2.5;
+    return image;
+}
+
+/// Write an arena with the test image and a parameter vector
+static string WriteTestArena() {
+    const string file_name = (temp_directory_path() / "testExchangeArena.arena").string();
+    const RealImage image = TestImage();
+    ExchangeArena arena;
+    arena.AddImage("image", image);
+    arena.AddParameters("parameters", {1.5, -2, 1e-12});
+    arena.Write(file_name);
+    return file_name;
+}
+
+/// Overwrite a field of a file
+template <class T>
+static void Patch(const string& file_name, size_t offset, T value) {
+    fstream file(file_name, ios::in | ios::out | ios::binary);
+    file.seekp(offset);
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+BOOST_AUTO_TEST_CASE(WriteAndOpen) {
+    const string file_name = WriteTestArena();
+    const RealImage image = TestImage();
+
+    ExchangeArena arena;
+    BOOST_REQUIRE(arena.Open(file_name));
+    BOOST_CHECK(arena.IsOpen());
+    BOOST_CHECK(arena.Contains("image"));
+    BOOST_CHECK(arena.Contains("parameters"));
+    BOOST_CHECK(!arena.Contains("missing"));
+
+    RealImage view;
+    arena.GetImage("image", view);
+    const ImageAttributes& attr = view.Attributes();
+    BOOST_CHECK_EQUAL(attr._x, 3);
+    BOOST_CHECK_EQUAL(attr._y, 2);
+    BOOST_CHECK_EQUAL(attr._z, 2);
+    BOOST_CHECK_EQUAL(attr._dx, 0.5);
+    BOOST_CHECK_EQUAL(attr._dz, 2);
+    BOOST_CHECK_EQUAL(attr._xorigin, -7);
+    BOOST_CHECK_EQUAL(attr._zaxis[2], -1);
+    BOOST_REQUIRE_EQUAL(view.NumberOfVoxels(), image.NumberOfVoxels());
+    for (int n = 0; n < image.NumberOfVoxels(); n++)
+        BOOST_CHECK_EQUAL(view.Data()[n], image.Data()[n]);
+
+    const Array<double> parameters = arena.GetParameters("parameters");
+    BOOST_REQUIRE_EQUAL(parameters.size(), 3u);
+    BOOST_CHECK_EQUAL(parameters[0], 1.5);
+    BOOST_CHECK_EQUAL(parameters[1], -2);
+    BOOST_CHECK_EQUAL(parameters[2], 1e-12);
+
+    //missing entries and entries of another kind throw
+    BOOST_CHECK_THROW(arena.GetImage("parameters", view), runtime_error);
+    BOOST_CHECK_THROW(arena.GetParameters("missing"), runtime_error);
+
+    //the image is a private view of the mapped payload, changes don't reach the file
+    RealImage view2;
+    arena.GetImage("image", view2);
+    BOOST_CHECK_EQUAL(view.Data(), view2.Data());
+    view.Data()[0] = 100;
+    ExchangeArena reopened;
+    BOOST_REQUIRE(reopened.Open(file_name));
+    reopened.GetImage("image", view2);
+    BOOST_CHECK_EQUAL(view2.Data()[0], image.Data()[0]);
+
+    arena.Close();
+    BOOST_CHECK(!arena.IsOpen());
+    BOOST_CHECK(!arena.Contains("image"));
+    remove(file_name);
+}
+
+BOOST_AUTO_TEST_CASE(InvalidFilesAreRejected) {
+    ExchangeArena arena;
+    BOOST_CHECK(!arena.Open((temp_directory_path() / "testExchangeArena.missing").string()));
+
+    //truncated file
+    string file_name = WriteTestArena();
+    resize_file(file_name, file_size(file_name) - 64);
+    BOOST_CHECK(!arena.Open(file_name));
+    BOOST_CHECK(!arena.IsOpen());
+
+    //wrong magic
+    file_name = WriteTestArena();
+    Patch<char>(file_name, 0, 'X');
+    BOOST_CHECK(!arena.Open(file_name));
+
+    //payload beyond the end of the file
+    file_name = WriteTestArena();
+    Patch<uint64_t>(file_name, FirstEntryCount, 1 << 20);
+    BOOST_CHECK(!arena.Open(file_name));
+
+    //a count for which offset + count * value size overflows to a small number
+    file_name = WriteTestArena();
+    Patch<uint64_t>(file_name, FirstEntryCount, numeric_limits<uint64_t>::max() / 4 + 1);
+    BOOST_CHECK(!arena.Open(file_name));
+
+    //the unmodified file is valid
+    file_name = WriteTestArena();
+    BOOST_CHECK(arena.Open(file_name));
+    arena.Close();
+    remove(file_name);
+}
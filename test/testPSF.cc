@@ -0,0 +1,116 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testPSF
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/PSF.h"
+
+// C++ Standard
+#include <thread>
+
+using namespace svrtk;
+
+/// Kernel of a 1x1x3 mm slice voxel reconstructed at 0.75 mm with quality factor 2
+static shared_ptr<const PSFKernel> GetKernel(double dz = 3) {
+    return PSFCache::Instance().Get(1, 1, dz, 1.2 / 2.3548, 1.2 / 2.3548, dz / 2.3548, 0.75 / 2, 0.75);
+}
+
+BOOST_AUTO_TEST_CASE(KernelIsNormalised) {
+    PSFCache::Instance().Clear();
+    const shared_ptr<const PSFKernel> kernel = GetKernel();
+
+    BOOST_CHECK_EQUAL(kernel->xDim % 2, 1);
+    BOOST_CHECK_EQUAL(kernel->yDim % 2, 1);
+    BOOST_CHECK_EQUAL(kernel->zDim % 2, 1);
+    BOOST_CHECK_EQUAL(kernel->centre, (kernel->dim - 1) / 2);
+    BOOST_REQUIRE_EQUAL(kernel->offset.size(), (size_t)kernel->image.NumberOfVoxels());
+    BOOST_REQUIRE_EQUAL(kernel->value.size(), kernel->offset.size());
+
+    //the weights sum to one and the offsets are centred
+    double sum = 0, mx = 0, my = 0, mz = 0;
+    for (size_t p = 0; p < kernel->value.size(); p++) {
+        sum += kernel->value[p];
+        mx += kernel->value[p] * kernel->offset[p]._x;
+        my += kernel->value[p] * kernel->offset[p]._y;
+        mz += kernel->value[p] * kernel->offset[p]._z;
+    }
+    BOOST_CHECK_CLOSE(sum, 1.0, 1e-4);
+    BOOST_CHECK_SMALL(mx, 1e-5);
+    BOOST_CHECK_SMALL(my, 1e-5);
+    BOOST_CHECK_SMALL(mz, 1e-5);
+
+    //offsets are in slice image coordinates, so they span about one slice voxel in every direction
+    const Point& corner = kernel->offset.front();
+    BOOST_CHECK_CLOSE(corner._x, -0.5 * (kernel->xDim - 1) * 0.75 / 2, 1e-6);
+    BOOST_CHECK_CLOSE(corner._z, -0.5 * (kernel->zDim - 1) * 0.75 / 2 / 3, 1e-6);
+}
+
+BOOST_AUTO_TEST_CASE(KernelsAreShared) {
+    PSFCache::Instance().Clear();
+
+    //every thread gets the same kernel for the same parameters
+    Array<shared_ptr<const PSFKernel>> kernels(8);
+    Array<thread> threads;
+    for (size_t t = 0; t < kernels.size(); t++)
+        threads.emplace_back([&kernels, t]() { kernels[t] = GetKernel(); });
+    for (auto& t : threads)
+        t.join();
+    for (size_t t = 1; t < kernels.size(); t++)
+        BOOST_CHECK(kernels[t] == kernels[0]);
+    BOOST_CHECK(GetKernel() == kernels[0]);
+
+    //a different geometry gets its own kernel
+    const shared_ptr<const PSFKernel> other = GetKernel(2);
+    BOOST_CHECK(other != kernels[0]);
+    BOOST_CHECK_LT(other->zDim, kernels[0]->zDim);
+
+    //kernels stay valid after the cache is cleared
+    PSFCache::Instance().Clear();
+    BOOST_CHECK(GetKernel() != kernels[0]);
+    BOOST_CHECK_EQUAL(kernels[0]->value.size(), kernels[0]->offset.size());
+}
+
+BOOST_AUTO_TEST_CASE(MappedOffsetsMatchPointMapping) {
+    const shared_ptr<const PSFKernel> kernel = GetKernel();
+
+    //affine slice image to volume image mapping: rotation, anisotropic scaling and translation
+    Matrix m(4, 4);
+    const double c = cos(0.3), s = sin(0.3);
+    m(0, 0) = 1.3 * c; m(0, 1) = -1.3 * s; m(0, 2) = 0;   m(0, 3) = 12.5;
+    m(1, 0) = 1.3 * s; m(1, 1) = 1.3 * c;  m(1, 2) = 0.2; m(1, 3) = -4;
+    m(2, 0) = 0;       m(2, 1) = 0.1;      m(2, 2) = 4;   m(2, 3) = 7.25;
+    m(3, 3) = 1;
+    const Array<Point> mapped_offset = MapPSFOffsets(*kernel, m);
+    BOOST_REQUIRE_EQUAL(mapped_offset.size(), kernel->offset.size());
+
+    //mapped centre of slice voxel (i, j) plus the mapped offset is the mapped PSF point
+    const int i = 17, j = 5;
+    for (size_t p = 0; p < kernel->offset.size(); p++) {
+        const double point[3] = {i + kernel->offset[p]._x, j + kernel->offset[p]._y, kernel->offset[p]._z};
+        const double centre[3] = {double(i), double(j), 0};
+        for (int r = 0; r < 3; r++) {
+            const double expected = m(r, 0) * point[0] + m(r, 1) * point[1] + m(r, 2) * point[2] + m(r, 3);
+            const double mapped_centre = m(r, 0) * centre[0] + m(r, 1) * centre[1] + m(r, 2) * centre[2] + m(r, 3);
+            const double offset = r == 0 ? mapped_offset[p]._x : r == 1 ? mapped_offset[p]._y : mapped_offset[p]._z;
+            BOOST_CHECK_SMALL(mapped_centre + offset - expected, 1e-9);
+        }
+    }
+}
@@ -0,0 +1,92 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testRegistrationWorkerPool
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/RegistrationWorkerPool.h"
+
+// C++ Standard
+#include <cstdio>
+#include <cstring>
+
+using namespace svrtk;
+
+/// Shell script that answers every request with "ok <request>", hangs on "hang" and dies on "die"
+static const Array<string> EchoWorker = {"-c",
+    "while read -r line; do case \"$line\" in quit) exit 0;; hang) sleep 5;; die) exit 1;; *) printf 'ok\\t%s\\n' \"$line\";; esac; done"};
+
+BOOST_AUTO_TEST_CASE(RigidJobRoundTrip) {
+    RigidTransformation dofin;
+    for (int i = 0; i < dofin.NumberOfDOFs(); i++)
+        dofin.Put(i, 0.1 * (i + 1) + 1e-12);
+
+    //the parameters travel inline without loss of precision
+    const string job = RegistrationWorkerPool::RigidJob("targets.arena#target-3", "source.nii", dofin);
+    BOOST_REQUIRE_EQUAL(job.compare(0, 35, "rigid\ttargets.arena#target-3\tsource"), 0);
+    const string reply = "ok" + job.substr(job.find("\tsource.nii") + strlen("\tsource.nii"));
+
+    RigidTransformation dofout;
+    BOOST_REQUIRE(RegistrationWorkerPool::RigidResult(reply, dofout));
+    for (int i = 0; i < dofin.NumberOfDOFs(); i++)
+        BOOST_CHECK_EQUAL(dofout.Get(i), dofin.Get(i));
+
+    //errors and truncated replies are rejected
+    BOOST_CHECK(!RegistrationWorkerPool::RigidResult("error\tfailed", dofout));
+    BOOST_CHECK(!RegistrationWorkerPool::RigidResult("ok\t1\t2", dofout));
+    BOOST_CHECK(!RegistrationWorkerPool::RigidResult("", dofout));
+
+    BOOST_CHECK(RegistrationWorkerPool::FFDResult("ok"));
+    BOOST_CHECK(!RegistrationWorkerPool::FFDResult(""));
+}
+
+BOOST_AUTO_TEST_CASE(ServeAnswersEveryRequest) {
+    char requests[] = "reset\nunknown\nrigid\nquit\nreset\n";
+    FILE *input = fmemopen(requests, strlen(requests), "r");
+    char *replies = nullptr;
+    size_t size = 0;
+    FILE *output = open_memstream(&replies, &size);
+
+    //requests after quit are not served
+    BOOST_CHECK_EQUAL(RegistrationWorkerPool::Serve(input, output, false), 0);
+    fclose(input);
+    fclose(output);
+    BOOST_CHECK_EQUAL(string(replies, size), "ok\nerror\tunknown request\nerror\tunknown request\n");
+    free(replies);
+}
+
+BOOST_AUTO_TEST_CASE(PoolRestartsFailedWorkers) {
+    RegistrationWorkerPool pool("/bin/sh", EchoWorker, 2, 1);
+    BOOST_CHECK_EQUAL(pool.NumberOfWorkers(), 2u);
+
+    const Array<string> jobs = {"a", "b\tc", "hang", "d", "die", "e", "f"};
+    const Array<string> replies = pool.Run(jobs);
+    BOOST_REQUIRE_EQUAL(replies.size(), jobs.size());
+
+    //the hung and the dead worker fail only their own job, the restarted workers serve the others
+    for (size_t n = 0; n < jobs.size(); n++) {
+        if (jobs[n] == "hang" || jobs[n] == "die")
+            BOOST_CHECK(replies[n].empty());
+        else
+            BOOST_CHECK_EQUAL(replies[n], "ok\t" + jobs[n]);
+    }
+
+    BOOST_CHECK_EQUAL(pool.Run({"g"})[0], "ok\tg");
+}
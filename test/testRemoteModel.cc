@@ -0,0 +1,142 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testRemoteModel
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/Reconstruction.h"
+
+using namespace svrtk;
+
+/// Reconstruction with the remote model exposed
+class RemoteModel: public Reconstruction {
+public:
+    using Reconstruction::_slices;
+    using Reconstruction::_mask;
+    using Reconstruction::_reconstructed;
+    using Reconstruction::_transformations;
+};
+
+/// Number of slices of the toy model
+constexpr int NumberOfSlices = 3;
+
+/// Slice thickness of the toy model
+constexpr double Thickness = 2.5;
+
+/// Iteration the model is exchanged at
+constexpr int Iteration = 2;
+
+/// Toy model with distinct slices, mask, volume and transformations
+static void ToyModel(RemoteModel& model) {
+    for (int n = 0; n < NumberOfSlices; n++) {
+        RealImage slice(5, 4, 1);
+        slice.PutPixelSize(1.5, 1.5, Thickness);
+        for (int j = 0; j < slice.GetY(); j++)
+            for (int i = 0; i < slice.GetX(); i++)
+                slice(i, j, 0) = 10 * n + i - 0.5 * j;
+        model._slices.push_back(slice);
+
+        RigidTransformation transformation;
+        for (int dof = 0; dof < transformation.NumberOfDOFs(); dof++)
+            transformation.Put(dof, 0.1 * (n + 1) * (dof + 1));
+        model._transformations.push_back(transformation);
+    }
+
+    model._reconstructed.Initialize(6, 6, 6);
+    model._mask.Initialize(6, 6, 6);
+    for (int k = 0; k < 6; k++)
+        for (int j = 0; j < 6; j++)
+            for (int i = 0; i < 6; i++) {
+                model._reconstructed(i, j, k) = i * j - k + 0.25;
+                model._mask(i, j, k) = (i + j + k) % 3 == 0;
+            }
+}
+
+static void CheckImage(const RealImage& image, const RealImage& expected) {
+    BOOST_REQUIRE_EQUAL(image.NumberOfVoxels(), expected.NumberOfVoxels());
+    for (int v = 0; v < expected.NumberOfVoxels(); v++)
+        BOOST_CHECK_CLOSE(image.GetAsDouble(v), expected.GetAsDouble(v), 1e-4);
+}
+
+/// Saves the toy model with the given exchange and loads it back into fresh reconstructions
+static void CheckRoundTrip(bool exchange_arena, const string& name) {
+    const path folder = temp_directory_path() / name;
+    remove_all(folder);
+    create_directories(folder);
+
+    RemoteModel saved;
+    saved.SetExchangeArena(exchange_arena);
+    ToyModel(saved);
+    saved.SaveModelRemote(folder.string(), 1, Iteration);
+
+    RemoteModel loaded;
+    loaded.SetExchangeArena(exchange_arena);
+    loaded.LoadModelRemote(folder.string(), NumberOfSlices, Thickness, Iteration);
+
+    CheckImage(loaded._reconstructed, saved._reconstructed);
+    CheckImage(loaded._mask, saved._mask);
+    BOOST_REQUIRE_EQUAL(loaded._slices.size(), NumberOfSlices);
+    BOOST_REQUIRE_EQUAL(loaded._transformations.size(), NumberOfSlices);
+    for (int n = 0; n < NumberOfSlices; n++) {
+        CheckImage(loaded._slices[n], saved._slices[n]);
+        BOOST_CHECK_CLOSE(loaded._slices[n].GetZSize(), Thickness, 1e-4);
+        for (int dof = 0; dof < saved._transformations[n].NumberOfDOFs(); dof++)
+            BOOST_CHECK_CLOSE(loaded._transformations[n].Get(dof), saved._transformations[n].Get(dof), 1e-4);
+    }
+
+    //the results of a later iteration only replace the volume
+    saved._reconstructed *= 2;
+    saved.SaveModelRemote(folder.string(), 0, Iteration + 1);
+    RemoteModel results;
+    results.SetExchangeArena(exchange_arena);
+    results.LoadResultsRemote(folder.string(), NumberOfSlices, Iteration + 1);
+    CheckImage(results._reconstructed, saved._reconstructed);
+
+    remove_all(folder);
+}
+
+BOOST_AUTO_TEST_CASE(InitialiseTest) {
+    InitializeIOLibrary();
+}
+
+BOOST_AUTO_TEST_CASE(FileRoundTrip) {
+    CheckRoundTrip(false, "testRemoteModel-files");
+}
+
+BOOST_AUTO_TEST_CASE(ArenaRoundTrip) {
+    CheckRoundTrip(true, "testRemoteModel-arena");
+}
+
+BOOST_AUTO_TEST_CASE(FilesAreTheDefault) {
+    const path folder = temp_directory_path() / "testRemoteModel-default";
+    remove_all(folder);
+    create_directories(folder);
+
+    RemoteModel saved;
+    ToyModel(saved);
+    saved.SaveModelRemote(folder.string(), 1, Iteration);
+    BOOST_CHECK(exists(folder / "org-slice-0.nii.gz"));
+    BOOST_CHECK(exists(folder / "current-mask.nii.gz"));
+    BOOST_CHECK(exists(folder / ("org-transformation-" + to_string(Iteration) + "-0.dof")));
+    BOOST_CHECK(exists(folder / "latest-out-recon.nii.gz"));
+    BOOST_CHECK(!exists(folder / "slices.arena"));
+
+    remove_all(folder);
+}
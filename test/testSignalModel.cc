@@ -0,0 +1,331 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testSignalModel
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/SignalModel.h"
+
+using namespace svrtk;
+
+/// Number of voxels of the toy volume
+constexpr int NumberOfVoxels = 7;
+
+/// 2x3 slice whose pixel (i, j) projects onto voxels i * 3 + j and i * 3 + j + 1 (pixel (1, 1) has no coefficients)
+static SliceCoeffs ToySlice() {
+    SliceCoeffs coeffs;
+    coeffs.Initialize(2, 3);
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++) {
+            if (i != 1 || j != 1) {
+                coeffs.Add(i * 3 + j, 0.1 * (i + 1));
+                coeffs.Add(i * 3 + j + 1, 0.3 + 0.01 * j);
+            }
+            coeffs.EndRow();
+        }
+    return coeffs;
+}
+
+/// Dense system matrix of the toy slice, a row of NumberOfVoxels weights per pixel
+static Array<Array<double>> ToyMatrix() {
+    Array<Array<double>> matrix(6, Array<double>(NumberOfVoxels, 0));
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++)
+            if (i != 1 || j != 1) {
+                matrix[i * 3 + j][i * 3 + j] += 0.1 * (i + 1);
+                matrix[i * 3 + j][i * 3 + j + 1] += 0.3 + 0.01 * j;
+            }
+    return matrix;
+}
+
+/// Every pixel but (0, 2) is simulated
+static bool Sample(int i, int j) {
+    return i != 0 || j != 2;
+}
+
+/// Error and weight of every pixel but (0, 0)
+static bool Residual(int i, int j, double& error, double& weight) {
+    if (i == 0 && j == 0)
+        return false;
+    error = i - j + 0.5;
+    weight = 1 + i;
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(SimulateScalarSlice) {
+    const SliceCoeffs coeffs = ToySlice();
+    const Array<Array<double>> matrix = ToyMatrix();
+    Array<RealPixel> volume(NumberOfVoxels);
+    for (int v = 0; v < NumberOfVoxels; v++)
+        volume[v] = 10 + v * v;
+
+    RealImage sim_slice(2, 3, 1), sim_weight(2, 3, 1), sim_inside(2, 3, 1);
+    sim_slice = 0;
+    sim_weight = 0;
+    sim_inside = 0;
+    //only the last two voxels are inside the mask
+    const bool slice_inside = SimulateSlice(coeffs, ScalarSignal(volume.data()), Sample, [](int index) { return index >= 5; },
+        sim_slice, sim_weight, sim_inside);
+    BOOST_CHECK(slice_inside);
+
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++) {
+            double signal = 0, weight = 0;
+            for (int v = 0; v < NumberOfVoxels; v++) {
+                signal += matrix[i * 3 + j][v] * volume[v];
+                weight += matrix[i * 3 + j][v];
+            }
+            //pixels that are not sampled or have no coefficients stay cleared
+            if (!Sample(i, j) || weight == 0) {
+                BOOST_CHECK_EQUAL(sim_slice(i, j, 0), 0);
+                BOOST_CHECK_EQUAL(sim_weight(i, j, 0), 0);
+                BOOST_CHECK_EQUAL(sim_inside(i, j, 0), 0);
+                continue;
+            }
+            BOOST_CHECK_CLOSE(sim_slice(i, j, 0), signal / weight, 1e-4);
+            BOOST_CHECK_CLOSE(sim_weight(i, j, 0), weight, 1e-4);
+            BOOST_CHECK_EQUAL(sim_inside(i, j, 0), i * 3 + j + 1 >= 5 ? 1 : 0);
+        }
+
+    //no pixel is inside an empty mask
+    BOOST_CHECK(!SimulateSlice(coeffs, ScalarSignal(volume.data()), Sample, [](int) { return false; }, sim_slice, sim_weight, sim_inside));
+}
+
+BOOST_AUTO_TEST_CASE(SimulateTemporalSlice) {
+    const SliceCoeffs coeffs = ToySlice();
+    const Array<Array<double>> matrix = ToyMatrix();
+    //two volumes, the slice is acquired with weight 0.25 and 0.75 (the temporal weights of slice 1)
+    Array<RealPixel> volume(2 * NumberOfVoxels);
+    for (int v = 0; v < 2 * NumberOfVoxels; v++)
+        volume[v] = 3 * v - 4;
+    const Array<Array<double>> temporal_weight = {{1, 0.25}, {0, 0.75}};
+
+    RealImage sim_slice(2, 3, 1), sim_weight(2, 3, 1), sim_inside(2, 3, 1);
+    sim_slice = 0;
+    sim_weight = 0;
+    sim_inside = 0;
+    SimulateSlice(coeffs, TemporalSignal(volume.data(), NumberOfVoxels, temporal_weight, 1), Sample, [](int) { return true; },
+        sim_slice, sim_weight, sim_inside);
+
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++) {
+            if (!Sample(i, j) || (i == 1 && j == 1))
+                continue;
+            double signal = 0, weight = 0;
+            for (int t = 0; t < 2; t++)
+                for (int v = 0; v < NumberOfVoxels; v++) {
+                    signal += temporal_weight[t][1] * matrix[i * 3 + j][v] * volume[t * NumberOfVoxels + v];
+                    weight += temporal_weight[t][1] * matrix[i * 3 + j][v];
+                }
+            BOOST_CHECK_CLOSE(sim_slice(i, j, 0), signal / weight, 1e-4);
+            BOOST_CHECK_CLOSE(sim_weight(i, j, 0), weight, 1e-4);
+            BOOST_CHECK_EQUAL(sim_inside(i, j, 0), 1);
+        }
+}
+
+BOOST_AUTO_TEST_CASE(BackProjectScalarSlice) {
+    const SliceCoeffs coeffs = ToySlice();
+    const Array<Array<double>> matrix = ToyMatrix();
+
+    Array<RealPixel> addon(NumberOfVoxels, 0), confidence(NumberOfVoxels, 0);
+    BackProjectSlice(coeffs, ScalarSignal(nullptr), Residual, addon.data(), confidence.data());
+
+    //the additional channel gets the same weighted errors and leaves the confidence alone
+    Array<RealPixel> channel_addon(NumberOfVoxels, 0), channel_confidence(NumberOfVoxels, 0);
+    BackProjectSlice(coeffs, ChannelSignal(nullptr), Residual, channel_addon.data(), channel_confidence.data());
+
+    //the transposed dense matrix applied to the weighted errors
+    for (int v = 0; v < NumberOfVoxels; v++) {
+        double expected_addon = 0, expected_confidence = 0;
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 3; j++) {
+                double error, weight;
+                if (Residual(i, j, error, weight)) {
+                    expected_addon += weight * matrix[i * 3 + j][v] * error;
+                    expected_confidence += weight * matrix[i * 3 + j][v];
+                }
+            }
+        BOOST_CHECK_SMALL(addon[v] - expected_addon, 1e-5);
+        BOOST_CHECK_SMALL(confidence[v] - expected_confidence, 1e-5);
+        BOOST_CHECK_SMALL(channel_addon[v] - expected_addon, 1e-5);
+        BOOST_CHECK_EQUAL(channel_confidence[v], 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(BackProjectGatedSlice) {
+    const SliceCoeffs coeffs = ToySlice();
+
+    //the first coefficient of every pixel and voxel 3 are excluded, the rows hold two coefficients or none
+    Array<RealPixel> addon(NumberOfVoxels, 0), confidence(NumberOfVoxels, 0);
+    auto include = [](int k, int index) { return index != 3 && k % 2 == 1; };
+    BackProjectSlice(coeffs, ScalarSignal(nullptr), Residual, include, addon.data(), confidence.data());
+
+    Array<double> expected_addon(NumberOfVoxels, 0), expected_confidence(NumberOfVoxels, 0);
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++) {
+            double error, weight;
+            if (!Residual(i, j, error, weight) || coeffs.Size(i, j) == 0)
+                continue;
+            //the second coefficient of the pixel
+            const int index = i * 3 + j + 1;
+            if (index == 3)
+                continue;
+            expected_addon[index] += weight * (0.3 + 0.01 * j) * error;
+            expected_confidence[index] += weight * (0.3 + 0.01 * j);
+        }
+    for (int v = 0; v < NumberOfVoxels; v++) {
+        BOOST_CHECK_SMALL(addon[v] - expected_addon[v], 1e-5);
+        BOOST_CHECK_SMALL(confidence[v] - expected_confidence[v], 1e-5);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(SphericalHarmonicSlice) {
+    const SliceCoeffs coeffs = ToySlice();
+    const Array<Array<double>> matrix = ToyMatrix();
+    //three coefficients per voxel in rows of four values
+    constexpr int ncoeffs = 3, stride = 4;
+    const float basis[ncoeffs] = {0.5f, -0.25f, 2};
+    Array<RealPixel> sh(NumberOfVoxels * stride, -100);
+    for (int v = 0; v < NumberOfVoxels; v++)
+        for (int l = 0; l < ncoeffs; l++)
+            sh[v * stride + l] = v + 2 * l;
+    const SphericalHarmonicSignal model(sh.data(), stride, basis, ncoeffs);
+
+    //the signal of a voxel is the product of its coefficients with the basis
+    RealImage sim_slice(2, 3, 1), sim_weight(2, 3, 1), sim_inside(2, 3, 1);
+    sim_slice = 0;
+    sim_weight = 0;
+    sim_inside = 0;
+    SimulateSlice(coeffs, model, Sample, [](int) { return true; }, sim_slice, sim_weight, sim_inside);
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++) {
+            if (!Sample(i, j) || (i == 1 && j == 1))
+                continue;
+            double signal = 0, weight = 0;
+            for (int v = 0; v < NumberOfVoxels; v++) {
+                double s = 0;
+                for (int l = 0; l < ncoeffs; l++)
+                    s += sh[v * stride + l] * basis[l];
+                signal += matrix[i * 3 + j][v] * s;
+                weight += matrix[i * 3 + j][v];
+            }
+            BOOST_CHECK_CLOSE(sim_slice(i, j, 0), signal / weight, 1e-4);
+        }
+
+    //the weighted errors are distributed along the basis, the padding of the rows is untouched
+    Array<RealPixel> addon(NumberOfVoxels * stride, 0), confidence(NumberOfVoxels, 0);
+    BackProjectSlice(coeffs, model, Residual, addon.data(), confidence.data());
+    for (int v = 0; v < NumberOfVoxels; v++) {
+        double expected = 0, expected_confidence = 0;
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 3; j++) {
+                double error, weight;
+                if (Residual(i, j, error, weight)) {
+                    expected += weight * matrix[i * 3 + j][v] * error;
+                    expected_confidence += weight * matrix[i * 3 + j][v];
+                }
+            }
+        for (int l = 0; l < ncoeffs; l++)
+            BOOST_CHECK_SMALL(addon[v * stride + l] - expected * basis[l], 1e-5);
+        BOOST_CHECK_EQUAL(addon[v * stride + ncoeffs], 0);
+        BOOST_CHECK_SMALL(confidence[v] - expected_confidence, 1e-5);
+    }
+}
+
+/// Number of voxels along x, y and z of the volume of the slice groups, two blocks along x
+constexpr int GroupX = 8, GroupY = 4, GroupZ = 4;
+
+/// Slices of a single row covering a 3x2 patch of voxels each, with a different offset along x
+static Array<SliceCoeffs> ToySlices(int n) {
+    Array<SliceCoeffs> slices(n);
+    for (int s = 0; s < n; s++) {
+        SliceCoeffs& coeffs = slices[s];
+        coeffs.Initialize(1, 2);
+        const int x = s % (GroupX - 2), z = s % GroupZ;
+        for (int j = 0; j < 2; j++) {
+            for (int i = 0; i < 3; i++)
+                coeffs.Add((z * GroupY + j) * GroupX + x + i, 0.1 + 0.01 * s + 0.1 * i);
+            coeffs.EndRow();
+        }
+    }
+    return slices;
+}
+
+/// Back-projects the toy slices with a scalar model
+struct ToyBackProjection {
+    const Array<SliceCoeffs>& slices;
+
+    void AddSlice(int inputIndex, RealPixel *addon, RealPixel *confidence) const {
+        auto residual = [&](int i, int j, double& error, double& weight) {
+            error = inputIndex - 2.0 * j;
+            weight = 1 + 0.5 * j;
+            return true;
+        };
+        BackProjectSlice(slices[inputIndex], ScalarSignal(nullptr), residual, addon, confidence);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(SliceGroupsAreDisjoint) {
+    const Array<SliceCoeffs> slices = ToySlices(20);
+    const Array<Array<int>> groups = DisjointSliceGroups(slices, GroupX, GroupY, GroupZ);
+
+    //every slice is in exactly one group, however few slices the groups hold
+    Array<int> count(slices.size(), 0);
+    for (const Array<int>& group : groups)
+        for (int s : group)
+            count[s]++;
+    for (size_t s = 0; s < slices.size(); s++)
+        BOOST_CHECK_EQUAL(count[s], 1);
+    BOOST_CHECK_GT(groups.size(), 1);
+
+    //no voxel is touched by two slices of a group
+    for (const Array<int>& group : groups) {
+        Array<int> owner(GroupX * GroupY * GroupZ, -1);
+        for (int s : group)
+            for (size_t k = 0; k < slices[s].NumberOfCoefficients(); k++) {
+                const int index = slices[s].Index(k);
+                BOOST_CHECK(owner[index] == -1 || owner[index] == s);
+                owner[index] = s;
+            }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(GroupedBackProjectionMatchesReduction) {
+    const Array<SliceCoeffs> slices = ToySlices(50);
+    const Array<Array<int>> groups = DisjointSliceGroups(slices, GroupX, GroupY, GroupZ);
+    const ToyBackProjection body{slices};
+    constexpr int nvox = GroupX * GroupY * GroupZ;
+
+    BackProjectSlices<ToyBackProjection> grouped(body, nvox, nvox);
+    grouped(slices.size(), groups);
+    BackProjectSlices<ToyBackProjection> reduced(body, nvox, nvox);
+    reduced(slices.size(), {});
+
+    //both match the sequential back-projection
+    Array<RealPixel> addon(nvox, 0), confidence(nvox, 0);
+    for (size_t s = 0; s < slices.size(); s++)
+        body.AddSlice(s, addon.data(), confidence.data());
+    for (int v = 0; v < nvox; v++) {
+        BOOST_CHECK_SMALL(grouped.addon[v] - addon[v], 1e-3f);
+        BOOST_CHECK_SMALL(grouped.confidence[v] - confidence[v], 1e-4f);
+        BOOST_CHECK_SMALL(reduced.addon[v] - addon[v], 1e-3f);
+        BOOST_CHECK_SMALL(reduced.confidence[v] - confidence[v], 1e-4f);
+    }
+}
@@ -0,0 +1,154 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testSliceRegistration
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/SliceRegistration.h"
+
+// MIRTK
+#include "mirtk/GenericRegistrationFilter.h"
+
+// C++ Standard
+#include <cmath>
+
+using namespace mirtk;
+using namespace svrtk;
+
+/// Smooth asymmetric phantom of three Gaussian blobs on a constant background, in world coordinates (mm)
+static double Phantom(double x, double y, double z) {
+    auto blob = [&](double cx, double cy, double cz, double sigma, double amplitude) {
+        const double d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy) + (z - cz) * (z - cz);
+        return amplitude * exp(-d2 / (2 * sigma * sigma));
+    };
+    return 100 + blob(-4, 3, 1, 8, 800) + blob(7, -5, -2, 5, 500) + blob(2, 9, 3, 6, 300);
+}
+
+/// 48^3 volume of the phantom with 1 mm voxels, centred at the origin
+static GreyImage PhantomVolume() {
+    GreyImage volume(ImageAttributes(48, 48, 48, 1, 1, 1));
+    for (int k = 0; k < volume.GetZ(); k++)
+        for (int j = 0; j < volume.GetY(); j++)
+            for (int i = 0; i < volume.GetX(); i++) {
+                double x = i, y = j, z = k;
+                volume.ImageToWorld(x, y, z);
+                volume(i, j, k) = round(Phantom(x, y, z));
+            }
+    return volume;
+}
+
+/// 40x40 slice of the phantom acquired at the position given by the slice to volume transformation
+static GreyImage PhantomSlice(const RigidTransformation& transformation) {
+    ImageAttributes attr(40, 40, 1, 1, 1, 1);
+    attr._zorigin = 2;
+    GreyImage slice(attr);
+    for (int j = 0; j < slice.GetY(); j++)
+        for (int i = 0; i < slice.GetX(); i++) {
+            double x = i, y = j, z = 0;
+            slice.ImageToWorld(x, y, z);
+            transformation.Transform(x, y, z);
+            slice(i, j, 0) = round(Phantom(x, y, z));
+        }
+    return slice;
+}
+
+/// Known slice motion: a few mm and degrees along every axis
+static RigidTransformation SliceMotion() {
+    RigidTransformation transformation;
+    transformation.PutTranslationX(2);
+    transformation.PutTranslationY(-1.5);
+    transformation.PutTranslationZ(1);
+    transformation.PutRotationX(3);
+    transformation.PutRotationY(-2);
+    transformation.PutRotationZ(4);
+    return transformation;
+}
+
+/// Register the slice with the dedicated rigid registration
+static RigidTransformation RegisterFast(const GreyImage& slice, const GreyImage& volume, bool ncc) {
+    RegistrationPyramid pyramid;
+    pyramid.Initialize(volume, -numeric_limits<double>::infinity(), 3);
+    RigidSliceRegistration registration(pyramid, ncc ? RigidSliceRegistration::NCC : RigidSliceRegistration::NMI);
+    RigidTransformation transformation;
+    registration.Run(slice, -numeric_limits<double>::infinity(), transformation);
+    return transformation;
+}
+
+/// Register the slice with the generic MIRTK registration and the parameters of the SVR
+static RigidTransformation RegisterGeneric(const GreyImage& slice, const GreyImage& volume, bool ncc) {
+    ParameterList params;
+    Insert(params, "Transformation model", "Rigid");
+    if (ncc) {
+        Insert(params, "Image (dis-)similarity measure", "NCC");
+        Insert(params, "Local window size [sigma]", "0mm");
+    } else {
+        Insert(params, "Image (dis-)similarity measure", "NMI");
+    }
+
+    GenericRegistrationFilter registration;
+    registration.Parameter(params);
+    registration.Input(&slice, &volume);
+    Transformation *dofout;
+    registration.Output(&dofout);
+    const RigidTransformation dofin;
+    registration.InitialGuess(&dofin);
+    registration.GuessParameter();
+    registration.Run();
+
+    unique_ptr<RigidTransformation> transformation(dynamic_cast<RigidTransformation*>(dofout));
+    return *transformation;
+}
+
+/// Both engines recover the known motion and agree within tolerance (mm and degrees)
+static void CheckEngines(bool ncc) {
+    constexpr double translation_tolerance = 0.5, rotation_tolerance = 1;
+
+    const GreyImage volume = PhantomVolume();
+    const RigidTransformation motion = SliceMotion();
+    const GreyImage slice = PhantomSlice(motion);
+
+    const RigidTransformation fast = RegisterFast(slice, volume, ncc);
+    const RigidTransformation generic = RegisterGeneric(slice, volume, ncc);
+
+    const double tolerance[6] = {translation_tolerance, translation_tolerance, translation_tolerance,
+        rotation_tolerance, rotation_tolerance, rotation_tolerance};
+    const double expected[6] = {motion.GetTranslationX(), motion.GetTranslationY(), motion.GetTranslationZ(),
+        motion.GetRotationX(), motion.GetRotationY(), motion.GetRotationZ()};
+    const double fast_parameters[6] = {fast.GetTranslationX(), fast.GetTranslationY(), fast.GetTranslationZ(),
+        fast.GetRotationX(), fast.GetRotationY(), fast.GetRotationZ()};
+    const double generic_parameters[6] = {generic.GetTranslationX(), generic.GetTranslationY(), generic.GetTranslationZ(),
+        generic.GetRotationX(), generic.GetRotationY(), generic.GetRotationZ()};
+
+    for (int i = 0; i < 6; i++) {
+        BOOST_TEST_CONTEXT((ncc ? "NCC" : "NMI") << " parameter " << i) {
+            BOOST_CHECK_SMALL(fast_parameters[i] - expected[i], tolerance[i]);
+            BOOST_CHECK_SMALL(generic_parameters[i] - expected[i], tolerance[i]);
+            BOOST_CHECK_SMALL(fast_parameters[i] - generic_parameters[i], tolerance[i]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(EnginesAgreeNCC) {
+    CheckEngines(true);
+}
+
+BOOST_AUTO_TEST_CASE(EnginesAgreeNMI) {
+    CheckEngines(false);
+}
@@ -0,0 +1,130 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testSphericalHarmonics
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/SphericalHarmonics.h"
+
+// C++ Standard
+#include <cmath>
+
+using namespace svrtk;
+
+/// Number of voxels of the test blocks, more than one block of the batched transform and not a multiple of it
+constexpr size_t NumberOfVoxels = 2500;
+
+/// Directions spread over the sphere on a spiral
+static Matrix Directions(int n) {
+    Matrix dirs(n, 3);
+    for (int i = 0; i < n; i++) {
+        const double z = 1 - (2 * i + 1.0) / n;
+        const double r = sqrt(1 - z * z);
+        const double phi = i * M_PI * (3 - sqrt(5.0));
+        dirs(i, 0) = r * cos(phi);
+        dirs(i, 1) = r * sin(phi);
+        dirs(i, 2) = z;
+    }
+    return dirs;
+}
+
+/// Smooth values that differ between voxels and between rows, with a large offset to expose rounding
+static Array<RealPixel> TestValues(int rows) {
+    Array<RealPixel> values((size_t)rows * NumberOfVoxels);
+    for (int t = 0; t < rows; t++)
+        for (size_t v = 0; v < NumberOfVoxels; v++)
+            values[t * NumberOfVoxels + v] = 1000 + 200 * sin(0.37 * t + 0.011 * v) + 50 * cos(0.05 * t * v);
+    return values;
+}
+
+/// The batched transform of every voxel matches the matrix-vector product with the same matrix
+static void CheckTransform(const Matrix& matrix, const Array<RealPixel>& in, const Array<RealPixel>& out) {
+    for (size_t v = 0; v < NumberOfVoxels; v++) {
+        Vector x(matrix.Cols());
+        for (int i = 0; i < matrix.Cols(); i++)
+            x(i) = in[i * NumberOfVoxels + v];
+        const Vector y = matrix * x;
+        for (int o = 0; o < matrix.Rows(); o++)
+            BOOST_CHECK_SMALL(out[o * NumberOfVoxels + v] - y(o), 1e-5 * (1 + fabs(y(o))));
+    }
+}
+
+static void CheckBatchedTransforms(SphericalHarmonics& sh) {
+    const int ndirs = sh._SHT.Rows(), ncoeffs = sh._SHT.Cols();
+
+    const Array<RealPixel> signal = TestValues(ndirs);
+    Array<RealPixel> coeffs((size_t)ncoeffs * NumberOfVoxels);
+    sh.Signal2Coeff(signal.data(), coeffs.data(), NumberOfVoxels);
+    CheckTransform(sh._iSHT, signal, coeffs);
+
+    Array<RealPixel> fitted((size_t)ndirs * NumberOfVoxels);
+    sh.Coeff2Signal(coeffs.data(), fitted.data(), NumberOfVoxels);
+    CheckTransform(sh._SHT, coeffs, fitted);
+}
+
+BOOST_AUTO_TEST_CASE(BatchedTransformsMatchMatrixProducts) {
+    SphericalHarmonics sh;
+    sh.InitSHT(Directions(32), 4);
+    BOOST_REQUIRE_EQUAL(sh._SHT.Cols(), 15);
+    CheckBatchedTransforms(sh);
+}
+
+BOOST_AUTO_TEST_CASE(BatchedTransformsMatchMatrixProductsRegularised) {
+    SphericalHarmonics sh;
+    sh.InitSHTRegul(Directions(32), 0.01, 6);
+    BOOST_REQUIRE_EQUAL(sh._SHT.Cols(), 28);
+    CheckBatchedTransforms(sh);
+}
+
+BOOST_AUTO_TEST_CASE(ImageTransformsMatchVectorTransforms) {
+    SphericalHarmonics sh;
+    sh.InitSHT(Directions(20), 2);
+
+    //5x4x3 voxels, the first volume is not positive in every voxel
+    RealImage signal(5, 4, 3, 20);
+    for (int t = 0; t < signal.GetT(); t++)
+        for (int z = 0; z < signal.GetZ(); z++)
+            for (int y = 0; y < signal.GetY(); y++)
+                for (int x = 0; x < signal.GetX(); x++)
+                    signal(x, y, z, t) = (x + y + z) % 4 == 0 ? 0 : 100 + 10 * x - 5 * y + 3 * z + cos(double(t + x));
+
+    const RealImage coeffs = sh.Signal2Coeff(signal);
+    const RealImage fitted = sh.Coeff2Signal(coeffs);
+    BOOST_REQUIRE_EQUAL(coeffs.GetT(), 6);
+    BOOST_REQUIRE_EQUAL(fitted.GetT(), 20);
+
+    for (int z = 0; z < signal.GetZ(); z++)
+        for (int y = 0; y < signal.GetY(); y++)
+            for (int x = 0; x < signal.GetX(); x++) {
+                Vector s(signal.GetT());
+                for (int t = 0; t < signal.GetT(); t++)
+                    s(t) = signal(x, y, z, t);
+                const Vector c = sh.Signal2Coeff(s);
+                const Vector f = sh.Coeff2Signal(c);
+
+                //voxels without signal have no coefficients
+                const bool inside = signal(x, y, z, 0) > 0;
+                for (int t = 0; t < coeffs.GetT(); t++)
+                    BOOST_CHECK_SMALL(coeffs(x, y, z, t) - (inside ? c(t) : 0), 1e-4 * (1 + fabs(c(t))));
+                if (inside)
+                    for (int t = 0; t < fitted.GetT(); t++)
+                        BOOST_CHECK_SMALL(fitted(x, y, z, t) - f(t), 1e-4 * (1 + fabs(f(t))));
+            }
+}
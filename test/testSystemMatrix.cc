@@ -0,0 +1,117 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testSystemMatrix
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/SystemMatrix.h"
+
+using namespace svrtk;
+
+/// 2x3 slice whose pixel (i, j) projects onto voxels i * 3 + j and i * 3 + j + 1 (pixel (1, 1) has no coefficients)
+static SliceCoeffs ToySlice() {
+    SliceCoeffs coeffs;
+    coeffs.Initialize(2, 3);
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++) {
+            if (i != 1 || j != 1) {
+                coeffs.Add(i * 3 + j, 0.1 * (i + 1));
+                coeffs.Add(i * 3 + j + 1, 0.3 + 0.01 * j);
+            }
+            coeffs.EndRow();
+        }
+    return coeffs;
+}
+
+BOOST_AUTO_TEST_CASE(SliceCoeffsRows) {
+    SliceCoeffs coeffs;
+    BOOST_CHECK(coeffs.Empty());
+
+    coeffs = ToySlice();
+    BOOST_CHECK(!coeffs.Empty());
+    BOOST_CHECK_EQUAL(coeffs.GetX(), 2);
+    BOOST_CHECK_EQUAL(coeffs.GetY(), 3);
+    BOOST_CHECK_EQUAL(coeffs.NumberOfCoefficients(), 10u);
+
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++) {
+            if (i == 1 && j == 1) {
+                BOOST_CHECK_EQUAL(coeffs.Size(i, j), 0);
+                continue;
+            }
+            BOOST_REQUIRE_EQUAL(coeffs.Size(i, j), 2);
+            const int k = coeffs.Begin(i, j);
+            BOOST_CHECK_EQUAL(coeffs.Index(k), i * 3 + j);
+            BOOST_CHECK_EQUAL(coeffs.Index(k + 1), i * 3 + j + 1);
+            //the PSF weights are kept in double precision
+            BOOST_CHECK_EQUAL(coeffs.Value(k), 0.1 * (i + 1));
+            BOOST_CHECK_EQUAL(coeffs.Value(k + 1), 0.3 + 0.01 * j);
+        }
+
+    BOOST_CHECK_EQUAL(coeffs.End(1, 2), (int)coeffs.NumberOfCoefficients());
+
+    coeffs.Clear();
+    BOOST_CHECK(coeffs.Empty());
+    BOOST_CHECK_EQUAL(coeffs.MemoryUsage(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(VolumeCoeffsTransposition) {
+    //two slices, the second one with a single coefficient per pixel
+    Array<SliceCoeffs> slicecoeffs(2, ToySlice());
+    slicecoeffs[1].Initialize(2, 3);
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++) {
+            slicecoeffs[1].Add(i * 3 + j, 0.5);
+            slicecoeffs[1].EndRow();
+        }
+
+    constexpr int nvox = 7;
+    VolumeCoeffs volcoeffs;
+    BOOST_CHECK(volcoeffs.Empty());
+    volcoeffs.Initialize(slicecoeffs, nvox);
+    BOOST_CHECK_EQUAL(volcoeffs.NumberOfCoefficients(), slicecoeffs[0].NumberOfCoefficients() + slicecoeffs[1].NumberOfCoefficients());
+
+    //every entry of the transposed matrix is a coefficient of the slice matrices and vice versa
+    size_t found = 0;
+    for (int v = 0; v < nvox; v++)
+        for (size_t n = volcoeffs.Begin(v); n < volcoeffs.End(v); n++) {
+            //entries of a voxel are in slice order
+            if (n > volcoeffs.Begin(v))
+                BOOST_CHECK_LE(volcoeffs.Slice(n - 1), volcoeffs.Slice(n));
+            const SliceCoeffs& coeffs = slicecoeffs[volcoeffs.Slice(n)];
+            const int i = volcoeffs.Pixel(n) % coeffs.GetX();
+            const int j = volcoeffs.Pixel(n) / coeffs.GetX();
+            bool match = false;
+            for (int k = coeffs.Begin(i, j); k < coeffs.End(i, j); k++)
+                match |= coeffs.Index(k) == v && coeffs.Value(k) == volcoeffs.Value(n);
+            BOOST_CHECK(match);
+            found++;
+        }
+    BOOST_CHECK_EQUAL(found, volcoeffs.NumberOfCoefficients());
+
+    //the optional flags drop coefficients
+    Array<Array<bool>> include(2);
+    include[0].assign(slicecoeffs[0].NumberOfCoefficients(), false);
+    include[1].assign(slicecoeffs[1].NumberOfCoefficients(), true);
+    volcoeffs.Initialize(slicecoeffs, nvox, &include);
+    BOOST_CHECK_EQUAL(volcoeffs.NumberOfCoefficients(), slicecoeffs[1].NumberOfCoefficients());
+    for (size_t n = 0; n < volcoeffs.NumberOfCoefficients(); n++)
+        BOOST_CHECK_EQUAL(volcoeffs.Slice(n), 1);
+}
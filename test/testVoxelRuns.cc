@@ -0,0 +1,70 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testVoxelRuns
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/VoxelRuns.h"
+
+using namespace svrtk;
+
+BOOST_AUTO_TEST_CASE(RunsCoverPositiveVoxels) {
+    //7x3x2 volume with runs at the row ends, in the middle, a full row, empty rows and negative values
+    RealImage image(7, 3, 2);
+    image = 0;
+    image(0, 0, 0) = 1;
+    image(1, 0, 0) = 2;
+    image(4, 0, 0) = 0.5;
+    image(6, 0, 0) = 3;
+    for (int x = 0; x < 7; x++)
+        image(x, 2, 0) = 1;
+    image(2, 1, 1) = -1;
+    image(3, 1, 1) = 1;
+
+    VoxelRuns runs;
+    BOOST_CHECK(runs.Empty());
+    runs.Initialize(image);
+    BOOST_CHECK(!runs.Empty());
+    BOOST_CHECK_EQUAL(runs.GetX(), 7);
+    BOOST_CHECK_EQUAL(runs.GetY(), 3);
+    BOOST_CHECK_EQUAL(runs.GetZ(), 2);
+    BOOST_CHECK_EQUAL(runs.NumberOfRuns(), 5u);
+    BOOST_CHECK_EQUAL(runs.NumberOfVoxels(), 12u);
+
+    //every voxel is in a run if and only if it is positive
+    for (int z = 0; z < 2; z++)
+        for (int y = 0; y < 3; y++) {
+            Array<bool> covered(7, false);
+            for (int k = runs.Begin(y, z); k < runs.End(y, z); k++) {
+                BOOST_CHECK_LT(runs.RunBegin(k), runs.RunEnd(k));
+                //runs are sorted and separated by inactive voxels
+                if (k > runs.Begin(y, z))
+                    BOOST_CHECK_LT(runs.RunEnd(k - 1), runs.RunBegin(k));
+                for (int x = runs.RunBegin(k); x < runs.RunEnd(k); x++)
+                    covered[x] = true;
+            }
+            for (int x = 0; x < 7; x++)
+                BOOST_CHECK_EQUAL(covered[x], image(x, y, z) > 0);
+        }
+
+    runs.Clear();
+    BOOST_CHECK(runs.Empty());
+    BOOST_CHECK_EQUAL(runs.NumberOfVoxels(), 0u);
+}
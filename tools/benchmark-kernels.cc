@@ -0,0 +1,475 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SVRTK
+#include "svrtk/Reconstruction.h"
+
+// C++ Standard
+#include <fstream>
+#include <iomanip>
+#include <random>
+
+// TBB
+#include <tbb/task_arena.h>
+
+using namespace std;
+using namespace mirtk;
+using namespace svrtk;
+using namespace svrtk::Utility;
+using namespace boost::program_options;
+
+// =============================================================================
+//
+// =============================================================================
+
+// -----------------------------------------------------------------------------
+
+void PrintUsage(const options_description& opts) {
+    cout << "SVRTK package: https://github.com/SVRTK/SVRTK" << endl;
+    cout << endl;
+    cout << "Usage: benchmark-kernels <options>\n" << endl;
+    cout << "  Times the main kernels of the SVR reconstruction on stacks simulated from a synthetic" << endl;
+    cout << "  phantom with random rigid slice motion, for several thread counts, and reports their" << endl;
+    cout << "  throughput, a checksum of their output and the accuracy of the registration and SR." << endl << endl;
+    cout << opts << endl;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Reconstruction with access to the buffers that the kernels write
+class BenchmarkReconstruction : public Reconstruction {
+public:
+    /// Position weighted sum of the voxels, so that misplaced values change it too
+    static double Checksum(const RealImage& image) {
+        const RealPixel *ptr = image.Data();
+        double sum = 0;
+        for (int i = 0; i < image.NumberOfVoxels(); i++)
+            sum += ptr[i] * (1 + i % 7);
+        return sum;
+    }
+
+    static double Checksum(const Array<RealImage>& images) {
+        double sum = 0;
+        for (size_t i = 0; i < images.size(); i++)
+            sum += Checksum(images[i]) * (1 + i % 5);
+        return sum;
+    }
+
+    inline size_t NumberOfSlices() const { return _slices.size(); }
+    inline double VolumeChecksum() const { return Checksum(_reconstructed); }
+    inline double VolumeWeightsChecksum() const { return Checksum(_volume_weights); }
+    inline double SimulatedSlicesChecksum() const { return Checksum(_simulated_slices); }
+
+    inline double WeightsChecksum() const {
+        double sum = Checksum(_weights);
+        for (size_t i = 0; i < _slice_weight.size(); i++)
+            sum += _slice_weight[i] * (1 + i % 5);
+        return sum;
+    }
+
+    inline double TransformationsChecksum() const {
+        double sum = 0;
+        for (size_t i = 0; i < _transformations.size(); i++)
+            for (int j = 0; j < _transformations[i].NumberOfDOFs(); j++)
+                sum += _transformations[i].Get(j) * (1 + j);
+        return sum;
+    }
+
+    /// Mean displacement of the slice corners between the current and the true transformations [mm]
+    double RegistrationError(const Array<RigidTransformation>& truth) const {
+        double error = 0;
+        for (size_t i = 0; i < _slices.size(); i++)
+            error += SliceDisplacement(i, truth[i]);
+        return _slices.empty() ? 0 : error / _slices.size();
+    }
+
+    /// Root mean square error of the reconstruction inside the mask, relative to the mean of the phantom
+    double NRMSE(const RealImage& phantom) const {
+        const RealPixel *pm = _mask.Data(), *pr = _reconstructed.Data(), *pp = phantom.Data();
+        double error = 0, sum = 0, num = 0;
+        for (int i = 0; i < phantom.NumberOfVoxels(); i++)
+            if (pm[i] > 0) {
+                const double difference = pr[i] - pp[i];
+                error += difference * difference;
+                sum += pp[i];
+                num++;
+            }
+        return num > 0 && sum > 0 ? sqrt(error / num) / (sum / num) : 0;
+    }
+};
+
+// -----------------------------------------------------------------------------
+
+/// Ellipsoid of the phantom in coordinates normalised to [-1, 1], rotated by phi degrees about z
+struct Ellipsoid {
+    double x, y, z, a, b, c, phi, value;
+};
+
+/// Head phantom similar to the 3D Shepp-Logan phantom with tissue contrasts kept positive inside the head
+const Array<Ellipsoid> PhantomEllipsoids {
+    {     0,       0,     0, 0.69,  0.92,  0.90,   0,  1.0},
+    {     0, -0.0184,     0, 0.6624, 0.874, 0.88,  0, -0.6},
+    {  0.22,       0,     0, 0.11,  0.31,  0.22, -18, -0.2},
+    { -0.22,       0,     0, 0.16,  0.41,  0.28,  18, -0.2},
+    {     0,    0.35, -0.15, 0.21,  0.25,  0.41,   0,  0.1},
+    {     0,     0.1,  0.25, 0.046, 0.046, 0.05,   0,  0.1},
+    {     0,    -0.1,  0.25, 0.046, 0.046, 0.05,   0,  0.1},
+    { -0.08,  -0.605,     0, 0.046, 0.023, 0.05,   0,  0.1},
+    {     0,  -0.605,     0, 0.023, 0.023, 0.02,   0,  0.1},
+    {  0.06,  -0.605,     0, 0.023, 0.046, 0.02,   0,  0.1}
+};
+
+/// Create the phantom volume of size^3 isotropic voxels centred at the origin
+RealImage CreatePhantom(int size, double resolution) {
+    ImageAttributes attr;
+    attr._x = attr._y = attr._z = size;
+    attr._dx = attr._dy = attr._dz = resolution;
+    RealImage phantom(attr);
+
+    const double half = 0.5 * size * resolution;
+    for (int k = 0; k < phantom.GetZ(); k++)
+        for (int j = 0; j < phantom.GetY(); j++)
+            for (int i = 0; i < phantom.GetX(); i++) {
+                double x = i, y = j, z = k;
+                phantom.ImageToWorld(x, y, z);
+                x /= half; y /= half; z /= half;
+
+                double value = 0;
+                for (const Ellipsoid& e : PhantomEllipsoids) {
+                    const double phi = e.phi * M_PI / 180;
+                    const double dx = x - e.x, dy = y - e.y, dz = z - e.z;
+                    const double u = (dx * cos(phi) + dy * sin(phi)) / e.a;
+                    const double v = (-dx * sin(phi) + dy * cos(phi)) / e.b;
+                    const double w = dz / e.c;
+                    if (u * u + v * v + w * w <= 1)
+                        value += e.value;
+                }
+                phantom(i, j, k) = 1000 * value;
+            }
+
+    return phantom;
+}
+
+/// Create empty stacks covering the phantom, cycling through axial, coronal and sagittal
+/// orientations and interleaving the slices of stacks with the same orientation
+Array<RealImage> CreateStacks(const RealImage& phantom, int number_of_stacks, double thickness) {
+    const double axes[3][3][3] = {
+        {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}},
+        {{1, 0, 0}, {0, 0, 1}, {0, -1, 0}},
+        {{0, 1, 0}, {0, 0, 1}, {1, 0, 0}}
+    };
+    const double fov = phantom.GetX() * phantom.GetXSize();
+    const int repeats = (number_of_stacks + 2) / 3;
+
+    Array<RealImage> stacks;
+    for (int s = 0; s < number_of_stacks; s++) {
+        const int o = s % 3;
+        ImageAttributes attr;
+        attr._x = phantom.GetX();
+        attr._y = phantom.GetY();
+        attr._z = max(1, (int)round(fov / thickness));
+        attr._dx = phantom.GetXSize();
+        attr._dy = phantom.GetYSize();
+        attr._dz = thickness;
+        for (int d = 0; d < 3; d++) {
+            attr._xaxis[d] = axes[o][0][d];
+            attr._yaxis[d] = axes[o][1][d];
+            attr._zaxis[d] = axes[o][2][d];
+        }
+        const double offset = thickness * (s / 3) / repeats;
+        attr._xorigin = offset * attr._zaxis[0];
+        attr._yorigin = offset * attr._zaxis[1];
+        attr._zorigin = offset * attr._zaxis[2];
+        stacks.push_back(RealImage(attr));
+    }
+
+    return stacks;
+}
+
+/// Random rigid slice motion with normally distributed rotations [degrees] and translations [mm]
+Array<RigidTransformation> CreateMotion(size_t number_of_slices, double rotation, double translation, mt19937& generator) {
+    normal_distribution<double> r(0, rotation), t(0, translation);
+    Array<RigidTransformation> motion(number_of_slices);
+    for (size_t i = 0; i < number_of_slices; i++) {
+        motion[i].PutRotationX(r(generator));
+        motion[i].PutRotationY(r(generator));
+        motion[i].PutRotationZ(r(generator));
+        motion[i].PutTranslationX(t(generator));
+        motion[i].PutTranslationY(t(generator));
+        motion[i].PutTranslationZ(t(generator));
+    }
+    return motion;
+}
+
+/// Simulate the acquisition of the stacks from the phantom under the given slice motion and add Gaussian noise
+void SimulateAcquisition(const RealImage& phantom, const RealImage& mask, Array<RealImage>& stacks, const Array<double>& thickness,
+    double rotation, double translation, double noise, mt19937& generator, Array<RigidTransformation>& motion) {
+    Reconstruction simulation;
+    simulation.CreateTemplate(phantom, phantom.GetXSize());
+    RealImage simulation_mask = mask;
+    simulation.SetMask(&simulation_mask, 0);
+    simulation.CreateSlicesAndTransformations(stacks, Array<RigidTransformation>(stacks.size()), thickness, {});
+
+    int number_of_slices = 0;
+    for (size_t i = 0; i < stacks.size(); i++)
+        number_of_slices += stacks[i].GetZ();
+    motion = CreateMotion(number_of_slices, rotation, translation, generator);
+    simulation.SetTransformations(motion);
+
+    simulation.InitializeEM();
+    simulation.CoeffInit();
+    simulation.SetReconstructed(phantom);
+    simulation.SimulateStacks(stacks);
+
+    RealPixel pmin, pmax;
+    phantom.GetMinMax(&pmin, &pmax);
+    normal_distribution<double> n(0, noise * pmax);
+    for (size_t s = 0; s < stacks.size(); s++) {
+        RealPixel *ptr = stacks[s].Data();
+        for (int i = 0; i < stacks[s].NumberOfVoxels(); i++)
+            if (ptr[i] > 0)
+                ptr[i] = max(0.0, ptr[i] + n(generator));
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+/// Fastest run and output checksum of a kernel
+struct KernelResult {
+    string name;
+    bool per_slice;
+    double seconds = numeric_limits<double>::max();
+    double checksum = 0;
+};
+
+/// Accuracy of one run of the kernels
+struct Accuracy {
+    double initial_error = 0;
+    double registration_error = 0;
+    double nrmse = 0;
+};
+
+/// Prepare a reconstruction of the stacks up to the first E-step, as in the first iteration of reconstruct
+void Setup(BenchmarkReconstruction& reconstruction, const RealImage& phantom, const RealImage& mask,
+    const Array<RealImage>& stacks, const Array<double>& thickness) {
+    reconstruction.CreateTemplate(RealImage(phantom.Attributes()), phantom.GetXSize());
+    RealImage reconstruction_mask = mask;
+    reconstruction.SetMask(&reconstruction_mask, 0);
+    reconstruction.SetSigma(20);
+    reconstruction.SetSmoothingParameters(150, 0.02);
+    reconstruction.CreateSlicesAndTransformations(stacks, Array<RigidTransformation>(stacks.size()), thickness, {});
+    reconstruction.MaskSlices();
+    reconstruction.InitializeEM();
+    reconstruction.InitializeEMValues();
+    reconstruction.CoeffInit();
+    reconstruction.GaussianReconstruction();
+    reconstruction.SimulateSlices();
+    reconstruction.InitializeRobustStatistics();
+    reconstruction.EStep();
+}
+
+/// Run the kernels once in the order of a reconstruction iteration, keeping the fastest run of each
+void RunKernels(BenchmarkReconstruction& reconstruction, const RealImage& phantom, const Array<RigidTransformation>& motion,
+    Array<KernelResult>& results, Accuracy& accuracy) {
+    size_t k = 0;
+    auto measure = [&](const char *name, bool per_slice, auto kernel, auto checksum) {
+        if (k == results.size())
+            results.push_back({name, per_slice});
+        const double start = Profiler::WallTime();
+        kernel();
+        results[k].seconds = min(results[k].seconds, Profiler::WallTime() - start);
+        results[k].checksum = checksum();
+        k++;
+    };
+
+    BenchmarkReconstruction& r = reconstruction;
+    accuracy.initial_error = r.RegistrationError(motion);
+    measure("SliceToVolumeRegistration", true, [&] { r.SliceToVolumeRegistration(); }, [&] { return r.TransformationsChecksum(); });
+    accuracy.registration_error = r.RegistrationError(motion);
+
+    r.InitializeEMValues();
+    measure("CoeffInit", true, [&] { r.CoeffInit(); }, [&] { return r.VolumeWeightsChecksum(); });
+    r.GaussianReconstruction();
+    measure("SimulateSlices", true, [&] { r.SimulateSlices(); }, [&] { return r.SimulatedSlicesChecksum(); });
+    r.InitializeRobustStatistics();
+    measure("EStep", true, [&] { r.EStep(); }, [&] { return r.WeightsChecksum(); });
+
+    RealImage original = r.GetReconstructed();
+    measure("Superresolution", true, [&] { r.Superresolution(1); }, [&] { return r.VolumeChecksum(); });
+    measure("AdaptiveRegularization", false, [&] { r.AdaptiveRegularization(1, original); }, [&] { return r.VolumeChecksum(); });
+    measure("NormaliseBias", false, [&] { r.NormaliseBias(1); }, [&] { return r.VolumeChecksum(); });
+    accuracy.nrmse = r.NRMSE(phantom);
+}
+
+// -----------------------------------------------------------------------------
+
+// =============================================================================
+// Main function
+// =============================================================================
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+    InitializeIOLibrary();
+
+    int size = 96;
+    double resolution = 1;
+    int numberOfStacks = 3;
+    double sliceThickness = 3;
+    double rotation = 3;
+    double translation = 2;
+    double noise = 0.02;
+    unsigned int seed = 1;
+    int repeats = 3;
+    vector<int> threads;
+    string outputName;
+    string phantomPrefix;
+
+    options_description opts("Allowed options");
+    opts.add_options()
+        ("size", value<int>(&size), "Number of voxels of the phantom in each dimension [Default: 96]")
+        ("resolution", value<double>(&resolution), "Isotropic voxel size of the phantom and the reconstruction [mm] [Default: 1]")
+        ("stacks", value<int>(&numberOfStacks), "Number of simulated stacks, in axial, coronal and sagittal order [Default: 3]")
+        ("thickness", value<double>(&sliceThickness), "Slice thickness of the simulated stacks [mm] [Default: 3]")
+        ("rotation", value<double>(&rotation), "Standard deviation of the random slice rotations [degrees] [Default: 3]")
+        ("translation", value<double>(&translation), "Standard deviation of the random slice translations [mm] [Default: 2]")
+        ("noise", value<double>(&noise), "Standard deviation of the Gaussian noise relative to the phantom maximum [Default: 0.02]")
+        ("seed", value<unsigned int>(&seed), "Seed of the random motion and noise [Default: 1]")
+        ("threads", value<vector<int>>(&threads)->multitoken(), "Thread counts to benchmark [Default: powers of two up to the number of cores]")
+        ("repeats", value<int>(&repeats), "Number of runs per thread count, the fastest run is reported [Default: 3]")
+        ("output", value<string>(&outputName), "Write the results to a CSV file")
+        ("phantom_prefix", value<string>(&phantomPrefix), "Write the phantom, its mask and the simulated stacks with the given prefix")
+        ("help", "Print this help");
+
+    variables_map vm;
+    try {
+        store(command_line_parser(argc, argv).options(opts)
+            // Allow single dash (-) for long arguments
+            .style(command_line_style::unix_style | command_line_style::allow_long_disguise).run(), vm);
+        notify(vm);
+
+        if (size < 8 || resolution <= 0 || numberOfStacks < 1 || sliceThickness <= 0 || repeats < 1)
+            throw error("Invalid phantom or benchmark settings!");
+    } catch (error& e) {
+        cerr << "Argument parsing error: " << e.what() << "\n\n";
+        PrintUsage(opts);
+        return 1;
+    }
+
+    if (vm.count("help")) {
+        PrintUsage(opts);
+        return 0;
+    }
+
+    if (threads.empty()) {
+        const int cores = max(1u, thread::hardware_concurrency());
+        for (int n = 1; n < cores; n *= 2)
+            threads.push_back(n);
+        threads.push_back(cores);
+    }
+
+    // -----------------------------------------------------------------------------
+    // SIMULATE THE INPUT STACKS
+    // -----------------------------------------------------------------------------
+
+    mt19937 generator(seed);
+    const RealImage phantom = CreatePhantom(size, resolution);
+    const RealImage mask = CreateMask(phantom);
+    Array<RealImage> stacks = CreateStacks(phantom, numberOfStacks, sliceThickness);
+    const Array<double> thickness(numberOfStacks, sliceThickness);
+    Array<RigidTransformation> motion;
+    SimulateAcquisition(phantom, mask, stacks, thickness, rotation, translation, noise, generator, motion);
+
+    if (!phantomPrefix.empty()) {
+        phantom.Write((phantomPrefix + "phantom.nii.gz").c_str());
+        mask.Write((phantomPrefix + "mask.nii.gz").c_str());
+        for (size_t i = 0; i < stacks.size(); i++)
+            stacks[i].Write((phantomPrefix + "stack-" + to_string(i) + ".nii.gz").c_str());
+    }
+
+    // -----------------------------------------------------------------------------
+    // RUN THE KERNELS
+    // -----------------------------------------------------------------------------
+
+    Array<Array<KernelResult>> results(threads.size());
+    Array<Accuracy> accuracy(threads.size());
+    size_t numberOfSlices = 0;
+
+    for (size_t t = 0; t < threads.size(); t++) {
+        tbb::task_arena arena(threads[t]);
+        omp_set_num_threads(threads[t]);
+        arena.execute([&] {
+            for (int run = 0; run < repeats; run++) {
+                BenchmarkReconstruction reconstruction;
+                Setup(reconstruction, phantom, mask, stacks, thickness);
+                RunKernels(reconstruction, phantom, motion, results[t], accuracy[t]);
+                numberOfSlices = reconstruction.NumberOfSlices();
+            }
+        });
+    }
+
+    // -----------------------------------------------------------------------------
+    // REPORT
+    // -----------------------------------------------------------------------------
+
+    const double voxels = phantom.NumberOfVoxels();
+    auto throughput = [&](const KernelResult& result) {
+        return (result.per_slice ? numberOfSlices : voxels / 1e6) / result.seconds;
+    };
+    auto unit = [](const KernelResult& result) {
+        return result.per_slice ? "slices/s" : "Mvoxels/s";
+    };
+
+    cout << "------------------------------------------------------" << endl;
+    cout << "Phantom : " << size << "^3 voxels of " << resolution << " mm, " << numberOfStacks << " stacks, "
+        << numberOfSlices << " slices of " << sliceThickness << " mm" << endl;
+    cout << "Motion : " << rotation << " degrees, " << translation << " mm, noise : " << noise << ", seed : " << seed << endl;
+    cout << "------------------------------------------------------" << endl;
+    cout << left << setw(28) << "kernel" << right << setw(8) << "threads" << setw(12) << "time [s]"
+        << setw(14) << "throughput" << setw(12) << "speedup" << setw(22) << "checksum" << endl;
+    for (size_t k = 0; k < results[0].size(); k++)
+        for (size_t t = 0; t < threads.size(); t++) {
+            const KernelResult& result = results[t][k];
+            cout << left << setw(28) << result.name << right << setw(8) << threads[t]
+                << setw(12) << setprecision(4) << fixed << result.seconds
+                << setw(14) << setprecision(1) << throughput(result) << " " << left << setw(10) << unit(result) << right
+                << setw(8) << setprecision(2) << results[0][k].seconds / result.seconds
+                << setw(22) << setprecision(10) << defaultfloat << result.checksum << endl;
+        }
+    cout << "------------------------------------------------------" << endl;
+    for (size_t t = 0; t < threads.size(); t++)
+        cout << "Threads " << threads[t] << " : registration error " << setprecision(4) << accuracy[t].initial_error
+            << " -> " << accuracy[t].registration_error << " mm, SR NRMSE " << accuracy[t].nrmse << endl;
+
+    if (!outputName.empty()) {
+        ofstream output(outputName);
+        if (!output)
+            throw runtime_error("Could not open " + outputName);
+        output << "kernel,threads,seconds,throughput,unit,checksum" << endl;
+        output << setprecision(10);
+        for (size_t t = 0; t < threads.size(); t++) {
+            for (const KernelResult& result : results[t])
+                output << result.name << "," << threads[t] << "," << result.seconds << "," << throughput(result) << ","
+                    << unit(result) << "," << result.checksum << endl;
+            output << "SVR error," << threads[t] << ",,,mm," << accuracy[t].registration_error << endl;
+            output << "SR NRMSE," << threads[t] << ",,,," << accuracy[t].nrmse << endl;
+        }
+    }
+
+    return 0;
+}
@@ -116,6 +116,13 @@ int main(int argc, char **argv) {
     int srIterations = 7;
     bool debug = false;
     bool profile = false;
+    // Output file of the hierarchical stage profile and whether it includes the per-slice tasks
+    string profileOutput;
+    bool profileSlices = false;
+    // Output file of the Chrome trace of the stages and slice tasks
+    string traceOutput;
+    // Output file of the memory usage report
+    string memoryReport;
     double sigma = 20;
     double resolution = 0.75;
     double lambda = 0.02;
@@ -170,10 +177,37 @@ int main(int argc, char **argv) {
 
     // Flag for running registration step outside
     bool remoteFlag = false;
+    // Number of persistent remote registration workers and their reply timeout (s)
+    int remoteWorkers = 0;
+    int remoteTimeout = 600;
 
     // Flag for no global registration
     bool noGlobalFlag = false;
 
+    // Flag for gather-based SR with the transposed system matrix
+    bool transposedSRFlag = false;
+
+    // Flag for the conjugate-gradient SR solver, its maximum number of iterations and tolerance
+    bool cgSRFlag = false;
+    int cgIterations = 10;
+    double cgTolerance = 0.01;
+
+    // Slice displacement (mm) below which CoeffInit keeps the previous coefficients
+    double coeffInitTolerance = 0;
+
+    // Flag for computing the system matrix on the fly instead of storing it
+    bool matrixFreeFlag = false;
+
+    // Flag for the dedicated rigid slice-to-volume registration
+    bool fastSVRFlag = false;
+
+    // Slice displacement (mm) below which a slice counts as converged in SVR
+    double svrConvergenceTolerance = 0;
+    // Number of iterations after which converged slices are registered again
+    int svrRecheckInterval = 3;
+    // Similarity improvement below which a slice counts as converged in SVR
+    double svrSimilarityTolerance = 1e-3;
+
     // Flag that sets slice thickness to 1.5 of spacing (for testing purposes)
     bool thinFlag = false;
     
@@ -257,9 +291,25 @@ int main(int argc, char **argv) {
         ("remove_black_background", bool_switch(&removeBlackBackground), "Create mask from black background")
         ("transformations", value<string>(&folder), "Use existing slice-to-volume transformations to initialize the reconstruction")
         ("force_exclude", value<vector<int>>(&forceExcluded)->multitoken(), "Force exclusion of slices with these indices")
-//        ("remote", bool_switch(&remoteFlag), "Run SVR registration as remote functions in case of memory issues [Default: false]")
+        ("remote", bool_switch(&remoteFlag), "Run SVR registration as remote functions in case of memory issues [Default: false]")
+        ("remote_workers", value<int>(&remoteWorkers), "Number of persistent register-worker processes for remote SVR (0 starts one process per slice) [Default: 0]")
+        ("remote_timeout", value<int>(&remoteTimeout), "Seconds after which a register-worker that hasn't finished a slice is restarted and the slice skipped (0 waits forever) [Default: 600]")
         ("no_registration", "Switch off registration")
+        ("incremental_coeffinit", value<double>(&coeffInitTolerance), "Recompute PSF coefficients only for slices that moved more than the given distance in mm between iterations [Default: off]")
+        ("matrix_free", bool_switch(&matrixFreeFlag), "Compute PSF coefficients on the fly instead of storing the system matrix (much lower memory, slower) [Default: false]")
+        ("transposed_sr", bool_switch(&transposedSRFlag), "Keep a transposed copy of the system matrix and run SR as a gather over volume voxels (lower transient memory on many cores) [Default: false]")
+        ("cg_sr", bool_switch(&cgSRFlag), "Solve the SR step with preconditioned conjugate gradients including the regularisation (single channel only) [Default: false]")
+        ("cg_iterations", value<int>(&cgIterations), "Maximum number of conjugate-gradient iterations per SR step [Default: 10]")
+        ("cg_tolerance", value<double>(&cgTolerance), "Relative residual at which the conjugate-gradient SR stops [Default: 0.01]")
+        ("skip_converged", value<double>(&svrConvergenceTolerance), "Skip the registration of slices that moved less than the given distance in mm in their last two registrations [Default: off]")
+        ("skip_recheck", value<int>(&svrRecheckInterval), "Register skipped converged slices again after this number of iterations [Default: 3]")
+        ("skip_similarity", value<double>(&svrSimilarityTolerance), "Similarity improvement of the last registration below which a slice can be skipped by skip_converged [Default: 0.001]")
+        ("fast_svr", bool_switch(&fastSVRFlag), "Use the dedicated rigid slice-to-volume registration instead of the generic MIRTK registration (not for FFD) [Default: false]")
 //        ("thin", bool_switch(&thinFlag), "Option for 1.5 x dz slice thickness (testing)")
+        ("profile_output", value<string>(&profileOutput), "Write the hierarchical stage profile (calls, wall and CPU time, thread utilisation) to a JSON file, or CSV if the name ends in .csv, at exit")
+        ("profile_slices", bool_switch(&profileSlices), "Include the timings of the individual slice tasks (registration, coefficients, SR) in the profile output [Default: false]")
+        ("trace_output", value<string>(&traceOutput), "Write a Chrome trace-event timeline of the stages and slice tasks of every thread to a JSON file at exit (chrome://tracing, Perfetto)")
+        ("memory_report", value<string>(&memoryReport), "Append the memory held by the large buffers (system matrix, slices, volumes, reduction buffers) and the process RSS after the main stages to a CSV file")
         ("debug", bool_switch(&debug), "Debug mode - save intermediate results");
 
 
@@ -550,6 +600,14 @@ int main(int argc, char **argv) {
     // -----------------------------------------------------------------------------
 
     reconstruction.SetStructural(structural);
+    reconstruction.SetTransposedSR(transposedSRFlag);
+    reconstruction.SetConjugateGradientSR(cgSRFlag, cgIterations, cgTolerance);
+    if (vm.count("incremental_coeffinit"))
+        reconstruction.SetIncrementalCoeffInit(true, coeffInitTolerance);
+    reconstruction.SetMatrixFree(matrixFreeFlag);
+    reconstruction.SetFastRigidSVR(fastSVRFlag);
+    if (vm.count("skip_converged"))
+        reconstruction.SetSkipConvergedSlices(true, svrConvergenceTolerance, svrRecheckInterval, svrSimilarityTolerance);
     
     // Set thickness to the exact dz value if specified
     if (flagNoOverlapThickness && thickness.size() < 1) {
@@ -738,6 +796,9 @@ int main(int argc, char **argv) {
     boost::filesystem::remove_all(strCurrentExchangeFilePath.c_str());
     boost::filesystem::create_directory(strCurrentExchangeFilePath.c_str());
 
+    if (remoteFlag)
+        reconstruction.SetRemoteWorkers(remoteWorkers, remoteTimeout);
+
     // Rescale stack if specified
     if (rescaleStacks) {
         for (size_t i = 0; i < stacks.size(); i++)
@@ -748,6 +809,14 @@ int main(int argc, char **argv) {
     if (dofinPaths.empty())
         stackTransformations = Array<RigidTransformation>(stacks.size());
 
+    // Record the stage profile and trace
+    if (!profileOutput.empty())
+        Profiler::Enable(profileOutput, profileSlices);
+    if (!traceOutput.empty())
+        Profiler::EnableTrace(traceOutput);
+    if (!memoryReport.empty())
+        reconstruction.SetMemoryReport(memoryReport);
+
     // Set debug mode option
     if (debug) reconstruction.DebugOn();
     else reconstruction.DebugOff();
@@ -1014,6 +1083,9 @@ int main(int argc, char **argv) {
     {
         // Interleaved registration-reconstruction iterations
         for (int iter = 0; iter < iterations; iter++) {
+            // Profile of the stages of this iteration
+            ProfileScope iterationProfile("iteration " + to_string(iter));
+
             cout << "------------------------------------------------------" << endl;
             cout << "Iteration : " << iter << endl;
             
@@ -1026,6 +1098,13 @@ int main(int argc, char **argv) {
             if (registrationFlag) {
             
                 if (svrOnly || iter > 0) {
+                    // register all slices when the smoothing level changes and in the final iteration
+                    if (iter == iterations - 1)
+                        reconstruction.ForceFullRegistration();
+                    for (int i = 0; i < levels; i++)
+                        if (iter == iterations * (levels - i - 1) / levels)
+                            reconstruction.ForceFullRegistration();
+
                     if (remoteFlag)
                         reconstruction.RemoteSliceToVolumeRegistration(iter, strMirtkPath, strCurrentExchangeFilePath);
                     else
@@ -1117,12 +1196,12 @@ int main(int argc, char **argv) {
                     reconstruction.NormaliseBias(i);
 
                 // Simulate slices (needs to be done after the update of the reconstructed volume)
-                reconstruction.SimulateSlices();
-
-                // Run robust statistics for rejection of outliers
+                // and run robust statistics for rejection of outliers, MStep is fused with the simulation
                 if (robustStatistics) {
-                    reconstruction.MStep(i + 1);
+                    reconstruction.SimulateSlicesMStep(i + 1);
                     reconstruction.EStep();
+                } else {
+                    reconstruction.SimulateSlices();
                 }
 
                 // Run local SSIM structure-based outlier rejection
@@ -106,6 +106,13 @@ int main(int argc, char **argv) {
     int iterations = 4;
     bool debug = false;
     bool profile = false;
+    // Output file of the hierarchical stage profile and whether it includes the per-slice tasks
+    string profileOutput;
+    bool profileSlices = false;
+    // Output file of the Chrome trace of the stages and slice tasks
+    string traceOutput;
+    // Output file of the memory usage report
+    string memoryReport;
     bool outputTransformations = false;
     double sigma = 20;
     double motionSigma = 0;
@@ -147,6 +154,9 @@ int main(int argc, char **argv) {
     string logID;
     bool noLog = false;
     bool remoteFlag = false;
+    bool fastSVRFlag = false;
+    int remoteWorkers = 0;
+    int remoteTimeout = 600;
 
     //forced exclusion
     Array<int> forceExcludedSlices;
@@ -223,10 +233,17 @@ int main(int argc, char **argv) {
         ("nmi_bins", value<int>(&nmiBins), "Number of NMI bins for registration. [Default: 16]")
         ("log_prefix", value<string>(&logID), "Prefix for the log file.")
         ("info", value<string>(&infoFilename), "File name for slice information in tab-separated columns.")
+        ("profile_output", value<string>(&profileOutput), "Write the hierarchical stage profile (calls, wall and CPU time, thread utilisation) to a JSON file, or CSV if the name ends in .csv, at exit")
+        ("profile_slices", bool_switch(&profileSlices), "Include the timings of the individual slice tasks (registration, coefficients, SR) in the profile output [Default: false]")
+        ("trace_output", value<string>(&traceOutput), "Write a Chrome trace-event timeline of the stages and slice tasks of every thread to a JSON file at exit (chrome://tracing, Perfetto)")
+        ("memory_report", value<string>(&memoryReport), "Append the memory held by the large buffers (system matrix, slices, volumes, reduction buffers) and the process RSS after the main stages to a CSV file")
         ("debug", bool_switch(&debug), "Debug mode - save intermediate results.")
         ("profile", bool_switch(&profile), "Profile - output profiling timings (also on in debug mode)")
         ("output_transformations", bool_switch(&outputTransformations), "Save transformation to file")
+        ("fast_svr", bool_switch(&fastSVRFlag), "Use the dedicated rigid slice-to-volume registration instead of the generic MIRTK registration. [Default: false]")
         ("remote", bool_switch(&remoteFlag), "Run SVR registration as remote functions in case of memory issues. [Default: false]")
+        ("remote_workers", value<int>(&remoteWorkers), "Number of persistent register-worker processes for remote SVR (0 starts one process per slice). [Default: 0]")
+        ("remote_timeout", value<int>(&remoteTimeout), "Seconds after which a register-worker that hasn't finished a slice is restarted and the slice skipped (0 waits forever). [Default: 600]")
         ("no_log", bool_switch(&noLog), "Do not redirect cout and cerr to log files.");
 
     // Combine all options
@@ -394,6 +411,10 @@ int main(int argc, char **argv) {
     boost::filesystem::remove_all(strCurrentExchangeFilePath.c_str());
     boost::filesystem::create_directory(strCurrentExchangeFilePath.c_str());
 
+    if (remoteFlag)
+        reconstruction.SetRemoteWorkers(remoteWorkers, remoteTimeout);
+    reconstruction.SetFastRigidSVR(fastSVRFlag);
+
     //---------------------------------------------------------------------------------------------
 
     // check that conflicting transformation folders haven't been given
@@ -469,6 +490,14 @@ int main(int argc, char **argv) {
         haveRefVol = true;
     }
 
+    // Record the stage profile and trace
+    if (!profileOutput.empty())
+        Profiler::Enable(profileOutput, profileSlices);
+    if (!traceOutput.empty())
+        Profiler::EnableTrace(traceOutput);
+    if (!memoryReport.empty())
+        reconstruction.SetMemoryReport(memoryReport);
+
     //Set debug mode
     if (debug)
         reconstruction.DebugOn();
@@ -645,6 +674,9 @@ int main(int argc, char **argv) {
     cout << "Will run " << iterations << " main iterations:" << endl;
 
     for (int iter = 0; iter < iterations; iter++) {
+        // Profile of the stages of this iteration
+        ProfileScope iterationProfile("iteration " + to_string(iter));
+
         cout << "Iteration " << iter+1 << "... " << endl;
 
         //perform slice-to-volume registrations
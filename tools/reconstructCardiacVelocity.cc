@@ -99,6 +99,13 @@ int main(int argc, char **argv) {
     unique_ptr<RealImage> mask;
     bool debug = false;
     bool profile = false;
+    // Output file of the hierarchical stage profile and whether it includes the per-slice tasks
+    string profileOutput;
+    bool profileSlices = false;
+    // Output file of the Chrome trace of the stages and slice tasks
+    string traceOutput;
+    // Output file of the memory usage report
+    string memoryReport;
     double sigma = 20;
     double resolution = 1.25;
     int numCardPhase = 15;
@@ -193,6 +200,10 @@ int main(int argc, char **argv) {
         ("reg_recon_to_ref", bool_switch(&regReconToRef), "Register reconstructed volume to reference volume. [Default: recon to ref]")
         ("ref_transformations", value<string>(&refTransformationsFolder), "Reference slice-to-volume transformation folder.")
         ("log_prefix", value<string>(&logID), "Prefix for the log file.")
+        ("profile_output", value<string>(&profileOutput), "Write the hierarchical stage profile (calls, wall and CPU time, thread utilisation) to a JSON file, or CSV if the name ends in .csv, at exit")
+        ("profile_slices", bool_switch(&profileSlices), "Include the timings of the individual slice tasks (registration, coefficients, SR) in the profile output [Default: false]")
+        ("trace_output", value<string>(&traceOutput), "Write a Chrome trace-event timeline of the stages and slice tasks of every thread to a JSON file at exit (chrome://tracing, Perfetto)")
+        ("memory_report", value<string>(&memoryReport), "Append the memory held by the large buffers (system matrix, slices, volumes, reduction buffers) and the process RSS after the main stages to a CSV file")
         ("debug", bool_switch(&debug), "Debug mode - save intermediate results.")
         ("no_log", bool_switch(&noLog), "Do not redirect cout and cerr to log files.");
 
@@ -435,6 +446,14 @@ int main(int argc, char **argv) {
         refVol.Read(refVolName.c_str());
     }
 
+    // Record the stage profile and trace
+    if (!profileOutput.empty())
+        Profiler::Enable(profileOutput, profileSlices);
+    if (!traceOutput.empty())
+        Profiler::EnableTrace(traceOutput);
+    if (!memoryReport.empty())
+        reconstruction.SetMemoryReport(memoryReport);
+
     //Set debug mode
     if (debug)
         reconstruction.DebugOn();
@@ -604,6 +623,9 @@ int main(int argc, char **argv) {
         reconstruction.SaveSliceInfo();
 
     for (int iteration = 0; iteration < recIterations; iteration++) {
+        // Profile of the stages of this iteration
+        ProfileScope iterationProfile("iteration " + to_string(iteration));
+
         cout << "\n - Reconstruction iteration : " << iteration << "  " << endl;
 
         //Gradient descent step
@@ -108,6 +108,8 @@ void usage()
     cerr << "\t-info [filename]          Filename for slice information in\
     tab-sparated columns."<<endl;
     cerr << "\t-debug                    Debug mode - save intermediate results."<<endl;
+    cerr << "\t-memory_report [file]     Append the memory held by the large buffers and the process RSS"<<endl;
+    cerr << "\t                          after the main stages to a CSV file."<<endl;
     cerr << "\t-no_log                   Do not redirect cout and cerr to log files."<<endl;
     cerr << "\t" << endl;
     cerr << "\t" << endl;
@@ -211,6 +213,7 @@ int main(int argc, char **argv)
     string info_filename = "slice_info.tsv";
     string log_id;
     bool no_log = false;
+    string memory_report;
 
     //forced exclusion of slices
     int number_of_force_excluded_slices = 0;
@@ -789,6 +792,16 @@ int main(int argc, char **argv)
             ok = true;
         }
 
+        //Memory usage report
+        if ((ok == false) && (strcmp(argv[1], "-memory_report") == 0)){
+            argc--;
+            argv++;
+            memory_report=argv[1];
+            ok = true;
+            argc--;
+            argv++;
+        }
+
         //Prefix for log files
         if ((ok == false) && (strcmp(argv[1], "-log_prefix") == 0)){
             argc--;
@@ -994,6 +1007,9 @@ int main(int argc, char **argv)
 
     //Set debug mode
     if (debug) reconstruction.DebugOn();
+
+    //Set memory usage report
+    if (!memory_report.empty()) reconstruction.SetMemoryReport(memory_report);
     else reconstruction.DebugOff();
 
     //Set force excluded slices
@@ -122,6 +122,13 @@ int main(int argc, char **argv) {
     int srIterations = 5;
     bool debug = false;
     bool profile = false;
+    // Output file of the hierarchical stage profile and whether it includes the per-slice tasks
+    string profileOutput;
+    bool profileSlices = false;
+    // Output file of the Chrome trace of the stages and slice tasks
+    string traceOutput;
+    // Output file of the memory usage report
+    string memoryReport;
     double sigma = 20;
     double resolution = 0.85;
     double lambda = 0.0225;
@@ -275,6 +282,10 @@ int main(int argc, char **argv) {
         ("default", bool_switch(&defaultFlag), "Set default options: structural, intersection")
         ("no_registration", "Switch off registration")
 //        ("thin", bool_switch(&thinFlag), "Option for 1.5 x dz slice thickness (testing)")
+        ("profile_output", value<string>(&profileOutput), "Write the hierarchical stage profile (calls, wall and CPU time, thread utilisation) to a JSON file, or CSV if the name ends in .csv, at exit")
+        ("profile_slices", bool_switch(&profileSlices), "Include the timings of the individual slice tasks (registration, coefficients, SR) in the profile output [Default: false]")
+        ("trace_output", value<string>(&traceOutput), "Write a Chrome trace-event timeline of the stages and slice tasks of every thread to a JSON file at exit (chrome://tracing, Perfetto)")
+        ("memory_report", value<string>(&memoryReport), "Append the memory held by the large buffers (system matrix, slices, volumes, reduction buffers) and the process RSS after the main stages to a CSV file")
         ("debug", bool_switch(&debug), "Debug mode - save intermediate results");
 
 
@@ -782,6 +793,14 @@ int main(int argc, char **argv) {
     if (dofinPaths.empty())
         stackTransformations = Array<RigidTransformation>(stacks.size());
 
+    // Record the stage profile and trace
+    if (!profileOutput.empty())
+        Profiler::Enable(profileOutput, profileSlices);
+    if (!traceOutput.empty())
+        Profiler::EnableTrace(traceOutput);
+    if (!memoryReport.empty())
+        reconstruction.SetMemoryReport(memoryReport);
+
     // Set debug mode option
     if (debug) reconstruction.DebugOn();
     else reconstruction.DebugOff();
@@ -965,6 +984,9 @@ int main(int argc, char **argv) {
     {
         // Interleaved registration-reconstruction iterations
         for (int iter = 0; iter < iterations; iter++) {
+            // Profile of the stages of this iteration
+            ProfileScope iterationProfile("iteration " + to_string(iter));
+
             cout << "------------------------------------------------------" << endl;
             cout << "Iteration : " << iter << endl;
             
@@ -1065,12 +1087,12 @@ int main(int argc, char **argv) {
                     reconstruction.NormaliseBias(i);
 
                 // Simulate slices (needs to be done after the update of the reconstructed volume)
-                reconstruction.SimulateSlices();
-
-                // Run robust statistics for rejection of outliers
+                // and run robust statistics for rejection of outliers, MStep is fused with the simulation
                 if (robustStatistics) {
-                    reconstruction.MStep(i + 1);
+                    reconstruction.SimulateSlicesMStep(i + 1);
                     reconstruction.EStep();
+                } else {
+                    reconstruction.SimulateSlices();
                 }
                 
                 // Run local SSIM structure-based outlier rejection
@@ -128,6 +128,13 @@ int main(int argc, char **argv) {
     double Multiplier = 1;
     bool GenerateMap = true;
     bool profile = false;
+    // Output file of the hierarchical stage profile and whether it includes the per-slice tasks
+    string profileOutput;
+    bool profileSlices = false;
+    // Output file of the Chrome trace of the stages and slice tasks
+    string traceOutput;
+    // Output file of the memory usage report
+    string memoryReport;
     bool AdaptiveRegularMap = true;
     bool HistogramMatching = true;
     bool HistogramVolMatching = false;
@@ -290,6 +297,10 @@ int main(int argc, char **argv) {
         ("structural", bool_switch(&structural), "Use structural exclusion of slices at the last iteration")
         ("exclude_slices_only", bool_switch(&robustSlicesOnly), "Robust statistics for exclusion of slices only")
         ("no_registration", "Switch off registration")
+        ("profile_output", value<string>(&profileOutput), "Write the hierarchical stage profile (calls, wall and CPU time, thread utilisation) to a JSON file, or CSV if the name ends in .csv, at exit")
+        ("profile_slices", bool_switch(&profileSlices), "Include the timings of the individual slice tasks (registration, coefficients, SR) in the profile output [Default: false]")
+        ("trace_output", value<string>(&traceOutput), "Write a Chrome trace-event timeline of the stages and slice tasks of every thread to a JSON file at exit (chrome://tracing, Perfetto)")
+        ("memory_report", value<string>(&memoryReport), "Append the memory held by the large buffers (system matrix, slices, volumes, reduction buffers) and the process RSS after the main stages to a CSV file")
         ("debug", bool_switch(&debug), "Debug mode - save intermediate results");
     
     // Combine all options
@@ -792,6 +803,14 @@ int main(int argc, char **argv) {
     if (dofinPaths.empty())
         stackTransformations = Array<RigidTransformation>(stacks.size());
 
+    // Record the stage profile and trace
+    if (!profileOutput.empty())
+        Profiler::Enable(profileOutput, profileSlices);
+    if (!traceOutput.empty())
+        Profiler::EnableTrace(traceOutput);
+    if (!memoryReport.empty())
+        reconstruction.SetMemoryReport(memoryReport);
+
     // Set debug mode option
     if (debug) reconstruction.DebugOn();
     else reconstruction.DebugOff();
@@ -1084,6 +1103,9 @@ int main(int argc, char **argv) {
     {
         // Interleaved registration-reconstruction iterations
         for (int iter = 0; iter < iterations; iter++) {
+            // Profile of the stages of this iteration
+            ProfileScope iterationProfile("iteration " + to_string(iter));
+
             if (iter == iterations-1)
                 reconstruction.MultiplyAlpha(Multiplier);
             cout << "------------------------------------------------------" << endl;
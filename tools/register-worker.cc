@@ -0,0 +1,78 @@
+/*
+* SVRTK : SVR reconstruction based on MIRTK
+*
+* Copyright 2008-2017 Imperial College London
+* Copyright 2018-2021 King's College London
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+// SVRTK
+#include "svrtk/RegistrationWorkerPool.h"
+
+// MIRTK
+#include "mirtk/IOConfig.h"
+
+// C++ Standard
+#include <unistd.h>
+
+using namespace std;
+using namespace mirtk;
+using namespace svrtk;
+
+// =============================================================================
+//
+// =============================================================================
+
+// -----------------------------------------------------------------------------
+
+void PrintUsage() {
+    cout << "SVRTK package: https://github.com/SVRTK/SVRTK" << endl;
+    cout << endl;
+    cout << "Usage: register-worker <options>\n" << endl;
+    cout << "Persistent slice-to-volume registration worker started by the remote registration of the reconstruction tools." << endl;
+    cout << "Reads registration requests from the standard input and writes the replies to the standard output." << endl << endl;
+    cout << "  -ncc                       Use NCC similarity metric" << endl;
+}
+
+// -----------------------------------------------------------------------------
+
+// =============================================================================
+// Main function
+// =============================================================================
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+    bool ncc = false;
+    for (int i = 1; i < argc; i++) {
+        if (string(argv[i]) == "-ncc") {
+            ncc = true;
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    // Initialisation of MIRTK image reader library
+    InitializeIOLibrary();
+
+    // The replies use the original standard output, anything printed by the registration goes to the standard error
+    FILE *output = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    const int status = RegistrationWorkerPool::Serve(stdin, output, ncc);
+    fclose(output);
+
+    return status;
+}